@@ -0,0 +1,82 @@
+/**
+ * @file alloc_counter.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief ヒープ割り当て回数の計測（GPS_TEST_ALLOC_CHECKビルド用）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "alloc_counter.hpp"
+#include <cstdlib>
+#include <new>
+
+static thread_local uint64_t allocations = 0;
+
+/**
+ * @brief 割り当て（回数を数える）
+ *
+ * @param size サイズ
+ * @return void* 割り当てた領域（失敗時nullptr）
+ */
+static void *counted_malloc(std::size_t size)
+{
+    allocations++;
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+/**
+ * @brief 呼び出したスレッドのこれまでの割り当て回数を取得
+ *
+ * @return uint64_t 回数
+ */
+uint64_t alloc_counter::count()
+{
+    return allocations;
+}
+
+void *operator new(std::size_t size)
+{
+    void *p = counted_malloc(size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    return counted_malloc(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    return counted_malloc(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
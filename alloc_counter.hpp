@@ -0,0 +1,29 @@
+/**
+ * @file alloc_counter.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief ヒープ割り当て回数の計測（GPS_TEST_ALLOC_CHECKビルド用）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef ALLOC_COUNTER_HPP
+#define ALLOC_COUNTER_HPP
+
+#include <cstdint>
+
+/**
+ * @brief ヒープ割り当て回数の計測
+ *
+ * alloc_counter.cppをリンクするとグローバルのoperator newを置き換え、
+ * スレッド毎に割り当て回数を数える（ループスレッドの検査が他のスレッドの割り当てに影響されない）。
+ */
+class alloc_counter
+{
+public:
+    static uint64_t count();
+};
+
+#endif
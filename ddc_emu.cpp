@@ -0,0 +1,598 @@
+/**
+ * @file ddc_emu.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief u-blox DDC(I2C)スレーブのエミュレーター（LD_PRELOADで使う）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * /dev/i2c-* に対する open/ioctl/close を横取りし、I2C_RDWRの
+ * 0xFD(データサイズ)・0xFF(データ)の読み込みをエミュレートする。
+ * 受信機の状態は共有メモリに置くので、複数のプロセスから同時に読むと実機と同じく競合する。
+ *
+ *   LD_PRELOAD=./libddc_emu.so ./gps_test
+ *
+ * 環境変数
+ *   DDC_EMU_SHM     共有メモリ名（既定 /ddc_emu）
+ *   DDC_EMU_RATE    出力レート(Hz、既定 1)
+ *   DDC_EMU_BPS     受信機が出力バッファへ書き込む速度(byte/s、既定 20000)
+ *   DDC_EMU_BUFFER  出力バッファのサイズ(byte、既定 4096、溢れた分は捨てる)
+ *   DDC_EMU_CLOCK   I2Cのクロック(Hz、既定 400000、転送時間の分だけ待つ)
+ *   DDC_EMU_SEED    乱数の種
+ *   DDC_EMU_STATS   設定するとプロセス終了時に統計を標準エラーへ出力
+ */
+
+#include "gps_sim.hpp"
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <string>
+#include <type_traits>
+
+static const uint32_t emu_magic = 0x44444345;  // "DDCE"
+static const size_t ring_capacity = 64 * 1024;  // 出力バッファの最大サイズ
+static const size_t burst_capacity = 64 * 1024; // 1エポックの最大サイズ
+static const int max_fds = 1024;
+static const int max_processes = 16;
+
+/**
+ * @brief 受信機の状態（共有メモリに置く）
+ *
+ */
+class ddc_state {
+public:
+    std::atomic<uint32_t> magic;    // 初期化済みならemu_magic
+    pthread_mutex_t mutex;          // プロセス間で共有
+    pid_t pids[max_processes];      // 接続中のプロセス
+    gps_sim sim;
+
+    int64_t period_ns;              // エポックの周期
+    int64_t next_epoch_ns;          // 次のバーストを出力する時刻
+    int64_t burst_start_ns;         // 出力中のバーストの開始時刻
+    uint32_t bps;
+    uint32_t clock_hz;
+    uint32_t buffer_size;
+
+    uint8_t burst[burst_capacity];  // 出力中のバースト
+    uint32_t burst_len;
+    uint32_t burst_pos;             // 出力バッファへ書き込んだ位置
+
+    uint8_t ring[ring_capacity];    // 出力バッファ
+    uint32_t ring_head;
+    uint32_t ring_count;
+
+    int64_t bus_busy_until_ns;      // 転送中のトランザクションの終了時刻
+
+    uint64_t transactions;
+    uint64_t collisions;
+    uint64_t bytes_read;
+    uint64_t bytes_dropped;
+    uint64_t writes;
+};
+
+// 別のプロセスからも同じアドレスの内容として読むので、ヒープを指すメンバーを持たないこと
+static_assert(std::is_trivially_copyable<gps_sim>::value, "gps_sim must be trivially copyable to live in shared memory");
+static_assert(std::is_trivially_copyable<ddc_state>::value, "ddc_state must be trivially copyable to live in shared memory");
+
+static ddc_state *state = nullptr;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static std::atomic<bool> fake_fd[max_fds];
+
+typedef int (*open_func)(const char *, int, ...);
+typedef int (*ioctl_func)(int, unsigned long, ...);
+typedef int (*close_func)(int);
+
+/**
+ * @brief 横取りした関数の本来の実装を取得
+ *
+ * @param name 関数名
+ * @return void* 関数
+ */
+static void *next_symbol(const char *name)
+{
+    void *p = dlsym(RTLD_NEXT, name);
+    if (p == nullptr) {
+        std::fprintf(stderr, "ddc_emu: failed to dlsym %s\n", name);
+        std::abort();
+    }
+    return p;
+}
+
+static int real_open(const char *path, int flags, mode_t mode)
+{
+    static open_func f = reinterpret_cast<open_func>(next_symbol("open"));
+    return f(path, flags, mode);
+}
+
+static int real_close(int fd)
+{
+    static close_func f = reinterpret_cast<close_func>(next_symbol("close"));
+    return f(fd);
+}
+
+static int real_ioctl(int fd, unsigned long request, void *arg)
+{
+    static ioctl_func f = reinterpret_cast<ioctl_func>(next_symbol("ioctl"));
+    return f(fd, request, arg);
+}
+
+/**
+ * @brief 環境変数の数値を取得
+ *
+ * @param name 環境変数
+ * @param def 未設定時の値
+ * @return long 値
+ */
+static long env_long(const char *name, long def)
+{
+    const char *s = std::getenv(name);
+    return (s != nullptr && *s != '\0') ? std::strtol(s, nullptr, 0) : def;
+}
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief 排他開始（ロックしたまま終了したプロセスがあれば引き継ぐ）
+ *
+ * @param s 受信機
+ */
+static void lock(ddc_state *s)
+{
+    if (pthread_mutex_lock(&s->mutex) == EOWNERDEAD) {
+        pthread_mutex_consistent(&s->mutex);
+    }
+}
+
+/**
+ * @brief 受信機を初期状態にする（設定は環境変数から読む）
+ *
+ * @param s 受信機
+ */
+static void reset(ddc_state *s)
+{
+    gps_sim::config conf;
+    conf.rate_hz = (int)env_long("DDC_EMU_RATE", 1);
+    conf.seed = (uint32_t)env_long("DDC_EMU_SEED", 1);
+    new (&s->sim) gps_sim(conf);
+    for (int i = 0; i < max_processes; i++) {
+        s->pids[i] = 0;
+    }
+    s->period_ns = 1000000000 / s->sim.get_rate();
+    s->next_epoch_ns = now_ns();
+    s->burst_start_ns = s->next_epoch_ns;
+    s->bps = (uint32_t)env_long("DDC_EMU_BPS", 20000);
+    s->clock_hz = (uint32_t)env_long("DDC_EMU_CLOCK", 400000);
+    s->buffer_size = (uint32_t)env_long("DDC_EMU_BUFFER", 4096);
+    if (s->buffer_size == 0 || s->buffer_size > ring_capacity) {
+        s->buffer_size = ring_capacity;
+    }
+    if (s->bps == 0) {
+        s->bps = 1;
+    }
+    if (s->clock_hz == 0) {
+        s->clock_hz = 400000;
+    }
+    s->burst_len = 0;
+    s->burst_pos = 0;
+    s->ring_head = 0;
+    s->ring_count = 0;
+    s->bus_busy_until_ns = 0;
+    s->transactions = 0;
+    s->collisions = 0;
+    s->bytes_read = 0;
+    s->bytes_dropped = 0;
+    s->writes = 0;
+}
+
+/**
+ * @brief 共有メモリの受信機に接続（無ければ作成して初期化）
+ *
+ * 接続中のプロセスが全て終了していた（異常終了で残っていた）場合は初期化し直す。
+ */
+static void attach()
+{
+    const char *name = std::getenv("DDC_EMU_SHM");
+    if (name == nullptr || *name == '\0') {
+        name = "/ddc_emu";
+    }
+
+    bool create = true;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        create = false;
+        fd = shm_open(name, O_RDWR | O_CLOEXEC, 0600);
+    }
+    if (fd < 0) {
+        std::fprintf(stderr, "ddc_emu: failed to shm_open %s: %s\n", name, std::strerror(errno));
+        return;
+    }
+    if (create && ftruncate(fd, sizeof(ddc_state)) != 0) {
+        std::fprintf(stderr, "ddc_emu: failed to ftruncate: %s\n", std::strerror(errno));
+        real_close(fd);
+        return;
+    }
+    // 作成したプロセスがサイズを設定するまで待つ
+    for (int i = 0; i < 1000; i++) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ddc_state)) {
+            break;
+        }
+        usleep(1000);
+    }
+    void *p = mmap(nullptr, sizeof(ddc_state), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    real_close(fd);
+    if (p == MAP_FAILED) {
+        std::fprintf(stderr, "ddc_emu: failed to mmap: %s\n", std::strerror(errno));
+        return;
+    }
+
+    ddc_state *s = static_cast<ddc_state *>(p);
+    if (create) {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&s->mutex, &attr);
+        pthread_mutexattr_destroy(&attr);
+        reset(s);
+        s->magic.store(emu_magic, std::memory_order_release);
+    }
+    else {
+        // 作成したプロセスが初期化するまで待つ
+        for (int i = 0; i < 1000 && s->magic.load(std::memory_order_acquire) != emu_magic; i++) {
+            usleep(1000);
+        }
+        if (s->magic.load(std::memory_order_acquire) != emu_magic) {
+            std::fprintf(stderr, "ddc_emu: %s is not initialized\n", name);
+            munmap(p, sizeof(ddc_state));
+            return;
+        }
+    }
+
+    lock(s);
+    int alive = 0;
+    for (int i = 0; i < max_processes; i++) {
+        if (s->pids[i] != 0 && kill(s->pids[i], 0) != 0 && errno == ESRCH) {
+            s->pids[i] = 0;
+        }
+        if (s->pids[i] != 0) {
+            alive++;
+        }
+    }
+    if (!create && alive == 0) {
+        reset(s);
+    }
+    int slot = -1;
+    for (int i = 0; i < max_processes; i++) {
+        if (s->pids[i] == 0) {
+            s->pids[i] = getpid();
+            slot = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s->mutex);
+    if (slot < 0) {
+        std::fprintf(stderr, "ddc_emu: too many processes\n");
+        munmap(p, sizeof(ddc_state));
+        return;
+    }
+    state = s;
+}
+
+/**
+ * @brief プロセス終了時に切断（最後のプロセスは共有メモリを削除）
+ *
+ */
+__attribute__((destructor))
+static void detach()
+{
+    if (state == nullptr) {
+        return;
+    }
+    lock(state);
+    int remain = 0;
+    for (int i = 0; i < max_processes; i++) {
+        if (state->pids[i] == getpid()) {
+            state->pids[i] = 0;
+        }
+        if (state->pids[i] != 0) {
+            remain++;
+        }
+    }
+    if (std::getenv("DDC_EMU_STATS") != nullptr) {
+        std::fprintf(stderr, "ddc_emu: epochs = %llu, transactions = %llu, collisions = %llu, "
+                     "read = %llu, dropped = %llu, writes = %llu\n",
+                     (unsigned long long)state->sim.get_epochs(),
+                     (unsigned long long)state->transactions,
+                     (unsigned long long)state->collisions,
+                     (unsigned long long)state->bytes_read,
+                     (unsigned long long)state->bytes_dropped,
+                     (unsigned long long)state->writes);
+    }
+    pthread_mutex_unlock(&state->mutex);
+    if (remain == 0) {
+        const char *name = std::getenv("DDC_EMU_SHM");
+        shm_unlink((name == nullptr || *name == '\0') ? "/ddc_emu" : name);
+    }
+    munmap(state, sizeof(ddc_state));
+    state = nullptr;
+}
+
+/**
+ * @brief 出力中のバーストを出力バッファへ書き込む（溢れた分は捨てる）
+ *
+ * @param s 受信機
+ * @param until_ns この時刻までに出力される分
+ */
+static void transmit(ddc_state *s, int64_t until_ns)
+{
+    int64_t due = (until_ns - s->burst_start_ns) * s->bps / 1000000000;
+    if (due > s->burst_len) {
+        due = s->burst_len;
+    }
+    while (s->burst_pos < due) {
+        if (s->ring_count < s->buffer_size) {
+            s->ring[(s->ring_head + s->ring_count) % ring_capacity] = s->burst[s->burst_pos];
+            s->ring_count++;
+        }
+        else {
+            s->bytes_dropped++;
+        }
+        s->burst_pos++;
+    }
+}
+
+/**
+ * @brief 現在時刻まで受信機を進める
+ *
+ * @param s 受信機
+ * @param now 現在時刻
+ */
+static void advance(ddc_state *s, int64_t now)
+{
+    static std::string burst;
+    while (true) {
+        transmit(s, now < s->next_epoch_ns ? now : s->next_epoch_ns);
+        if (s->next_epoch_ns > now) {
+            break;
+        }
+        // 次のエポック（出力しきれなかった分は捨てる）
+        s->bytes_dropped += s->burst_len - s->burst_pos;
+        s->sim.next_burst(burst);
+        s->burst_len = burst.size() < burst_capacity ? burst.size() : burst_capacity;
+        std::memcpy(s->burst, burst.data(), s->burst_len);
+        s->burst_pos = 0;
+        s->burst_start_ns = s->next_epoch_ns;
+        s->next_epoch_ns += s->period_ns;
+    }
+}
+
+/**
+ * @brief レジスタの読み込み
+ *
+ * @param s 受信機
+ * @param reg レジスタ
+ * @param data 読み込み先
+ * @param len 長さ
+ */
+static void read_register(ddc_state *s, uint8_t reg, uint8_t *data, uint16_t len)
+{
+    if (reg == 0xfd) {
+        // データサイズ(ビッグエンディアン)、0xFEまで続けて読める
+        uint8_t regs[2] = {(uint8_t)(s->ring_count >> 8), (uint8_t)(s->ring_count & 0xff)};
+        for (uint16_t i = 0; i < len; i++) {
+            data[i] = (i < 2) ? regs[i] : 0xff;
+        }
+    }
+    else if (reg == 0xff) {
+        // データ、無くなったら0xFF
+        for (uint16_t i = 0; i < len; i++) {
+            if (s->ring_count > 0) {
+                data[i] = s->ring[s->ring_head];
+                s->ring_head = (s->ring_head + 1) % ring_capacity;
+                s->ring_count--;
+                s->bytes_read++;
+            }
+            else {
+                data[i] = 0xff;
+            }
+        }
+    }
+    else {
+        std::memset(data, 0, len);
+    }
+}
+
+/**
+ * @brief I2C_RDWRのエミュレート
+ *
+ * 転送時間の分だけ待つ。別のトランザクションの転送中に始めた場合は
+ * 競合として読み込みは0xFFになる（出力バッファは変わらない）。
+ *
+ * @param s 受信機
+ * @param rdwr 転送内容
+ * @return int 転送したメッセージ数
+ */
+static int emulate_rdwr(ddc_state *s, struct i2c_rdwr_ioctl_data *rdwr)
+{
+    if (rdwr == nullptr || rdwr->nmsgs == 0 || rdwr->msgs == nullptr) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // 転送時間（アドレスを含め1byte当たり9クロック）
+    int64_t bytes = 0;
+    for (uint32_t i = 0; i < rdwr->nmsgs; i++) {
+        bytes += rdwr->msgs[i].len + 1;
+    }
+    int64_t duration_ns = bytes * 9 * 1000000000 / s->clock_hz;
+
+    int64_t now = now_ns();
+    lock(s);
+    advance(s, now);
+    s->transactions++;
+    bool collision = now < s->bus_busy_until_ns;
+    if (collision) {
+        s->collisions++;
+    }
+    else {
+        s->bus_busy_until_ns = now + duration_ns;
+    }
+
+    struct i2c_msg *msgs = rdwr->msgs;
+    if (rdwr->nmsgs == 2 && !(msgs[0].flags & I2C_M_RD) && msgs[0].len == 1 && (msgs[1].flags & I2C_M_RD)) {
+        // レジスタの読み込み
+        if (collision) {
+            std::memset(msgs[1].buf, 0xff, msgs[1].len);
+        }
+        else {
+            read_register(s, msgs[0].buf[0], msgs[1].buf, msgs[1].len);
+        }
+    }
+    else {
+        for (uint32_t i = 0; i < rdwr->nmsgs; i++) {
+            if (msgs[i].flags & I2C_M_RD) {
+                // レジスタを指定しない読み込みはデータ(0xFF)と同じ
+                if (collision) {
+                    std::memset(msgs[i].buf, 0xff, msgs[i].len);
+                }
+                else {
+                    read_register(s, 0xff, msgs[i].buf, msgs[i].len);
+                }
+            }
+            else if (!collision) {
+                // UBXメッセージの書き込み（応答のACK、MGA-ACK、UPD-SOSは次のバーストの前に出力される）
+                s->sim.receive(msgs[i].buf, msgs[i].len);
+                s->writes++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&s->mutex);
+
+    struct timespec ts = {(time_t)(duration_ns / 1000000000), (long)(duration_ns % 1000000000)};
+    nanosleep(&ts, nullptr);
+    return (int)rdwr->nmsgs;
+}
+
+static void init()
+{
+    for (int i = 0; i < max_fds; i++) {
+        fake_fd[i] = false;
+    }
+    attach();
+}
+
+static bool is_i2c_path(const char *path)
+{
+    return path != nullptr && std::strncmp(path, "/dev/i2c-", 9) == 0;
+}
+
+static bool is_fake_fd(int fd)
+{
+    return fd >= 0 && fd < max_fds && fake_fd[fd].load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief I2Cデバイスの代わりに/dev/nullを開く
+ *
+ * @param flags
+ * @return int ファイルディスクリプタ
+ */
+static int open_fake(int flags)
+{
+    pthread_once(&init_once, init);
+    if (state == nullptr) {
+        errno = ENODEV;
+        return -1;
+    }
+    int fd = real_open("/dev/null", O_RDWR | (flags & O_CLOEXEC), 0);
+    if (fd >= max_fds) {
+        real_close(fd);
+        errno = EMFILE;
+        return -1;
+    }
+    if (fd >= 0) {
+        fake_fd[fd] = true;
+    }
+    return fd;
+}
+
+extern "C" {
+
+int open(const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+    if (flags & (O_CREAT | O_TMPFILE)) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    if (is_i2c_path(path)) {
+        return open_fake(flags);
+    }
+    return real_open(path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+    if (flags & (O_CREAT | O_TMPFILE)) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    if (is_i2c_path(path)) {
+        return open_fake(flags);
+    }
+    return real_open(path, flags | O_LARGEFILE, mode);
+}
+
+int ioctl(int fd, unsigned long request, ...) __THROW
+{
+    va_list ap;
+    va_start(ap, request);
+    void *arg = va_arg(ap, void *);
+    va_end(ap);
+
+    if (!is_fake_fd(fd)) {
+        return real_ioctl(fd, request, arg);
+    }
+    if (request == I2C_RDWR) {
+        return emulate_rdwr(state, static_cast<struct i2c_rdwr_ioctl_data *>(arg));
+    }
+    // I2C_SLAVE等は何もしない
+    return 0;
+}
+
+int close(int fd)
+{
+    if (is_fake_fd(fd)) {
+        fake_fd[fd] = false;
+    }
+    return real_close(fd);
+}
+
+}
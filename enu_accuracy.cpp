@@ -0,0 +1,357 @@
+/**
+ * @file enu_accuracy.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 基準点からのENU(東・北・上)誤差と精度の統計（CEP50/CEP95/2DRMS）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "enu_accuracy.hpp"
+#include <cmath>
+#include <cstring>
+
+// WGS84
+static const double wgs84_a = 6378137.0;
+static const double wgs84_f = 1.0 / 298.257223563;
+static const double wgs84_e2 = wgs84_f * (2.0 - wgs84_f);
+static const double deg_to_rad = M_PI / 180.0;
+
+static const double sketch_gamma = 1.02;    // 隣のビンとの比
+
+/**
+ * @brief 緯度・経度・高度をECEFに変換
+ *
+ * @param latitude 緯度(deg)
+ * @param longitude 経度(deg)
+ * @param altitude 高度(m)
+ * @param ecef 出力(m)
+ */
+static inline void to_ecef(double latitude, double longitude, double altitude, double ecef[3])
+{
+    double lat = latitude * deg_to_rad;
+    double lon = longitude * deg_to_rad;
+    double sin_lat = std::sin(lat);
+    double cos_lat = std::cos(lat);
+    double n = wgs84_a / std::sqrt(1.0 - wgs84_e2 * sin_lat * sin_lat);
+    ecef[0] = (n + altitude) * cos_lat * std::cos(lon);
+    ecef[1] = (n + altitude) * cos_lat * std::sin(lon);
+    ecef[2] = (n * (1.0 - wgs84_e2) + altitude) * sin_lat;
+}
+
+/**
+ * @brief Construct a new quantile sketch::quantile sketch object
+ *
+ * @param min_value 最小の分解能
+ */
+quantile_sketch::quantile_sketch(double min_value) :
+min_value(min_value),
+log_gamma(std::log(sketch_gamma))
+{
+    clear();
+}
+
+/**
+ * @brief 空にする
+ *
+ */
+void quantile_sketch::clear()
+{
+    count = 0;
+    std::memset(bins, 0, sizeof(bins));
+}
+
+/**
+ * @brief 値を追加
+ *
+ * @param value 値（0以上）
+ */
+void quantile_sketch::add(double value)
+{
+    if (!(value >= 0)) {
+        return;
+    }
+    int i = 0;
+    if (value > min_value) {
+        double k = std::ceil(std::log(value / min_value) / log_gamma);
+        i = k < bin_count - 1 ? (int)k : bin_count - 1;
+    }
+    bins[i]++;
+    count++;
+}
+
+/**
+ * @brief 別の近似を足し合わせる
+ *
+ * @param other 近似（同じmin_value）
+ */
+void quantile_sketch::merge(const quantile_sketch &other)
+{
+    for (int i = 0; i < bin_count; i++) {
+        bins[i] += other.bins[i];
+    }
+    count += other.count;
+}
+
+/**
+ * @brief 分位点を取得
+ *
+ * @param q 0～1
+ * @return double 値（ビンの代表値、無ければNaN）
+ */
+double quantile_sketch::quantile(double q) const
+{
+    if (count == 0) {
+        return std::nan("");
+    }
+    uint64_t rank = (uint64_t)(q * (count - 1));
+    uint64_t n = 0;
+    for (int i = 0; i < bin_count; i++) {
+        n += bins[i];
+        if (n > rank) {
+            if (i == 0) {
+                return min_value;
+            }
+            // ビン(min*gamma^(i-1), min*gamma^i]の代表値
+            return min_value * std::exp(i * log_gamma) * 2.0 / (1.0 + sketch_gamma);
+        }
+    }
+    return min_value * std::exp((bin_count - 1) * log_gamma);
+}
+
+/**
+ * @brief 値の数を取得
+ *
+ * @return uint64_t 値の数
+ */
+uint64_t quantile_sketch::get_count() const
+{
+    return count;
+}
+
+/**
+ * @brief Construct a new enu accuracy::config::config object
+ *
+ */
+enu_accuracy::config::config()
+{
+    latitude = std::nan("");
+    longitude = std::nan("");
+    altitude = std::nan("");
+    estimate_epochs = 60;
+}
+
+/**
+ * @brief Construct a new enu accuracy::enu accuracy object
+ *
+ * @param conf 設定
+ */
+enu_accuracy::enu_accuracy(const config &conf) :
+conf(conf),
+reference(false),
+sum_lat(0),
+sum_lon(0),
+sum_alt(0),
+estimated(0),
+sum_e(0),
+sum_n(0),
+sum_u(0),
+sum_h2(0)
+{
+    if (!std::isnan(conf.latitude) && !std::isnan(conf.longitude) && !std::isnan(conf.altitude)) {
+        set_reference(conf.latitude, conf.longitude, conf.altitude);
+    }
+}
+
+/**
+ * @brief 基準点を設定してENUへの回転を計算
+ *
+ * @param latitude 緯度(deg)
+ * @param longitude 経度(deg)
+ * @param altitude 高度(m)
+ */
+void enu_accuracy::set_reference(double latitude, double longitude, double altitude)
+{
+    conf.latitude = latitude;
+    conf.longitude = longitude;
+    conf.altitude = altitude;
+    to_ecef(latitude, longitude, altitude, ref_ecef);
+    double sin_lat = std::sin(latitude * deg_to_rad);
+    double cos_lat = std::cos(latitude * deg_to_rad);
+    double sin_lon = std::sin(longitude * deg_to_rad);
+    double cos_lon = std::cos(longitude * deg_to_rad);
+    rot[0][0] = -sin_lon;
+    rot[0][1] = cos_lon;
+    rot[0][2] = 0;
+    rot[1][0] = -sin_lat * cos_lon;
+    rot[1][1] = -sin_lat * sin_lon;
+    rot[1][2] = cos_lat;
+    rot[2][0] = cos_lat * cos_lon;
+    rot[2][1] = cos_lat * sin_lon;
+    rot[2][2] = sin_lat;
+    reference = true;
+}
+
+/**
+ * @brief 測位結果を追加
+ *
+ * @param latitude 緯度(deg)
+ * @param longitude 経度(deg)
+ * @param altitude 高度(m)
+ * @return true 統計に追加した
+ * @return false 値が無い、または基準点の推定中
+ */
+bool enu_accuracy::add(double latitude, double longitude, double altitude)
+{
+    if (std::isnan(latitude) || std::isnan(longitude) || std::isnan(altitude)) {
+        return false;
+    }
+    if (!reference) {
+        // 静止しているので緯度・経度の平均で十分
+        sum_lat += latitude;
+        sum_lon += longitude;
+        sum_alt += altitude;
+        estimated++;
+        if (estimated >= conf.estimate_epochs) {
+            set_reference(sum_lat / estimated, sum_lon / estimated, sum_alt / estimated);
+        }
+        return false;
+    }
+    double e, n, u;
+    to_enu(latitude, longitude, altitude, e, n, u);
+    add_enu(e, n, u);
+    return true;
+}
+
+/**
+ * @brief ENUの誤差を統計に追加
+ *
+ * @param e 東(m)
+ * @param n 北(m)
+ * @param u 上(m)
+ */
+void enu_accuracy::add_enu(double e, double n, double u)
+{
+    if (std::isnan(e) || std::isnan(n) || std::isnan(u)) {
+        return;
+    }
+    double h2 = e * e + n * n;
+    horizontal.add(std::sqrt(h2));
+    vertical.add(std::fabs(u));
+    sum_e += e;
+    sum_n += n;
+    sum_u += u;
+    sum_h2 += h2;
+}
+
+/**
+ * @brief 基準点からのENUに変換（基準点が決まっていること）
+ *
+ * @param latitude 緯度(deg)
+ * @param longitude 経度(deg)
+ * @param altitude 高度(m)
+ * @param e 東(m)
+ * @param n 北(m)
+ * @param u 上(m)
+ */
+void enu_accuracy::to_enu(double latitude, double longitude, double altitude, double &e, double &n, double &u) const
+{
+    double p[3];
+    to_ecef(latitude, longitude, altitude, p);
+    double dx = p[0] - ref_ecef[0];
+    double dy = p[1] - ref_ecef[1];
+    double dz = p[2] - ref_ecef[2];
+    e = rot[0][0] * dx + rot[0][1] * dy;
+    n = rot[1][0] * dx + rot[1][1] * dy + rot[1][2] * dz;
+    u = rot[2][0] * dx + rot[2][1] * dy + rot[2][2] * dz;
+}
+
+/**
+ * @brief 基準点からのENUにまとめて変換（オフライン解析用）
+ *
+ * 項目毎の配列（fix_historyのチャンク）をそのまま渡せる。回転は基準点で計算済みなので
+ * 1点当たりは三角関数4回と積和のみ。
+ *
+ * @param latitude 緯度(deg)
+ * @param longitude 経度(deg)
+ * @param altitude 高度(m)
+ * @param count 数
+ * @param e 東(m)
+ * @param n 北(m)
+ * @param u 上(m)
+ */
+void enu_accuracy::to_enu(const double *latitude, const double *longitude, const double *altitude, size_t count,
+                          double *e, double *n, double *u) const
+{
+    const double r00 = rot[0][0], r01 = rot[0][1];
+    const double r10 = rot[1][0], r11 = rot[1][1], r12 = rot[1][2];
+    const double r20 = rot[2][0], r21 = rot[2][1], r22 = rot[2][2];
+    const double x0 = ref_ecef[0], y0 = ref_ecef[1], z0 = ref_ecef[2];
+    for (size_t i = 0; i < count; i++) {
+        double p[3];
+        to_ecef(latitude[i], longitude[i], altitude[i], p);
+        double dx = p[0] - x0;
+        double dy = p[1] - y0;
+        double dz = p[2] - z0;
+        e[i] = r00 * dx + r01 * dy;
+        n[i] = r10 * dx + r11 * dy + r12 * dz;
+        u[i] = r20 * dx + r21 * dy + r22 * dz;
+    }
+}
+
+/**
+ * @brief 基準点が決まったか
+ *
+ * @return true 決まった
+ * @return false 推定中
+ */
+bool enu_accuracy::has_reference() const
+{
+    return reference;
+}
+
+/**
+ * @brief 基準点の推定に使った測位数を取得
+ *
+ * @return int 測位数
+ */
+int enu_accuracy::get_estimated() const
+{
+    return estimated;
+}
+
+/**
+ * @brief 基準点を取得
+ *
+ * @param latitude 緯度(deg)
+ * @param longitude 経度(deg)
+ * @param altitude 高度(m)
+ */
+void enu_accuracy::get_reference(double &latitude, double &longitude, double &altitude) const
+{
+    latitude = conf.latitude;
+    longitude = conf.longitude;
+    altitude = conf.altitude;
+}
+
+/**
+ * @brief 精度を取得
+ *
+ * @return result 精度（測位が無ければNaN）
+ */
+enu_accuracy::result enu_accuracy::get_result() const
+{
+    result r;
+    r.count = horizontal.get_count();
+    double nan = std::nan("");
+    r.cep50 = horizontal.quantile(0.50);
+    r.cep95 = horizontal.quantile(0.95);
+    r.vertical95 = vertical.quantile(0.95);
+    r.drms2 = r.count > 0 ? 2.0 * std::sqrt(sum_h2 / r.count) : nan;
+    r.mean_e = r.count > 0 ? sum_e / r.count : nan;
+    r.mean_n = r.count > 0 ? sum_n / r.count : nan;
+    r.mean_u = r.count > 0 ? sum_u / r.count : nan;
+    return r;
+}
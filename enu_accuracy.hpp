@@ -0,0 +1,113 @@
+/**
+ * @file enu_accuracy.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 基準点からのENU(東・北・上)誤差と精度の統計（CEP50/CEP95/2DRMS）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef ENU_ACCURACY_HPP
+#define ENU_ACCURACY_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief 分位点の近似（対数ビンのヒストグラム）
+ *
+ * 値をmin_value～約6e5の対数ビン（隣のビンと2%違い）に数えるので、分位点の相対誤差は約1%。
+ * メモリは固定（ビン数）で、何日動かしても増えない。min_value未満は最初のビンに数える。
+ */
+class quantile_sketch
+{
+public:
+    static const int bin_count = 1024;
+
+    quantile_sketch(double min_value = 0.001);
+    void add(double value);
+    void merge(const quantile_sketch &other);
+    void clear();
+    double quantile(double q) const;
+    uint64_t get_count() const;
+
+private:
+    double min_value;
+    double log_gamma;           // log(ビンの比)
+    uint64_t count;
+    uint64_t bins[bin_count];
+};
+
+/**
+ * @brief 基準点からのENU誤差と精度の統計
+ *
+ * 基準点を指定しない場合は最初のestimate_epochs回の平均を基準点にする。
+ * 基準点が決まったらECEFからENUへの回転を計算しておき、測位毎にENUへ変換して
+ * 水平誤差・垂直誤差を分位点の近似に追加する。
+ */
+class enu_accuracy
+{
+public:
+    /**
+     * @brief 設定
+     *
+     */
+    class config {
+    public:
+        double latitude;        // 基準点(deg、NaNなら推定)
+        double longitude;
+        double altitude;        // m（楕円体高ではなくGGAの高度と同じ基準）
+        int estimate_epochs;    // 基準点の推定に使う測位数
+        config();
+    };
+
+    /**
+     * @brief 精度
+     *
+     */
+    class result {
+    public:
+        uint64_t count;         // 統計に使った測位数
+        double cep50;           // 水平誤差の50%(m)
+        double cep95;           // 水平誤差の95%(m)
+        double drms2;           // 2DRMS(m)
+        double vertical95;      // 垂直誤差(絶対値)の95%(m)
+        double mean_e;          // 平均の偏り(m)
+        double mean_n;
+        double mean_u;
+    };
+
+    enu_accuracy(const config &conf = config());
+
+    bool add(double latitude, double longitude, double altitude);
+    void add_enu(double e, double n, double u);
+    void to_enu(double latitude, double longitude, double altitude, double &e, double &n, double &u) const;
+    void to_enu(const double *latitude, const double *longitude, const double *altitude, size_t count,
+                double *e, double *n, double *u) const;
+
+    void set_reference(double latitude, double longitude, double altitude);
+    bool has_reference() const;
+    int get_estimated() const;
+    void get_reference(double &latitude, double &longitude, double &altitude) const;
+    result get_result() const;
+
+private:
+    config conf;
+    bool reference;
+    double ref_ecef[3];
+    double rot[3][3];           // ECEFの差からENUへの回転（行がE、N、U）
+    double sum_lat;             // 基準点の推定
+    double sum_lon;
+    double sum_alt;
+    int estimated;
+    quantile_sketch horizontal;
+    quantile_sketch vertical;
+    double sum_e;
+    double sum_n;
+    double sum_u;
+    double sum_h2;
+};
+
+#endif
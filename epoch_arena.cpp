@@ -0,0 +1,97 @@
+/**
+ * @file epoch_arena.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief エポック毎に解放する領域
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "epoch_arena.hpp"
+
+/**
+ * @brief Construct a new epoch arena::epoch arena object
+ *
+ * @param size 領域のサイズ(byte)
+ */
+epoch_arena::epoch_arena(size_t size) :
+buffer(size),
+offset(0),
+peak(0),
+overflows(0)
+{
+}
+
+/**
+ * @brief 領域を割り当て
+ *
+ * @param size サイズ
+ * @param align アライメント（2のべき乗）
+ * @return void* 割り当てた領域（足りなければnullptr）
+ */
+void *epoch_arena::allocate(size_t size, size_t align)
+{
+    uintptr_t base = reinterpret_cast<uintptr_t>(buffer.data());
+    uintptr_t p = (base + offset + align - 1) & ~(uintptr_t)(align - 1);
+    size_t next = p - base + size;
+    if (next > buffer.size()) {
+        overflows++;
+        return nullptr;
+    }
+    offset = next;
+    if (offset > peak) {
+        peak = offset;
+    }
+    return reinterpret_cast<void *>(p);
+}
+
+/**
+ * @brief すべての割り当てを解放
+ *
+ */
+void epoch_arena::reset()
+{
+    offset = 0;
+}
+
+/**
+ * @brief 領域のサイズを取得
+ *
+ * @return size_t サイズ(byte)
+ */
+size_t epoch_arena::capacity() const
+{
+    return buffer.size();
+}
+
+/**
+ * @brief 使用中のサイズを取得
+ *
+ * @return size_t サイズ(byte)
+ */
+size_t epoch_arena::used() const
+{
+    return offset;
+}
+
+/**
+ * @brief 使用したサイズの最大値を取得
+ *
+ * @return size_t サイズ(byte)
+ */
+size_t epoch_arena::high_water() const
+{
+    return peak;
+}
+
+/**
+ * @brief 領域不足で割り当てられなかった回数を取得
+ *
+ * @return uint64_t 回数
+ */
+uint64_t epoch_arena::get_overflows() const
+{
+    return overflows;
+}
@@ -0,0 +1,109 @@
+/**
+ * @file epoch_arena.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief エポック毎に解放する領域
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef EPOCH_ARENA_HPP
+#define EPOCH_ARENA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief エポック毎に解放する領域
+ *
+ * 起動時に確保した領域から先頭から順に割り当て、reset()でまとめて解放する。
+ * 領域が足りない場合はnullptrを返す（ヒープは使わない）。
+ */
+class epoch_arena
+{
+public:
+    epoch_arena(size_t size);
+    void *allocate(size_t size, size_t align);
+    void reset();
+    size_t capacity() const;
+    size_t used() const;
+    size_t high_water() const;
+    uint64_t get_overflows() const;
+
+private:
+    std::vector<unsigned char> buffer;
+    size_t offset;
+    size_t peak;
+    uint64_t overflows;
+};
+
+/**
+ * @brief epoch_arenaに確保する容量固定の配列
+ *
+ * 要素のデストラクタは呼ばないので、トリビアルに破棄できる型に限る。
+ *
+ * @tparam T 要素
+ */
+template <class T>
+class arena_vector
+{
+    static_assert(std::is_trivially_destructible<T>::value, "arena_vector requires trivially destructible T");
+
+public:
+    arena_vector() : items(nullptr), count(0), cap(0) {}
+
+    /**
+     * @brief Construct a new arena vector object
+     *
+     * @param arena 確保先
+     * @param capacity 容量（確保できなければ0）
+     */
+    arena_vector(epoch_arena &arena, size_t capacity) : count(0), cap(capacity)
+    {
+        items = static_cast<T *>(arena.allocate(sizeof(T) * capacity, alignof(T)));
+        if (items == nullptr) {
+            cap = 0;
+        }
+    }
+
+    size_t size() const { return count; }
+    size_t capacity() const { return cap; }
+    bool empty() const { return count == 0; }
+
+    /**
+     * @brief 要素をその場で構築して追加
+     *
+     * @return true 追加した
+     * @return false 容量不足
+     */
+    template <class... Args>
+    bool emplace_back(Args&&... args)
+    {
+        if (count >= cap) {
+            return false;
+        }
+        new (&items[count]) T(std::forward<Args>(args)...);
+        count++;
+        return true;
+    }
+
+    T &operator[](size_t i) { return items[i]; }
+    const T &operator[](size_t i) const { return items[i]; }
+    T *begin() { return items; }
+    T *end() { return items + count; }
+    const T *begin() const { return items; }
+    const T *end() const { return items + count; }
+
+private:
+    T *items;
+    size_t count;
+    size_t cap;
+};
+
+#endif
@@ -0,0 +1,511 @@
+/**
+ * @file fix_history.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 測位結果の履歴（列指向）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "fix_history.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <new>
+
+static const char history_magic[4] = { 'F', 'X', 'H', 'C' };
+static const uint32_t history_version = 1;
+
+static const char *column_names[fix_history::column_count] = {
+    "utc", "latitude", "longitude", "altitude", "num_sv", "pdop", "hdop", "vdop"
+};
+
+/**
+ * @brief チャンクを空にする
+ *
+ * @param first 最初の行の番号
+ */
+void fix_history::chunk::clear(uint64_t first)
+{
+    for (int c = 0; c < column_count; c++) {
+        min[c] = std::numeric_limits<double>::infinity();
+        max[c] = -std::numeric_limits<double>::infinity();
+    }
+    first_row = first;
+    rows = 0;
+}
+
+/**
+ * @brief Construct a new fix history::fix history object
+ *
+ * @param max_chunks 保持するチャンク数（0なら制限なし）
+ */
+fix_history::fix_history(size_t max_chunks) :
+max_chunks(max_chunks),
+start(0),
+used(0),
+rows(0)
+{
+    // 上限があれば起動時にすべて確保
+    for (size_t i = 0; i < max_chunks; i++) {
+        chunks.push_back(new_chunk());
+    }
+}
+
+/**
+ * @brief Destroy the fix history::fix history object
+ *
+ */
+fix_history::~fix_history()
+{
+    for (auto c : chunks) {
+        delete_chunk(c);
+    }
+}
+
+/**
+ * @brief 64byteアライメントのチャンクを確保
+ *
+ * @return chunk* チャンク
+ */
+fix_history::chunk *fix_history::new_chunk()
+{
+    void *p = nullptr;
+    if (posix_memalign(&p, 64, sizeof(chunk)) != 0) {
+        throw std::bad_alloc();
+    }
+    chunk *c = new (p) chunk;
+    c->clear(0);
+    return c;
+}
+
+/**
+ * @brief チャンクを解放
+ *
+ * @param c チャンク
+ */
+void fix_history::delete_chunk(chunk *c)
+{
+    c->~chunk();
+    free(c);
+}
+
+/**
+ * @brief 古い順でi番目のチャンク
+ *
+ * @param i 番号
+ * @return chunk* チャンク
+ */
+fix_history::chunk *fix_history::at(size_t i) const
+{
+    return chunks[(start + i) % chunks.size()];
+}
+
+/**
+ * @brief 1エポック分を追加
+ *
+ * @param fix 測位結果
+ */
+void fix_history::append(const gps_fix &fix)
+{
+    if (used == 0 || at(used - 1)->rows == chunk_rows) {
+        // 次のチャンクへ
+        if (max_chunks == 0) {
+            chunks.push_back(new_chunk());
+            used++;
+        }
+        else if (used < max_chunks) {
+            used++;
+        }
+        else {
+            // 最も古いチャンクを上書き
+            start = (start + 1) % chunks.size();
+        }
+        at(used - 1)->clear(rows);
+    }
+
+    chunk *c = at(used - 1);
+    size_t i = c->rows;
+    double v[column_count];
+    v[utc] = (fix.utc > 0) ? (double)fix.utc : std::numeric_limits<double>::quiet_NaN();
+    v[latitude] = fix.latitude;
+    v[longitude] = fix.longitude;
+    v[altitude] = fix.altitude;
+    v[num_sv] = fix.num_sv;
+    v[pdop] = fix.pdop;
+    v[hdop] = fix.hdop;
+    v[vdop] = fix.vdop;
+    for (int col = 0; col < column_count; col++) {
+        c->values[col][i] = v[col];
+        if (!std::isnan(v[col])) {
+            c->min[col] = std::min(c->min[col], v[col]);
+            c->max[col] = std::max(c->max[col], v[col]);
+        }
+    }
+    c->mono_ns[i] = fix.mono_ns;
+    c->flags[i] = (fix.sum_err ? sum_err : 0) | (fix.utc_err ? utc_err : 0) |
+                  (fix.position_err ? position_err : 0) | (fix.timeout ? timeout : 0);
+    c->rows++;
+    rows++;
+}
+
+/**
+ * @brief すべて削除（確保したチャンクは残す）
+ *
+ */
+void fix_history::clear()
+{
+    if (max_chunks == 0) {
+        for (auto c : chunks) {
+            delete_chunk(c);
+        }
+        chunks.clear();
+    }
+    start = 0;
+    used = 0;
+    rows = 0;
+}
+
+/**
+ * @brief 追加した行数（上書きしたものを含む）
+ *
+ * @return uint64_t 行数
+ */
+uint64_t fix_history::size() const
+{
+    return rows;
+}
+
+/**
+ * @brief 保持しているチャンク数
+ *
+ * @return size_t チャンク数
+ */
+size_t fix_history::chunk_count() const
+{
+    return used;
+}
+
+/**
+ * @brief チャンクを取得
+ *
+ * @param i 番号（0が最も古い）
+ * @return const chunk& チャンク
+ */
+const fix_history::chunk &fix_history::get_chunk(size_t i) const
+{
+    return *at(i);
+}
+
+/**
+ * @brief 条件にすべて合う行を検索
+ *
+ * 最小値・最大値が条件の範囲と重ならないチャンクは読み飛ばす。
+ * チャンク内は条件毎に分岐の無いループでマスクを作る（自動ベクトル化される）。
+ *
+ * @param ranges 条件
+ * @param result 条件に合う行の番号
+ * @param stats 統計（nullptrなら記録しない）
+ * @return size_t 条件に合う行数
+ */
+size_t fix_history::scan(const std::vector<range> &ranges, std::vector<uint64_t> &result, scan_stats *stats) const
+{
+    result.clear();
+    alignas(64) uint8_t mask[chunk_rows];
+    for (size_t k = 0; k < used; k++) {
+        const chunk *c = at(k);
+        bool skip = false;
+        for (auto &r : ranges) {
+            if (c->max[r.col] < r.lo || c->min[r.col] > r.hi) {
+                skip = true;
+                break;
+            }
+        }
+        if (skip) {
+            if (stats) {
+                stats->skipped++;
+            }
+            continue;
+        }
+        if (stats) {
+            stats->scanned++;
+        }
+
+        const size_t n = c->rows;
+        std::memset(mask, 1, n);
+        for (auto &r : ranges) {
+            const double *v = c->values[r.col];
+            const double lo = r.lo;
+            const double hi = r.hi;
+            for (size_t i = 0; i < n; i++) {
+                mask[i] &= (uint8_t)((v[i] >= lo) & (v[i] <= hi));
+            }
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (mask[i]) {
+                result.push_back(c->first_row + i);
+            }
+        }
+    }
+    return result.size();
+}
+
+/**
+ * @brief 行の値を取得
+ *
+ * @param row 行の番号
+ * @param values 値
+ * @return true OK
+ * @return false 無い（範囲外、上書き済み）
+ */
+bool fix_history::get_row(uint64_t row, double values[column_count]) const
+{
+    if (used == 0 || row < at(0)->first_row || row >= rows) {
+        return false;
+    }
+    // チャンクは固定長なので先頭からの位置で求まる
+    const chunk *c = at((row - at(0)->first_row) / chunk_rows);
+    size_t i = row - c->first_row;
+    for (int col = 0; col < column_count; col++) {
+        values[col] = c->values[col][i];
+    }
+    return true;
+}
+
+/**
+ * @brief 移動平均
+ *
+ * 直近window行のうちNaNでない値の平均（すべてNaNならNaN）。
+ *
+ * @param col 項目
+ * @param window 行数
+ * @param out 結果（保持している行毎）
+ */
+void fix_history::rolling_mean(column col, size_t window, std::vector<double> &out) const
+{
+    out.clear();
+    std::vector<double> all;
+    for (size_t k = 0; k < used; k++) {
+        const chunk *c = at(k);
+        all.insert(all.end(), c->values[col], c->values[col] + c->rows);
+    }
+    out.resize(all.size());
+    double sum = 0;
+    size_t count = 0;
+    for (size_t i = 0; i < all.size(); i++) {
+        if (!std::isnan(all[i])) {
+            sum += all[i];
+            count++;
+        }
+        if (i >= window && !std::isnan(all[i - window])) {
+            sum -= all[i - window];
+            count--;
+        }
+        out[i] = (count > 0) ? sum / count : std::numeric_limits<double>::quiet_NaN();
+    }
+}
+
+/**
+ * @brief ファイルへ保存
+ *
+ * @param path ファイル
+ * @return true OK
+ * @return false ERROR
+ */
+bool fix_history::save(const std::string &path) const
+{
+    FILE *fp = std::fopen(path.c_str(), "wb");
+    if (fp == nullptr) {
+        std::cerr << "fix_history: failed to open " << path << std::endl;
+        return false;
+    }
+    uint32_t header[3] = { history_version, (uint32_t)chunk_rows, (uint32_t)column_count };
+    bool ok = std::fwrite(history_magic, sizeof(history_magic), 1, fp) == 1 &&
+              std::fwrite(header, sizeof(header), 1, fp) == 1;
+    for (size_t k = 0; ok && k < used; k++) {
+        const chunk *c = at(k);
+        uint32_t n = c->rows;
+        ok = std::fwrite(&n, sizeof(n), 1, fp) == 1 &&
+             std::fwrite(&c->first_row, sizeof(c->first_row), 1, fp) == 1 &&
+             std::fwrite(c->mono_ns, sizeof(c->mono_ns[0]), n, fp) == n &&
+             std::fwrite(c->flags, sizeof(c->flags[0]), n, fp) == n;
+        for (int col = 0; ok && col < column_count; col++) {
+            ok = std::fwrite(c->values[col], sizeof(double), n, fp) == n;
+        }
+    }
+    if (std::fclose(fp) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        std::cerr << "fix_history: failed to write " << path << std::endl;
+    }
+    return ok;
+}
+
+/**
+ * @brief ファイルから読み込む（保持しているものは削除）
+ *
+ * @param path ファイル
+ * @return true OK
+ * @return false ERROR（形式が違う、壊れている）
+ */
+bool fix_history::load(const std::string &path)
+{
+    FILE *fp = std::fopen(path.c_str(), "rb");
+    if (fp == nullptr) {
+        return false;
+    }
+    char magic[4];
+    uint32_t header[3];
+    if (std::fread(magic, sizeof(magic), 1, fp) != 1 || std::memcmp(magic, history_magic, sizeof(magic)) != 0 ||
+        std::fread(header, sizeof(header), 1, fp) != 1 || header[0] != history_version ||
+        header[1] != chunk_rows || header[2] != column_count) {
+        std::fclose(fp);
+        return false;
+    }
+
+    clear();
+    bool ok = true;
+    uint32_t n;
+    uint64_t first;
+    gps_fix fix;
+    std::vector<uint64_t> mono(chunk_rows);
+    std::vector<uint8_t> flags(chunk_rows);
+    std::vector<double> values(column_count * chunk_rows);
+    while (std::fread(&n, sizeof(n), 1, fp) == 1) {
+        ok = n <= chunk_rows &&
+             std::fread(&first, sizeof(first), 1, fp) == 1 &&
+             std::fread(mono.data(), sizeof(mono[0]), n, fp) == n &&
+             std::fread(flags.data(), sizeof(flags[0]), n, fp) == n;
+        for (int col = 0; ok && col < column_count; col++) {
+            ok = std::fread(&values[col * chunk_rows], sizeof(double), n, fp) == n;
+        }
+        if (!ok) {
+            break;
+        }
+        // 行の番号を合わせてから追加（最小値・最大値は追加時に計算し直す）
+        rows = first;
+        for (uint32_t i = 0; i < n; i++) {
+            double v = values[utc * chunk_rows + i];
+            fix.utc = std::isnan(v) ? (time_t)-1 : (time_t)v;
+            fix.latitude = values[latitude * chunk_rows + i];
+            fix.longitude = values[longitude * chunk_rows + i];
+            fix.altitude = values[altitude * chunk_rows + i];
+            v = values[num_sv * chunk_rows + i];
+            fix.num_sv = std::isnan(v) ? 0 : (int)v;
+            fix.pdop = values[pdop * chunk_rows + i];
+            fix.hdop = values[hdop * chunk_rows + i];
+            fix.vdop = values[vdop * chunk_rows + i];
+            fix.mono_ns = mono[i];
+            fix.sum_err = flags[i] & sum_err;
+            fix.utc_err = flags[i] & utc_err;
+            fix.position_err = flags[i] & position_err;
+            fix.timeout = flags[i] & timeout;
+            append(fix);
+        }
+    }
+    std::fclose(fp);
+    if (!ok) {
+        std::cerr << "fix_history: truncated file " << path << std::endl;
+    }
+    return ok;
+}
+
+/**
+ * @brief 項目名を取得
+ *
+ * @param col 項目
+ * @return const char* 項目名
+ */
+const char *fix_history::column_name(column col)
+{
+    return column_names[col];
+}
+
+/**
+ * @brief 項目名から項目を取得
+ *
+ * @param name 項目名
+ * @param col 項目
+ * @return true OK
+ * @return false 無い項目
+ */
+bool fix_history::parse_column(const std::string &name, column &col)
+{
+    for (int c = 0; c < column_count; c++) {
+        if (name == column_names[c]) {
+            col = (column)c;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief 条件を解析
+ *
+ * "hdop>2,num_sv<6" のように項目名と比較（< <= > >= =）を','で並べる。
+ *
+ * @param str 条件
+ * @param ranges 条件（追加される）
+ * @return true OK
+ * @return false 形式が違う
+ */
+bool fix_history::parse_condition(const std::string &str, std::vector<range> &ranges)
+{
+    const double inf = std::numeric_limits<double>::infinity();
+    size_t pos = 0;
+    while (pos <= str.size()) {
+        size_t end = str.find(',', pos);
+        if (end == std::string::npos) {
+            end = str.size();
+        }
+        std::string term = str.substr(pos, end - pos);
+        pos = end + 1;
+        size_t op = term.find_first_of("<>=");
+        if (op == std::string::npos || op == 0) {
+            return false;
+        }
+        range r;
+        if (!parse_column(term.substr(0, op), r.col)) {
+            return false;
+        }
+        std::string ops = term.substr(op, (term.size() > op + 1 && term[op + 1] == '=') ? 2 : 1);
+        double value;
+        try {
+            value = std::stod(term.substr(op + ops.size()));
+        }
+        catch (std::exception &) {
+            return false;
+        }
+        r.lo = -inf;
+        r.hi = inf;
+        if (ops == "<") {
+            r.hi = std::nextafter(value, -inf);
+        }
+        else if (ops == "<=") {
+            r.hi = value;
+        }
+        else if (ops == ">") {
+            r.lo = std::nextafter(value, inf);
+        }
+        else if (ops == ">=") {
+            r.lo = value;
+        }
+        else if (ops == "=" || ops == "==") {
+            r.lo = value;
+            r.hi = value;
+        }
+        else {
+            return false;
+        }
+        ranges.push_back(r);
+    }
+    return true;
+}
@@ -0,0 +1,132 @@
+/**
+ * @file fix_history.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 測位結果の履歴（列指向）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef FIX_HISTORY_HPP
+#define FIX_HISTORY_HPP
+
+#include "gps_fix.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief 測位結果の履歴（列指向）
+ *
+ * 項目毎に連続した配列（64byteアライメント）を持つ固定長のチャンクに記録する。
+ * チャンク毎に項目の最小値・最大値を持つので、条件に合わないチャンクは読み飛ばせる。
+ * 値が無い場合はNaN（比較はすべて偽になるので条件に合わない）。
+ *
+ * max_chunksを指定すると起動時にすべてのチャンクを確保し、古いチャンクから上書きする
+ * （gps_testのループでヒープを使わない）。0なら必要に応じて増やす（ログの解析用）。
+ *
+ * ファイル形式（ホストのバイト順）
+ *      header: magic "FXHC"(4), version(4), chunk_rows(4), column_count(4)
+ *      chunk:  rows(4), first_row(8), mono_ns[rows](8), flags[rows](1), values[column][rows](8)
+ */
+class fix_history
+{
+public:
+    enum column {
+        utc,            // GPS時刻（エポック秒）
+        latitude,
+        longitude,
+        altitude,
+        num_sv,
+        pdop,
+        hdop,
+        vdop,
+        column_count
+    };
+
+    // flagsのビット
+    enum flag {
+        sum_err = 0x01,
+        utc_err = 0x02,
+        position_err = 0x04,
+        timeout = 0x08
+    };
+
+    static const size_t chunk_rows = 1024;
+
+    /**
+     * @brief チャンク
+     *
+     */
+    class chunk {
+    public:
+        alignas(64) double values[column_count][chunk_rows];
+        alignas(64) uint64_t mono_ns[chunk_rows];
+        alignas(64) uint8_t flags[chunk_rows];
+        double min[column_count];       // NaNを除いた最小値（値が無ければ+inf）
+        double max[column_count];       // NaNを除いた最大値（値が無ければ-inf）
+        uint64_t first_row;             // 最初の行の番号
+        size_t rows;
+
+        void clear(uint64_t first);
+    };
+
+    /**
+     * @brief 条件（lo <= 値 <= hi）
+     *
+     */
+    class range {
+    public:
+        column col;
+        double lo;
+        double hi;
+    };
+
+    /**
+     * @brief 検索の統計
+     *
+     */
+    class scan_stats {
+    public:
+        size_t scanned = 0;     // 読んだチャンク数
+        size_t skipped = 0;     // 最小値・最大値で読み飛ばしたチャンク数
+    };
+
+    fix_history(size_t max_chunks = 0);
+    ~fix_history();
+    fix_history(const fix_history &) = delete;
+    fix_history &operator=(const fix_history &) = delete;
+
+    void append(const gps_fix &fix);
+    void clear();
+    uint64_t size() const;
+    size_t chunk_count() const;
+    const chunk &get_chunk(size_t i) const;
+
+    size_t scan(const std::vector<range> &ranges, std::vector<uint64_t> &rows, scan_stats *stats = nullptr) const;
+    bool get_row(uint64_t row, double values[column_count]) const;
+    void rolling_mean(column col, size_t window, std::vector<double> &out) const;
+
+    bool save(const std::string &path) const;
+    bool load(const std::string &path);
+
+    static const char *column_name(column col);
+    static bool parse_column(const std::string &name, column &col);
+    static bool parse_condition(const std::string &str, std::vector<range> &ranges);
+
+private:
+    std::vector<chunk *> chunks;        // 古い順（リングの場合はstartから）
+    size_t max_chunks;
+    size_t start;                       // リングの先頭
+    size_t used;                        // 使用中のチャンク数
+    uint64_t rows;                      // 追加した行数（上書きしたものを含む）
+
+    chunk *at(size_t i) const;
+    static chunk *new_chunk();
+    static void delete_chunk(chunk *c);
+};
+
+#endif
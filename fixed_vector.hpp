@@ -0,0 +1,66 @@
+/**
+ * @file fixed_vector.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 固定容量の配列（ヒープを使わない）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef FIXED_VECTOR_HPP
+#define FIXED_VECTOR_HPP
+
+#include <cstddef>
+
+/**
+ * @brief 固定容量の配列（ヒープを使わない）
+ *
+ * 容量を超えた要素は追加しない。
+ *
+ * @tparam T 要素（デフォルト構築・コピーできること）
+ * @tparam N 容量
+ */
+template <class T, size_t N>
+class fixed_vector
+{
+public:
+    fixed_vector() : count(0) {}
+
+    size_t size() const { return count; }
+    size_t capacity() const { return N; }
+    bool empty() const { return count == 0; }
+    void clear() { count = 0; }
+
+    /**
+     * @brief 要素を追加
+     *
+     * @param value 要素
+     * @return true 追加した
+     * @return false 容量不足
+     */
+    bool push_back(const T &value)
+    {
+        if (count >= N) {
+            return false;
+        }
+        items[count++] = value;
+        return true;
+    }
+
+    void resize(size_t n) { count = n < N ? n : N; }
+
+    T &operator[](size_t i) { return items[i]; }
+    const T &operator[](size_t i) const { return items[i]; }
+    T *begin() { return items; }
+    T *end() { return items + count; }
+    const T *begin() const { return items; }
+    const T *end() const { return items + count; }
+
+private:
+    T items[N];
+    size_t count;
+};
+
+#endif
@@ -0,0 +1,383 @@
+/**
+ * @file flight_recorder.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 直近の受信データの記録（フライトレコーダー）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "flight_recorder.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char *status_names[] = { "empty", "conflict", "dev_error", "ok" };
+
+/**
+ * @brief 全部書き込む
+ *
+ * @param fd ファイル
+ * @param data データ
+ * @param len バイト数
+ * @return true OK
+ * @return false ERROR
+ */
+static bool write_all(int fd, const void *data, size_t len)
+{
+    const char *p = static_cast<const char *>(data);
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/**
+ * @brief Construct a new flight recorder::flight recorder object
+ *
+ * リングバッファとダンプ用のバッファはここで確保する。
+ *
+ * @param conf 設定
+ */
+flight_recorder::flight_recorder(const config &conf) :
+conf(conf),
+entries(std::max<size_t>(conf.bursts, 1)),
+buffer(std::max<size_t>(conf.buffer_size, 1)),
+head(0),
+byte_head(0),
+last_empty(false),
+pending(false),
+pending_reason(manual),
+post_left(0),
+requested(0),
+dump_entries(entries.size()),
+dump_buffer(buffer.size()),
+dump_count(0),
+dump_reason(manual),
+busy(false),
+stop(false),
+dumps(0),
+suppressed(0),
+errors(0)
+{
+    for (int r = 0; r < reason_count; r++) {
+        triggered[r] = false;
+    }
+    thread = std::thread([this]{thread_proc();});
+}
+
+/**
+ * @brief Destroy the flight recorder::flight recorder object
+ *
+ */
+flight_recorder::~flight_recorder()
+{
+    close();
+}
+
+/**
+ * @brief 記録中のダンプを途中までで書き出して書き込みスレッドを終了
+ *
+ */
+void flight_recorder::close()
+{
+    if (!thread.joinable()) {
+        return;
+    }
+    if (pending) {
+        pending = false;
+        snapshot();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stop = true;
+    }
+    cv.notify_one();
+    thread.join();
+}
+
+/**
+ * @brief 読み込んだデータを記録（ヒープは使わない）
+ *
+ * @param status 読み込みの結果
+ * @param data データ
+ * @param len バイト数
+ */
+void flight_recorder::record(ubx::status status, const uint8_t *data, size_t len)
+{
+    // 空読みはバーストの区切りとして最初の1回だけ記録する
+    bool repeated_empty = status == ubx::empty && last_empty;
+    last_empty = status == ubx::empty;
+    if (!repeated_empty) {
+        append(status, data, len);
+    }
+
+    // 記録しない空読みも数える（受信機が止まったままでもダンプを書き出す）
+    if (pending && --post_left == 0) {
+        pending = false;
+        snapshot();
+    }
+}
+
+/**
+ * @brief リングバッファへ追加
+ *
+ * @param status 読み込みの結果
+ * @param data データ
+ * @param len バイト数
+ */
+void flight_recorder::append(ubx::status status, const uint8_t *data, size_t len)
+{
+    // バッファより大きいデータは末尾だけ
+    if (len > buffer.size()) {
+        data += len - buffer.size();
+        len = buffer.size();
+    }
+    size_t pos = byte_head % buffer.size();
+    size_t first = std::min(len, buffer.size() - pos);
+    std::memcpy(&buffer[pos], data, first);
+    std::memcpy(&buffer[0], data + first, len - first);
+
+    entry &e = entries[head % entries.size()];
+    e.mono_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    e.utc_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    e.status = status;
+    e.offset = byte_head;
+    e.len = len;
+    byte_head += len;
+    head++;
+}
+
+/**
+ * @brief ダンプを要求（post_bursts回記録してから書き出す）
+ *
+ * @param r 種類
+ */
+void flight_recorder::trigger(reason r)
+{
+    if (pending) {
+        // 記録中のダンプに含まれる
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (requested >= conf.max_dumps || busy ||
+        (triggered[r] && now - last_trigger[r] < std::chrono::seconds(conf.min_interval_s))) {
+        suppressed++;
+        return;
+    }
+    triggered[r] = true;
+    last_trigger[r] = now;
+    requested++;
+    pending_reason = r;
+    if (conf.post_bursts == 0) {
+        snapshot();
+    }
+    else {
+        pending = true;
+        post_left = conf.post_bursts;
+    }
+}
+
+/**
+ * @brief 記録をダンプ用のバッファへコピーして書き込みスレッドへ渡す
+ *
+ */
+void flight_recorder::snapshot()
+{
+    if (busy) {
+        suppressed++;
+        return;
+    }
+    // 古い順に、データが上書きされていないものだけ
+    size_t n = 0;
+    size_t bytes = 0;
+    uint64_t first = head > entries.size() ? head - entries.size() : 0;
+    for (uint64_t i = first; i < head; i++) {
+        const entry &e = entries[i % entries.size()];
+        if (byte_head - e.offset > buffer.size()) {
+            continue;
+        }
+        entry &d = dump_entries[n++];
+        d = e;
+        d.offset = bytes;
+        size_t pos = e.offset % buffer.size();
+        size_t part = std::min(e.len, buffer.size() - pos);
+        std::memcpy(&dump_buffer[bytes], &buffer[pos], part);
+        std::memcpy(&dump_buffer[bytes + part], &buffer[0], e.len - part);
+        bytes += e.len;
+    }
+    dump_count = n;
+    dump_reason = pending_reason;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        busy = true;
+    }
+    cv.notify_one();
+}
+
+/**
+ * @brief 書き込みスレッド
+ *
+ */
+void flight_recorder::thread_proc()
+{
+    // 前回までの起動のダンプは上書きせず、続きの番号から
+    int index = next_index(conf.path_prefix);
+    std::unique_lock<std::mutex> lock(mtx);
+    while (true) {
+        cv.wait(lock, [this]{return busy.load() || stop.load();});
+        if (busy) {
+            lock.unlock();
+            if (write_dump(index)) {
+                dumps++;
+            }
+            else {
+                errors++;
+            }
+            lock.lock();
+            busy = false;
+            continue;
+        }
+        if (stop) {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief 既存のダンプ（path_prefix_連番_種類.txt）の次の連番
+ *
+ * @param path_prefix 出力ファイル
+ * @return int 連番
+ */
+int flight_recorder::next_index(const std::string &path_prefix)
+{
+    size_t slash = path_prefix.rfind('/');
+    std::string dir = (slash == std::string::npos) ? "." : path_prefix.substr(0, slash + 1);
+    std::string base = (slash == std::string::npos) ? path_prefix : path_prefix.substr(slash + 1);
+    DIR *dp = opendir(dir.c_str());
+    if (dp == nullptr) {
+        return 0;
+    }
+    int next = 0;
+    struct dirent *de;
+    while ((de = readdir(dp)) != nullptr) {
+        const char *name = de->d_name;
+        if (std::strncmp(name, base.c_str(), base.size()) != 0 || name[base.size()] != '_') {
+            continue;
+        }
+        char *end = nullptr;
+        long n = std::strtol(name + base.size() + 1, &end, 10);
+        if (end != name + base.size() + 1 && *end == '_' && n >= next) {
+            next = (int)n + 1;
+        }
+    }
+    closedir(dp);
+    return next;
+}
+
+/**
+ * @brief ダンプをファイルへ出力
+ *
+ * @param index 連番
+ * @return true OK
+ * @return false ERROR
+ */
+bool flight_recorder::write_dump(int &index)
+{
+    char path[512];
+    int fd = -1;
+    // 既存のファイルは上書きしない（同じ番号のファイルを別のプロセスが作った場合は次の番号）
+    for (int retry = 0; fd < 0 && retry < 100; retry++) {
+        std::snprintf(path, sizeof(path), "%s_%04d_%s.txt", conf.path_prefix.c_str(), index++, reason_name(dump_reason));
+        fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0 && errno != EEXIST) {
+            return false;
+        }
+    }
+    if (fd < 0) {
+        return false;
+    }
+    char line[256];
+    int len = std::snprintf(line, sizeof(line), "# gps_test flight recorder: reason = %s, bursts = %zu\n",
+                            reason_name(dump_reason), dump_count);
+    bool ok = write_all(fd, line, len);
+    for (size_t i = 0; ok && i < dump_count; i++) {
+        const entry &e = dump_entries[i];
+        time_t t = (time_t)(e.utc_ms / 1000);
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        len = std::snprintf(line, sizeof(line), "# %04d-%02d-%02dT%02d:%02d:%02d.%03dZ mono_ns = %llu, status = %s, bytes = %zu\n",
+                            tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                            (int)(e.utc_ms % 1000), (unsigned long long)e.mono_ns, status_names[e.status], e.len);
+        ok = write_all(fd, line, len) && write_all(fd, &dump_buffer[e.offset], e.len);
+        if (ok && e.len > 0 && dump_buffer[e.offset + e.len - 1] != '\n') {
+            ok = write_all(fd, "\n", 1);
+        }
+    }
+    // 電源断に備えてすぐに書き出す
+    if (fsync(fd) != 0) {
+        ok = false;
+    }
+    if (::close(fd) != 0) {
+        ok = false;
+    }
+    return ok;
+}
+
+/**
+ * @brief ダンプした回数を取得
+ *
+ * @return uint64_t 回数
+ */
+uint64_t flight_recorder::get_dumps() const
+{
+    return dumps;
+}
+
+/**
+ * @brief 制限したダンプの回数を取得
+ *
+ * @return uint64_t 回数
+ */
+uint64_t flight_recorder::get_suppressed() const
+{
+    return suppressed;
+}
+
+/**
+ * @brief 書き込みエラーの回数を取得
+ *
+ * @return uint64_t 回数
+ */
+uint64_t flight_recorder::get_errors() const
+{
+    return errors;
+}
+
+/**
+ * @brief 種類の名前
+ *
+ * @param r 種類
+ * @return const char* 名前
+ */
+const char *flight_recorder::reason_name(reason r)
+{
+    static const char *names[reason_count] = { "checksum", "utc", "position", "timeout", "manual" };
+    return (r < reason_count) ? names[r] : "unknown";
+}
@@ -0,0 +1,130 @@
+/**
+ * @file flight_recorder.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 直近の受信データの記録（フライトレコーダー）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef FLIGHT_RECORDER_HPP
+#define FLIGHT_RECORDER_HPP
+
+#include "ubx.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief 直近の受信データの記録（フライトレコーダー）
+ *
+ * ループスレッドは読み込んだデータを事前確保したリングバッファへmemcpyするだけ。
+ * チェックがエラーになった時（またはSIGUSR2）にtrigger()すると、その後post_bursts回（空読みを含む）読み込んでから
+ * 前後のデータをダンプ用のバッファへコピーし、書き込みスレッドがファイルへ出力する。
+ * エラーが続いてもSDカードを埋めないよう、同じ種類は一定間隔に1回、全体でmax_dumps回までに制限する。
+ *
+ * 出力ファイル（path_prefix_連番_種類.txt、連番は既存のファイルの続きから、上書きはしない）
+ *      # で始まる行に時刻・ubx::status・バイト数、その後に受信したデータをそのまま出力する。
+ */
+class flight_recorder
+{
+public:
+    enum reason {
+        checksum,
+        utc,
+        position,
+        timeout,
+        manual,         // SIGUSR2
+        reason_count
+    };
+
+    /**
+     * @brief 設定
+     *
+     */
+    class config {
+    public:
+        std::string path_prefix;    // 出力ファイル
+        size_t bursts;              // 記録する読み込み回数
+        size_t buffer_size;         // 記録するデータ(byte)
+        size_t post_bursts;         // trigger()の後に待つ読み込み回数（空読みを含む）
+        int min_interval_s;         // 同じ種類のダンプの最小間隔(秒)
+        int max_dumps;              // ダンプの最大回数
+        config() {
+            path_prefix = "gps_test_rec";
+            bursts = 64;
+            buffer_size = 1024 * 1024;
+            post_bursts = 8;
+            min_interval_s = 60;
+            max_dumps = 32;
+        }
+    };
+
+    flight_recorder(const config &conf);
+    ~flight_recorder();
+    void record(ubx::status status, const uint8_t *data, size_t len);
+    void trigger(reason r);
+    void close();
+    uint64_t get_dumps() const;
+    uint64_t get_suppressed() const;
+    uint64_t get_errors() const;
+
+    static const char *reason_name(reason r);
+
+private:
+    /**
+     * @brief 1回の読み込み
+     *
+     */
+    class entry {
+    public:
+        uint64_t mono_ns;       // 単調増加時刻
+        int64_t utc_ms;         // システム時刻
+        ubx::status status;
+        uint64_t offset;        // データの位置（記録した総バイト数）
+        size_t len;
+    };
+
+    config conf;
+    std::vector<entry> entries;             // 事前確保したリングバッファ
+    std::vector<uint8_t> buffer;
+    uint64_t head;                          // 記録した回数
+    uint64_t byte_head;                     // 記録した総バイト数
+    bool last_empty;                        // 空読みが続く間は記録しない
+    bool pending;                           // trigger()後の記録中
+    reason pending_reason;
+    size_t post_left;
+    bool triggered[reason_count];
+    std::chrono::steady_clock::time_point last_trigger[reason_count];
+    int requested;                          // 受け付けたダンプの回数
+
+    // ダンプ（書き込みスレッドへ渡す）
+    std::vector<entry> dump_entries;
+    std::vector<uint8_t> dump_buffer;
+    size_t dump_count;
+    reason dump_reason;
+    std::atomic<bool> busy;
+    std::atomic<bool> stop;
+    std::atomic<uint64_t> dumps;
+    std::atomic<uint64_t> suppressed;
+    std::atomic<uint64_t> errors;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::thread thread;
+
+    void snapshot();
+    void append(ubx::status status, const uint8_t *data, size_t len);
+    void thread_proc();
+    bool write_dump(int &index);
+    static int next_index(const std::string &path_prefix);
+};
+
+#endif
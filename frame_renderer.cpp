@@ -0,0 +1,269 @@
+/**
+ * @file frame_renderer.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 差分描画用フレームバッファ
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "frame_renderer.hpp"
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+/**
+ * @brief 単調増加時刻(ns)を取得
+ *
+ * @return uint64_t 時刻(ns)
+ */
+static inline uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Construct a new frame renderer::frame renderer object
+ *
+ * @param fd 出力先のファイルディスクリプタ
+ * @param rows 最大行数
+ * @param cols 1行の最大バイト数（エスケープシーケンスを含む）
+ */
+frame_renderer::frame_renderer(int fd, size_t rows, size_t cols) :
+fd(fd),
+rows(rows),
+cols(cols),
+curr(rows * cols, '\0'),
+prev(rows * cols, '\0'),
+curr_len(rows, 0),
+prev_len(rows, 0),
+// 全行を書き換えても収まるサイズ（行毎のカーソル移動と行末消去を含む）
+out(rows * (cols + 32) + 32, '\0'),
+row(0),
+prev_rows(0),
+full_redraw(true),
+begin_ns(0),
+st()
+{
+}
+
+/**
+ * @brief フレームの組み立てを開始
+ *
+ */
+void frame_renderer::begin()
+{
+    begin_ns = now_ns();
+    row = 0;
+    curr_len[0] = 0;
+}
+
+/**
+ * @brief 書式付きで現在の行に追加
+ *
+ * @param fmt 書式
+ * @param ... 引数
+ */
+void frame_renderer::printf(const char *fmt, ...)
+{
+    if (row >= rows) {
+        return;
+    }
+    size_t len = curr_len[row];
+    size_t remain = cols - len;
+    if (remain <= 1) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int n = std::vsnprintf(&curr[row * cols + len], remain, fmt, args);
+    va_end(args);
+    if (n < 0) {
+        return;
+    }
+    // 収まらない分は切り捨て（終端文字の分を除く）
+    if ((size_t)n >= remain) {
+        n = remain - 1;
+    }
+    curr_len[row] = len + n;
+}
+
+/**
+ * @brief 文字列を現在の行に追加
+ *
+ * @param str 文字列
+ */
+void frame_renderer::puts(const char *str)
+{
+    append(str, std::strlen(str));
+}
+
+/**
+ * @brief 改行（次の行へ移動）
+ *
+ */
+void frame_renderer::newline()
+{
+    if (row >= rows) {
+        return;
+    }
+    row++;
+    if (row < rows) {
+        curr_len[row] = 0;
+    }
+}
+
+/**
+ * @brief ここまで組み立てた行が前回出力したフレームと違うか
+ *
+ * この後に組み立てる行（trailing_rows）は比較しない（描画を省略するかを途中で判断するため）。
+ * 行数が変わった場合は違うとする（短くなったフレームでも前回の行を消す）。
+ *
+ * @param trailing_rows この後に組み立てる行数
+ * @return true 違う（または全画面再描画）
+ * @return false 同じ
+ */
+bool frame_renderer::changed(size_t trailing_rows) const
+{
+    if (full_redraw) {
+        return true;
+    }
+    size_t curr_rows = row;
+    if (row < rows && curr_len[row] > 0) {
+        curr_rows++;
+    }
+    if (curr_rows + trailing_rows != prev_rows) {
+        return true;
+    }
+    for (size_t i = 0; i < curr_rows; i++) {
+        if (i >= prev_rows || prev_len[i] != curr_len[i] ||
+            std::memcmp(&curr[i * cols], &prev[i * cols], curr_len[i]) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief 前回のフレームとの差分を出力
+ *
+ * @return size_t 出力したバイト数
+ */
+size_t frame_renderer::present()
+{
+    static const char clear_screen[] = "\033[2J";
+    static const char clear_eol[] = "\033[0K";
+    static const char clear_line[] = "\033[2K";
+
+    // 最終行が改行されていなければ1行として扱う
+    size_t curr_rows = row;
+    if (row < rows && curr_len[row] > 0) {
+        curr_rows++;
+    }
+
+    size_t out_len = 0;
+    size_t updated = 0;
+    auto put = [&](const char *str, size_t len) {
+        std::memcpy(&out[out_len], str, len);
+        out_len += len;
+    };
+
+    if (full_redraw) {
+        put(clear_screen, sizeof(clear_screen) - 1);
+    }
+    size_t n = curr_rows > prev_rows ? curr_rows : prev_rows;
+    for (size_t i = 0; i < n; i++) {
+        const char *line = &curr[i * cols];
+        if (i < curr_rows) {
+            size_t len = curr_len[i];
+            if (!full_redraw && i < prev_rows && prev_len[i] == len &&
+                std::memcmp(line, &prev[i * cols], len) == 0) {
+                // 変化なし
+                continue;
+            }
+            int m = std::snprintf(&out[out_len], 16, "\033[%zu;1H", i + 1);
+            out_len += m;
+            put(line, len);
+            put(clear_eol, sizeof(clear_eol) - 1);
+            std::memcpy(&prev[i * cols], line, len);
+            prev_len[i] = len;
+        }
+        else {
+            // 前回より行数が減った場合は残った行を消去
+            int m = std::snprintf(&out[out_len], 16, "\033[%zu;1H", i + 1);
+            out_len += m;
+            put(clear_line, sizeof(clear_line) - 1);
+            prev_len[i] = 0;
+        }
+        updated++;
+    }
+    prev_rows = curr_rows;
+    full_redraw = false;
+
+    // 1回のwrite(2)で出力（部分書き込みの場合のみ続きを書く）
+    size_t written = 0;
+    while (written < out_len) {
+        ssize_t ret = write(fd, &out[written], out_len - written);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        written += ret;
+    }
+
+    uint64_t elapsed = (now_ns() - begin_ns) / 1000;
+    st.frames++;
+    st.total_bytes += written;
+    st.total_us += elapsed;
+    st.last_bytes = written;
+    st.last_us = elapsed;
+    st.last_lines = updated;
+
+    return written;
+}
+
+/**
+ * @brief 次回の描画で全画面を再描画する
+ *
+ */
+void frame_renderer::invalidate()
+{
+    full_redraw = true;
+}
+
+/**
+ * @brief 描画統計を取得
+ *
+ * @return const frame_renderer::stats& 描画統計
+ */
+const frame_renderer::stats &frame_renderer::get_stats() const
+{
+    return st;
+}
+
+/**
+ * @brief 現在の行に追加（収まらない分は切り捨て）
+ *
+ * @param str 文字列
+ * @param len 長さ
+ */
+void frame_renderer::append(const char *str, size_t len)
+{
+    if (row >= rows) {
+        return;
+    }
+    size_t pos = curr_len[row];
+    if (pos + len > cols) {
+        len = cols - pos;
+    }
+    std::memcpy(&curr[row * cols + pos], str, len);
+    curr_len[row] = pos + len;
+}
@@ -0,0 +1,70 @@
+/**
+ * @file frame_renderer.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 差分描画用フレームバッファ
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef FRAME_RENDERER_HPP
+#define FRAME_RENDERER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief 差分描画用フレームバッファ
+ *
+ * 1画面分の文字列を行単位で事前確保したバッファに組み立て、
+ * 前回のフレームと比較して変化した行だけを1回のwrite(2)で出力する。
+ */
+class frame_renderer
+{
+public:
+    /**
+     * @brief 描画統計
+     *
+     */
+    class stats {
+    public:
+        uint64_t frames;        // 描画回数
+        uint64_t total_bytes;   // 出力したバイト数の合計
+        uint64_t total_us;      // 描画時間の合計(us)
+        size_t last_bytes;      // 前回の出力バイト数
+        uint32_t last_us;       // 前回の描画時間(us)
+        size_t last_lines;      // 前回の更新行数
+    };
+
+    frame_renderer(int fd, size_t rows = 128, size_t cols = 256);
+    void begin();
+    void printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+    void puts(const char *str);
+    void newline();
+    bool changed(size_t trailing_rows = 0) const;
+    size_t present();
+    void invalidate();
+    const stats &get_stats() const;
+
+private:
+    int fd;
+    size_t rows;
+    size_t cols;
+    std::vector<char> curr;             // 組み立て中のフレーム
+    std::vector<char> prev;             // 前回出力したフレーム
+    std::vector<uint16_t> curr_len;     // 組み立て中の各行の長さ
+    std::vector<uint16_t> prev_len;     // 前回出力した各行の長さ
+    std::vector<char> out;              // 出力バッファ
+    size_t row;                         // 組み立て中の行
+    size_t prev_rows;                   // 前回出力した行数
+    bool full_redraw;                   // 全画面再描画フラグ
+    uint64_t begin_ns;                  // フレーム組み立て開始時刻
+    stats st;
+
+    void append(const char *str, size_t len);
+};
+
+#endif
@@ -0,0 +1,560 @@
+/**
+ * @file gnss_core.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief NMEAの解析とチェック（1台の受信機の状態）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "gnss_core.hpp"
+#include "nmea_gga.hpp"
+#include "nmea_rmc.hpp"
+#include <cstring>
+#include <limits>
+#include <new>
+#include <time.h>
+
+/**
+ * @brief Construct a new gnss core::gnss core object
+ *
+ * 受信バッファと作業領域は起動時に確保する。
+ *
+ * @param conf 設定
+ */
+gnss_core::gnss_core(const config &conf) :
+conf(conf),
+arena(conf.arena_size),
+sum_err(false),
+sum_err_cnt(0),
+timeout(false),
+timeout_cnt(0),
+position_err_cnt(0),
+last_ns(now_ns()),
+snapshot_seq(0)
+{
+    msg.reserve(conf.receive_size);
+    epoch_data.reserve(conf.receive_size);
+    gps_utc[0] = '\0';
+    position.latitude_error = true;
+    position.longitude_error = true;
+    position.altitude_error = true;
+    std::memset(&fix, 0, sizeof(fix));
+    fix.utc = (time_t)-1;
+    fix.latitude = std::numeric_limits<double>::quiet_NaN();
+    fix.longitude = std::numeric_limits<double>::quiet_NaN();
+    fix.altitude = std::numeric_limits<double>::quiet_NaN();
+    fix.pdop = std::numeric_limits<double>::quiet_NaN();
+    fix.hdop = std::numeric_limits<double>::quiet_NaN();
+    fix.vdop = std::numeric_limits<double>::quiet_NaN();
+    std::memset(&work, 0, sizeof(work));
+    std::memset(&snapshot, 0, sizeof(snapshot));
+}
+
+/**
+ * @brief 単調増加時刻(ns)を取得
+ *
+ * @return uint64_t 時刻（CLOCK_MONOTONIC, ns）
+ */
+uint64_t gnss_core::now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+ * @brief 位置の範囲を変更（カウンターはそのまま）
+ *
+ * @param range 範囲
+ */
+void gnss_core::set_range(const position_range &range)
+{
+    conf.range = range;
+}
+
+/**
+ * @brief 受信が途切れたと判定する時間を変更
+ *
+ * @param timeout_ms 時間(ms)
+ */
+void gnss_core::set_timeout(int timeout_ms)
+{
+    conf.timeout_ms = timeout_ms;
+}
+
+/**
+ * @brief 受信データを追加（バーストの途中）
+ *
+ * 1バーストでreceive_sizeを超えた分は捨てる（確保済みの容量を超えて伸ばさない）。
+ * 捨てた分で途中で切れたセンテンスはend_burst()でtruncatedに数える。
+ *
+ * @param data 受信データ
+ * @param len 長さ
+ */
+void gnss_core::feed(const uint8_t *data, size_t len)
+{
+    cnt.bytes.fetch_add(len, std::memory_order_relaxed);
+    size_t room = conf.receive_size > msg.size() ? conf.receive_size - msg.size() : 0;
+    msg.append(reinterpret_cast<const char *>(data), len < room ? len : room);
+}
+
+/**
+ * @brief 受信が途切れたかチェック（読み込みの度に呼ぶ）
+ *
+ * 途切れたと判定したときだけtrueを返し、タイムアウトのフラグは次の呼び出しで戻す。
+ *
+ * @param mono_ns 現在時刻（CLOCK_MONOTONIC, ns）
+ * @return true 途切れた（process()で前回のセンテンスのままエポックを処理する）
+ * @return false 途切れていない
+ */
+bool gnss_core::check_timeout(uint64_t mono_ns)
+{
+    uint64_t elapsed_ms = mono_ns > last_ns ? (mono_ns - last_ns) / 1000000u : 0;
+    if (elapsed_ms >= (uint64_t)conf.timeout_ms && timeout == false) {
+        timeout = true;
+        timeout_cnt++;
+        cnt.timeouts.fetch_add(1, std::memory_order_relaxed);
+        last_ns = mono_ns;
+        return true;
+    }
+    timeout = false;
+    return false;
+}
+
+/**
+ * @brief バーストの終わり（受信機のバッファが空になった）
+ *
+ * 受信データをセンテンス毎に分割する。
+ *
+ * @param mono_ns 現在時刻（CLOCK_MONOTONIC, ns）
+ * @return true 受信データがあった（process()でエポックを処理する）
+ * @return false 受信データが無い
+ */
+bool gnss_core::end_burst(uint64_t mono_ns)
+{
+    if (msg.empty()) {
+        return false;
+    }
+    last_ns = mono_ns;
+
+    stage_scope ts(*this, GNSS_CORE_STAGE_SPLIT);
+    // 受信データを入れ替え（どちらも確保済みの容量を使い回す）
+    epoch_data.swap(msg);
+    msg.clear();
+    size_t used = split_nmea(epoch_data, nmea);
+    if (used < epoch_data.size()) {
+        // 途中で切れたセンテンス
+        sum_err = true;
+        sum_err_cnt++;
+        cnt.truncated.fetch_add(1, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+/**
+ * @brief 1エポック分を処理（チェックサム、解析、時刻と位置のチェック）して公開
+ *
+ * @param mono_ns 受信時刻（CLOCK_MONOTONIC, ns）
+ */
+void gnss_core::process(uint64_t mono_ns)
+{
+    gps_utc[0] = '\0';
+    double latitude = std::numeric_limits<double>::quiet_NaN();
+    double longitude = std::numeric_limits<double>::quiet_NaN();
+    double altitude = std::numeric_limits<double>::quiet_NaN();
+    int num_sv = 0;
+    time_t current_gps_time_t = (time_t)-1;
+    arena.reset();
+    gsa = arena_vector<nmea_gsa>(arena, 16);
+    gsv = arena_vector<nmea_gsv>(arena, 64);
+    valid.clear();
+    for (auto &s : nmea) {
+        bool sum_ok;
+        {
+            stage_scope ts(*this, GNSS_CORE_STAGE_CHECKSUM);
+            sum_ok = check_sum(s);
+        }
+        if (sum_ok == false) {
+            // チェックサムエラー
+            sum_err = true;
+            sum_err_cnt++;
+            cnt.checksum_errors.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        cnt.sentences.fetch_add(1, std::memory_order_relaxed);
+        valid.push_back(s);
+
+        if (s.contains("RMC")) {
+            stage_scope ts(*this, GNSS_CORE_STAGE_PARSE_RMC);
+            nmea_rmc rmc(s);
+            rmc.get_utc_datetime(gps_utc, sizeof(gps_utc));
+            current_gps_time_t = rmc.get_time_t();
+            if (current_gps_time_t == (time_t)-1) {
+                cnt.parse_failures.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        if (s.contains("GGA")) {
+            stage_scope ts(*this, GNSS_CORE_STAGE_PARSE_GGA);
+            nmea_gga gga(s);
+            latitude = gga.get_latitude();
+            longitude = gga.get_longitude();
+            altitude = gga.get_altitude();
+            num_sv = gga.get_num_sv();
+        }
+        if (s.contains("GSA")) {
+            stage_scope ts(*this, GNSS_CORE_STAGE_PARSE_GSA);
+            gsa.emplace_back(s);
+        }
+        if (s.contains("GSV")) {
+            stage_scope ts(*this, GNSS_CORE_STAGE_PARSE_GSV);
+            gsv.emplace_back(s);
+        }
+    }
+
+    // 時刻チェック
+    {
+        stage_scope ts(*this, GNSS_CORE_STAGE_CHECK);
+        int utc_count = utc.count;
+        utc.update(current_gps_time_t);
+        cnt.utc_errors.fetch_add(utc.count - utc_count, std::memory_order_relaxed);
+
+        // GPS座標をチェック
+        position = check_position(latitude, longitude, altitude, conf.range);
+        if (position.error()) {
+            position_err_cnt++;
+            cnt.position_errors.fetch_add(1, std::memory_order_relaxed);
+            cnt.latitude_errors.fetch_add(position.latitude_error, std::memory_order_relaxed);
+            cnt.longitude_errors.fetch_add(position.longitude_error, std::memory_order_relaxed);
+            cnt.altitude_errors.fetch_add(position.altitude_error, std::memory_order_relaxed);
+        }
+    }
+
+    // DOP（精度）
+    double pdop = std::numeric_limits<double>::quiet_NaN();
+    double hdop = std::numeric_limits<double>::quiet_NaN();
+    double vdop = std::numeric_limits<double>::quiet_NaN();
+    if (gsa.size() > 0) {
+        pdop = gsa[0].get_pdop();
+        hdop = gsa[0].get_hdop();
+        vdop = gsa[0].get_vdop();
+    }
+
+    // 測位結果
+    fix.seq = cnt.epochs.load(std::memory_order_relaxed);
+    fix.mono_ns = mono_ns;
+    fix.utc = current_gps_time_t;
+    fix.latitude = latitude;
+    fix.longitude = longitude;
+    fix.altitude = altitude;
+    fix.num_sv = num_sv;
+    fix.pdop = pdop;
+    fix.hdop = hdop;
+    fix.vdop = vdop;
+    fix.sum_err = sum_err;
+    fix.utc_err = utc.error;
+    fix.position_err = position.error();
+    fix.timeout = timeout;
+    fix.sum_err_cnt = sum_err_cnt;
+    fix.utc_err_cnt = utc.count;
+    fix.position_err_cnt = position_err_cnt;
+    fix.timeout_cnt = timeout_cnt;
+
+    build_snapshot();
+    publish();
+    cnt.epochs.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief 公開するスナップショットを組み立て（ロックの外で行う）
+ *
+ */
+void gnss_core::build_snapshot()
+{
+    work.seq = fix.seq + 1;
+    work.mono_ns = fix.mono_ns;
+    work.utc = fix.utc;
+    work.latitude = fix.latitude;
+    work.longitude = fix.longitude;
+    work.altitude = fix.altitude;
+    work.pdop = fix.pdop;
+    work.hdop = fix.hdop;
+    work.vdop = fix.vdop;
+    work.num_sv = fix.num_sv;
+    work.flags = (fix.sum_err ? GNSS_CORE_SUM_ERR : 0u) |
+                 (fix.utc_err ? GNSS_CORE_UTC_ERR : 0u) |
+                 (fix.position_err ? GNSS_CORE_POSITION_ERR : 0u) |
+                 (fix.timeout ? GNSS_CORE_TIMEOUT : 0u) |
+                 (position.latitude_error ? GNSS_CORE_LATITUDE_ERR : 0u) |
+                 (position.longitude_error ? GNSS_CORE_LONGITUDE_ERR : 0u) |
+                 (position.altitude_error ? GNSS_CORE_ALTITUDE_ERR : 0u) |
+                 (has_fix() ? GNSS_CORE_FIX : 0u);
+    work.sum_err_cnt = fix.sum_err_cnt;
+    work.utc_err_cnt = fix.utc_err_cnt;
+    work.position_err_cnt = fix.position_err_cnt;
+    work.timeout_cnt = fix.timeout_cnt;
+    std::memset(work.utc_string, 0, sizeof(work.utc_string));
+    std::memcpy(work.utc_string, gps_utc, strnlen(gps_utc, sizeof(work.utc_string) - 1));
+
+    uint32_t n = 0;
+    for (auto &g : gsv) {
+        for (auto svid : g.get_svid_list()) {
+            if (n >= GNSS_CORE_MAX_SV) {
+                break;
+            }
+            nmea_gsv::sv_info si = g.get_svinfo(svid);
+            gnss_core_sv &sv = work.sv[n++];
+            sv.svid = si.svid;
+            sv.elv = si.elv;
+            sv.az = si.az;
+            sv.cno = si.cno;
+            sv.sys = si.sys;
+            sv.active = 0;
+            for (auto &a : gsa) {
+                for (auto said : a.get_svid_list()) {
+                    if (said == svid) {
+                        sv.active = 1;
+                    }
+                }
+            }
+        }
+    }
+    work.sv_count = n;
+}
+
+/**
+ * @brief スナップショットを読み込み側へ公開
+ *
+ * seqlock: 奇数にしてから書き込み、偶数に戻す（書き込み側は1スレッドなので待たない）。
+ */
+void gnss_core::publish()
+{
+    uint32_t seq = snapshot_seq.load(std::memory_order_relaxed);
+    snapshot_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&snapshot, &work, sizeof(work));
+    snapshot_seq.store(seq + 2, std::memory_order_release);
+}
+
+/**
+ * @brief 最新のスナップショットをコピー（何スレッドからでもよい）
+ *
+ * @param out 出力先
+ * @return true コピーした
+ * @return false まだエポックを処理していない
+ */
+bool gnss_core::read(gnss_core_fix &out) const
+{
+    for (;;) {
+        uint32_t before = snapshot_seq.load(std::memory_order_acquire);
+        if (before == 0) {
+            return false;
+        }
+        if (before & 1) {
+            // 書き込み中
+            continue;
+        }
+        std::memcpy(&out, &snapshot, sizeof(out));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (snapshot_seq.load(std::memory_order_relaxed) == before) {
+            return true;
+        }
+    }
+}
+
+/**
+ * @brief 累積のカウンターを取得（何スレッドからでもよい）
+ *
+ * @param out 出力先
+ */
+void gnss_core::get_counters(gnss_core_counters &out) const
+{
+    out.epochs = cnt.epochs.load(std::memory_order_relaxed);
+    out.bytes = cnt.bytes.load(std::memory_order_relaxed);
+    out.sentences = cnt.sentences.load(std::memory_order_relaxed);
+    out.checksum_errors = cnt.checksum_errors.load(std::memory_order_relaxed);
+    out.truncated = cnt.truncated.load(std::memory_order_relaxed);
+    out.parse_failures = cnt.parse_failures.load(std::memory_order_relaxed);
+    out.utc_errors = cnt.utc_errors.load(std::memory_order_relaxed);
+    out.position_errors = cnt.position_errors.load(std::memory_order_relaxed);
+    out.latitude_errors = cnt.latitude_errors.load(std::memory_order_relaxed);
+    out.longitude_errors = cnt.longitude_errors.load(std::memory_order_relaxed);
+    out.altitude_errors = cnt.altitude_errors.load(std::memory_order_relaxed);
+    out.timeouts = cnt.timeouts.load(std::memory_order_relaxed);
+}
+
+const gps_fix &gnss_core::get_fix() const
+{
+    return fix;
+}
+
+const position_result &gnss_core::get_position() const
+{
+    return position;
+}
+
+/**
+ * @brief 測位できているか（位置が範囲内で、測位に衛星を使っている）
+ *
+ * @return true 測位できている
+ * @return false 測位できていない
+ */
+bool gnss_core::has_fix() const
+{
+    return !position.error() && fix.num_sv > 0;
+}
+
+const char *gnss_core::get_utc_string() const
+{
+    return gps_utc;
+}
+
+const nmea_list &gnss_core::get_sentences() const
+{
+    return nmea;
+}
+
+const nmea_list &gnss_core::get_valid_sentences() const
+{
+    return valid;
+}
+
+arena_vector<nmea_gsa> &gnss_core::get_gsa()
+{
+    return gsa;
+}
+
+arena_vector<nmea_gsv> &gnss_core::get_gsv()
+{
+    return gsv;
+}
+
+const gnss_core_fix &gnss_core::get_snapshot() const
+{
+    return work;
+}
+
+const epoch_arena &gnss_core::get_arena() const
+{
+    return arena;
+}
+
+/*
+ * C API（例外はCの呼び出し側へ投げない）
+ */
+
+extern "C" {
+
+uint32_t gnss_core_version(void)
+{
+    return GNSS_CORE_VERSION;
+}
+
+void gnss_core_default_config(struct gnss_core_config *conf)
+{
+    gnss_core::config c;
+    std::memset(conf, 0, sizeof(*conf));
+    conf->size = sizeof(*conf);
+    conf->timeout_ms = c.timeout_ms;
+    conf->range.minimum_latitude = c.range.minimum_latitude;
+    conf->range.maximum_latitude = c.range.maximum_latitude;
+    conf->range.minimum_longitude = c.range.minimum_longitude;
+    conf->range.maximum_longitude = c.range.maximum_longitude;
+    conf->range.minimum_altitude = c.range.minimum_altitude;
+    conf->range.maximum_altitude = c.range.maximum_altitude;
+    conf->timing = nullptr;
+    conf->timing_user = nullptr;
+}
+
+gnss_core *gnss_core_create(const struct gnss_core_config *conf)
+{
+    if (conf == nullptr || conf->size != sizeof(*conf)) {
+        // 別のバージョンのヘッダーでビルドされた
+        return nullptr;
+    }
+    gnss_core::config c;
+    c.timeout_ms = conf->timeout_ms;
+    c.range.minimum_latitude = conf->range.minimum_latitude;
+    c.range.maximum_latitude = conf->range.maximum_latitude;
+    c.range.minimum_longitude = conf->range.minimum_longitude;
+    c.range.maximum_longitude = conf->range.maximum_longitude;
+    c.range.minimum_altitude = conf->range.minimum_altitude;
+    c.range.maximum_altitude = conf->range.maximum_altitude;
+    c.timing = conf->timing;
+    c.timing_user = conf->timing_user;
+    try {
+        return new gnss_core(c);
+    }
+    catch (...) {
+        return nullptr;
+    }
+}
+
+void gnss_core_destroy(gnss_core *core)
+{
+    delete core;
+}
+
+void gnss_core_set_range(gnss_core *core, const struct gnss_core_range *range)
+{
+    position_range r;
+    r.minimum_latitude = range->minimum_latitude;
+    r.maximum_latitude = range->maximum_latitude;
+    r.minimum_longitude = range->minimum_longitude;
+    r.maximum_longitude = range->maximum_longitude;
+    r.minimum_altitude = range->minimum_altitude;
+    r.maximum_altitude = range->maximum_altitude;
+    core->set_range(r);
+}
+
+void gnss_core_feed(gnss_core *core, const void *data, size_t len)
+{
+    try {
+        core->feed(static_cast<const uint8_t *>(data), len);
+    }
+    catch (...) {
+        // 受信データを捨てる（次のend_burstで途中で切れたセンテンスになる）
+    }
+}
+
+int gnss_core_end_burst(gnss_core *core, uint64_t mono_ns)
+{
+    try {
+        if (!core->end_burst(mono_ns)) {
+            return 0;
+        }
+        core->process(mono_ns);
+        return 1;
+    }
+    catch (...) {
+        return 0;
+    }
+}
+
+int gnss_core_check_timeout(gnss_core *core, uint64_t mono_ns)
+{
+    try {
+        if (!core->check_timeout(mono_ns)) {
+            return 0;
+        }
+        core->process(mono_ns);
+        return 1;
+    }
+    catch (...) {
+        return 0;
+    }
+}
+
+int gnss_core_read_fix(const gnss_core *core, struct gnss_core_fix *fix)
+{
+    return core->read(*fix) ? 1 : 0;
+}
+
+void gnss_core_read_counters(const gnss_core *core, struct gnss_core_counters *counters)
+{
+    core->get_counters(*counters);
+}
+
+}
@@ -0,0 +1,190 @@
+/**
+ * @file gnss_core.h
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief NMEAの解析とチェックのライブラリ（C API）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * 受信機から読んだバイト列を渡すと、エポック毎に測位結果とチェック結果（チェックサム、
+ * 時刻の連続性、位置の範囲、タイムアウト）を作る。gps_testを起動して画面を読まなくても、
+ * 同じ処理をアプリケーションのプロセス内で使える。
+ * 書き込み（feed/end_burst/check_timeout/set_range）は1スレッド、読み出し（read_fix/read_counters）は
+ * 何スレッドからでもよい。グローバル変数は使わないので、複数のハンドルを同時に使える
+ * （処理時間の計測もハンドル毎にconf.timingで受け取る）。
+ * 1バーストの受信データは64KiBまで（超えた分は捨てて途中で切れたセンテンスに数える）。
+ * C++の例外は呼び出し側へ投げない（失敗したエポックは処理しなかったものとして0を返す）。
+ *
+ * 使用例
+ *      struct gnss_core_config conf;
+ *      gnss_core_default_config(&conf);
+ *      gnss_core *core = gnss_core_create(&conf);
+ *      // 受信スレッド: 読めたバイト列を渡し、受信機のバッファが空になったらエポックの終わり
+ *      gnss_core_feed(core, data, len);
+ *      gnss_core_end_burst(core, now_ns);
+ *      gnss_core_check_timeout(core, now_ns);      // 読み込みの度に呼ぶ
+ *      // 他のスレッド
+ *      struct gnss_core_fix fix;
+ *      if (gnss_core_read_fix(core, &fix) && (fix.flags & GNSS_CORE_FIX)) { ... }
+ *      gnss_core_destroy(core);
+ */
+
+#ifndef GNSS_CORE_H
+#define GNSS_CORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define GNSS_CORE_API __attribute__((visibility("default")))
+#else
+#define GNSS_CORE_API
+#endif
+
+#define GNSS_CORE_VERSION   2u          /* 構造体のレイアウトを変えたら上げる */
+#define GNSS_CORE_MAX_SV    64
+
+/* gnss_core_fix.flags */
+#define GNSS_CORE_SUM_ERR       0x0001u     /* チェックサムエラー（一度でも発生すれば以後も立つ） */
+#define GNSS_CORE_UTC_ERR       0x0002u     /* 時刻が無い、または1秒を超えて飛んだ */
+#define GNSS_CORE_POSITION_ERR  0x0004u     /* 位置が範囲外 */
+#define GNSS_CORE_TIMEOUT       0x0008u     /* 受信が途切れた */
+#define GNSS_CORE_LATITUDE_ERR  0x0010u
+#define GNSS_CORE_LONGITUDE_ERR 0x0020u
+#define GNSS_CORE_ALTITUDE_ERR  0x0040u
+#define GNSS_CORE_FIX           0x0080u     /* 位置が範囲内で、測位に衛星を使っている */
+
+/* gnss_core_sv.sys */
+#define GNSS_CORE_SYS_GPS       1
+#define GNSS_CORE_SYS_GLONASS   2
+#define GNSS_CORE_SYS_GALILEO   3
+#define GNSS_CORE_SYS_BEIDOU    4
+
+/* gnss_core_timing_fnの処理段階 */
+#define GNSS_CORE_STAGE_SPLIT       0       /* バーストをセンテンスへ分割 */
+#define GNSS_CORE_STAGE_CHECKSUM    1
+#define GNSS_CORE_STAGE_PARSE_RMC   2
+#define GNSS_CORE_STAGE_PARSE_GGA   3
+#define GNSS_CORE_STAGE_PARSE_GSA   4
+#define GNSS_CORE_STAGE_PARSE_GSV   5
+#define GNSS_CORE_STAGE_CHECK       6       /* 時刻・位置チェック */
+#define GNSS_CORE_STAGE_COUNT       7
+
+typedef struct gnss_core gnss_core;
+
+/**
+ * @brief 処理段階毎の時間を受け取る関数（書き込み側のスレッドから呼ばれる）
+ *
+ * stageはGNSS_CORE_STAGE_*、時刻はCLOCK_MONOTONIC(ns)。
+ */
+typedef void (*gnss_core_timing_fn)(void *user, int stage, uint64_t start_ns, uint64_t end_ns);
+
+/**
+ * @brief 位置の範囲
+ *
+ */
+struct gnss_core_range {
+    double minimum_latitude;    /* 度 */
+    double maximum_latitude;
+    double minimum_longitude;
+    double maximum_longitude;
+    double minimum_altitude;    /* m */
+    double maximum_altitude;
+};
+
+/**
+ * @brief 設定（gnss_core_default_config()で初期化してから変更する）
+ *
+ */
+struct gnss_core_config {
+    uint32_t size;              /* sizeof(struct gnss_core_config) */
+    int32_t timeout_ms;         /* 受信が途切れたと判定する時間 */
+    struct gnss_core_range range;
+    gnss_core_timing_fn timing; /* 処理段階毎の時間（NULLなら計測しない） */
+    void *timing_user;          /* timingへ渡す値 */
+};
+
+/**
+ * @brief 衛星情報（値が無い項目は-1）
+ *
+ */
+struct gnss_core_sv {
+    int16_t svid;
+    int16_t elv;            /* 仰角（度） */
+    int16_t az;             /* 方位角（度） */
+    int16_t cno;            /* C/N0（dBHz） */
+    uint8_t sys;            /* GNSS_CORE_SYS_* */
+    uint8_t active;         /* 1: 測位に使用 */
+    uint8_t reserved[2];
+};
+
+/**
+ * @brief 1エポック分の測位結果とチェック結果（値が無い項目はNaN）
+ *
+ */
+struct gnss_core_fix {
+    uint64_t seq;           /* エポック毎に1ずつ増える（0は未処理） */
+    uint64_t mono_ns;       /* 受信時刻（CLOCK_MONOTONIC, ns） */
+    int64_t utc;            /* GPS時刻（エポック秒）、無効なら-1 */
+    double latitude;        /* 緯度（度） */
+    double longitude;       /* 経度（度） */
+    double altitude;        /* 高度（m） */
+    double pdop;
+    double hdop;
+    double vdop;
+    int32_t num_sv;         /* 使用した衛星の数 */
+    uint32_t flags;         /* GNSS_CORE_* */
+    int32_t sum_err_cnt;
+    int32_t utc_err_cnt;
+    int32_t position_err_cnt;
+    int32_t timeout_cnt;
+    char utc_string[32];    /* "YYYY-MM-DD hh:mm:ss"（無ければ空） */
+    uint32_t sv_count;      /* sv[]の有効数 */
+    uint32_t reserved;
+    struct gnss_core_sv sv[GNSS_CORE_MAX_SV];
+};
+
+/**
+ * @brief 累積のカウンター
+ *
+ */
+struct gnss_core_counters {
+    uint64_t epochs;            /* 処理したエポック数 */
+    uint64_t bytes;             /* 渡されたバイト数 */
+    uint64_t sentences;         /* チェックサムが正しいセンテンス数 */
+    uint64_t checksum_errors;
+    uint64_t truncated;         /* バーストの途中で切れたセンテンス */
+    uint64_t parse_failures;    /* 時刻を解析できなかったRMC */
+    uint64_t utc_errors;
+    uint64_t position_errors;
+    uint64_t latitude_errors;
+    uint64_t longitude_errors;
+    uint64_t altitude_errors;
+    uint64_t timeouts;
+};
+
+GNSS_CORE_API uint32_t gnss_core_version(void);
+GNSS_CORE_API void gnss_core_default_config(struct gnss_core_config *conf);
+GNSS_CORE_API gnss_core *gnss_core_create(const struct gnss_core_config *conf);
+GNSS_CORE_API void gnss_core_destroy(gnss_core *core);
+
+/* 書き込み側（1スレッド） */
+GNSS_CORE_API void gnss_core_set_range(gnss_core *core, const struct gnss_core_range *range);
+GNSS_CORE_API void gnss_core_feed(gnss_core *core, const void *data, size_t len);
+GNSS_CORE_API int gnss_core_end_burst(gnss_core *core, uint64_t mono_ns);
+GNSS_CORE_API int gnss_core_check_timeout(gnss_core *core, uint64_t mono_ns);
+
+/* 読み出し側（何スレッドでも） */
+GNSS_CORE_API int gnss_core_read_fix(const gnss_core *core, struct gnss_core_fix *fix);
+GNSS_CORE_API void gnss_core_read_counters(const gnss_core *core, struct gnss_core_counters *counters);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,157 @@
+/**
+ * @file gnss_core.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief NMEAの解析とチェック（1台の受信機の状態）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef GNSS_CORE_HPP
+#define GNSS_CORE_HPP
+
+#include "gnss_core.h"
+#include "gps_check.hpp"
+#include "gps_fix.hpp"
+#include "epoch_arena.hpp"
+#include "nmea_gsa.hpp"
+#include "nmea_gsv.hpp"
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief NMEAの解析とチェック（1台の受信機の状態）
+ *
+ * gps_testのループ処理から受信機の入出力と表示を除いたもの。チェックの状態（エラーの回数、
+ * 前回の時刻、位置の範囲）はすべてメンバーに持つ。
+ * 書き込み側（1スレッド）: feed()で受信データを渡し、check_timeout()とend_burst()の後にprocess()。
+ * get_*()は最後に処理したエポックの詳細で、次のprocess()まで有効（書き込み側のスレッドだけ）。
+ * 読み込み側（何スレッドでも）: read()で最新のスナップショットをコピー（seqlock）、get_counters()。
+ * 起動時に確保したバッファだけを使い、エポック毎にヒープを使わない。
+ * グローバルな状態は持たない（処理時間はconf.timingへ渡すだけ）。
+ */
+class gnss_core
+{
+public:
+    /**
+     * @brief 設定
+     *
+     */
+    class config {
+    public:
+        position_range range;       // 位置の範囲
+        int timeout_ms;             // 受信が途切れたと判定する時間
+        size_t arena_size;          // エポック毎の作業領域(byte)
+        size_t receive_size;        // 1エポックの受信データの最大(byte)
+        gnss_core_timing_fn timing; // 処理段階毎の時間（nullptrなら計測しない）
+        void *timing_user;
+        config() {
+            timeout_ms = TimeoutLimit;
+            arena_size = 64 * 1024;
+            receive_size = 64 * 1024;
+            timing = nullptr;
+            timing_user = nullptr;
+        }
+    };
+
+    gnss_core(const config &conf);
+    gnss_core(const gnss_core &) = delete;
+    gnss_core &operator=(const gnss_core &) = delete;
+
+    // 書き込み側
+    void set_range(const position_range &range);
+    void set_timeout(int timeout_ms);
+    void feed(const uint8_t *data, size_t len);
+    bool check_timeout(uint64_t mono_ns);
+    bool end_burst(uint64_t mono_ns);
+    void process(uint64_t mono_ns);
+
+    const gps_fix &get_fix() const;
+    const position_result &get_position() const;
+    bool has_fix() const;
+    const char *get_utc_string() const;
+    const nmea_list &get_sentences() const;
+    const nmea_list &get_valid_sentences() const;
+    arena_vector<nmea_gsa> &get_gsa();
+    arena_vector<nmea_gsv> &get_gsv();
+    const gnss_core_fix &get_snapshot() const;
+    const epoch_arena &get_arena() const;
+
+    // 読み込み側
+    bool read(gnss_core_fix &out) const;
+    void get_counters(gnss_core_counters &out) const;
+
+private:
+    /**
+     * @brief 累積のカウンター（読み込み側はrelaxedで読む）
+     *
+     */
+    class counters {
+    public:
+        std::atomic<uint64_t> epochs{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> sentences{0};
+        std::atomic<uint64_t> checksum_errors{0};
+        std::atomic<uint64_t> truncated{0};
+        std::atomic<uint64_t> parse_failures{0};
+        std::atomic<uint64_t> utc_errors{0};
+        std::atomic<uint64_t> position_errors{0};
+        std::atomic<uint64_t> latitude_errors{0};
+        std::atomic<uint64_t> longitude_errors{0};
+        std::atomic<uint64_t> altitude_errors{0};
+        std::atomic<uint64_t> timeouts{0};
+    };
+
+    config conf;
+    std::string msg;                // 受信中のバースト
+    std::string epoch_data;         // 分割中のバースト（nmeaはこの中を参照する）
+    nmea_list nmea;                 // 分割したセンテンス
+    nmea_list valid;                // チェックサムが正しいセンテンス
+    epoch_arena arena;
+    arena_vector<nmea_gsa> gsa;
+    arena_vector<nmea_gsv> gsv;
+    utc_check utc;
+    bool sum_err;                   // 一度でもチェックサムエラーがあれば立てたまま
+    int sum_err_cnt;
+    bool timeout;
+    int timeout_cnt;
+    int position_err_cnt;
+    uint64_t last_ns;               // 最後にバーストを受信した（またはタイムアウトした）時刻
+    char gps_utc[32];
+    position_result position;
+    gps_fix fix;
+    gnss_core_fix work;             // 公開する前に組み立てる領域
+    counters cnt;
+
+    // 読み込み側へ公開するスナップショット（seqlock）
+    std::atomic<uint32_t> snapshot_seq;
+    gnss_core_fix snapshot;
+
+    /**
+     * @brief スコープの処理時間をconf.timingへ渡す（timingが無ければ時刻も読まない）
+     *
+     */
+    class stage_scope {
+    public:
+        stage_scope(const gnss_core &core, int stage) :
+        core(core), stage(stage), start(core.conf.timing != nullptr ? now_ns() : 0) {}
+        ~stage_scope() {
+            if (core.conf.timing != nullptr) {
+                core.conf.timing(core.conf.timing_user, stage, start, now_ns());
+            }
+        }
+    private:
+        const gnss_core &core;
+        int stage;
+        uint64_t start;
+    };
+
+    static uint64_t now_ns();
+    void build_snapshot();
+    void publish();
+};
+
+#endif
@@ -0,0 +1,57 @@
+#!/bin/bash
+# 受信機のTX-readyの代わりにgpio-simのラインを一定間隔でパルスさせる（root、CONFIG_GPIO_SIMが必要）
+# gps_test.confのTxReadyChipに表示されたチップ、TxReadyLine = 0を設定して ./gps_test -S で確認する
+
+CFG=/sys/kernel/config/gpio-sim/gps_test
+PID_FILE=/tmp/gpio_sim_txready.pid
+
+start() {
+    hz=${1:-1}
+    modprobe gpio-sim || exit 1
+    mkdir -p $CFG/bank0/line0 || exit 1
+    echo 1 > $CFG/bank0/num_lines
+    echo 1 > $CFG/live
+    chip=$(cat $CFG/bank0/chip_name)
+    pull=/sys/devices/platform/$(cat $CFG/dev_name)/$chip/sim_gpio0/pull
+    echo "TxReadyChip = /dev/$chip"
+
+    # 受信機がバーストを出力してから読まれるまでアクティブになる代わりに20msのパルス
+    period=$(awk "BEGIN { print 1 / $hz - 0.02 }")
+    (
+        while true; do
+            echo pull-up > $pull
+            sleep 0.02
+            echo pull-down > $pull
+            sleep $period
+        done
+    ) &
+    echo $! > $PID_FILE
+}
+
+stop() {
+    if [ -f $PID_FILE ]; then
+        kill $(cat $PID_FILE)
+        rm -f $PID_FILE
+    fi
+    if [ -d $CFG ]; then
+        echo 0 > $CFG/live
+        rmdir $CFG/bank0/line0 $CFG/bank0 $CFG
+    fi
+}
+
+case "$1" in
+    'start')
+            start "$2"
+            ;;
+    'stop')
+            stop
+            ;;
+    *)
+            echo
+            echo "Usage: $0 { start [hz] | stop }"
+            echo
+            exit 1
+            ;;
+esac
+
+exit 0
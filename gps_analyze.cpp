@@ -0,0 +1,474 @@
+/**
+ * @file gps_analyze.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief NMEAログのオフライン解析
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * ログファイルをmmapし、エポック（RMCから次のRMCの手前まで）の境界でチャンクに分けて
+ * 全コアで並列にチェックする。チェック内容はgps_testと同じ（gps_check）で、
+ * チャンク毎の結果をファイル毎に順番にまとめるので逐次処理と同じ結果になる。
+ */
+
+#include "gps_check.hpp"
+#include "gps_conf.hpp"
+#include "nmea_gga.hpp"
+#include "nmea_rmc.hpp"
+#include "work_pool.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+static position_range PositionRange;     // 位置の範囲（スレッドを起動する前にgps_test.confから読む）
+static int TimeoutMs = TimeoutLimit;    // 受信が途切れたと判定する時間（gps_test.confのTimeoutLimit、または-t）
+
+/**
+ * @brief ログファイル（mmap）
+ *
+ */
+class log_file {
+public:
+    std::string path;
+    const char *data = nullptr;
+    size_t size = 0;
+    size_t first_chunk = 0;     // 最初のチャンクの番号
+    size_t chunk_count = 0;
+};
+
+/**
+ * @brief チャンク（エポックの境界で区切ったファイルの範囲）
+ *
+ */
+class chunk {
+public:
+    size_t file;
+    size_t begin;
+    size_t end;
+};
+
+/**
+ * @brief チェック結果（チャンク毎、ファイル毎）
+ *
+ * 時刻の連続性はチャンク内で先頭から数え、最初と最後の時刻を残しておいて
+ * まとめる時につなぎ目の分を足す。
+ */
+class check_result {
+public:
+    uint64_t bytes = 0;
+    uint64_t sentences = 0;
+    uint64_t epochs = 0;
+    int sum_err_cnt = 0;
+    int utc_err_cnt = 0;
+    int position_err_cnt = 0;
+    int latitude_err_cnt = 0;
+    int longitude_err_cnt = 0;
+    int altitude_err_cnt = 0;
+    int timeout_cnt = 0;
+    time_t first_time = (time_t)-1;     // 最初の時刻（無ければ-1）
+    time_t last_time = (time_t)-1;      // 最後の時刻（無ければ-1）
+
+    void merge(const check_result &r);
+};
+
+/**
+ * @brief 時刻の間隔から受信が途切れた回数を推定
+ *
+ * gps_testは受信が無い時間がTimeoutLimitを超える毎に1回数えるので、
+ * 時刻の間隔をTimeoutLimit（TimeoutMs）で割った回数とする。
+ *
+ * @param prev 前の時刻
+ * @param current 今回の時刻
+ * @return int 回数
+ */
+static int infer_timeouts(time_t prev, time_t current)
+{
+    if (prev <= 0 || current <= 0) {
+        return 0;
+    }
+    double gap_ms = difftime(current, prev) * 1000;
+    if (gap_ms < TimeoutMs) {
+        return 0;
+    }
+    return (int)(gap_ms / TimeoutMs);
+}
+
+/**
+ * @brief 後ろのチャンクの結果を足す
+ *
+ * @param r 後ろのチャンクの結果
+ */
+void check_result::merge(const check_result &r)
+{
+    bytes += r.bytes;
+    sentences += r.sentences;
+    epochs += r.epochs;
+    sum_err_cnt += r.sum_err_cnt;
+    utc_err_cnt += r.utc_err_cnt;
+    position_err_cnt += r.position_err_cnt;
+    latitude_err_cnt += r.latitude_err_cnt;
+    longitude_err_cnt += r.longitude_err_cnt;
+    altitude_err_cnt += r.altitude_err_cnt;
+    timeout_cnt += r.timeout_cnt;
+
+    // つなぎ目の時刻の連続性（チャンク内の最初の時刻は前の時刻が無いものとしてチェック済み）
+    if (last_time > 0 && r.first_time > 0) {
+        utc_check utc;
+        utc.prev = last_time;
+        utc_err_cnt += utc.update(r.first_time) ? 1 : 0;
+        timeout_cnt += infer_timeouts(last_time, r.first_time);
+    }
+    if (first_time <= 0) {
+        first_time = r.first_time;
+    }
+    if (r.last_time > 0) {
+        last_time = r.last_time;
+    }
+}
+
+/**
+ * @brief エポックの先頭（RMC）のセンテンスか
+ *
+ * @param line センテンス（"$xxRMC,..."）
+ * @return true 先頭
+ * @return false それ以外
+ */
+static bool is_epoch_start(const char *line, size_t len)
+{
+    return len >= 6 && line[0] == '$' && std::memcmp(line + 3, "RMC", 3) == 0;
+}
+
+/**
+ * @brief チャンクの終わりを探す
+ *
+ * pos以降で最初にRMCで始まる行の先頭を返す。
+ *
+ * @param f ファイル
+ * @param pos 探し始める位置
+ * @return size_t チャンクの終わり（無ければファイルの終わり）
+ */
+static size_t find_epoch_boundary(const log_file &f, size_t pos)
+{
+    while (pos < f.size) {
+        const char *nl = static_cast<const char *>(std::memchr(f.data + pos, '\n', f.size - pos));
+        if (nl == nullptr) {
+            break;
+        }
+        pos = nl - f.data + 1;
+        if (is_epoch_start(f.data + pos, f.size - pos)) {
+            return pos;
+        }
+    }
+    return f.size;
+}
+
+/**
+ * @brief 1エポック分のチェック
+ *
+ */
+class epoch_checker {
+public:
+    check_result &result;
+    utc_check utc;
+    bool active = false;
+    time_t time = (time_t)-1;
+    double latitude;
+    double longitude;
+    double altitude;
+
+    epoch_checker(check_result &result) : result(result) { clear(); }
+
+    void clear()
+    {
+        active = false;
+        time = (time_t)-1;
+        latitude = std::numeric_limits<double>::quiet_NaN();
+        longitude = std::numeric_limits<double>::quiet_NaN();
+        altitude = std::numeric_limits<double>::quiet_NaN();
+    }
+
+    /**
+     * @brief センテンスを追加（gps_testの受信ループと同じ処理）
+     *
+     */
+    void add(const nmea_view &s)
+    {
+        if (is_epoch_start(s.str, s.len) && active) {
+            finish();
+        }
+        active = true;
+        result.sentences++;
+        if (check_sum(s) == false) {
+            result.sum_err_cnt++;
+            return;
+        }
+        if (s.contains("RMC")) {
+            nmea_rmc rmc(s);
+            time = rmc.get_time_t();
+        }
+        if (s.contains("GGA")) {
+            nmea_gga gga(s);
+            latitude = gga.get_latitude();
+            longitude = gga.get_longitude();
+            altitude = gga.get_altitude();
+        }
+    }
+
+    /**
+     * @brief エポックの終わり（時刻・位置チェック）
+     *
+     */
+    void finish()
+    {
+        if (!active) {
+            return;
+        }
+        result.epochs++;
+        if (time > 0) {
+            result.timeout_cnt += infer_timeouts(utc.prev, time);
+            if (result.first_time <= 0) {
+                result.first_time = time;
+            }
+            result.last_time = time;
+        }
+        utc.update(time);
+        result.utc_err_cnt = utc.count;
+
+        position_result pos = check_position(latitude, longitude, altitude, PositionRange);
+        result.latitude_err_cnt += pos.latitude_error;
+        result.longitude_err_cnt += pos.longitude_error;
+        result.altitude_err_cnt += pos.altitude_error;
+        result.position_err_cnt += pos.error();
+        clear();
+    }
+};
+
+/**
+ * @brief チャンクをチェック
+ *
+ * @param f ファイル
+ * @param c チャンク
+ * @param result 結果
+ */
+static void check_chunk(const log_file &f, const chunk &c, check_result &result)
+{
+    epoch_checker ec(result);
+    result.bytes = c.end - c.begin;
+    size_t pos = c.begin;
+    while (pos < c.end) {
+        const char *line = f.data + pos;
+        const char *nl = static_cast<const char *>(std::memchr(line, '\n', c.end - pos));
+        size_t len = (nl != nullptr) ? (size_t)(nl - line) : c.end - pos;
+        pos += len + 1;
+        // "\r\n"と"\n"のどちらの改行でもよい
+        if (len > 0 && line[len - 1] == '\r') {
+            len--;
+        }
+        if (len == 0) {
+            continue;
+        }
+        ec.add(nmea_view(line, len));
+    }
+    ec.finish();
+}
+
+/**
+ * @brief ファイルをmmap
+ *
+ * @param f ファイル
+ * @return true OK
+ * @return false ERROR
+ */
+static bool map_file(log_file &f)
+{
+    int fd = open(f.path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    f.size = st.st_size;
+    if (f.size > 0) {
+        void *p = mmap(nullptr, f.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        madvise(p, f.size, MADV_SEQUENTIAL);
+        f.data = static_cast<const char *>(p);
+    }
+    // mmapした後はファイルを閉じてもよい
+    close(fd);
+    return true;
+}
+
+/**
+ * @brief 時刻を文字列にする
+ *
+ * @param t 時刻
+ * @return std::string "YYYY-MM-DDThh:mm:ssZ"（無ければ"-"）
+ */
+static std::string format_time(time_t t)
+{
+    if (t <= 0) {
+        return "-";
+    }
+    struct tm tm;
+    char buf[32];
+    gmtime_r(&t, &tm);
+    std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    return buf;
+}
+
+/**
+ * @brief ファイル毎の結果を表示
+ *
+ * @param f ファイル
+ * @param r 結果
+ */
+static void print_report(const log_file &f, const check_result &r)
+{
+    std::printf("%s\n", f.path.c_str());
+    std::printf("  bytes = %llu, sentences = %llu, epochs = %llu, chunks = %zu\n",
+                (unsigned long long)r.bytes, (unsigned long long)r.sentences,
+                (unsigned long long)r.epochs, f.chunk_count);
+    std::printf("  checksum = %d, utc = %d, position = %d (lat = %d, lon = %d, alt = %d), timeout = %d\n",
+                r.sum_err_cnt, r.utc_err_cnt, r.position_err_cnt,
+                r.latitude_err_cnt, r.longitude_err_cnt, r.altitude_err_cnt, r.timeout_cnt);
+    std::printf("  utc = %s - %s\n", format_time(r.first_time).c_str(), format_time(r.last_time).c_str());
+}
+
+static void usage()
+{
+    std::cerr << "usage: gps_analyze [-j threads] [-c chunk_size] [-f conf] [-t timeout_ms] file..." << std::endl;
+    std::cerr << "  -j  worker threads (default: number of cores)" << std::endl;
+    std::cerr << "  -c  chunk size in bytes (default 4194304)" << std::endl;
+    std::cerr << "  -f  configuration file for the position range and TimeoutLimit (default gps_test.conf)" << std::endl;
+    std::cerr << "  -t  timeout in ms used to infer timeouts (default TimeoutLimit in the configuration file)" << std::endl;
+    std::cerr << "exit status: 0 no error, 1 errors found in the logs, 2 invalid argument or file" << std::endl;
+}
+
+/**
+ * @brief メイン関数
+ *
+ * @return int
+ */
+int main(int argc, char *argv[])
+{
+    int threads = 0;
+    size_t chunk_size = 4 * 1024 * 1024;
+    std::string conf = "gps_test.conf";
+    int timeout_ms = 0;
+    std::vector<log_file> files;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc) {
+            threads = std::stoi(argv[++i]);
+        }
+        else if (arg == "-c" && i + 1 < argc) {
+            chunk_size = std::max(1ul, std::stoul(argv[++i]));
+        }
+        else if (arg == "-f" && i + 1 < argc) {
+            conf = argv[++i];
+        }
+        else if (arg == "-t" && i + 1 < argc) {
+            timeout_ms = std::stoi(argv[++i]);
+        }
+        else if (arg[0] != '-') {
+            log_file f;
+            f.path = arg;
+            files.push_back(f);
+        }
+        else {
+            usage();
+            return 2;
+        }
+    }
+    if (files.empty()) {
+        usage();
+        return 2;
+    }
+
+    // 位置の範囲とTimeoutLimitはgps_testと同じ設定ファイルから読む
+    if (!read_conf_file(conf, [](const std::string &key, const std::string &value) {
+            if (!read_position_conf(key, value, PositionRange) && key == "TimeoutLimit") {
+                TimeoutMs = std::stoi(value);
+            }
+        })) {
+        std::cerr << "gps_analyze: failed to read " << conf << ", using default position range and TimeoutLimit" << std::endl;
+    }
+    if (timeout_ms > 0) {
+        TimeoutMs = timeout_ms;
+    }
+    if (TimeoutMs <= 0) {
+        std::cerr << "gps_analyze: invalid TimeoutLimit " << TimeoutMs << std::endl;
+        return 2;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    // エポックの境界でチャンクに分ける
+    std::vector<chunk> chunks;
+    for (size_t i = 0; i < files.size(); i++) {
+        log_file &f = files[i];
+        if (!map_file(f)) {
+            std::cerr << "gps_analyze: failed to open " << f.path << std::endl;
+            return 2;
+        }
+        f.first_chunk = chunks.size();
+        size_t begin = 0;
+        while (begin < f.size) {
+            size_t end = (f.size - begin > chunk_size) ? find_epoch_boundary(f, begin + chunk_size) : f.size;
+            chunks.push_back(chunk{i, begin, end});
+            begin = end;
+        }
+        f.chunk_count = chunks.size() - f.first_chunk;
+    }
+
+    // 並列にチェック
+    std::vector<check_result> results(chunks.size());
+    work_pool pool(threads);
+    pool.run(chunks.size(), [&](size_t index) {
+        const chunk &c = chunks[index];
+        check_chunk(files[c.file], c, results[index]);
+    });
+
+    // ファイル毎に順番にまとめる
+    check_result total;
+    bool error = false;
+    for (auto &f : files) {
+        check_result r;
+        for (size_t i = 0; i < f.chunk_count; i++) {
+            r.merge(results[f.first_chunk + i]);
+        }
+        print_report(f, r);
+        if (r.sum_err_cnt > 0 || r.utc_err_cnt > 0 || r.position_err_cnt > 0 || r.timeout_cnt > 0) {
+            error = true;
+        }
+        total.bytes += r.bytes;
+        if (f.data != nullptr) {
+            munmap(const_cast<char *>(f.data), f.size);
+        }
+    }
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("total: files = %zu, bytes = %llu, threads = %d, chunks = %zu, steals = %llu, %.3f s, %.1f MB/s\n",
+                files.size(), (unsigned long long)total.bytes, pool.get_threads(), chunks.size(),
+                (unsigned long long)pool.get_steals(), elapsed,
+                elapsed > 0 ? total.bytes / elapsed / 1e6 : 0.0);
+    return error ? 1 : 0;
+}
@@ -0,0 +1,335 @@
+/**
+ * @file gps_archive.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief NMEAアーカイブの作成・復元
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "nmea_archive.hpp"
+#include "nmea_rmc.hpp"
+#include <sys/stat.h>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief 使い方を表示
+ *
+ */
+static void usage()
+{
+    std::cerr << "Usage: gps_archive pack [-z] <raw nmea> <archive>" << std::endl;
+    std::cerr << "       gps_archive unpack <archive> <raw nmea>" << std::endl;
+    std::cerr << "       gps_archive index <archive>" << std::endl;
+    std::cerr << "       gps_archive query <archive> <from> <to> [raw nmea]" << std::endl;
+    std::cerr << "       (from/to: UTC YYYY-MM-DDThh:mm:ss)" << std::endl;
+}
+
+/**
+ * @brief 時刻(UTC)を解析
+ *
+ * @param str "YYYY-MM-DDThh:mm:ss"（'T'は空白でもよい、末尾の'Z'は省略可）
+ * @param t 時刻
+ * @return true OK
+ * @return false 形式が違う
+ */
+static bool parse_utc(const char *str, time_t &t)
+{
+    struct tm tm;
+    std::memset(&tm, 0, sizeof(tm));
+    if (std::sscanf(str, "%d-%d-%d%*c%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                    &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6) {
+        std::cerr << "gps_archive: invalid time " << str << std::endl;
+        return false;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    t = timegm(&tm);
+    return true;
+}
+
+/**
+ * @brief 時刻(UTC)を文字列にする
+ *
+ * @param t 時刻
+ * @return std::string "YYYY-MM-DDThh:mm:ssZ"（無ければ"-"）
+ */
+static std::string format_utc(int64_t t)
+{
+    if (t <= 0) {
+        return "-";
+    }
+    time_t tt = t;
+    struct tm tm;
+    char buf[32];
+    gmtime_r(&tt, &tm);
+    std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    return buf;
+}
+
+/**
+ * @brief ファイルサイズを取得
+ *
+ * @param path ファイル
+ * @return off_t サイズ（開けなければ-1）
+ */
+static off_t file_size(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return -1;
+    }
+    return st.st_size;
+}
+
+/**
+ * @brief RMCの数（エポック数）を数える
+ *
+ * @param data NMEA
+ * @param len 長さ
+ * @return uint64_t エポック数
+ */
+static uint64_t count_epochs(const char *data, size_t len)
+{
+    uint64_t n = 0;
+    for (size_t i = 0; i + 6 <= len; i++) {
+        if (data[i] == '$' && std::memcmp(&data[i + 3], "RMC", 3) == 0) {
+            n++;
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief アーカイブ作成
+ *
+ * 受信時と同じく1秒分（RMC毎）に区切って追加し、圧縮率とCPU時間を表示する。
+ *
+ * @param in 入力（生のNMEA）
+ * @param out 出力（アーカイブ）
+ * @param compress true: LZ圧縮する
+ * @return int 終了コード
+ */
+static int pack(const char *in, const char *out, bool compress)
+{
+    std::ifstream ifs(in, std::ios::binary);
+    if (!ifs) {
+        std::cerr << "gps_archive: failed to open " << in << std::endl;
+        return 1;
+    }
+    std::vector<char> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+
+    nmea_archive::writer writer(out, compress);
+    if (!writer.is_open()) {
+        return 1;
+    }
+
+    std::clock_t start = std::clock();
+    size_t pos = 0;
+    while (pos < data.size()) {
+        // 次のRMCの手前までを1バーストとする
+        size_t next = pos + 1;
+        while (next + 6 <= data.size() &&
+               !(data[next] == '$' && std::memcmp(&data[next + 3], "RMC", 3) == 0)) {
+            next++;
+        }
+        if (next + 6 > data.size()) {
+            next = data.size();
+        }
+        writer.append(reinterpret_cast<const uint8_t *>(&data[pos]), next - pos);
+        pos = next;
+    }
+    writer.close();
+    double cpu_us = (double)(std::clock() - start) * 1e6 / CLOCKS_PER_SEC;
+
+    uint64_t epochs = count_epochs(data.data(), data.size());
+    uint64_t raw = writer.get_raw_bytes();
+    uint64_t stored = writer.get_stored_bytes();
+    std::cout << "raw bytes    : " << raw << std::endl;
+    std::cout << "stored bytes : " << stored << std::endl;
+    if (stored > 0) {
+        std::cout << "ratio        : " << (double)raw / stored << std::endl;
+    }
+    std::cout << "epochs       : " << epochs << std::endl;
+    if (epochs > 0) {
+        std::cout << "cpu/epoch    : " << cpu_us / epochs << " us" << std::endl;
+    }
+    return 0;
+}
+
+/**
+ * @brief アーカイブ復元
+ *
+ * @param in 入力（アーカイブ）
+ * @param out 出力（生のNMEA）
+ * @return int 終了コード
+ */
+static int unpack(const char *in, const char *out)
+{
+    nmea_archive::reader reader(in);
+    if (!reader.is_open()) {
+        return 1;
+    }
+    std::ofstream ofs(out, std::ios::binary);
+    if (!ofs) {
+        std::cerr << "gps_archive: failed to open " << out << std::endl;
+        return 1;
+    }
+
+    std::clock_t start = std::clock();
+    std::string data;
+    uint64_t total = 0;
+    while (reader.read_block(data)) {
+        ofs.write(data.data(), data.size());
+        total += data.size();
+    }
+    double cpu_ms = (double)(std::clock() - start) * 1e3 / CLOCKS_PER_SEC;
+    std::cout << "raw bytes    : " << total << std::endl;
+    std::cout << "cpu          : " << cpu_ms << " ms" << std::endl;
+    return 0;
+}
+
+/**
+ * @brief 索引を作り直す
+ *
+ * @param in アーカイブ
+ * @return int 終了コード
+ */
+static int rebuild_index(const char *in)
+{
+    if (!nmea_archive::index::rebuild(in)) {
+        return 1;
+    }
+    nmea_archive::index idx(in);
+    nmea_archive::index_entry first;
+    nmea_archive::index_entry last;
+    std::cout << "blocks       : " << idx.size() << std::endl;
+    if (idx.size() > 0 && idx.get(0, first) && idx.get(idx.size() - 1, last)) {
+        std::cout << "utc          : " << format_utc(first.first_utc) << " - " << format_utc(last.max_utc) << std::endl;
+    }
+    return 0;
+}
+
+/**
+ * @brief 時刻の範囲のエポックを取り出す
+ *
+ * 索引を二分探索して必要なブロックだけを読む。
+ * 索引が無い、またはアーカイブと合わない場合は作り直す。
+ *
+ * @param in アーカイブ
+ * @param from 開始時刻(UTC)
+ * @param to 終了時刻(UTC、この時刻を含む)
+ * @param out 出力（生のNMEA、nullptrなら標準出力）
+ * @return int 終了コード
+ */
+static int query(const char *in, time_t from, time_t to, const char *out)
+{
+    nmea_archive::reader reader(in);
+    if (!reader.is_open()) {
+        return 1;
+    }
+    std::unique_ptr<nmea_archive::index> idx(new nmea_archive::index(in));
+    nmea_archive::index_entry last;
+    bool valid = idx->is_open() && idx->size() > 0 && idx->get(idx->size() - 1, last) &&
+                 last.end() == (uint64_t)file_size(in);
+    if (!valid) {
+        std::cerr << "gps_archive: rebuilding index of " << in << std::endl;
+        if (!nmea_archive::index::rebuild(in)) {
+            return 1;
+        }
+        idx.reset(new nmea_archive::index(in));
+    }
+
+    std::ofstream ofs;
+    if (out != nullptr) {
+        ofs.open(out, std::ios::binary);
+        if (!ofs) {
+            std::cerr << "gps_archive: failed to open " << out << std::endl;
+            return 1;
+        }
+    }
+    std::ostream &os = (out != nullptr) ? ofs : std::cout;
+
+    size_t first = idx->find(from);
+    size_t blocks = 0;
+    uint64_t epochs = 0;
+    int64_t epoch_utc = -1;         // 出力中のエポックの時刻
+    std::string data;
+    nmea_archive::index_entry e;
+    for (size_t i = first; i < idx->size() && idx->get(i, e); i++) {
+        if (e.first_utc > (int64_t)to) {
+            break;
+        }
+        if (!reader.seek(e.offset) || !reader.read_block(data)) {
+            std::cerr << "gps_archive: failed to read block " << i << std::endl;
+            return 1;
+        }
+        blocks++;
+
+        // エポック（RMC～次のRMCの手前）単位で範囲内のものを出力
+        size_t pos = 0;
+        while (pos < data.size()) {
+            size_t nl = data.find('\n', pos);
+            size_t end = (nl == std::string::npos) ? data.size() : nl + 1;
+            const char *line = &data[pos];
+            if (end - pos >= 6 && line[0] == '$' && std::memcmp(&line[3], "RMC", 3) == 0) {
+                nmea_rmc rmc(nmea_view(line, end - pos));
+                epoch_utc = rmc.get_time_t();
+                if (epoch_utc >= (int64_t)from && epoch_utc <= (int64_t)to) {
+                    epochs++;
+                }
+            }
+            if (epoch_utc >= (int64_t)from && epoch_utc <= (int64_t)to) {
+                os.write(line, end - pos);
+            }
+            pos = end;
+        }
+    }
+    std::cerr << "epochs       : " << epochs << std::endl;
+    std::cerr << "blocks read  : " << blocks << " / " << idx->size() << std::endl;
+    return 0;
+}
+
+/**
+ * @brief メイン関数
+ *
+ * @return int
+ */
+int main(int argc, char *argv[])
+{
+    if (argc >= 4 && std::strcmp(argv[1], "pack") == 0) {
+        bool compress = false;
+        int i = 2;
+        if (std::strcmp(argv[i], "-z") == 0) {
+            compress = true;
+            i++;
+        }
+        if (argc - i == 2) {
+            return pack(argv[i], argv[i + 1], compress);
+        }
+    }
+    else if (argc == 4 && std::strcmp(argv[1], "unpack") == 0) {
+        return unpack(argv[2], argv[3]);
+    }
+    else if (argc == 3 && std::strcmp(argv[1], "index") == 0) {
+        return rebuild_index(argv[2]);
+    }
+    else if ((argc == 5 || argc == 6) && std::strcmp(argv[1], "query") == 0) {
+        time_t from;
+        time_t to;
+        if (parse_utc(argv[3], from) && parse_utc(argv[4], to)) {
+            return query(argv[2], from, to, argc == 6 ? argv[5] : nullptr);
+        }
+    }
+
+    usage();
+    return 1;
+}
@@ -0,0 +1,493 @@
+/**
+ * @file gps_bench.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief NMEAの解析・チェック・描画のマイクロベンチマーク
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * benchディレクトリの.nmea（1エポック分の受信データ）に対して各処理の時間を計測し、
+ * ns/op、bytes/s、allocs/op を出力する。ベースラインと比較して遅くなった処理を報告する。
+ */
+
+#include "gps_check.hpp"
+#include "nmea_gga.hpp"
+#include "nmea_gsa.hpp"
+#include "nmea_gsv.hpp"
+#include "nmea_rmc.hpp"
+#include "frame_renderer.hpp"
+#include "alloc_counter.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef GPS_BENCH_DIR
+#define GPS_BENCH_DIR "bench"
+#endif
+#ifndef GPS_BENCH_BUILD_TYPE
+#define GPS_BENCH_BUILD_TYPE ""
+#endif
+
+// 最適化していないビルドの処理時間はベースラインと比較しない
+#ifdef __OPTIMIZE__
+static const bool optimized = true;
+#else
+static const bool optimized = false;
+#endif
+
+static const char *corpus_names[] = {"nominal", "nofix", "gnss4", "hp"};
+
+static volatile double sink;    // 計測対象の結果（最適化で消されないように）
+
+/**
+ * @brief 計測結果
+ *
+ */
+class bench_result {
+public:
+    std::string name;
+    std::string corpus;
+    double ns_per_op;
+    double bytes_per_sec;
+    double allocs_per_op;
+};
+
+/**
+ * @brief 計測の設定
+ *
+ */
+class bench_config {
+public:
+    std::string dir = GPS_BENCH_DIR;
+    std::string baseline;       // 比較するベースライン
+    std::string output;         // 書き出すベースライン
+    std::string filter;         // 名前に含む処理だけ計測
+    double threshold = 15.0;    // 遅くなったと判定する割合(%)
+    int min_ms = 200;           // 1処理当たりの最小計測時間
+};
+
+/**
+ * @brief 処理を繰り返して計測
+ *
+ * 最小計測時間を超えるまで繰り返し回数を倍にしていき、その回数で
+ * Rounds回計測した最小値を結果とする（割り込み等による揺らぎを除く）。
+ *
+ * @param conf 設定
+ * @param name 処理名
+ * @param corpus コーパス名
+ * @param ops 1回の呼び出しで処理する数
+ * @param bytes 1回の呼び出しで処理するバイト数
+ * @param f 処理
+ * @return bench_result 計測結果
+ */
+template <class F>
+static bench_result run(const bench_config &conf, const char *name, const std::string &corpus,
+                        size_t ops, size_t bytes, F f)
+{
+    const int Rounds = 5;
+
+    // ウォームアップ
+    sink = f();
+
+    uint64_t iterations = 1;
+    uint64_t elapsed_ns = 0;
+    uint64_t allocs = 0;
+    auto measure = [&]() {
+        uint64_t a0 = alloc_counter::count();
+        auto t0 = std::chrono::steady_clock::now();
+        double acc = 0;
+        for (uint64_t i = 0; i < iterations; i++) {
+            acc += f();
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        allocs = alloc_counter::count() - a0;
+        sink = acc;
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+    };
+    while (true) {
+        elapsed_ns = measure();
+        if (elapsed_ns >= (uint64_t)conf.min_ms * 1000000 / Rounds || iterations >= (1ull << 40)) {
+            break;
+        }
+        iterations *= 2;
+    }
+    for (int i = 0; i < Rounds; i++) {
+        elapsed_ns = std::min(elapsed_ns, measure());
+    }
+
+    bench_result r;
+    r.name = name;
+    r.corpus = corpus;
+    r.ns_per_op = (double)elapsed_ns / iterations / ops;
+    r.bytes_per_sec = (elapsed_ns > 0) ? (double)bytes * iterations * 1e9 / elapsed_ns : 0;
+    r.allocs_per_op = (double)allocs / iterations / ops;
+    return r;
+}
+
+/**
+ * @brief ファイルを読み込む
+ *
+ * @param path ファイル
+ * @param data 内容
+ * @return true OK
+ * @return false ERROR
+ */
+static bool load(const std::string &path, std::string &data)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) {
+        return false;
+    }
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    data = ss.str();
+    return true;
+}
+
+/**
+ * @brief 指定した種類のセンテンスを取り出す
+ *
+ * @param list センテンス
+ * @param type 種類("RMC"等)
+ * @param bytes 合計バイト数
+ * @return std::vector<nmea_view> センテンス
+ */
+static std::vector<nmea_view> select(const nmea_list &list, const char *type, size_t &bytes)
+{
+    std::vector<nmea_view> out;
+    bytes = 0;
+    for (auto &s : list) {
+        if (type == nullptr || s.contains(type)) {
+            out.push_back(s);
+            bytes += s.len;
+        }
+    }
+    return out;
+}
+
+/**
+ * @brief 1つのコーパスで全ての処理を計測
+ *
+ * @param conf 設定
+ * @param corpus コーパス名
+ * @param data 受信データ
+ * @param results 計測結果
+ */
+static void bench_corpus(const bench_config &conf, const std::string &corpus, const std::string &data,
+                         std::vector<bench_result> &results)
+{
+    nmea_list list;
+    split_nmea(data, list);
+    auto enabled = [&](const char *name) {
+        return conf.filter.empty() || std::strstr(name, conf.filter.c_str()) != nullptr;
+    };
+
+    if (enabled("split")) {
+        results.push_back(run(conf, "split", corpus, 1, data.size(), [&]() {
+            nmea_list l;
+            return (double)split_nmea(data, l);
+        }));
+    }
+
+    size_t bytes;
+    std::vector<nmea_view> all = select(list, nullptr, bytes);
+    if (enabled("check_sum") && !all.empty()) {
+        results.push_back(run(conf, "check_sum", corpus, all.size(), bytes, [&]() {
+            double ok = 0;
+            for (auto &s : all) {
+                ok += check_sum(s);
+            }
+            return ok;
+        }));
+    }
+
+    std::vector<nmea_view> rmc = select(list, "RMC", bytes);
+    if (enabled("nmea_rmc") && !rmc.empty()) {
+        results.push_back(run(conf, "nmea_rmc", corpus, rmc.size(), bytes, [&]() {
+            double t = 0;
+            for (auto &s : rmc) {
+                nmea_rmc r(s);
+                t += r.get_time_t();
+            }
+            return t;
+        }));
+    }
+
+    std::vector<nmea_view> gga = select(list, "GGA", bytes);
+    if (enabled("nmea_gga") && !gga.empty()) {
+        results.push_back(run(conf, "nmea_gga", corpus, gga.size(), bytes, [&]() {
+            double v = 0;
+            for (auto &s : gga) {
+                nmea_gga g(s);
+                v += g.get_altitude() + g.get_num_sv();
+            }
+            return v;
+        }));
+    }
+
+    std::vector<nmea_view> gsa = select(list, "GSA", bytes);
+    if (enabled("nmea_gsa") && !gsa.empty()) {
+        results.push_back(run(conf, "nmea_gsa", corpus, gsa.size(), bytes, [&]() {
+            double v = 0;
+            for (auto &s : gsa) {
+                nmea_gsa g(s);
+                v += g.get_pdop() + g.get_svid_list().size();
+            }
+            return v;
+        }));
+    }
+
+    std::vector<nmea_view> gsv = select(list, "GSV", bytes);
+    if (enabled("nmea_gsv") && !gsv.empty()) {
+        results.push_back(run(conf, "nmea_gsv", corpus, gsv.size(), bytes, [&]() {
+            double v = 0;
+            for (auto &s : gsv) {
+                nmea_gsv g(s);
+                v += g.get_svid_list().size();
+            }
+            return v;
+        }));
+    }
+
+    if (enabled("check_position")) {
+        double latitude = std::nan("");
+        double longitude = std::nan("");
+        double altitude = std::nan("");
+        if (!gga.empty()) {
+            nmea_gga g(gga[0]);
+            latitude = g.get_latitude();
+            longitude = g.get_longitude();
+            altitude = g.get_altitude();
+        }
+        position_range range;
+        results.push_back(run(conf, "check_position", corpus, 1, 0, [&]() {
+            return (double)check_position(latitude, longitude, altitude, range).error();
+        }));
+    }
+
+    if (enabled("render")) {
+        // gps_test -n と同じ程度の画面（1行は毎回変わる）
+        int fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        frame_renderer fr(fd);
+        uint64_t frame = 0;
+        results.push_back(run(conf, "render", corpus, 1, data.size(), [&]() {
+            fr.begin();
+            for (auto &s : all) {
+                fr.printf("%.*s %s", (int)s.len, s.str, "\033[32m[OK]   \033[0m");
+                fr.newline();
+            }
+            fr.printf("Checksum  %s(error count = %d)", "\033[32m[OK]   \033[0m", 0);
+            fr.newline();
+            fr.printf("LAT=%11.7f, LON=%11.7f, ALT=%6.1f", 35.6706332, 139.3728955, 148.0);
+            fr.newline();
+            fr.printf("frame %llu", (unsigned long long)frame++);
+            fr.newline();
+            fr.present();
+            return (double)fr.get_stats().last_bytes;
+        }));
+        close(fd);
+    }
+}
+
+/**
+ * @brief ベースラインを読み込む
+ *
+ * @param path ファイル
+ * @param baseline "処理名 コーパス名" → 計測結果
+ * @param build 計測したビルド（ヘッダーに無ければ空）
+ * @return true OK
+ * @return false ERROR
+ */
+static bool load_baseline(const std::string &path, std::map<std::string, bench_result> &baseline, std::string &build)
+{
+    std::ifstream ifs(path);
+    if (!ifs) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(ifs, line)) {
+        if (line.compare(0, 9, "# build: ") == 0) {
+            build = line.substr(9);
+            continue;
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream iss(line);
+        bench_result r;
+        if (iss >> r.name >> r.corpus >> r.ns_per_op >> r.allocs_per_op) {
+            baseline[r.name + " " + r.corpus] = r;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief このビルドの種類（CMAKE_BUILD_TYPE、最適化していなければその旨）
+ *
+ * @return std::string ビルドの種類
+ */
+static std::string build_name()
+{
+    std::string name = GPS_BENCH_BUILD_TYPE;
+    if (name.empty()) {
+        name = "unknown";
+    }
+    if (!optimized) {
+        name += " (unoptimized)";
+    }
+    return name;
+}
+
+/**
+ * @brief ベースラインを書き出す
+ *
+ * @param path ファイル
+ * @param results 計測結果
+ * @return true OK
+ * @return false ERROR
+ */
+static bool save_baseline(const std::string &path, const std::vector<bench_result> &results)
+{
+    std::ofstream ofs(path);
+    if (!ofs) {
+        return false;
+    }
+    ofs << "# gps_bench baseline" << std::endl;
+    ofs << "# build: " << build_name() << std::endl;
+    ofs << "# name corpus ns/op allocs/op" << std::endl;
+    for (auto &r : results) {
+        char line[256];
+        std::snprintf(line, sizeof(line), "%s %s %.1f %.2f", r.name.c_str(), r.corpus.c_str(), r.ns_per_op, r.allocs_per_op);
+        ofs << line << std::endl;
+    }
+    return static_cast<bool>(ofs);
+}
+
+static void usage()
+{
+    std::cerr << "Usage: gps_bench [-d <corpus dir>] [-b <baseline>] [-w <baseline>] [-t <percent>] [-m <ms>] [filter]" << std::endl;
+    std::cerr << "  -d  corpus directory (default " << GPS_BENCH_DIR << ")" << std::endl;
+    std::cerr << "  -b  baseline to compare (default <corpus dir>/baseline.txt)" << std::endl;
+    std::cerr << "  -w  write the results as a baseline" << std::endl;
+    std::cerr << "  -t  regression threshold in percent (default 15)" << std::endl;
+    std::cerr << "  -m  minimum measuring time per benchmark in ms (default 200)" << std::endl;
+}
+
+/**
+ * @brief メイン関数
+ *
+ * @return int 0: OK, 1: 遅くなった処理がある, 2: 引数・ファイルのエラー
+ */
+int main(int argc, char *argv[])
+{
+    bench_config conf;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-d" && i + 1 < argc) {
+            conf.dir = argv[++i];
+        }
+        else if (arg == "-b" && i + 1 < argc) {
+            conf.baseline = argv[++i];
+        }
+        else if (arg == "-w" && i + 1 < argc) {
+            conf.output = argv[++i];
+        }
+        else if (arg == "-t" && i + 1 < argc) {
+            conf.threshold = std::stod(argv[++i]);
+        }
+        else if (arg == "-m" && i + 1 < argc) {
+            conf.min_ms = std::stoi(argv[++i]);
+        }
+        else if (arg[0] != '-') {
+            conf.filter = arg;
+        }
+        else {
+            usage();
+            return 2;
+        }
+    }
+    if (conf.baseline.empty() && conf.output.empty()) {
+        conf.baseline = conf.dir + "/baseline.txt";
+    }
+
+    std::vector<bench_result> results;
+    for (auto name : corpus_names) {
+        std::string data;
+        if (!load(conf.dir + "/" + name + ".nmea", data)) {
+            std::cerr << "gps_bench: failed to read " << conf.dir << "/" << name << ".nmea" << std::endl;
+            return 2;
+        }
+        bench_corpus(conf, name, data, results);
+    }
+
+    std::map<std::string, bench_result> baseline;
+    std::string baseline_build;
+    bool compare = !conf.baseline.empty() && load_baseline(conf.baseline, baseline, baseline_build);
+    if (!optimized) {
+        std::cerr << "gps_bench: built without optimization (" << build_name()
+                  << "), ns/op is not checked for regressions; rebuild with -DCMAKE_BUILD_TYPE=Release" << std::endl;
+    }
+    else if (compare && !baseline_build.empty() && baseline_build != build_name()) {
+        std::cerr << "gps_bench: baseline was measured with " << baseline_build
+                  << ", this build is " << build_name() << std::endl;
+    }
+
+    int regressions = 0;
+    std::printf("%-15s %-8s %12s %12s %10s", "name", "corpus", "ns/op", "MB/s", "allocs/op");
+    if (compare) {
+        std::printf(" %12s %8s", "base ns/op", "delta");
+    }
+    std::printf("\n");
+    for (auto &r : results) {
+        std::printf("%-15s %-8s %12.1f ", r.name.c_str(), r.corpus.c_str(), r.ns_per_op);
+        if (r.bytes_per_sec > 0) {
+            std::printf("%12.1f ", r.bytes_per_sec / 1e6);
+        }
+        else {
+            std::printf("%12s ", "-");
+        }
+        std::printf("%10.2f", r.allocs_per_op);
+        if (compare) {
+            auto it = baseline.find(r.name + " " + r.corpus);
+            if (it != baseline.end() && it->second.ns_per_op > 0) {
+                double delta = (r.ns_per_op - it->second.ns_per_op) * 100.0 / it->second.ns_per_op;
+                bool slower = optimized && delta > conf.threshold;
+                bool allocs = r.allocs_per_op > it->second.allocs_per_op + 0.005;
+                std::printf(" %12.1f %+7.1f%%", it->second.ns_per_op, delta);
+                if (slower || allocs) {
+                    std::printf(" REGRESSION%s", allocs ? " (allocs)" : "");
+                    regressions++;
+                }
+            }
+            else {
+                std::printf(" %12s %8s", "-", "new");
+            }
+        }
+        std::printf("\n");
+    }
+
+    if (!conf.output.empty()) {
+        if (!save_baseline(conf.output, results)) {
+            std::cerr << "gps_bench: failed to write " << conf.output << std::endl;
+            return 2;
+        }
+        std::cout << "baseline written to " << conf.output << std::endl;
+    }
+    if (regressions > 0) {
+        std::cout << regressions << " regression(s) (threshold " << conf.threshold << "%)" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,573 @@
+/**
+ * @file gps_broker.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief I2Cバスを占有して受信データを複数のクライアントへ配信する
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * 受信機を読むのはこのプロセスだけにして、読んだバイト列をそのまま
+ * Unixドメインソケットの全クライアントへ配信する。
+ * クライアントから受け取ったUBXメッセージは1つずつ直列化して受信機へ書き込む。
+ */
+
+#include "ubx.hpp"
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+static const size_t client_queue_limit = 64 * 1024;    // クライアント毎の送信待ちの上限
+static const size_t ubx_frame_limit = 8 + 4096;        // クライアントから受け付けるUBXメッセージの上限
+static const int poll_interval_ms = 100;                // 受信機の確認間隔
+
+/**
+ * @brief 受信機の代わりにファイルのNMEAを1秒毎に出力する
+ *
+ */
+class file_source
+{
+public:
+    file_source(const std::string &path, int interval_ms);
+    bool is_open();
+    ubx::status get_nmea(std::vector<uint8_t> &buf);
+
+private:
+    std::vector<std::string> bursts;    // RMC毎に区切ったNMEA
+    size_t next;
+    int interval_ms;
+    int elapsed_ms;
+};
+
+/**
+ * @brief Construct a new file source::file source object
+ *
+ * @param path NMEAファイル
+ * @param interval_ms 出力間隔
+ */
+file_source::file_source(const std::string &path, int interval_ms) :
+next(0),
+interval_ms(interval_ms),
+elapsed_ms(interval_ms)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    size_t pos = 0;
+    while (pos < data.size()) {
+        size_t end = pos + 1;
+        // 末尾の'$'は（RMCでなければ）次の'$'を探す
+        while ((end = data.find('$', end)) != std::string::npos &&
+               (end + 6 > data.size() || data.compare(end + 3, 3, "RMC") != 0)) {
+            end++;
+        }
+        if (end == std::string::npos) {
+            end = data.size();
+        }
+        bursts.push_back(data.substr(pos, end - pos));
+        pos = end;
+    }
+}
+
+/**
+ * @brief ファイルを読めたかどうか
+ *
+ * @return true 読めた
+ * @return false 読めなかった
+ */
+bool file_source::is_open()
+{
+    return bursts.size() > 0;
+}
+
+/**
+ * @brief 受信データ取得（poll_interval_ms毎に呼ばれる）
+ *
+ * @param buf 受信データ
+ * @return ubx::status
+ */
+ubx::status file_source::get_nmea(std::vector<uint8_t> &buf)
+{
+    elapsed_ms += poll_interval_ms;
+    if (elapsed_ms < interval_ms) {
+        return ubx::empty;
+    }
+    elapsed_ms = 0;
+    const std::string &burst = bursts[next];
+    next = (next + 1) % bursts.size();
+    buf.assign(burst.begin(), burst.end());
+    return ubx::ok;
+}
+
+/**
+ * @brief クライアント
+ *
+ */
+class client
+{
+public:
+    int fd;
+    std::string out;            // 送信待ち
+    std::vector<uint8_t> in;    // 受信した未処理のバイト列
+    bool want_write;            // EPOLLOUTを登録済み
+};
+
+/**
+ * @brief ブローカー
+ *
+ */
+class broker
+{
+public:
+    broker(const std::string &path, ubx *dev, file_source *file);
+    ~broker();
+    int run();
+
+private:
+    std::string path;
+    ubx *dev;
+    file_source *file;
+    int epfd;
+    int listen_fd;
+    int signal_fd;
+    int timer_fd;
+    std::map<int, client> clients;
+    std::deque<std::vector<uint8_t>> commands;     // 受信機へ書き込むUBXメッセージ
+
+    uint64_t bytes_read;
+    uint64_t bytes_sent;
+    uint64_t conflicts;
+    uint64_t dropped_clients;
+    uint64_t commands_sent;
+
+    bool setup();
+    void poll_receiver();
+    void accept_client();
+    void read_client(client &c);
+    void flush_client(client &c);
+    void close_client(int fd);
+    void broadcast(const uint8_t *data, size_t len);
+    void update_events(client &c);
+};
+
+/**
+ * @brief Construct a new broker::broker object
+ *
+ * @param path ソケットのパス
+ * @param dev 受信機（fileがnullptrの場合）
+ * @param file 受信機の代わり
+ */
+broker::broker(const std::string &path, ubx *dev, file_source *file) :
+path(path),
+dev(dev),
+file(file),
+epfd(-1),
+listen_fd(-1),
+signal_fd(-1),
+timer_fd(-1),
+bytes_read(0),
+bytes_sent(0),
+conflicts(0),
+dropped_clients(0),
+commands_sent(0)
+{
+}
+
+/**
+ * @brief Destroy the broker::broker object
+ *
+ */
+broker::~broker()
+{
+    while (!clients.empty()) {
+        close_client(clients.begin()->first);
+    }
+    for (int fd : { listen_fd, signal_fd, timer_fd, epfd }) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    if (listen_fd >= 0) {
+        unlink(path.c_str());
+    }
+}
+
+/**
+ * @brief ソケット・シグナル・タイマーを準備
+ *
+ * @return true OK
+ * @return false ERROR
+ */
+bool broker::setup()
+{
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        std::cerr << "gps_broker: failed to epoll_create1: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    // 待ち受けソケット
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(path.c_str());
+    if (listen_fd < 0 || bind(listen_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        listen(listen_fd, 16) != 0) {
+        std::cerr << "gps_broker: failed to listen " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Ctrl+Cとkill
+    sigset_t ss;
+    sigemptyset(&ss);
+    sigaddset(&ss, SIGINT);
+    sigaddset(&ss, SIGTERM);
+    sigaddset(&ss, SIGHUP);
+    sigprocmask(SIG_BLOCK, &ss, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    signal_fd = signalfd(-1, &ss, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    // 受信機の確認周期
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct itimerspec its;
+    its.it_interval.tv_sec = 0;
+    its.it_interval.tv_nsec = poll_interval_ms * 1000000L;
+    its.it_value = its.it_interval;
+    if (signal_fd < 0 || timer_fd < 0 || timerfd_settime(timer_fd, 0, &its, NULL) != 0) {
+        std::cerr << "gps_broker: failed to setup: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    for (int fd : { listen_fd, signal_fd, timer_fd }) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+    return true;
+}
+
+/**
+ * @brief メインループ
+ *
+ * @return int 終了コード
+ */
+int broker::run()
+{
+    if (!setup()) {
+        return EXIT_FAILURE;
+    }
+
+    struct epoll_event events[32];
+    bool terminate = false;
+    while (!terminate) {
+        int n = epoll_wait(epfd, events, 32, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "gps_broker: failed to epoll_wait: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == signal_fd) {
+                terminate = true;
+            }
+            else if (fd == timer_fd) {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) > 0) {
+                    poll_receiver();
+                }
+            }
+            else if (fd == listen_fd) {
+                accept_client();
+            }
+            else {
+                auto it = clients.find(fd);
+                if (it == clients.end()) {
+                    continue;
+                }
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    close_client(fd);
+                    continue;
+                }
+                if (events[i].events & EPOLLIN) {
+                    read_client(it->second);
+                }
+                it = clients.find(fd);
+                if (it != clients.end() && (events[i].events & EPOLLOUT)) {
+                    flush_client(it->second);
+                }
+            }
+        }
+    }
+
+    std::cerr << "gps_broker: read = " << bytes_read << ", sent = " << bytes_sent
+              << ", conflicts = " << conflicts << ", dropped clients = " << dropped_clients
+              << ", commands = " << commands_sent << std::endl;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief 受信機へ書き込み、受信データを配信
+ *
+ */
+void broker::poll_receiver()
+{
+    // クライアントからのUBXメッセージを読み出し1回につき1つ書き込む（受信機の入力バッファを溢れさせない）
+    if (!commands.empty()) {
+        std::vector<uint8_t> &frame = commands.front();
+        if (file == nullptr) {
+            dev->send(frame.data(), frame.size());
+        }
+        commands_sent++;
+        commands.pop_front();
+    }
+
+    // 受信機のバッファが空になるまで読み出す
+    while (true) {
+        std::vector<uint8_t> buf;
+        ubx::status sts = (file != nullptr) ? file->get_nmea(buf) : dev->get_nmea(buf);
+        if (sts == ubx::conflict) {
+            // 他のプロセスがまだバスを読んでいる
+            conflicts++;
+            break;
+        }
+        if (sts != ubx::ok) {
+            break;
+        }
+        bytes_read += buf.size();
+        broadcast(buf.data(), buf.size());
+        if (file != nullptr) {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief クライアントの接続を受け付け
+ *
+ */
+void broker::accept_client()
+{
+    while (true) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            break;
+        }
+        client &c = clients[fd];
+        c.fd = fd;
+        c.want_write = false;
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+/**
+ * @brief クライアントからUBXメッセージを受信
+ *
+ * @param c クライアント
+ */
+void broker::read_client(client &c)
+{
+    uint8_t tmp[4096];
+    while (true) {
+        ssize_t ret = recv(c.fd, tmp, sizeof(tmp), 0);
+        if (ret > 0) {
+            c.in.insert(c.in.end(), tmp, tmp + ret);
+            continue;
+        }
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        close_client(c.fd);
+        return;
+    }
+
+    // 0xB5 0x62 class id length(2) payload ck_a ck_b を切り出す
+    size_t pos = 0;
+    while (c.in.size() - pos >= 8) {
+        if (c.in[pos] != 0xb5 || c.in[pos + 1] != 0x62) {
+            pos++;
+            continue;
+        }
+        size_t len = c.in[pos + 4] | (c.in[pos + 5] << 8);
+        size_t total = len + 8;
+        if (total > ubx_frame_limit) {
+            pos++;
+            continue;
+        }
+        if (c.in.size() - pos < total) {
+            break;
+        }
+        uint8_t ck_a = 0;
+        uint8_t ck_b = 0;
+        for (size_t i = 2; i < total - 2; i++) {
+            ck_a += c.in[pos + i];
+            ck_b += ck_a;
+        }
+        if (ck_a == c.in[pos + total - 2] && ck_b == c.in[pos + total - 1]) {
+            commands.emplace_back(c.in.begin() + pos, c.in.begin() + pos + total);
+            pos += total;
+        }
+        else {
+            pos++;
+        }
+    }
+    c.in.erase(c.in.begin(), c.in.begin() + pos);
+}
+
+/**
+ * @brief 送信待ちのデータを送信
+ *
+ * @param c クライアント
+ */
+void broker::flush_client(client &c)
+{
+    size_t pos = 0;
+    while (pos < c.out.size()) {
+        ssize_t ret = ::send(c.fd, &c.out[pos], c.out.size() - pos, MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            close_client(c.fd);
+            return;
+        }
+        pos += ret;
+        bytes_sent += ret;
+    }
+    c.out.erase(0, pos);
+    update_events(c);
+}
+
+/**
+ * @brief クライアントを切断
+ *
+ * @param fd ソケット
+ */
+void broker::close_client(int fd)
+{
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    clients.erase(fd);
+}
+
+/**
+ * @brief 全クライアントへ配信
+ *
+ * 送信待ちが上限を超えたクライアント（読むのが遅い）は切断する。
+ *
+ * @param data 受信データ
+ * @param len 長さ
+ */
+void broker::broadcast(const uint8_t *data, size_t len)
+{
+    std::vector<int> slow;
+    for (auto &it : clients) {
+        client &c = it.second;
+        if (c.out.size() + len > client_queue_limit) {
+            slow.push_back(c.fd);
+            continue;
+        }
+        c.out.append(reinterpret_cast<const char *>(data), len);
+    }
+    for (int fd : slow) {
+        dropped_clients++;
+        close_client(fd);
+    }
+
+    std::vector<int> fds;
+    for (auto &it : clients) {
+        fds.push_back(it.first);
+    }
+    for (int fd : fds) {
+        auto it = clients.find(fd);
+        if (it != clients.end()) {
+            flush_client(it->second);
+        }
+    }
+}
+
+/**
+ * @brief 送信待ちの有無に合わせてEPOLLOUTを登録・解除
+ *
+ * @param c クライアント
+ */
+void broker::update_events(client &c)
+{
+    bool want_write = !c.out.empty();
+    if (want_write == c.want_write) {
+        return;
+    }
+    struct epoll_event ev;
+    ev.events = want_write ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    ev.data.fd = c.fd;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c.fd, &ev);
+    c.want_write = want_write;
+}
+
+/**
+ * @brief メイン関数
+ *
+ * gps_broker [-s socket] [-f nmea_file [-i interval_ms]]
+ *
+ * @return int
+ */
+int main(int argc, char *argv[])
+{
+    std::string path = ubx::default_broker_path;
+    std::string file_path;
+    int interval_ms = 1000;
+
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-' && i + 1 < argc) {
+            if (argv[i][1] == 's') {
+                path = argv[++i];
+            }
+            else if (argv[i][1] == 'f') {
+                file_path = argv[++i];
+            }
+            else if (argv[i][1] == 'i') {
+                interval_ms = std::stoi(argv[++i]);
+            }
+        }
+    }
+
+    ubx dev;
+    std::unique_ptr<file_source> file;
+    if (file_path != "") {
+        file.reset(new file_source(file_path, interval_ms));
+        if (!file->is_open()) {
+            std::cerr << "gps_broker: failed to read " << file_path << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    broker b(path, &dev, file.get());
+    return b.run();
+}
@@ -0,0 +1,149 @@
+/**
+ * @file gps_check.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief NMEAのチェック処理
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "gps_check.hpp"
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief サムチェック
+ * 
+ * @param sentence NMEAのセンテンス
+ * @return true OK
+ * @return false ERROR
+ */
+bool check_sum(const nmea_view &sentence)
+{
+    // チェックサムの計算
+    size_t start = sentence.find('$') + 1;
+    size_t end = sentence.find('*');
+    if (start == 0 || end == std::string::npos || end < start || end + 3 > sentence.len) {
+        // '$'または'*'が無い、チェックサムが2桁無い
+        return false;
+    }
+    uint8_t sum = 0;
+    for (size_t i = start; i < end; i++) {
+        sum ^= sentence[i];
+    }
+
+    // チェックサムを切り出し
+    int value = 0;
+    for (size_t i = end + 1; i < end + 3; i++) {
+        char c = sentence[i];
+        value <<= 4;
+        if (c >= '0' && c <= '9') {
+            value |= c - '0';
+        }
+        else if (c >= 'A' && c <= 'F') {
+            value |= c - 'A' + 10;
+        }
+        else if (c >= 'a' && c <= 'f') {
+            value |= c - 'a' + 10;
+        }
+        else {
+            return false;
+        }
+    }
+    if (sum == value) {
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief 受信データをセンテンス毎に分割（"\r\n"で区切る）
+ *
+ * @param data 受信データ（listはこの中を参照する）
+ * @param list 分割したセンテンス
+ * @return size_t 分割した範囲の長さ（data.lenより短ければ途中で切れたセンテンスが残っている）
+ */
+size_t split_nmea(const nmea_view &data, nmea_list &list)
+{
+    list.clear();
+    size_t start = 0;
+    size_t pos = 0;
+    while ((pos = data.find('\r', pos)) != std::string::npos) {
+        if (pos + 1 < data.len && data[pos + 1] == '\n') {
+            if (!list.push_back(data.substr(start, pos - start))) {
+                break;
+            }
+            start = pos + 2;
+        }
+        pos++;
+    }
+    return start;
+}
+
+/**
+ * @brief 時刻の連続性をチェック
+ *
+ * @param current 今回のエポックの時刻（無ければ0以下）
+ * @return true エラー
+ * @return false OK
+ */
+bool utc_check::update(time_t current)
+{
+    if (current <= 0) {
+        // エラー
+        error = true;
+        count++;
+    }
+    else {
+        if (prev > 0) {
+            int diff = difftime(current, prev);
+            if (diff > 1) {
+                error = true;
+                count++;
+            }
+            else {
+                error = false;
+            }
+        }
+        prev = current;
+    }
+    return error;
+}
+
+/**
+ * @brief 位置の範囲の設定項目を読み込む
+ *
+ * @param key 設定項目
+ * @param value 値
+ * @param range 出力先
+ * @return true 位置の範囲の設定項目
+ * @return false それ以外
+ */
+bool read_position_conf(const std::string &key, const std::string &value, position_range &range)
+{
+    if (key == "MinimumLatitude") {
+        range.minimum_latitude = std::stod(value);
+    }
+    else if (key == "MaximumLatitude") {
+        range.maximum_latitude = std::stod(value);
+    }
+    else if (key == "MinimumLongitude") {
+        range.minimum_longitude = std::stod(value);
+    }
+    else if (key == "MaximumLongitude") {
+        range.maximum_longitude = std::stod(value);
+    }
+    else if (key == "MinimumAltitude") {
+        range.minimum_altitude = std::stod(value);
+    }
+    else if (key == "MaximumAltitude") {
+        range.maximum_altitude = std::stod(value);
+    }
+    else {
+        return false;
+    }
+    return true;
+}
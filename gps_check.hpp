@@ -0,0 +1,86 @@
+/**
+ * @file gps_check.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief NMEAのチェック処理
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef GPS_CHECK_HPP
+#define GPS_CHECK_HPP
+
+#include "nmea_view.hpp"
+#include "fixed_vector.hpp"
+#include <cmath>
+#include <ctime>
+#include <string>
+
+// 受信が途切れたと判定する時間(ms)
+const int TimeoutLimit = 2000;
+
+typedef fixed_vector<nmea_view, 128> nmea_list;
+
+// 位置の範囲（gps_test.confで設定）
+class position_range {
+public:
+    double minimum_latitude = -90;
+    double maximum_latitude = 90;
+    double minimum_longitude = -180;
+    double maximum_longitude = 180;
+    double minimum_altitude = -1000;
+    double maximum_altitude = 10000;
+};
+
+/**
+ * @brief 位置チェックの結果（1エポック分）
+ *
+ */
+class position_result {
+public:
+    bool latitude_error;
+    bool longitude_error;
+    bool altitude_error;
+
+    bool error() const { return latitude_error || longitude_error || altitude_error; }
+};
+
+/**
+ * @brief 時刻の連続性チェック
+ *
+ * 時刻が無い、または前回の時刻から1秒を超えて飛んでいればエラー。
+ */
+class utc_check {
+public:
+    bool error = false;
+    int count = 0;
+    time_t prev = (time_t)-1;      // 前回の時刻（無ければ-1）
+
+    bool update(time_t current);
+};
+
+bool check_sum(const nmea_view &sentence);
+size_t split_nmea(const nmea_view &data, nmea_list &list);
+bool read_position_conf(const std::string &key, const std::string &value, position_range &range);
+
+/**
+ * @brief GPS座標が指定した範囲内かチェック
+ *
+ * @param latitude 
+ * @param longitude 
+ * @param altitude 
+ * @param range 範囲
+ * @return position_result 結果
+ */
+inline position_result check_position(double latitude, double longitude, double altitude, const position_range &range)
+{
+    position_result r;
+    r.latitude_error = !(!std::isnan(latitude) && latitude >= range.minimum_latitude && latitude <= range.maximum_latitude);
+    r.longitude_error = !(!std::isnan(longitude) && longitude >= range.minimum_longitude && longitude <= range.maximum_longitude);
+    r.altitude_error = !(!std::isnan(altitude) && altitude >= range.minimum_altitude && altitude <= range.maximum_altitude);
+    return r;
+}
+
+#endif
@@ -0,0 +1,68 @@
+/**
+ * @file gps_conf.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 設定ファイル(gps_test.conf)の読み込み
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "gps_conf.hpp"
+#include <fstream>
+
+/**
+ * @brief 空白文字削除
+ * 
+ * @param str 文字列
+ * @param trim_character_list 削除対象の空白文字
+ * @return std::string 結果
+ */
+std::string trim(const std::string &str, const char *trim_character_list)
+{
+    std::string result = "";
+    // 左から最初の空白文字以外の文字を検索
+    auto left = str.find_first_not_of(trim_character_list);
+    if (left != std::string::npos) {
+        // すべて空白文字でなければ右から最後の空白文字以外の文字を検索 
+        auto right = str.find_last_not_of(trim_character_list);
+        // 左右の空白文字を除いた文字列を切り出す
+        result = str.substr(left, right - left + 1);
+    }
+    return result;
+}
+
+/**
+ * @brief 設定ファイル読み込み
+ *
+ * "Key = Value"の行毎にhandlerを呼ぶ（#以降はコメント）。
+ *
+ * @param filename 設定ファイル
+ * @param handler 設定項目を受け取る関数
+ * @return true OK
+ * @return false ファイルを開けない
+ */
+bool read_conf_file(const std::string &filename, const conf_handler &handler)
+{
+    std::ifstream ifs;
+    ifs.open(filename, std::ios::in);
+    if (!ifs) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(ifs, line)) {
+        // #以降はコメントなので削除
+        auto comment_pos = line.find("#");
+        if (comment_pos != std::string::npos) {
+            line = line.substr(0, comment_pos);
+        }
+
+        // '='があればKeyとValueへ分割
+        auto pos = line.find("=");
+        if (pos != std::string::npos) {
+            handler(trim(line.substr(0, pos)), trim(line.substr(pos + 1)));
+        }
+    }
+    return true;
+}
@@ -0,0 +1,27 @@
+/**
+ * @file gps_conf.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 設定ファイル(gps_test.conf)の読み込み
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef GPS_CONF_HPP
+#define GPS_CONF_HPP
+
+#include <functional>
+#include <string>
+
+/**
+ * @brief 設定項目を受け取る関数
+ *
+ */
+typedef std::function<void(const std::string &key, const std::string &value)> conf_handler;
+
+std::string trim(const std::string &str, const char *trim_character_list = " \t\v\r\n");
+bool read_conf_file(const std::string &filename, const conf_handler &handler);
+
+#endif
@@ -0,0 +1,45 @@
+/**
+ * @file gps_fix.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 1エポック分の測位結果とチェック結果
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef GPS_FIX_HPP
+#define GPS_FIX_HPP
+
+#include <cstdint>
+#include <ctime>
+
+/**
+ * @brief 1エポック分の測位結果とチェック結果
+ *
+ */
+class gps_fix
+{
+public:
+    uint64_t seq;               // エポック番号
+    uint64_t mono_ns;           // 受信時刻（CLOCK_MONOTONIC, ns）
+    time_t utc;                 // GPS時刻（RMC, エポック秒）、無効なら-1
+    double latitude;            // 緯度（度）
+    double longitude;           // 経度（度）
+    double altitude;            // 高度（m）
+    int num_sv;                 // 使用した衛星の数
+    double pdop;
+    double hdop;
+    double vdop;
+    bool sum_err;               // チェックサムエラー
+    bool utc_err;               // UTCチェックエラー
+    bool position_err;          // 位置チェックエラー
+    bool timeout;               // タイムアウト
+    int sum_err_cnt;
+    int utc_err_cnt;
+    int position_err_cnt;
+    int timeout_cnt;
+};
+
+#endif
@@ -0,0 +1,428 @@
+/**
+ * @file gps_history.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 測位結果の履歴の作成・検索
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * 入力はgps_testが保存した履歴(HistoryFile)またはNMEAログ。
+ * NMEAログはgps_testと同じチェックをしながらエポック毎の測位結果にする。
+ */
+
+#include "fix_history.hpp"
+#include "enu_accuracy.hpp"
+#include "gps_check.hpp"
+#include "gps_conf.hpp"
+#include "nmea_gga.hpp"
+#include "nmea_gsa.hpp"
+#include "nmea_rmc.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+static position_range PositionRange;     // 位置の範囲（gps_test.confから読む）
+
+/**
+ * @brief 使い方を表示
+ *
+ */
+static void usage()
+{
+    std::cerr << "Usage: gps_history build <history|nmea log> <history>" << std::endl;
+    std::cerr << "       gps_history summary <history|nmea log>" << std::endl;
+    std::cerr << "       gps_history query <history|nmea log> <condition>   (e.g. \"hdop>2,num_sv<6\")" << std::endl;
+    std::cerr << "       gps_history mean <history|nmea log> <column> <window>" << std::endl;
+    std::cerr << "       gps_history accuracy <history|nmea log> [latitude longitude altitude]" << std::endl;
+    std::cerr << "columns: utc latitude longitude altitude num_sv pdop hdop vdop" << std::endl;
+}
+
+/**
+ * @brief NMEAログから1エポック分の測位結果を組み立てる
+ *
+ */
+class fix_builder {
+public:
+    fix_history &history;
+    gps_fix fix;
+    utc_check utc;
+    int sum_err_cnt = 0;
+    int position_err_cnt = 0;
+    bool active = false;
+    bool sum_err = false;
+    bool first_gsa = true;
+
+    fix_builder(fix_history &history) : history(history) { fix.seq = 0; clear(); }
+
+    void clear()
+    {
+        const double nan = std::numeric_limits<double>::quiet_NaN();
+        fix.mono_ns = 0;
+        fix.utc = (time_t)-1;
+        fix.latitude = nan;
+        fix.longitude = nan;
+        fix.altitude = nan;
+        fix.num_sv = 0;
+        fix.pdop = nan;
+        fix.hdop = nan;
+        fix.vdop = nan;
+        fix.timeout = false;
+        active = false;
+        sum_err = false;
+        first_gsa = true;
+    }
+
+    void add(const nmea_view &s)
+    {
+        if (s.len >= 6 && s[0] == '$' && std::memcmp(s.str + 3, "RMC", 3) == 0 && active) {
+            finish();
+        }
+        active = true;
+        if (check_sum(s) == false) {
+            sum_err = true;
+            sum_err_cnt++;
+            return;
+        }
+        if (s.contains("RMC")) {
+            nmea_rmc rmc(s);
+            fix.utc = rmc.get_time_t();
+        }
+        if (s.contains("GGA")) {
+            nmea_gga gga(s);
+            fix.latitude = gga.get_latitude();
+            fix.longitude = gga.get_longitude();
+            fix.altitude = gga.get_altitude();
+            fix.num_sv = gga.get_num_sv();
+        }
+        if (s.contains("GSA") && first_gsa) {
+            // gps_testと同じく最初のGSAのDOP
+            nmea_gsa gsa(s);
+            fix.pdop = gsa.get_pdop();
+            fix.hdop = gsa.get_hdop();
+            fix.vdop = gsa.get_vdop();
+            first_gsa = false;
+        }
+    }
+
+    void finish()
+    {
+        if (!active) {
+            return;
+        }
+        utc.update(fix.utc);
+        position_result pos = check_position(fix.latitude, fix.longitude, fix.altitude, PositionRange);
+        position_err_cnt += pos.error();
+        fix.sum_err = sum_err;
+        fix.utc_err = utc.error;
+        fix.position_err = pos.error();
+        fix.sum_err_cnt = sum_err_cnt;
+        fix.utc_err_cnt = utc.count;
+        fix.position_err_cnt = position_err_cnt;
+        fix.timeout_cnt = 0;
+        history.append(fix);
+        fix.seq++;
+        clear();
+    }
+};
+
+/**
+ * @brief 履歴またはNMEAログを読み込む
+ *
+ * @param path ファイル
+ * @param history 履歴
+ * @return true OK
+ * @return false ERROR
+ */
+static bool load(const std::string &path, fix_history &history)
+{
+    if (history.load(path)) {
+        return true;
+    }
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) {
+        std::cerr << "gps_history: failed to open " << path << std::endl;
+        return false;
+    }
+    history.clear();
+    fix_builder builder(history);
+    std::string line;
+    while (std::getline(ifs, line)) {
+        while (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (!line.empty()) {
+            builder.add(nmea_view(line));
+        }
+    }
+    builder.finish();
+    return true;
+}
+
+/**
+ * @brief 値を表示（NaNは空欄）
+ *
+ * @param col 項目
+ * @param value 値
+ */
+static void print_value(fix_history::column col, double value)
+{
+    if (std::isnan(value)) {
+        return;
+    }
+    if (col == fix_history::utc) {
+        time_t t = (time_t)value;
+        struct tm tm;
+        char buf[32];
+        gmtime_r(&t, &tm);
+        std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm);
+        std::printf("%s", buf);
+    }
+    else if (col == fix_history::latitude || col == fix_history::longitude) {
+        std::printf("%.7f", value);
+    }
+    else {
+        std::printf("%g", value);
+    }
+}
+
+/**
+ * @brief 行を表示
+ *
+ * @param history 履歴
+ * @param row 行の番号
+ */
+static void print_row(const fix_history &history, uint64_t row)
+{
+    double values[fix_history::column_count];
+    if (!history.get_row(row, values)) {
+        return;
+    }
+    std::printf("%llu", (unsigned long long)row);
+    for (int col = 0; col < fix_history::column_count; col++) {
+        std::printf(",");
+        print_value((fix_history::column)col, values[col]);
+    }
+    std::printf("\n");
+}
+
+/**
+ * @brief 項目名の見出しを表示
+ *
+ */
+static void print_header()
+{
+    std::printf("row");
+    for (int col = 0; col < fix_history::column_count; col++) {
+        std::printf(",%s", fix_history::column_name((fix_history::column)col));
+    }
+    std::printf("\n");
+}
+
+/**
+ * @brief チャンクの最小値・最大値から全体の範囲を表示
+ *
+ * @param history 履歴
+ */
+static void summary(const fix_history &history)
+{
+    std::printf("rows   : %llu\n", (unsigned long long)history.size());
+    std::printf("chunks : %zu\n", history.chunk_count());
+    for (int col = 0; col < fix_history::column_count; col++) {
+        double lo = std::numeric_limits<double>::infinity();
+        double hi = -std::numeric_limits<double>::infinity();
+        for (size_t k = 0; k < history.chunk_count(); k++) {
+            lo = std::min(lo, history.get_chunk(k).min[col]);
+            hi = std::max(hi, history.get_chunk(k).max[col]);
+        }
+        std::printf("%-10s: ", fix_history::column_name((fix_history::column)col));
+        if (lo <= hi) {
+            print_value((fix_history::column)col, lo);
+            std::printf(" - ");
+            print_value((fix_history::column)col, hi);
+        }
+        else {
+            std::printf("-");
+        }
+        std::printf("\n");
+    }
+}
+
+/**
+ * @brief 基準点からの精度（CEP50/CEP95/2DRMS）を表示
+ *
+ * 基準点を指定しなければ全エポックの平均を基準点にする。範囲外の位置のエポックは除く。
+ * チャンク毎に緯度・経度・高度の配列をまとめてENUに変換する。
+ *
+ * @param history 履歴
+ * @param conf 基準点
+ * @return true OK
+ * @return false 位置が無い
+ */
+static bool accuracy(const fix_history &history, const enu_accuracy::config &conf)
+{
+    enu_accuracy acc(conf);
+    if (!acc.has_reference()) {
+        double sum[3] = { 0, 0, 0 };
+        uint64_t count = 0;
+        for (size_t k = 0; k < history.chunk_count(); k++) {
+            const fix_history::chunk &c = history.get_chunk(k);
+            for (size_t i = 0; i < c.rows; i++) {
+                double lat = c.values[fix_history::latitude][i];
+                double lon = c.values[fix_history::longitude][i];
+                double alt = c.values[fix_history::altitude][i];
+                if ((c.flags[i] & fix_history::position_err) || std::isnan(lat) || std::isnan(lon) || std::isnan(alt)) {
+                    continue;
+                }
+                sum[0] += lat;
+                sum[1] += lon;
+                sum[2] += alt;
+                count++;
+            }
+        }
+        if (count == 0) {
+            std::cerr << "gps_history: no position" << std::endl;
+            return false;
+        }
+        acc.set_reference(sum[0] / count, sum[1] / count, sum[2] / count);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<double> e(fix_history::chunk_rows);
+    std::vector<double> n(fix_history::chunk_rows);
+    std::vector<double> u(fix_history::chunk_rows);
+    for (size_t k = 0; k < history.chunk_count(); k++) {
+        const fix_history::chunk &c = history.get_chunk(k);
+        acc.to_enu(c.values[fix_history::latitude], c.values[fix_history::longitude], c.values[fix_history::altitude],
+                   c.rows, e.data(), n.data(), u.data());
+        for (size_t i = 0; i < c.rows; i++) {
+            if (!(c.flags[i] & fix_history::position_err)) {
+                acc.add_enu(e[i], n[i], u[i]);
+            }
+        }
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double lat, lon, alt;
+    acc.get_reference(lat, lon, alt);
+    enu_accuracy::result r = acc.get_result();
+    std::printf("reference : %.7f, %.7f, %.2f%s\n", lat, lon, alt, std::isnan(conf.latitude) ? " (mean)" : "");
+    std::printf("epochs    : %llu\n", (unsigned long long)r.count);
+    std::printf("cep50     : %.3f m\n", r.cep50);
+    std::printf("cep95     : %.3f m\n", r.cep95);
+    std::printf("2drms     : %.3f m\n", r.drms2);
+    std::printf("v95       : %.3f m\n", r.vertical95);
+    std::printf("bias(enu) : %.3f, %.3f, %.3f m\n", r.mean_e, r.mean_n, r.mean_u);
+    std::cerr << "converted " << r.count << " epochs in " << sec * 1000 << " ms" << std::endl;
+    return true;
+}
+
+/**
+ * @brief メイン関数
+ *
+ * @return int
+ */
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        usage();
+        return 1;
+    }
+    std::string cmd = argv[1];
+
+    // NMEAログの位置チェックはgps_testと同じ設定
+    read_conf_file("gps_test.conf", [](const std::string &key, const std::string &value) {
+        read_position_conf(key, value, PositionRange);
+    });
+
+    fix_history history;
+    if (cmd == "build" && argc == 4) {
+        if (!load(argv[2], history) || !history.save(argv[3])) {
+            return 1;
+        }
+        std::cout << "rows   : " << history.size() << std::endl;
+        std::cout << "chunks : " << history.chunk_count() << std::endl;
+        return 0;
+    }
+    if (cmd == "summary" && argc == 3) {
+        if (!load(argv[2], history)) {
+            return 1;
+        }
+        summary(history);
+        return 0;
+    }
+    if (cmd == "query" && argc == 4) {
+        std::vector<fix_history::range> ranges;
+        if (!fix_history::parse_condition(argv[3], ranges)) {
+            std::cerr << "gps_history: invalid condition " << argv[3] << std::endl;
+            return 1;
+        }
+        if (!load(argv[2], history)) {
+            return 1;
+        }
+        std::vector<uint64_t> rows;
+        fix_history::scan_stats st;
+        history.scan(ranges, rows, &st);
+        print_header();
+        for (auto row : rows) {
+            print_row(history, row);
+        }
+        std::cerr << "matched " << rows.size() << " of " << history.size() << " rows, scanned "
+                  << st.scanned << " chunks, skipped " << st.skipped << " chunks" << std::endl;
+        return 0;
+    }
+    if (cmd == "mean" && argc == 5) {
+        fix_history::column col;
+        int window = std::atoi(argv[4]);
+        if (!fix_history::parse_column(argv[3], col) || window < 1) {
+            usage();
+            return 1;
+        }
+        if (!load(argv[2], history)) {
+            return 1;
+        }
+        std::vector<double> mean;
+        history.rolling_mean(col, window, mean);
+        std::printf("row,utc,%s,mean\n", argv[3]);
+        uint64_t first = history.chunk_count() > 0 ? history.get_chunk(0).first_row : 0;
+        double values[fix_history::column_count];
+        for (size_t i = 0; i < mean.size(); i++) {
+            history.get_row(first + i, values);
+            std::printf("%llu,", (unsigned long long)(first + i));
+            print_value(fix_history::utc, values[fix_history::utc]);
+            std::printf(",");
+            print_value(col, values[col]);
+            std::printf(",");
+            if (!std::isnan(mean[i])) {
+                std::printf("%g", mean[i]);
+            }
+            std::printf("\n");
+        }
+        return 0;
+    }
+
+    if (cmd == "accuracy" && (argc == 3 || argc == 6)) {
+        enu_accuracy::config conf;
+        if (argc == 6) {
+            conf.latitude = std::atof(argv[3]);
+            conf.longitude = std::atof(argv[4]);
+            conf.altitude = std::atof(argv[5]);
+        }
+        if (!load(argv[2], history) || !accuracy(history, conf)) {
+            return 1;
+        }
+        return 0;
+    }
+
+    usage();
+    return 1;
+}
@@ -0,0 +1,126 @@
+/**
+ * @file gps_load.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief CPUとメモリの負荷を掛ける（gps_testのリアルタイムモードの確認用）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * カメラの画像処理の代わりに、全コアでメモリを書き換え続けるスレッドを動かす。
+ * 動かしている間のgps_testの起床の遅れ（終了時のwakeupのヒストグラム）を
+ * RealTime = 0 と 1 で比較する。
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static std::atomic<bool> stop(false);
+
+/**
+ * @brief 終了のシグナル
+ *
+ * @param signo
+ */
+static void on_signal(int signo)
+{
+    (void)signo;
+    stop = true;
+}
+
+/**
+ * @brief 負荷を掛けるスレッド
+ *
+ * キャッシュに収まらないバッファを書き換え続ける（CPUとメモリ帯域の両方を使う）。
+ *
+ * @param size バッファのサイズ(byte)
+ * @param passes バッファを一周した回数
+ */
+static void load_proc(size_t size, std::atomic<uint64_t> &passes)
+{
+    std::vector<uint64_t> buf(size / sizeof(uint64_t), 1);
+    uint64_t x = 88172645463325252ull;
+    while (!stop) {
+        for (size_t i = 0; i < buf.size() && !stop; i += 8) {
+            // xorshiftで値を作って書き込む（最適化で消されないように前の値を使う）
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            buf[i] += x;
+        }
+        passes++;
+    }
+}
+
+static void usage()
+{
+    std::cerr << "usage: gps_load [-j threads] [-m megabytes] [-d seconds]" << std::endl;
+    std::cerr << "  -j  load threads (default: number of cores)" << std::endl;
+    std::cerr << "  -m  buffer per thread in MiB (default 16)" << std::endl;
+    std::cerr << "  -d  duration in seconds (default 0: until SIGINT/SIGTERM)" << std::endl;
+}
+
+/**
+ * @brief メイン関数
+ *
+ * @return int
+ */
+int main(int argc, char *argv[])
+{
+    int threads = 0;
+    size_t megabytes = 16;
+    int duration = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc) {
+            threads = std::stoi(argv[++i]);
+        }
+        else if (arg == "-m" && i + 1 < argc) {
+            megabytes = std::max(1ul, std::stoul(argv[++i]));
+        }
+        else if (arg == "-d" && i + 1 < argc) {
+            duration = std::stoi(argv[++i]);
+        }
+        else {
+            usage();
+            return 2;
+        }
+    }
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    std::vector<std::atomic<uint64_t>> passes(threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        passes[t] = 0;
+        workers.emplace_back(load_proc, megabytes * 1024 * 1024, std::ref(passes[t]));
+    }
+    std::cout << "gps_load: " << threads << " threads, " << megabytes << " MiB each" << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    while (!stop) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (duration > 0 && std::chrono::steady_clock::now() - start >= std::chrono::seconds(duration)) {
+            stop = true;
+        }
+    }
+    uint64_t total = 0;
+    for (int t = 0; t < threads; t++) {
+        workers[t].join();
+        total += passes[t];
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "gps_load: " << elapsed << " s, " << total * megabytes / elapsed << " MiB/s written" << std::endl;
+    return 0;
+}
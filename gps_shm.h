@@ -0,0 +1,163 @@
+/**
+ * @file gps_shm.h
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 最新の測位結果の共有メモリ（C/C++共通）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * gps_testがエポック毎に測位結果をPOSIX共有メモリへ書き込み、
+ * 他のプロセスはmmapした領域をシステムコールなしで読み出す。
+ * 書き込みは1プロセスのみ、読み出しは何プロセスでもよい（seqlock）。
+ *
+ * 読み出し例
+ *      int fd = shm_open(GPS_SHM_NAME, O_RDONLY, 0);
+ *      const struct gps_shm *shm = mmap(NULL, sizeof(struct gps_shm), PROT_READ, MAP_SHARED, fd, 0);
+ *      struct gps_shm_fix fix;
+ *      if (gps_shm_check(shm) && gps_shm_read(shm, &fix)) { ... }
+ */
+
+#ifndef GPS_SHM_H
+#define GPS_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GPS_SHM_NAME        "/gps_test"
+#define GPS_SHM_MAGIC       0x48535047u     /* "GPSH" */
+#define GPS_SHM_VERSION     1u
+#define GPS_SHM_MAX_SV      64
+
+/* gps_shm_fix.flags */
+#define GPS_SHM_SUM_ERR         0x0001u     /* チェックサムエラー */
+#define GPS_SHM_UTC_ERR         0x0002u     /* UTCチェックエラー */
+#define GPS_SHM_POSITION_ERR    0x0004u     /* 位置チェックエラー */
+#define GPS_SHM_TIMEOUT         0x0008u     /* タイムアウト */
+
+/* gps_shm_sv.sys */
+#define GPS_SHM_SYS_GPS         1
+#define GPS_SHM_SYS_GLONASS     2
+#define GPS_SHM_SYS_GALILEO     3
+#define GPS_SHM_SYS_BEIDOU      4
+
+/**
+ * @brief 衛星情報（値が無い項目は-1）
+ *
+ */
+struct gps_shm_sv {
+    int16_t svid;
+    int16_t elv;            /* 仰角（度） */
+    int16_t az;             /* 方位角（度） */
+    int16_t cno;            /* C/N0（dBHz） */
+    uint8_t sys;            /* GPS_SHM_SYS_* */
+    uint8_t active;         /* 1: 測位に使用 */
+    uint8_t reserved[2];
+};
+
+/**
+ * @brief 1エポック分の測位結果（値が無い項目はNaN）
+ *
+ */
+struct gps_shm_fix {
+    uint64_t generation;    /* エポック毎に1ずつ増える（0は未書き込み） */
+    uint64_t mono_ns;       /* 受信時刻（CLOCK_MONOTONIC, ns） */
+    int64_t utc;            /* GPS時刻（エポック秒）、無効なら-1 */
+    double latitude;        /* 緯度（度） */
+    double longitude;       /* 経度（度） */
+    double altitude;        /* 高度（m） */
+    double pdop;
+    double hdop;
+    double vdop;
+    int32_t num_sv;         /* 使用した衛星の数 */
+    uint32_t flags;         /* GPS_SHM_* */
+    int32_t sum_err_cnt;
+    int32_t utc_err_cnt;
+    int32_t position_err_cnt;
+    int32_t timeout_cnt;
+    uint32_t sv_count;      /* sv[]の有効数 */
+    uint32_t reserved;
+    struct gps_shm_sv sv[GPS_SHM_MAX_SV];
+};
+
+/**
+ * @brief 共有メモリのレイアウト
+ *
+ */
+struct gps_shm {
+    uint32_t magic;         /* GPS_SHM_MAGIC */
+    uint32_t version;       /* GPS_SHM_VERSION */
+    uint32_t size;          /* sizeof(struct gps_shm) */
+    uint32_t seq;           /* seqlock（奇数は書き込み中） */
+    struct gps_shm_fix fix;
+};
+
+/**
+ * @brief レイアウトが一致するか確認
+ *
+ * @param shm 共有メモリ
+ * @return int 1: 一致, 0: 不一致
+ */
+static inline int gps_shm_check(const struct gps_shm *shm)
+{
+    return shm->magic == GPS_SHM_MAGIC && shm->version == GPS_SHM_VERSION &&
+           shm->size == sizeof(struct gps_shm);
+}
+
+/**
+ * @brief 読み出し開始（書き込み中なら待つ）
+ *
+ * @param shm 共有メモリ
+ * @return uint32_t gps_shm_read_retry()に渡す値
+ */
+static inline uint32_t gps_shm_read_begin(const struct gps_shm *shm)
+{
+    uint32_t seq;
+    while ((seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE)) & 1u) {
+        /* 書き込み中 */
+    }
+    return seq;
+}
+
+/**
+ * @brief 読み出し中に書き込まれたか確認
+ *
+ * shm->fixのフィールドを直接（コピーせずに）参照する場合は
+ * gps_shm_read_begin()と本関数の間で読み出し、0が返るまで繰り返す。
+ *
+ * @param shm 共有メモリ
+ * @param seq gps_shm_read_begin()の戻り値
+ * @return int 1: 読み直しが必要, 0: 読み出した値は一貫している
+ */
+static inline int gps_shm_read_retry(const struct gps_shm *shm, uint32_t seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&shm->seq, __ATOMIC_RELAXED) != seq;
+}
+
+/**
+ * @brief 最新の測位結果をコピー
+ *
+ * @param shm 共有メモリ
+ * @param fix コピー先
+ * @return int 1: 書き込み済み, 0: まだ書き込まれていない
+ */
+static inline int gps_shm_read(const struct gps_shm *shm, struct gps_shm_fix *fix)
+{
+    uint32_t seq;
+    do {
+        seq = gps_shm_read_begin(shm);
+        memcpy(fix, (const void *)&shm->fix, sizeof(*fix));
+    } while (gps_shm_read_retry(shm, seq));
+    return fix->generation != 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
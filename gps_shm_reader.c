@@ -0,0 +1,76 @@
+/**
+ * @file gps_shm_reader.c
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 共有メモリの読み出しサンプル
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "gps_shm.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief メイン関数
+ *
+ * 最新の測位結果を1秒毎に表示する。
+ *
+ * @return int
+ */
+int main(void)
+{
+    int fd = shm_open(GPS_SHM_NAME, O_RDONLY, 0);
+    if (fd < 0) {
+        perror("shm_open");
+        return EXIT_FAILURE;
+    }
+    const struct gps_shm *shm = mmap(NULL, sizeof(struct gps_shm), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        perror("mmap");
+        return EXIT_FAILURE;
+    }
+    if (!gps_shm_check(shm)) {
+        fprintf(stderr, "gps_shm: layout mismatch\n");
+        return EXIT_FAILURE;
+    }
+
+    uint64_t last = 0;
+    while (1) {
+        /* 必要なフィールドだけならコピーせずに読み出せる */
+        uint64_t generation;
+        uint32_t seq;
+        do {
+            seq = gps_shm_read_begin(shm);
+            generation = shm->fix.generation;
+        } while (gps_shm_read_retry(shm, seq));
+
+        if (generation != last) {
+            /* 衛星情報も含めて一貫したスナップショットを取る */
+            struct gps_shm_fix fix;
+            gps_shm_read(shm, &fix);
+            last = fix.generation;
+            printf("gen=%llu utc=%lld lat=%.7f lon=%.7f alt=%.1f num_sv=%d "
+                   "PDOP=%.2f HDOP=%.2f VDOP=%.2f flags=0x%x sv=%u\n",
+                   (unsigned long long)fix.generation, (long long)fix.utc,
+                   fix.latitude, fix.longitude, fix.altitude, fix.num_sv,
+                   fix.pdop, fix.hdop, fix.vdop, fix.flags, fix.sv_count);
+            for (uint32_t i = 0; i < fix.sv_count; i++) {
+                const struct gps_shm_sv *sv = &fix.sv[i];
+                printf("  sys=%u svid=%3d elv=%3d az=%4d cno=%3d%s\n",
+                       sv->sys, sv->svid, sv->elv, sv->az, sv->cno, sv->active ? " *" : "");
+            }
+            fflush(stdout);
+        }
+        sleep(1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,604 @@
+/**
+ * @file gps_sim.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 受信機のシミュレーター（NMEAの生成と異常の注入）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "gps_sim.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static const double earth_radius = 6378137.0;   // m
+static const double rad_to_deg = 180.0 / M_PI;
+static const double deg_to_rad = M_PI / 180.0;
+
+static const char *talker[gps_sim::constellation_count] = {"GP", "GL", "GA", "GB"};
+static const int svid_base[gps_sim::constellation_count] = {1, 65, 1, 1};
+static const int system_id[gps_sim::constellation_count] = {1, 2, 3, 4};
+static const int signal_id[gps_sim::constellation_count] = {1, 1, 7, 1};
+static const int jam_seconds = 5;       // 妨害の継続時間
+static const int jam_attenuation = 12;  // 妨害中のC/N0の低下(dB)
+static const int jam_lost_cno = 20;     // これより低い衛星は追尾が外れる
+
+/**
+ * @brief Construct a new gps sim::config::config object
+ *
+ * 既定値はubx.cppのサンプルと同じ位置・衛星数
+ */
+gps_sim::config::config() :
+rate_hz(1),
+latitude(35.6706332),
+longitude(139.3728955),
+altitude(148.0),
+speed(0),
+heading(0),
+turn_rate(0),
+climb_rate(0),
+start_time(0),
+seed(1),
+cold_start_s(0),
+assisted_start_s(5.0),
+hot_start_s(1.0)
+{
+    sv_count[gps] = 10;
+    sv_count[glonass] = 11;
+    sv_count[galileo] = 1;
+    sv_count[beidou] = 0;
+    backup_file[0] = '\0';
+    for (int i = 0; i < fault_count; i++) {
+        fault_rate[i] = 0;
+    }
+}
+
+/**
+ * @brief Construct a new gps sim::gps sim object
+ *
+ * @param conf 設定
+ */
+gps_sim::gps_sim(const config &conf) :
+conf(conf),
+rng(conf.seed),
+latitude(conf.latitude),
+longitude(conf.longitude),
+altitude(conf.altitude),
+heading(conf.heading),
+epochs(0),
+jam_epochs(0),
+assist_time(false),
+assist_position(false),
+assist_data(false),
+ack_aiding(false),
+restore_status(0),
+stopped(false),
+ubx_out_len(0)
+{
+    if (this->conf.rate_hz < 1) {
+        this->conf.rate_hz = 1;
+    }
+    if (this->conf.rate_hz > 50) {
+        this->conf.rate_hz = 50;
+    }
+    if (conf.start_time != 0) {
+        base_ms = (int64_t)conf.start_time * 1000;
+    }
+    else {
+        base_ms = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count() * 1000;
+    }
+    for (int i = 0; i < fault_count; i++) {
+        injected[i] = 0;
+        pending[i] = false;
+    }
+    fix_epoch = (uint64_t)std::llround(std::max(this->conf.cold_start_s, 0.0) * this->conf.rate_hz);
+    this->conf.backup_file[sizeof(this->conf.backup_file) - 1] = '\0';
+    if (this->conf.backup_file[0] != '\0') {
+        // 起動時に保存した航法データを復元（受信機は結果を1回出力する）
+        FILE *fp = std::fopen(this->conf.backup_file, "r");
+        restore_status = 3;
+        if (fp != nullptr) {
+            long long saved_ms = 0;
+            if (std::fscanf(fp, "gps_sim backup %lld", &saved_ms) == 1) {
+                restore_status = 2;
+                uint64_t e = (uint64_t)std::llround(std::max(this->conf.hot_start_s, 0.0) * this->conf.rate_hz);
+                fix_epoch = std::min(fix_epoch, e);
+            }
+            else {
+                restore_status = 1;
+            }
+            std::fclose(fp);
+        }
+        const uint8_t msg[8] = { 3, 0, 0, 0, (uint8_t)restore_status, 0, 0, 0 };
+        add_ubx(0x09, 0x14, msg, sizeof(msg));
+    }
+}
+
+/**
+ * @brief 次のエポックで異常を注入
+ *
+ * @param f 異常
+ */
+void gps_sim::inject(fault f)
+{
+    if (f < fault_count) {
+        pending[f] = true;
+    }
+}
+
+/**
+ * @brief 受信機へ書き込まれたUBXメッセージを処理
+ *
+ * CFG-VALSETにはACK-ACKを返し、CFG-NAVSPG-ACKAIDINGが含まれていればMGA-ACKを有効にする。
+ * UBX-MGAは種類を記録して（有効なら）MGA-ACKを返す。時刻と軌道が揃った時点から
+ * assisted_start_s秒（位置が無ければ2倍）で測位する。
+ *
+ * @param data UBXメッセージ（複数可）
+ * @param len バイト数
+ */
+void gps_sim::receive(const uint8_t *data, size_t len)
+{
+    size_t pos = 0;
+    while (pos + 8 <= len) {
+        if (data[pos] != 0xb5 || data[pos + 1] != 0x62) {
+            pos++;
+            continue;
+        }
+        uint8_t cls = data[pos + 2];
+        uint8_t id = data[pos + 3];
+        size_t plen = data[pos + 4] | (data[pos + 5] << 8);
+        if (pos + 8 + plen > len) {
+            break;
+        }
+        const uint8_t *p = &data[pos + 6];
+        if (cls == 0x06 && id == 0x8a) {
+            // CFG-VALSET: 鍵と値の組（ACKAIDINGは1バイト）
+            for (size_t i = 4; i + 5 <= plen; ) {
+                uint32_t key = p[i] | (p[i + 1] << 8) | (p[i + 2] << 16) | ((uint32_t)p[i + 3] << 24);
+                size_t size = 1;
+                switch ((key >> 28) & 0x7) {
+                case 3: size = 2; break;
+                case 4: size = 4; break;
+                case 5: size = 8; break;
+                }
+                if (key == 0x10110025) {
+                    ack_aiding = p[i + 4] != 0;
+                }
+                i += 4 + size;
+            }
+            const uint8_t ack[2] = { cls, id };
+            add_ubx(0x05, 0x01, ack, sizeof(ack));
+        }
+        else if (cls == 0x06 && id == 0x04 && plen >= 4) {
+            // CFG-RST（GNSSの停止と再開だけ、ACKは返さない）
+            if (p[2] == 0x08) {
+                stopped = true;
+            }
+            else if (p[2] == 0x09) {
+                stopped = false;
+            }
+        }
+        else if (cls == 0x09 && id == 0x14 && conf.backup_file[0] != '\0') {
+            receive_sos(p, plen);
+        }
+        else if (cls == 0x13) {
+            if (id == 0x40 && plen > 0 && p[0] == 0x10) {
+                assist_time = true;
+            }
+            else if (id == 0x40 && plen > 0 && p[0] == 0x01) {
+                assist_position = true;
+            }
+            else if (id != 0x40) {
+                assist_data = true;
+            }
+            if (ack_aiding) {
+                uint8_t ack[8] = { 1, 0, 0, id, 0, 0, 0, 0 };
+                for (size_t i = 0; i < 4 && i < plen; i++) {
+                    ack[4 + i] = p[i];
+                }
+                add_ubx(0x13, 0x60, ack, sizeof(ack));
+            }
+            if (assist_time && assist_data) {
+                // 位置が無ければ衛星の探索に時間がかかる
+                double s = assist_position ? conf.assisted_start_s : conf.assisted_start_s * 2;
+                uint64_t e = epochs + (uint64_t)std::llround(s * conf.rate_hz);
+                fix_epoch = std::min(fix_epoch, e);
+            }
+        }
+        pos += 8 + plen;
+    }
+}
+
+/**
+ * @brief UPD-SOSを処理
+ *
+ * @param payload ペイロード（無ければ復元の結果の問い合わせ）
+ * @param len ペイロードの長さ
+ */
+void gps_sim::receive_sos(const uint8_t *payload, size_t len)
+{
+    if (len == 0) {
+        const uint8_t msg[8] = { 3, 0, 0, 0, (uint8_t)restore_status, 0, 0, 0 };
+        add_ubx(0x09, 0x14, msg, sizeof(msg));
+        return;
+    }
+    if (payload[0] == 0) {
+        // 保存（GNSSを止めていなくても受け付ける）
+        FILE *fp = std::fopen(conf.backup_file, "w");
+        bool ok = fp != nullptr;
+        if (ok) {
+            ok = std::fprintf(fp, "gps_sim backup %lld\n", (long long)(base_ms + (int64_t)(epochs * 1000 / conf.rate_hz))) > 0;
+            ok = (std::fclose(fp) == 0) && ok;
+        }
+        const uint8_t msg[8] = { 2, 0, 0, 0, (uint8_t)(ok ? 1 : 0), 0, 0, 0 };
+        add_ubx(0x09, 0x14, msg, sizeof(msg));
+    }
+    else if (payload[0] == 1) {
+        std::remove(conf.backup_file);
+    }
+}
+
+/**
+ * @brief UBXメッセージを出力待ちに追加
+ *
+ * @param cls クラス
+ * @param id ID
+ * @param payload ペイロード
+ * @param len ペイロードの長さ
+ */
+void gps_sim::add_ubx(uint8_t cls, uint8_t id, const uint8_t *payload, size_t len)
+{
+    if (ubx_out_len + 8 + len > sizeof(ubx_out)) {
+        // 出力バッファが一杯（受信機も溢れた分は捨てる）
+        return;
+    }
+    char *p = ubx_out + ubx_out_len;
+    p[0] = '\xb5';
+    p[1] = '\x62';
+    p[2] = (char)cls;
+    p[3] = (char)id;
+    p[4] = (char)(len & 0xff);
+    p[5] = (char)(len >> 8);
+    std::memcpy(p + 6, payload, len);
+    uint8_t ck_a = 0;
+    uint8_t ck_b = 0;
+    for (size_t i = 2; i < 6 + len; i++) {
+        ck_a += static_cast<uint8_t>(p[i]);
+        ck_b += ck_a;
+    }
+    p[6 + len] = (char)ck_a;
+    p[7 + len] = (char)ck_b;
+    ubx_out_len += 8 + len;
+}
+
+/**
+ * @brief 測位しているか
+ *
+ * @return true 測位している
+ * @return false コールドスタート中
+ */
+bool gps_sim::has_fix() const
+{
+    return epochs >= fix_epoch;
+}
+
+/**
+ * @brief 出力レートを取得
+ *
+ * @return int レート(Hz)
+ */
+int gps_sim::get_rate() const
+{
+    return conf.rate_hz;
+}
+
+/**
+ * @brief 生成したエポック数を取得
+ *
+ * @return uint64_t エポック数
+ */
+uint64_t gps_sim::get_epochs() const
+{
+    return epochs;
+}
+
+/**
+ * @brief 注入した異常の回数を取得
+ *
+ * @param f 異常
+ * @return uint64_t 回数
+ */
+uint64_t gps_sim::get_injected(fault f) const
+{
+    return (f < fault_count) ? injected[f] : 0;
+}
+
+/**
+ * @brief 異常の名前を取得
+ *
+ * @param f 異常
+ * @return const char* 名前
+ */
+const char *gps_sim::fault_name(fault f)
+{
+    static const char *names[fault_count] = {
+        "bad_checksum", "drop_sentence", "truncate", "time_jump", "out_of_range", "conflict", "jamming"
+    };
+    return (f < fault_count) ? names[f] : "unknown";
+}
+
+/**
+ * @brief 異常を注入するか判定（注入する場合は回数を数える）
+ *
+ * @param f 異常
+ * @return true 注入する
+ * @return false 注入しない
+ */
+bool gps_sim::roll(fault f)
+{
+    bool hit = false;
+    if (pending[f]) {
+        pending[f] = false;
+        hit = true;
+    }
+    else if (conf.fault_rate[f] > 0) {
+        hit = std::uniform_real_distribution<double>(0.0, 1.0)(rng) < conf.fault_rate[f];
+    }
+    if (hit) {
+        injected[f]++;
+    }
+    return hit;
+}
+
+/**
+ * @brief チェックサムを付けてセンテンスを追加
+ *
+ * @param out 出力先
+ * @param body '$'と'*'の間
+ */
+void gps_sim::add_sentence(std::string &out, const char *body)
+{
+    if (roll(drop_sentence)) {
+        return;
+    }
+    uint8_t sum = 0;
+    for (const char *p = body; *p != '\0'; p++) {
+        sum ^= static_cast<uint8_t>(*p);
+    }
+    if (roll(bad_checksum)) {
+        sum ^= 0x5a;
+    }
+    char tail[8];
+    std::snprintf(tail, sizeof(tail), "*%02X\r\n", sum);
+    out += '$';
+    out += body;
+    out += tail;
+}
+
+/**
+ * @brief GSVを追加
+ *
+ * 仰角・方位角は衛星番号から決め、方位角は時間とともにゆっくり回す。
+ *
+ * @param out 出力先
+ * @param c 衛星システム
+ */
+void gps_sim::add_gsv(std::string &out, constellation c)
+{
+    int n = conf.sv_count[c];
+    int num_msg = (n == 0) ? 1 : (n + 3) / 4;
+    int drift = (int)((base_ms / 1000 + epochs / conf.rate_hz) / 240);
+    char body[128];
+    for (int msg = 0; msg < num_msg; msg++) {
+        int len = std::snprintf(body, sizeof(body), "%sGSV,%d,%d,%02d", talker[c], num_msg, msg + 1, n);
+        for (int i = msg * 4; i < n && i < msg * 4 + 4; i++) {
+            int elv = 5 + (i * 37 + c * 11) % 85;
+            int az = (i * 97 + c * 53 + drift) % 360;
+            int cno = 20 + (i * 13 + c * 7) % 30 + std::uniform_int_distribution<int>(-2, 2)(rng);
+            if (jam_epochs > 0) {
+                cno -= jam_attenuation;
+                if (cno < jam_lost_cno) {
+                    // 妨害で追尾が外れた（C/N0は空欄）
+                    len += std::snprintf(body + len, sizeof(body) - len, ",%02d,%02d,%03d,", svid_base[c] + i, elv, az);
+                    continue;
+                }
+            }
+            len += std::snprintf(body + len, sizeof(body) - len, ",%02d,%02d,%03d,%02d", svid_base[c] + i, elv, az, cno);
+        }
+        std::snprintf(body + len, sizeof(body) - len, ",%d", signal_id[c]);
+        add_sentence(out, body);
+    }
+}
+
+/**
+ * @brief GSAを追加（先頭から12機までを測位に使用、測位前は空欄）
+ *
+ * @param out 出力先
+ * @param c 衛星システム
+ * @param pdop
+ * @param hdop
+ * @param vdop
+ */
+void gps_sim::add_gsa(std::string &out, constellation c, double pdop, double hdop, double vdop)
+{
+    char body[128];
+    bool fix = has_fix();
+    int len = std::snprintf(body, sizeof(body), "GNGSA,A,%d", fix ? 3 : 1);
+    for (int i = 0; i < 12; i++) {
+        if (fix && i < conf.sv_count[c]) {
+            len += std::snprintf(body + len, sizeof(body) - len, ",%02d", svid_base[c] + i);
+        }
+        else {
+            len += std::snprintf(body + len, sizeof(body) - len, ",");
+        }
+    }
+    std::snprintf(body + len, sizeof(body) - len, ",%.2f,%.2f,%.2f,%d", pdop, hdop, vdop, system_id[c]);
+    add_sentence(out, body);
+}
+
+/**
+ * @brief 緯度・経度をNMEAの形式(度分)に変換
+ *
+ * @param buf 出力先
+ * @param size 出力先のサイズ
+ * @param deg 度
+ * @param width 度の桁数
+ */
+static void format_coordinate(char *buf, size_t size, double deg, int width)
+{
+    unsigned long long m = std::llround(std::fabs(deg) * 60.0 * 100000.0);
+    unsigned long long d = m / (60 * 100000ULL);
+    unsigned rem = m % (60 * 100000ULL);
+    std::snprintf(buf, size, "%0*llu%02u.%05u", width, d, rem / 100000, rem % 100000);
+}
+
+/**
+ * @brief 1エポック分のNMEAを生成
+ *
+ * @param out 出力先（確保済みの容量を使い回す）
+ */
+void gps_sim::next_burst(std::string &out)
+{
+    out.clear();
+
+    if (roll(time_jump)) {
+        base_ms += std::uniform_int_distribution<int>(2, 30)(rng) * 1000;
+    }
+    bool position_fault = roll(out_of_range);
+    if (jam_epochs > 0) {
+        jam_epochs--;
+    }
+    else if (roll(jamming)) {
+        jam_epochs = jam_seconds * conf.rate_hz;
+    }
+
+    // 時刻
+    int64_t now_ms = base_ms + (int64_t)(epochs * 1000 / conf.rate_hz);
+    std::time_t t = (std::time_t)(now_ms / 1000);
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char time_str[32];
+    char date_str[32];
+    std::snprintf(time_str, sizeof(time_str), "%02d%02d%02d.%02d",
+                  tm.tm_hour, tm.tm_min, tm.tm_sec, (int)(now_ms % 1000) / 10);
+    std::snprintf(date_str, sizeof(date_str), "%02d%02d%02d", tm.tm_mday, tm.tm_mon + 1, tm.tm_year % 100);
+
+    // 位置
+    char lat_str[32];
+    char lon_str[32];
+    format_coordinate(lat_str, sizeof(lat_str), latitude, 2);
+    format_coordinate(lon_str, sizeof(lon_str), longitude, 3);
+    char ns = latitude >= 0 ? 'N' : 'S';
+    char ew = longitude >= 0 ? 'E' : 'W';
+    double alt = position_fault ? altitude + 100000.0 : altitude;
+
+    // DOP（使用衛星数から概算）
+    int num_sv = 0;
+    for (int c = 0; c < constellation_count; c++) {
+        num_sv += conf.sv_count[c] < 12 ? conf.sv_count[c] : 12;
+    }
+    double hdop = num_sv >= 4 ? 0.6 + 4.0 / num_sv : 99.99;
+    double pdop = num_sv >= 4 ? hdop * 1.6 : 99.99;
+    double vdop = num_sv >= 4 ? hdop * 1.3 : 99.99;
+
+    double knots = conf.speed * 1.943844;
+    char course[16] = "";
+    if (conf.speed > 0) {
+        std::snprintf(course, sizeof(course), "%.1f", heading);
+    }
+
+    // 受信機へ書き込まれたメッセージへの応答
+    out.append(ubx_out, ubx_out_len);
+    ubx_out_len = 0;
+    if (stopped) {
+        return;
+    }
+
+    char body[256];
+    if (has_fix()) {
+        std::snprintf(body, sizeof(body), "GNRMC,%s,A,%s,%c,%s,%c,%.3f,%s,%s,,,A,V",
+                      time_str, lat_str, ns, lon_str, ew, knots, course, date_str);
+        add_sentence(out, body);
+        std::snprintf(body, sizeof(body), "GNVTG,%s,T,,M,%.3f,N,%.3f,K,A", course, knots, conf.speed * 3.6);
+        add_sentence(out, body);
+        std::snprintf(body, sizeof(body), "GNGGA,%s,%s,%c,%s,%c,1,%02d,%.2f,%.1f,M,38.9,M,,",
+                      time_str, lat_str, ns, lon_str, ew, num_sv > 99 ? 99 : num_sv, hdop, alt);
+        add_sentence(out, body);
+    }
+    else {
+        // 測位前（時刻はRTCから出力される）
+        std::snprintf(body, sizeof(body), "GNRMC,%s,V,,,,,,,%s,,,N,V", time_str, date_str);
+        add_sentence(out, body);
+        add_sentence(out, "GNVTG,,,,,,,,,N");
+        std::snprintf(body, sizeof(body), "GNGGA,%s,,,,,0,00,99.99,,,,,,", time_str);
+        add_sentence(out, body);
+    }
+    if (!has_fix()) {
+        pdop = hdop = vdop = 99.99;
+    }
+    for (int c = 0; c < constellation_count; c++) {
+        add_gsa(out, (constellation)c, pdop, hdop, vdop);
+    }
+    for (int c = 0; c < constellation_count; c++) {
+        add_gsv(out, (constellation)c);
+    }
+    if (has_fix()) {
+        std::snprintf(body, sizeof(body), "GNGLL,%s,%c,%s,%c,%s,A,A", lat_str, ns, lon_str, ew, time_str);
+    }
+    else {
+        std::snprintf(body, sizeof(body), "GNGLL,,,,,%s,V,N", time_str);
+    }
+    add_sentence(out, body);
+
+    // 0xFFの混入
+    if (roll(conflict)) {
+        size_t pos = std::uniform_int_distribution<size_t>(0, out.size())(rng);
+        out.insert(pos, 16, '\xff');
+    }
+
+    // バーストの途中で切れる（センテンスの途中で切る）
+    if (out.size() > 2 && roll(truncate)) {
+        size_t pos = std::uniform_int_distribution<size_t>(1, out.size() - 2)(rng);
+        if (out[pos - 1] == '\n' || out[pos - 1] == '\r') {
+            pos++;
+        }
+        out.resize(pos);
+    }
+
+    epochs++;
+    step();
+}
+
+/**
+ * @brief 軌跡に沿って1エポック分進める
+ *
+ */
+void gps_sim::step()
+{
+    double dt = 1.0 / conf.rate_hz;
+    heading = std::fmod(heading + conf.turn_rate * dt + 360.0, 360.0);
+    double north = conf.speed * std::cos(heading * deg_to_rad) * dt;
+    double east = conf.speed * std::sin(heading * deg_to_rad) * dt;
+    latitude += north / earth_radius * rad_to_deg;
+    if (latitude > 89.9) {
+        latitude = 89.9;
+    }
+    if (latitude < -89.9) {
+        latitude = -89.9;
+    }
+    longitude += east / (earth_radius * std::cos(latitude * deg_to_rad)) * rad_to_deg;
+    if (longitude >= 180.0) {
+        longitude -= 360.0;
+    }
+    if (longitude < -180.0) {
+        longitude += 360.0;
+    }
+    altitude += conf.climb_rate * dt;
+}
@@ -0,0 +1,124 @@
+/**
+ * @file gps_sim.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 受信機のシミュレーター（NMEAの生成と異常の注入）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef GPS_SIM_HPP
+#define GPS_SIM_HPP
+
+#include <cstdint>
+#include <ctime>
+#include <random>
+#include <string>
+
+/**
+ * @brief 受信機のシミュレーター
+ *
+ * 設定した軌跡に沿って移動する受信機のNMEA(RMC,VTG,GGA,GSA,GSV,GLL)を
+ * 1エポック分ずつ生成する。設定した確率、またはinject()の指定で異常を注入する。
+ * 起動からcold_start_s秒間は測位できない（コールドスタート）。receive()で支援データ(UBX-MGA)の
+ * 時刻と軌道を受け取ると、その時点からassisted_start_s秒（位置も受け取れば）で測位する。MGA-ACKはCFG-VALSETで有効にされた場合だけ返す。
+ * UPD-SOSで保存を指示されるとbackup_fileを作り、次の起動時にあればhot_start_s秒で測位する（ホットスタート）。
+ * CFG-RSTでGNSSを止めている間はNMEAを出力しない。
+ * ddc_emuが共有メモリに置くので、トリビアルにコピーできる型だけをメンバーに持つ（ポインターやstd::stringを持たない）。
+ */
+class gps_sim
+{
+public:
+    /**
+     * @brief 注入する異常
+     *
+     */
+    enum fault {
+        bad_checksum,       // チェックサム不正（センテンス毎）
+        drop_sentence,      // センテンスの欠落（センテンス毎）
+        truncate,           // バーストの途中で切れる
+        time_jump,          // 時刻の飛び
+        out_of_range,       // 範囲外の位置（高度）
+        conflict,           // 0xFFの混入（I2Cのコンフリクト）
+        jamming,            // 数秒間すべての衛星のC/N0が下がり、弱い衛星は追尾が外れる
+        fault_count
+    };
+
+    /**
+     * @brief 衛星システム
+     *
+     */
+    enum constellation {
+        gps,
+        glonass,
+        galileo,
+        beidou,
+        constellation_count
+    };
+
+    class config {
+    public:
+        int rate_hz;                        // 出力レート(1～50Hz)
+        int sv_count[constellation_count];  // 衛星システム毎の衛星数
+        double latitude;                    // 開始位置(deg)
+        double longitude;                   // 開始位置(deg)
+        double altitude;                    // 開始位置(m)
+        double speed;                       // 速度(m/s)
+        double heading;                     // 進行方向(deg、北から時計回り)
+        double turn_rate;                   // 旋回(deg/s)
+        double climb_rate;                  // 上昇(m/s)
+        std::time_t start_time;             // 開始時刻(0なら現在時刻)
+        double fault_rate[fault_count];     // 異常の発生確率(0～1)
+        uint32_t seed;                      // 乱数の種
+        double cold_start_s;                // 支援データが無い時の初回測位までの時間(秒)
+        double assisted_start_s;            // 支援データを受け取ってから初回測位までの時間(秒)
+        char backup_file[256];              // UPD-SOSで保存する航法データ（空ならUPD-SOSに応答しない）
+        double hot_start_s;                 // 保存した航法データを復元した時の初回測位までの時間(秒)
+
+        config();
+    };
+
+    gps_sim(const config &conf);
+    void next_burst(std::string &out);
+    void receive(const uint8_t *data, size_t len);
+    void inject(fault f);
+    int get_rate() const;
+    uint64_t get_epochs() const;
+    uint64_t get_injected(fault f) const;
+    bool has_fix() const;
+    static const char *fault_name(fault f);
+
+private:
+    config conf;
+    std::mt19937 rng;
+    int64_t base_ms;            // 開始時刻(UTC ms、時刻の飛びを含む)
+    double latitude;
+    double longitude;
+    double altitude;
+    double heading;
+    uint64_t epochs;
+    int jam_epochs;             // 妨害の残りエポック数
+    uint64_t injected[fault_count];
+    bool pending[fault_count];  // inject()で指定された異常
+    uint64_t fix_epoch;         // 初回測位のエポック
+    bool assist_time;           // 受け取った支援データ（MGA-INI-TIME）
+    bool assist_position;       // MGA-INI-POS
+    bool assist_data;           // 衛星の軌道
+    bool ack_aiding;            // MGA-ACKを返す（CFG-VALSETで有効にされた）
+    int restore_status;         // UPD-SOSの復元の結果
+    bool stopped;               // CFG-RSTでGNSSを停止中
+    char ubx_out[1024];         // 次のバーストの前に出力するUBXメッセージ（入りきらない分は捨てる）
+    size_t ubx_out_len;
+
+    bool roll(fault f);
+    void add_sentence(std::string &out, const char *body);
+    void add_gsv(std::string &out, constellation c);
+    void add_gsa(std::string &out, constellation c, double pdop, double hdop, double vdop);
+    void step();
+    void add_ubx(uint8_t cls, uint8_t id, const uint8_t *payload, size_t len);
+    void receive_sos(const uint8_t *payload, size_t len);
+};
+
+#endif
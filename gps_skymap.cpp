@@ -0,0 +1,203 @@
+/**
+ * @file gps_skymap.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 方位角・仰角毎のC/N0の統計（スカイマップ）の作成・出力
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ * 入力はgps_testが保存したスカイマップ(SkyMapFile)またはNMEAログ。
+ * 複数の入力（別の試験、別の端末）は足し合わせる。
+ */
+
+#include "sky_map.hpp"
+#include "gps_check.hpp"
+#include "nmea_gsv.hpp"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+/**
+ * @brief 使い方を表示
+ *
+ */
+static void usage()
+{
+    std::cerr << "Usage: gps_skymap build [-r resolution] <skymap> <skymap|nmea log>..." << std::endl;
+    std::cerr << "       gps_skymap summary <skymap|nmea log>..." << std::endl;
+    std::cerr << "       gps_skymap csv <skymap|nmea log>..." << std::endl;
+    std::cerr << "       gps_skymap pgm [-s scale] [-l min] [-h max] <pgm> <skymap|nmea log>..." << std::endl;
+}
+
+/**
+ * @brief NMEAログのGSVをマップへ追加
+ *
+ * @param path ファイル
+ * @param map マップ
+ * @return true OK
+ * @return false ERROR
+ */
+static bool add_nmea(const std::string &path, sky_map &map)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) {
+        std::cerr << "gps_skymap: failed to open " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(ifs, line)) {
+        while (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        nmea_view s(line);
+        if (!s.contains("GSV") || check_sum(s) == false) {
+            continue;
+        }
+        nmea_gsv gsv(s);
+        for (auto svid : gsv.get_svid_list()) {
+            nmea_gsv::sv_info si = gsv.get_svinfo(svid);
+            map.add(si.elv, si.az, si.cno);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 入力を足し合わせる
+ *
+ * 最初のスカイマップの分解能に合わせる（NMEAログだけなら指定の分解能）。
+ *
+ * @param argc 引数の数
+ * @param argv 引数
+ * @param first 最初の入力
+ * @param map マップ
+ * @return true OK
+ * @return false ERROR
+ */
+static bool load_all(int argc, char *argv[], int first, sky_map &map)
+{
+    bool empty = true;
+    for (int i = first; i < argc; i++) {
+        sky_map other;
+        if (other.load(argv[i])) {
+            if (empty) {
+                map = other;
+            }
+            else if (!map.merge(other)) {
+                std::cerr << "gps_skymap: resolution mismatch " << argv[i] << " ("
+                          << other.get_resolution() << " deg, expected " << map.get_resolution() << " deg)" << std::endl;
+                return false;
+            }
+        }
+        else if (!add_nmea(argv[i], map)) {
+            return false;
+        }
+        empty = false;
+    }
+    return true;
+}
+
+/**
+ * @brief メイン関数
+ *
+ * @return int
+ */
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        usage();
+        return 1;
+    }
+    std::string cmd = argv[1];
+    int resolution = 5;
+    int scale = 8;
+    int lo = 10;
+    int hi = 50;
+    int arg = 2;
+    while (arg + 1 < argc && argv[arg][0] == '-') {
+        std::string opt = argv[arg];
+        int value = std::atoi(argv[arg + 1]);
+        if (opt == "-r") {
+            resolution = value;
+        }
+        else if (opt == "-s") {
+            scale = value;
+        }
+        else if (opt == "-l") {
+            lo = value;
+        }
+        else if (opt == "-h") {
+            hi = value;
+        }
+        else {
+            usage();
+            return 1;
+        }
+        arg += 2;
+    }
+    if (!sky_map::valid_resolution(resolution)) {
+        std::cerr << "gps_skymap: resolution must divide 90" << std::endl;
+        return 1;
+    }
+
+    sky_map map(resolution);
+    if (cmd == "build" && argc - arg >= 2) {
+        if (!load_all(argc, argv, arg + 1, map) || !map.save(argv[arg])) {
+            return 1;
+        }
+        std::cout << "observations : " << map.get_observations() << std::endl;
+        std::cout << "cells        : " << map.get_covered() << " / " << map.get_az_cells() * map.get_el_cells() << std::endl;
+        return 0;
+    }
+    if (cmd == "summary" && argc - arg >= 1) {
+        if (!load_all(argc, argv, arg, map)) {
+            return 1;
+        }
+        std::cout << "resolution   : " << map.get_resolution() << " deg" << std::endl;
+        std::cout << "observations : " << map.get_observations() << std::endl;
+        std::cout << "cells        : " << map.get_covered() << " / " << map.get_az_cells() * map.get_el_cells() << std::endl;
+        // 仰角毎の平均（アンテナの仰角特性）
+        for (int e = map.get_el_cells() - 1; e >= 0; e--) {
+            uint64_t count = 0;
+            uint64_t sum = 0;
+            for (int a = 0; a < map.get_az_cells(); a++) {
+                count += map.at(e, a).count;
+                sum += map.at(e, a).sum;
+            }
+            std::cout << "el " << e * map.get_resolution() << "-" << (e + 1) * map.get_resolution() << " : ";
+            if (count > 0) {
+                std::cout << (double)sum / count << " dB-Hz (" << count << ")";
+            }
+            else {
+                std::cout << "-";
+            }
+            std::cout << std::endl;
+        }
+        return 0;
+    }
+    if (cmd == "csv" && argc - arg >= 1) {
+        if (!load_all(argc, argv, arg, map)) {
+            return 1;
+        }
+        map.write_csv(std::cout);
+        return 0;
+    }
+    if (cmd == "pgm" && argc - arg >= 2) {
+        if (!load_all(argc, argv, arg + 1, map)) {
+            return 1;
+        }
+        if (scale < 1 || hi <= lo) {
+            std::cerr << "gps_skymap: invalid scale or range" << std::endl;
+            return 1;
+        }
+        if (!map.write_pgm(argv[arg], scale, lo, hi)) {
+            return 1;
+        }
+        return 0;
+    }
+
+    usage();
+    return 1;
+}
@@ -11,46 +11,180 @@
 
 
 #include "ubx.hpp"
-#include "nmea_gga.hpp"
-#include "nmea_rmc.hpp"
 #include "nmea_gsa.hpp"
 #include "nmea_gsv.hpp"
+#include "frame_renderer.hpp"
+#include "log_writer.hpp"
+#include "nmea_archive.hpp"
+#include "shm_publisher.hpp"
+#include "trace.hpp"
+#include "nmea_view.hpp"
+#include "fixed_vector.hpp"
+#include "epoch_arena.hpp"
+#include "gps_check.hpp"
+#include "gnss_core.hpp"
+#include "gps_conf.hpp"
+#include "gps_sim.hpp"
+#include "fix_history.hpp"
+#include "sv_monitor.hpp"
+#include "sky_map.hpp"
+#include "enu_accuracy.hpp"
+#include "flight_recorder.hpp"
+#include "mga_assist.hpp"
+#include "upd_sos.hpp"
+#include "rcu_ptr.hpp"
+#include "metrics.hpp"
+#include "triple_buffer.hpp"
+#include "realtime.hpp"
+#include "tx_ready.hpp"
+#ifdef GPS_TEST_ALLOC_CHECK
+#include "alloc_counter.hpp"
+#endif
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cstdio>
 #include <iostream>
 #include <iomanip>
 #include <limits>
+#include <memory>
 #include <random>
 #include <thread>
+#include <cstring>
+#include <poll.h>
 #include <signal.h>
-#include <fstream>
+#include <sys/inotify.h>
+#include <termios.h>
+#include <unistd.h>
 
 static std::atomic<bool> terminate(false);
-double MinimumLatitude = -90;
-double MaximumLatitude = 90;
-double MinimumLongitude = -180;
-double MaximumLongitude = 180;
-double MinimumAltitude = -1000;
-double MaximumAltitude = 10000;
-bool PositionError = false;
-bool LatitudeError = false;
-bool LongitudeError = false;
-bool AltitudeError = false;
-int PositionErrorCount = 0;
-int LatitudeErrorCount = 0;
-int LongitudeErrorCount = 0;
-int AltitudeErrorCount = 0;
+static std::atomic<bool> recorder_request(false);     // SIGUSR2
+log_writer::config LogConfig;
+std::string ArchiveFile = "gps_test.nmab";
+bool ArchiveCompress = true;
+std::string SharedMemoryName = GPS_SHM_NAME;
+std::string BrokerSocket = ubx::default_broker_path;
+std::string TraceFile = "gps_test_trace.json";
+size_t ArenaSize = 64 * 1024;
+size_t HistoryChunks = 16;
+std::string HistoryFile = "gps_test.fxh";
+bool ConfWatch = true;
+std::string MetricsSocket = "/tmp/gps_test_metrics.sock";
+int MetricsPort = 0;
+int RenderMaxFps = 10;
+int SkyMapResolution = 5;
+std::string SkyMapFile = "gps_test.skm";
+enu_accuracy::config AccuracyConfig;
+flight_recorder::config RecorderConfig;
+std::string AssistFile = "";
+std::string AssistPositionFile = "gps_test.pos";
+mga_assist::config AssistConfig;
+bool SosBackup = false;
+upd_sos::config SosConfig;
+realtime::config RealtimeConfig;
+tx_ready::config TxReadyConfig;
+gps_sim::config SimConfig;
 
 struct gps_test_param {
     bool print_nmea;
     bool print_sv;
+    bool headless;
+    bool logging;
+    bool archive;
+    bool broker;
+    bool simulate;
     gps_test_param() {
         print_nmea = false;
         print_sv = false;
+        headless = false;
+        logging = false;
+        archive = false;
+        broker = false;
+        simulate = false;
     }
 };
 
+/**
+ * @brief 動作中に再読み込みできる設定（SIGHUP、またはgps_test.confの変更で差し替える）
+ *
+ * ループスレッドはエポック毎にLiveConf.read()で最新のスナップショットを取得する（ロックなし）。
+ */
+class live_conf {
+public:
+    position_range range;                   // 位置の範囲
+    int timeout_ms = TimeoutLimit;          // 受信が途切れたと判定する時間
+    sv_monitor::config monitor;             // C/N0の閾値
+    uint64_t version = 0;                   // 再読み込みの回数
+};
+/**
+ * @brief 描画スレッドへ渡す1エポック分の表示内容
+ *
+ * ループスレッドがtriple_bufferのback()へ直接書く（固定長なのでヒープを使わない）。
+ */
+class display_state {
+public:
+    static const size_t nmea_size = 16 * 1024;      // -nで表示するセンテンス
+    static const size_t sv_size = 64;               // -sで表示する衛星
+
+    /**
+     * @brief 衛星情報の1行
+     *
+     */
+    class sv_row {
+    public:
+        const char *system;     // 衛星システム名（静的な文字列）
+        bool active;            // 測位に使用
+        int svid;
+        int elv;
+        int az;
+        int cno;
+    };
+
+    bool sum_err;
+    int sum_err_cnt;
+    bool utc_err;
+    int utc_err_cnt;
+    bool position_err;
+    int position_err_cnt;
+    bool latitude_err;
+    bool longitude_err;
+    bool altitude_err;
+    bool timeout;
+    int timeout_cnt;
+    size_t sv_tracked;
+    uint64_t sv_events[sv_monitor::event_type_count];
+    bool has_reference;
+    enu_accuracy::result accuracy;
+    int estimated;                  // 基準点の推定に使ったエポック数
+    double ttff;                    // 初回測位までの時間（測位前は-1）
+    double elapsed;                 // 起動からの時間
+    bool assist;
+    size_t assist_sent;
+    size_t assist_total;
+    size_t assist_acked;
+    size_t assist_nak;
+    size_t assist_timeout;
+    bool sos;
+    upd_sos::restore_result restore;
+    char gps_utc[32];
+    double latitude;
+    double longitude;
+    double altitude;
+    int num_sv;
+    double pdop;
+    double hdop;
+    double vdop;
+    size_t nmea_len;
+    char nmea[nmea_size];           // チェックサムが正しいセンテンス（改行区切り）
+    size_t sv_count;
+    sv_row sv[sv_size];
+};
+
+static rcu_ptr<live_conf> LiveConf;
+static const char conf_file[] = "gps_test.conf";
+
 void read_conf();
+bool read_live_conf(live_conf &conf);
 
 /**
  * @brief ランダムな時間ウェイト(500ms ～ 1s)
@@ -67,49 +201,24 @@ static void random_sleep()
     std::this_thread::sleep_for(std::chrono::milliseconds(interval));
 }
 
-/**
- * @brief サムチェック
- * 
- * @param sentence NMEAのセンテンス
- * @return true OK
- * @return false ERROR
- */
-bool check_sum(std::string sentence)
-{
-    // チェックサムの計算
-    size_t start = sentence.find("$") + 1;
-    size_t end = sentence.find("*");
-    uint8_t sum = 0;
-    for (auto it = sentence.begin() + start, e = sentence.begin() + end; it != e; ++it) {
-        sum ^= *it;
-    }
-
-    // チェックサムを切り出し
-    std::string sum_str = sentence.substr(end + 1, 2);
-    if (sum == std::stoi(sum_str, nullptr, 16)) {
-        return true;
-    }
-
-    return false;
-}
+static const char result_ok[] = "\033[32m[OK]   \033[0m";
+static const char result_error[] = "\033[31m[ERROR]\033[0m";
 
 /**
  * @brief 数値を出力（-1は表示しない）
  * 
+ * @param fr 描画先
+ * @param width 表示幅
  * @param value 
- * @return std::string 
  */
-std::string to_str(int value)
+void print_value(frame_renderer &fr, int width, int value)
 {
-    std::string str = "";
     if (value < 0) {
-        str = "  ";
+        fr.printf("%*s", width, "  ");
     }
     else {
-        str = std::to_string(value);
+        fr.printf("%*d", width, value);
     }
-
-    return str;
 }
 
 /**
@@ -117,163 +226,129 @@ std::string to_str(int value)
  * 
  * @param ok 
  */
-inline std::string print_result(bool ok) 
+inline const char *print_result(bool ok) 
 {
     if (ok == true) {
-        return "\033[32m[OK]   \033[0m";
+        return result_ok;
     }
     else {
-        return "\033[31m[ERROR]\033[0m";
+        return result_error;
     }
 }
 
 /**
  * @brief UTCを出力
  * 
+ * @param fr 描画先
  * @param gps_utc 
  */
-void print_utc(std::string gps_utc)
+void print_utc(frame_renderer &fr, const char *gps_utc)
 {
-    std::cout << "\033[0K";
-    if (gps_utc == "") {
-        std::cout << "DateTime(UTC) \033[31m[ERROR]\033[0m";
+    if (gps_utc[0] == '\0') {
+        fr.printf("DateTime(UTC) %s", result_error);
     }
     else {
-        std::cout << "DateTime(UTC) " << gps_utc;
+        fr.printf("DateTime(UTC) %s", gps_utc);
     }
-    std::cout << std::endl;
-}
-
-void position_check(double latitude, double longitude, double altitude)
-{
-    if (!std::isnan(latitude) && latitude >= MinimumLatitude && latitude <= MaximumLatitude) {
-        LatitudeError = false;
-    }
-    else {
-        LatitudeError = true;
-        LatitudeErrorCount++;
-    }
-
-    if (!std::isnan(longitude) && longitude >= MinimumLongitude && longitude <= MaximumLongitude) {
-        LongitudeError = false;
-    }
-    else {
-        LongitudeError = true;
-        LongitudeErrorCount++;
-    }
-
-    if (!std::isnan(altitude) && altitude >= MinimumAltitude && altitude <= MaximumAltitude) {
-        AltitudeError = false;
-    }
-    else {
-        AltitudeError = true;
-        AltitudeErrorCount++;
-    }
-
-    if(LatitudeError == false && LongitudeError == false && AltitudeError == false) {
-        PositionError = false;
-    }
-    else {
-        PositionError = true;
-        PositionErrorCount++;
-    }
-
+    fr.newline();
 }
 
 /**
  * @brief GPS座標を出力
  * 
+ * @param fr 描画先
  * @param latitude 
  * @param longitude 
  * @param altitude 
- * @param num_sv 
+ * @param latitude_err 
+ * @param longitude_err 
+ * @param altitude_err 
  */
-void print_gps_coordinates(double latitude, double longitude, double altitude)
+void print_gps_coordinates(frame_renderer &fr, double latitude, double longitude, double altitude,
+                           bool latitude_err, bool longitude_err, bool altitude_err)
 {
-    std::cout << "\033[0K";
-    std::cout << "LAT=";
+    fr.puts("LAT=");
     if (std::isnan(latitude)) {
-        std::cout << "-----------";
+        fr.puts("-----------");
     }
     else {
-        std::cout << std::right << std::setw(11) << std::fixed << std::setprecision(7) << latitude;
+        fr.printf("%11.7f", latitude);
     }
-    std::cout << print_result(!LatitudeError) << ", ";
+    fr.printf("%s, ", print_result(!latitude_err));
 
     // 経度を表示
-    std::cout << "LON=";
+    fr.puts("LON=");
     if (std::isnan(longitude)) {
-        std::cout << "-----------";
+        fr.puts("-----------");
     }
     else {
-        std::cout << std::right << std::setw(11) << std::fixed << std::setprecision(7) << longitude;
+        fr.printf("%11.7f", longitude);
     }
-    std::cout << print_result(!LongitudeError) << ", ";
+    fr.printf("%s, ", print_result(!longitude_err));
 
     // 高度を表示
-    std::cout << "ALT=";
+    fr.puts("ALT=");
     if (std::isnan(altitude)) {
-        std::cout << "------";
+        fr.puts("------");
     }
     else {
-        std::cout << std::setw(6) << std::fixed << std::setprecision(1) << altitude;
+        fr.printf("%6.1f", altitude);
     }
-    std::cout << print_result(!AltitudeError) << std::endl;
+    fr.puts(print_result(!altitude_err));
+    fr.newline();
 }
 
 /**
  * @brief DOP（精度）を出力
  * 
+ * @param fr 描画先
  * @param pdop 
  * @param hdop 
  * @param vdop 
  */
-void print_dop(double pdop, double hdop, double vdop)
+void print_dop(frame_renderer &fr, double pdop, double hdop, double vdop)
 {
-    std::cout << "\033[0K";
-    std::cout << "PDOP=";
+    fr.puts("PDOP=");
     if (std::isnan(pdop)) {
-        std::cout << "\033[31m[ERROR]\033[0m";
+        fr.puts(result_error);
     }
     else {
-        std::cout << std::fixed << std::setprecision(2) << pdop;
+        fr.printf("%.2f", pdop);
     }
-    std::cout << ", ";
+    fr.puts(", ");
 
-    std::cout << "HDOP=";
+    fr.puts("HDOP=");
     if (std::isnan(hdop)) {
-        std::cout << "\033[31m[ERROR]\033[0m";
+        fr.puts(result_error);
     }
     else {
-        std::cout << std::fixed << std::setprecision(2) << hdop;
+        fr.printf("%.2f", hdop);
     }
-    std::cout << ", ";
+    fr.puts(", ");
 
-    std::cout << "VDOP=";
+    fr.puts("VDOP=");
     if (std::isnan(vdop)){
-        std::cout << "\033[31m[ERROR]\033[0m";
+        fr.puts(result_error);
     }
     else {
-        std::cout << std::fixed << std::setprecision(2) << vdop;
+        fr.printf("%.2f", vdop);
     }
-    std::cout << std::endl;
-
+    fr.newline();
 }
 
 /**
- * @brief 衛星情報を出力
+ * @brief 衛星情報を表示内容へ取り込む
  * 
+ * @param d 表示内容
  * @param gsa_list 
  * @param gsv_list 
  */
-void print_satellite_info(std::vector<nmea_gsa> gsa_list, std::vector<nmea_gsv> gsv_list)
+static void capture_satellite_info(display_state &d, arena_vector<nmea_gsa> &gsa_list, arena_vector<nmea_gsv> &gsv_list)
 {
-    int no = 0;
-    std::cout << "\033[0K";
-    std::cout << "No.\tActive\tSat.ID\tEL.\tAZ.\tC/N0\tGNSS\t" << std::endl;
-    for(auto gsv : gsv_list) {
-        std::vector<int> svid_list = gsv.get_svid_list();
-        std::string sys_str;
+    d.sv_count = 0;
+    for(auto &gsv : gsv_list) {
+        const nmea_gsv::svid_list svid_list = gsv.get_svid_list();
+        const char *sys_str;
         switch (gsv.get_system_id()) {
         case 1:
             sys_str = "GPS";
@@ -292,27 +367,224 @@ void print_satellite_info(std::vector<nmea_gsa> gsa_list, std::vector<nmea_gsv>
             break;
         }
         for(auto svid : svid_list) {
-            std::string active = "";
-            for(auto gsa : gsa_list) {
-                auto said_list = gsa.get_svid_list();
-                for (auto said : said_list) {
+            if (d.sv_count >= display_state::sv_size) {
+                return;
+            }
+            bool active = false;
+            for(auto &gsa : gsa_list) {
+                for (auto said : gsa.get_svid_list()) {
                     if (said == svid) {
-                        active = "Yes";
+                        active = true;
                     }
                 }
             }
             nmea_gsv::sv_info si = gsv.get_svinfo(svid);
-            std::cout << "\033[0K";
-            std::cout << std::right << std::setw(2) << no << "\t";
-            std::cout << active << "\t";
-            std::cout << std::right << std::setw(2) << si.svid << "\t";
-            std::cout << std::right << std::setw(2) << to_str(si.elv) << "\t";
-            std::cout << std::right << std::setw(3) << to_str(si.az) << "\t";
-            std::cout << std::right << std::setw(2) << to_str(si.cno) << "\t";
-            std::cout << std::left << std::setw(8) << sys_str << std::endl;
-            no++;
+            display_state::sv_row &row = d.sv[d.sv_count++];
+            row.system = sys_str;
+            row.active = active;
+            row.svid = si.svid;
+            row.elv = si.elv;
+            row.az = si.az;
+            row.cno = si.cno;
+        }
+    }
+}
+
+/**
+ * @brief 衛星情報を出力
+ * 
+ * @param fr 描画先
+ * @param d 表示内容
+ */
+void print_satellite_info(frame_renderer &fr, const display_state &d)
+{
+    fr.puts("No.\tActive\tSat.ID\tEL.\tAZ.\tC/N0\tGNSS\t");
+    fr.newline();
+    for (size_t no = 0; no < d.sv_count; no++) {
+        const display_state::sv_row &row = d.sv[no];
+        fr.printf("%2zu\t%s\t%2d\t", no, row.active ? "Yes" : "", row.svid);
+        print_value(fr, 2, row.elv);
+        fr.puts("\t");
+        print_value(fr, 3, row.az);
+        fr.puts("\t");
+        print_value(fr, 2, row.cno);
+        fr.printf("\t%-8s", row.system);
+        fr.newline();
+    }
+}
+
+/**
+ * @brief 表示内容を組み立てる（描画統計の行を除く）
+ * 
+ * @param fr 描画先
+ * @param d 表示内容
+ * @param param 起動パラメーター
+ */
+static void render_frame(frame_renderer &fr, const display_state &d, const gps_test_param &param)
+{
+    // NMEA表示
+    if (param.print_nmea) {
+        size_t pos = 0;
+        while (pos < d.nmea_len) {
+            const char *line = d.nmea + pos;
+            const char *end = static_cast<const char *>(std::memchr(line, '\n', d.nmea_len - pos));
+            size_t len = end ? end - line : d.nmea_len - pos;
+            fr.printf("%.*s %s", (int)len, line, result_ok);
+            fr.newline();
+            pos += len + 1;
+        }
+    }
+
+    fr.printf("Checksum  %s(error count = %d)", print_result(!d.sum_err), d.sum_err_cnt);
+    fr.newline();
+    fr.printf("UTC check %s(error count = %d)", print_result(!d.utc_err), d.utc_err_cnt);
+    fr.newline();
+    fr.printf("Position  %s(error count = %d)", print_result(!d.position_err), d.position_err_cnt);
+    fr.newline();
+    fr.printf("Timeout   %s(error count = %d)", print_result(!d.timeout), d.timeout_cnt);
+    fr.newline();
+    fr.printf("C/N0      tracked = %zu, lost = %llu, drop = %llu, fade = %llu, interference = %llu",
+              d.sv_tracked,
+              (unsigned long long)d.sv_events[sv_monitor::loss_of_lock],
+              (unsigned long long)d.sv_events[sv_monitor::sudden_drop],
+              (unsigned long long)d.sv_events[sv_monitor::slow_fade],
+              (unsigned long long)d.sv_events[sv_monitor::interference]);
+    fr.newline();
+
+    if (d.has_reference) {
+        const enu_accuracy::result &acc = d.accuracy;
+        fr.printf("Accuracy  CEP50 = %.2f m, CEP95 = %.2f m, 2DRMS = %.2f m, V95 = %.2f m (n = %llu)",
+                  acc.cep50, acc.cep95, acc.drms2, acc.vertical95, (unsigned long long)acc.count);
+    }
+    else {
+        fr.printf("Accuracy  estimating reference (%d / %d)", d.estimated, AccuracyConfig.estimate_epochs);
+    }
+    fr.newline();
+
+    if (d.ttff >= 0) {
+        fr.printf("TTFF      %.1f s", d.ttff);
+    }
+    else {
+        fr.printf("TTFF      waiting (%.1f s)", d.elapsed);
+    }
+    if (d.assist) {
+        fr.printf(", assist %zu / %zu sent, acked = %zu, nak = %zu, timeout = %zu",
+                  d.assist_sent, d.assist_total, d.assist_acked, d.assist_nak, d.assist_timeout);
+    }
+    if (d.sos) {
+        fr.printf(", restore = %s", upd_sos::restore_name(d.restore));
+    }
+    fr.newline();
+
+    // 時刻を表示
+    print_utc(fr, d.gps_utc);
+
+    // 緯度を表示
+    print_gps_coordinates(fr, d.latitude, d.longitude, d.altitude, d.latitude_err, d.longitude_err, d.altitude_err);
+
+    // DOP（精度）を表示
+    fr.printf("num_sv=%d, ", d.num_sv);
+
+    print_dop(fr, d.pdop, d.hdop, d.vdop);
+
+    if (param.print_sv) {
+        // 衛星の情報表示
+        print_satellite_info(fr, d);
+    }
+}
+
+/**
+ * @brief 描画スレッド
+ *
+ * 最新の表示内容だけを取り（間のエポックはまとめる）、RenderMaxFpsを上限に描画する。
+ * 見た目が前回と同じなら端末へ書かない。端末が遅くてもループスレッドは待たない。
+ *
+ * @param view 表示内容
+ * @param param 起動パラメーター
+ * @param stop 終了要求（最後の表示内容を描画してから終わる）
+ * @param st 描画統計（終了時に設定）
+ * @param skipped 見た目が変わらず描画しなかった数（終了時に設定）
+ */
+static void render_thread_proc(triple_buffer<display_state> &view, const gps_test_param &param,
+                               const std::atomic<bool> &stop, frame_renderer::stats &st, uint64_t &skipped)
+{
+    frame_renderer fr(STDOUT_FILENO);
+    const std::chrono::microseconds interval(1000000 / std::max(1, RenderMaxFps));
+    std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+    skipped = 0;
+    for (;;) {
+        bool last = stop;
+        if (view.take()) {
+            trace::scope ts(trace::render);
+            fr.begin();
+            render_frame(fr, view.front(), param);
+            if (fr.changed(1)) {
+                // 前回の描画統計を表示（この行は比較しない）
+                const frame_renderer::stats &rs = fr.get_stats();
+                fr.printf("Render %zu bytes, %u us (lines = %zu), coalesced = %llu, skipped = %llu",
+                          rs.last_bytes, rs.last_us, rs.last_lines,
+                          (unsigned long long)view.get_coalesced(), (unsigned long long)skipped);
+                fr.newline();
+                fr.present();
+            }
+            else {
+                skipped++;
+            }
+        }
+        if (last) {
+            break;
         }
+        // 遅れた分は取り戻さない（次のフレームまで待つだけ）
+        next += interval;
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (next < now) {
+            next = now;
+        }
+        std::this_thread::sleep_until(next);
     }
+    st = fr.get_stats();
+}
+
+/**
+ * @brief gnss_coreのカウンターの増分をメトリクスへ反映
+ *
+ * @param core 解析とチェック
+ * @param prev 反映済みのカウンター（更新する）
+ */
+static void add_core_metrics(const gnss_core &core, gnss_core_counters &prev)
+{
+    gnss_core_counters now;
+    core.get_counters(now);
+    metrics::add(metrics::epochs, now.epochs - prev.epochs);
+    metrics::add(metrics::sentences, now.sentences - prev.sentences);
+    metrics::add(metrics::checksum_errors, now.checksum_errors - prev.checksum_errors);
+    metrics::add(metrics::truncated, now.truncated - prev.truncated);
+    metrics::add(metrics::parse_failures, now.parse_failures - prev.parse_failures);
+    metrics::add(metrics::utc_errors, now.utc_errors - prev.utc_errors);
+    metrics::add(metrics::position_errors, now.position_errors - prev.position_errors);
+    metrics::add(metrics::timeouts, now.timeouts - prev.timeouts);
+    prev = now;
+}
+
+/**
+ * @brief gnss_coreの処理段階毎の時間をtraceへ記録
+ *
+ * @param stage GNSS_CORE_STAGE_*
+ * @param start_ns 開始時刻
+ * @param end_ns 終了時刻
+ */
+static void core_timing(void *, int stage, uint64_t start_ns, uint64_t end_ns)
+{
+    static const trace::stage stages[GNSS_CORE_STAGE_COUNT] = {
+        trace::split,
+        trace::checksum,
+        trace::parse_rmc,
+        trace::parse_gga,
+        trace::parse_gsa,
+        trace::parse_gsv,
+        trace::check,
+    };
+    trace::record(stages[stage], start_ns, end_ns);
 }
 
 /**
@@ -321,179 +593,576 @@ void print_satellite_info(std::vector<nmea_gsa> gsa_list, std::vector<nmea_gsv>
  */
 static void loop_thread_proc(gps_test_param param)
 {
-    ubx ubx;
-    bool sum_err = false;
-    int sum_err_cnt = 0;
-    bool utc_err = false;
-    int utc_err_cnt = 0;
-    bool timeout = false;
-    int timeout_cnt = 0;
-    std::chrono::system_clock::time_point  prev_time = std::chrono::system_clock::now();
-    std::chrono::system_clock::time_point  curr_time = std::chrono::system_clock::now();
-    const double timeout_limit = 2000.0;
-    std::string msg;
-    std::vector<std::string> nmea;
+    std::unique_ptr<gps_sim> sim;
+    if (param.simulate) {
+        sim.reset(new gps_sim(SimConfig));
+    }
+    ubx ubx(param.broker ? BrokerSocket : "", sim.get());
+    // シミュレーターの出力レートに合わせて読み出す（バーストと空読みを交互に読むため周期の半分）
+    const int poll_interval = sim ? std::min(100, 500 / sim->get_rate()) : 100;
+    int conflict_cnt = 0;
+    int recorded_cnt[flight_recorder::reason_count] = {0};     // ダンプを判定済みのエラー回数
+    std::vector<uint8_t> buf;
     bool update = false;
+    std::unique_ptr<triple_buffer<display_state>> view;    // 描画スレッドへ渡す表示内容
+    std::atomic<bool> render_stop(false);
+    std::thread render_thread;
+    frame_renderer::stats render_stats = {};
+    uint64_t render_skipped = 0;
+    std::unique_ptr<log_writer> logger;
+    std::unique_ptr<nmea_archive::writer> archive;
+    std::unique_ptr<shm_publisher> publisher;
+    std::unique_ptr<fix_history> history;
+    const live_conf *lc = LiveConf.read();
+    uint64_t conf_version = lc->version;    // 適用済みの設定
+    gnss_core::config core_conf;
+    core_conf.timing = core_timing;     // 処理段階毎の時間をtraceへ記録
+    core_conf.range = lc->range;
+    core_conf.timeout_ms = lc->timeout_ms;
+    core_conf.arena_size = ArenaSize;
+    gnss_core core(core_conf);              // 解析とチェック（受信データとチェックの状態を持つ）
+    gnss_core_counters core_prev = {};      // メトリクスへ反映済みのカウンター
+    std::unique_ptr<sv_monitor> monitor(new sv_monitor(lc->monitor));
+    std::unique_ptr<sky_map> skymap;
+    std::unique_ptr<enu_accuracy> accuracy(new enu_accuracy(AccuracyConfig));
+    std::unique_ptr<flight_recorder> recorder;
+    std::unique_ptr<mga_assist> assist;
+    std::unique_ptr<upd_sos> sos;
+    std::unique_ptr<metrics_server> metrics_srv;
+    std::unique_ptr<tx_ready> txready;
+    const std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+    double ttff = -1;                       // 初回測位までの時間(秒)
+    bool has_last = false;                  // 最後の正常な位置（次回の起動時に支援データとして送る）
+    double last_latitude = 0;
+    double last_longitude = 0;
+    double last_altitude = 0;
+    uint64_t late_cnt = 0;                  // poll間隔以上遅れて起床した回数
+    bool fifo = false;
+    uint64_t watchdog_cnt = 0;              // TX-readyが来ずにwatchdogで読んだ回数
+#ifdef GPS_TEST_ALLOC_CHECK
+    const uint64_t alloc_warmup = 10;      // 容量が定まるまでのエポック数
+#endif
 
-    std::cout << "\033[2J" << std::endl;
-    while(!terminate) {
-        curr_time = std::chrono::system_clock::now();
-        double elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(curr_time - prev_time).count(); 
-        if (elapsed >= timeout_limit && timeout == false) {
-            timeout = true;
-            timeout_cnt++;
-            update = true;
-            prev_time = curr_time;
+    // 受信バッファは起動時に確保（I2Cの1回の読み込みは最大64KiB）
+    buf.reserve(core_conf.receive_size);
+
+    if (param.logging) {
+        logger.reset(new log_writer(LogConfig));
+    }
+    if (param.archive) {
+        archive.reset(new nmea_archive::writer(ArchiveFile, ArchiveCompress));
+    }
+    if (SharedMemoryName != "") {
+        publisher.reset(new shm_publisher(SharedMemoryName));
+    }
+    if (HistoryChunks > 0) {
+        // 履歴のチャンクは起動時にすべて確保
+        history.reset(new fix_history(HistoryChunks));
+    }
+    if (SkyMapFile != "") {
+        skymap.reset(new sky_map(SkyMapResolution));
+    }
+    if (RecorderConfig.path_prefix != "") {
+        // 記録用のバッファは起動時に確保
+        recorder.reset(new flight_recorder(RecorderConfig));
+    }
+    if (AssistFile != "") {
+        // 支援データ（時刻・前回の位置・軌道）を送ってTTFFを短縮
+        assist.reset(new mga_assist(AssistConfig));
+        double lat, lon, alt;
+        if (AssistPositionFile != "" && mga_assist::load_position(AssistPositionFile, lat, lon, alt)) {
+            assist->set_position(lat, lon, alt);
+        }
+        assist->load(AssistFile);
+        assist->start();
+    }
+    if (SosBackup && !param.broker && (!param.simulate || SimConfig.backup_file[0] != '\0')) {
+        // 前回の終了時に保存した航法データを復元できたか問い合わせる
+        // （gps_broker経由では他のクライアントも使っているのでGNSSを止めない）
+        // （シミュレーターはSimBackupFileが空だとUPD-SOSに応答しないので、終了時にSosTimeoutまで待たない）
+        sos.reset(new upd_sos(SosConfig));
+        sos->start(ubx);
+    }
+    if (TxReadyConfig.chip != "" && !param.broker) {
+        // 一定間隔で読む代わりにTX-readyのエッジを待つ（開けなければ一定間隔で読む）
+        txready.reset(new tx_ready(TxReadyConfig));
+        if (txready->open()) {
+            if (TxReadyConfig.configure) {
+                txready->configure(ubx);
+            }
         }
         else {
-            timeout = false;
+            txready.reset();
+        }
+    }
+    metrics::set(metrics::ttff_seconds, -1);
+    if (MetricsSocket != "" || MetricsPort > 0) {
+        // メトリクスは別スレッドで公開（ループはatomicを更新するだけ）
+        metrics_srv.reset(new metrics_server(MetricsSocket, MetricsPort));
+        if (!metrics_srv->start()) {
+            metrics_srv.reset();
+        }
+    }
+    if (!param.headless) {
+        // 描画は別スレッド（端末が遅くても受信とチェックは受信機のレートで続ける）
+        view.reset(new triple_buffer<display_state>());
+        render_thread = std::thread([&]{
+            render_thread_proc(*view, param, render_stop, render_stats, render_skipped);
+        });
+    }
+    if (RealtimeConfig.enabled) {
+        // 他のスレッドを作り終えてから（後に作ったスレッドはSCHED_FIFOとコアを継承する）
+        realtime::prefault_stack(RealtimeConfig.stack_prefault);
+        if (RealtimeConfig.cpu >= 0) {
+            realtime::set_cpu(RealtimeConfig.cpu);
+        }
+        fifo = realtime::set_fifo(RealtimeConfig.priority);
+    }
+
+    while(!terminate) {
+#ifdef GPS_TEST_ALLOC_CHECK
+        uint64_t alloc_before = alloc_counter::count();
+#endif
+        // 再読み込みした設定（カウンターと受信機の状態はそのまま）
+        lc = LiveConf.read();
+        if (lc->version != conf_version) {
+            monitor->set_config(lc->monitor);
+            core.set_range(lc->range);
+            core.set_timeout(lc->timeout_ms);
+            conf_version = lc->version;
+        }
+
+        // 途切れた場合は前回のセンテンスのままエポックを処理する
+        if (core.check_timeout(trace::now())) {
+            update = true;
         }
 
-        std::vector<uint8_t> buf;
+        buf.clear();
         ubx::status sts = ubx.get_nmea(buf);
+        if (recorder) {
+            recorder->record(sts, buf.data(), buf.size());
+            if (recorder_request.exchange(false)) {
+                recorder->trigger(flight_recorder::manual);
+            }
+        }
+        if (sts == ubx::ok) {
+            // NMEAに混ざったUBX(MGA-ACK、UPD-SOS)を取り除く
+            ubx::take_frames(buf, [&assist, &sos](const uint8_t *frame, size_t len) {
+                if (assist) {
+                    assist->on_frame(frame, len);
+                }
+                if (sos) {
+                    sos->on_frame(frame, len);
+                }
+            });
+        }
+        if (assist) {
+            assist->poll(ubx);
+        }
+        if (sos) {
+            sos->poll(ubx);
+        }
+        if (sts == ubx::dev_error) {
+            metrics::add(metrics::dev_errors);
+        }
         if (sts == ubx::conflict) {
             // コンフリクトした場合はランダムな時間ウェイト
+            conflict_cnt++;
+            metrics::add(metrics::conflicts);
             random_sleep();
             continue;
         };
 
         if(sts == ubx::ok) {
-            msg.insert(msg.end(), buf.begin(), buf.end());
+            metrics::add(metrics::bytes_read, buf.size());
+            core.feed(buf.data(), buf.size());
+            if (archive) {
+                archive->append(buf.data(), buf.size());
+            }
         }
 
-        if(sts == ubx::empty && msg.size() > 0) {
-            prev_time = curr_time;
-
-            nmea.clear();
-            size_t pos;
-            std::string delimiter = "\r\n";
-            while ((pos = msg.find(delimiter)) != std::string::npos) {
-                std::string sentence = msg.substr(0, pos);
-                msg.erase(0, pos + delimiter.length());
-                nmea.push_back(sentence);
-            }
-            msg = "";
+        if(sts == ubx::empty && core.end_burst(trace::now())) {
             update = true;
         }
         if (update == true) {
             update = false;
-            std::string gps_utc = "";
-            double latitude = std::numeric_limits<double>::quiet_NaN();
-            double longitude = std::numeric_limits<double>::quiet_NaN();
-            double altitude = std::numeric_limits<double>::quiet_NaN();
-            int num_sv = 0;
-            time_t prev_gps_time_t = (time_t)-1;
-            time_t current_gps_time_t = (time_t)-1;
-            std::vector<nmea_gsa> gsa;
-            std::vector<nmea_gsv> gsv;
-            std::vector<nmea_gsv::sv_info> sv_list;
-            std::cout << "\033[0;0H";
-            for (auto s : nmea) {
-                std::stringstream ss;
-                ss << s << " ";
-                if (check_sum(s) == false) {
-                    // チェックサムエラー
-                    sum_err = true;
-                    sum_err_cnt++;
-                    ss << print_result(false);
-                    continue;
-                }
-                else {
-                    ss << print_result(true);
-                }
-                ss << "\033[0K" << std::endl;
-                // NMEA表示
-                if (param.print_nmea) {
-                    std::cout << ss.str();
+            // チェックサム、解析、時刻と位置のチェック
+            core.process(trace::now());
+            add_core_metrics(core, core_prev);
+            const gps_fix &fix = core.get_fix();
+            const position_result &pos = core.get_position();
+            arena_vector<nmea_gsa> &gsa = core.get_gsa();
+            arena_vector<nmea_gsv> &gsv = core.get_gsv();
+            display_state *d = view ? &view->back() : nullptr;
+            if (d != nullptr) {
+                d->nmea_len = 0;
+            }
+            if (param.print_nmea && d != nullptr) {
+                // NMEA表示（入りきらない分は表示しない）
+                for (auto &s : core.get_valid_sentences()) {
+                    if (d->nmea_len + s.len + 1 > display_state::nmea_size) {
+                        break;
+                    }
+                    std::memcpy(d->nmea + d->nmea_len, s.str, s.len);
+                    d->nmea_len += s.len;
+                    d->nmea[d->nmea_len++] = '\n';
                 }
+            }
 
-                if (s.find("RMC") != std::string::npos) {
-                    nmea_rmc rmc(s);
-                    gps_utc = rmc.get_utc_datetime();
-                    current_gps_time_t = rmc.get_time_t();
-                }
-                if (s.find("GGA") != std::string::npos) {
-                    nmea_gga gga(s);
-                    latitude = gga.get_latitude();
-                    longitude = gga.get_longitude();
-                    altitude = gga.get_altitude();
-                    num_sv = gga.get_num_sv();
-                }
-                if (s.find("GSA") != std::string::npos) {
-                    gsa.push_back(nmea_gsa(s));
+            // エラーが増えたら前後の受信データを書き出す
+            if (recorder) {
+                const int err_cnt[flight_recorder::manual] = { fix.sum_err_cnt, fix.utc_err_cnt, fix.position_err_cnt, fix.timeout_cnt };
+                for (int r = 0; r < flight_recorder::manual; r++) {
+                    if (err_cnt[r] > recorded_cnt[r]) {
+                        recorder->trigger((flight_recorder::reason)r);
+                        recorded_cnt[r] = err_cnt[r];
+                    }
                 }
-                if (s.find("GSV") != std::string::npos) {
-                    gsv.push_back(nmea_gsv(s));
+            }
+
+            // 基準点からの誤差（範囲外の位置は除く）
+            if (!fix.position_err) {
+                accuracy->add(fix.latitude, fix.longitude, fix.altitude);
+            }
+
+            // 初回測位
+            if (core.has_fix()) {
+                if (ttff < 0) {
+                    ttff = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
                 }
+                has_last = true;
+                last_latitude = fix.latitude;
+                last_longitude = fix.longitude;
+                last_altitude = fix.altitude;
             }
 
-            // 時刻チェック
-            if (current_gps_time_t <= 0) {
-                // エラー
-                utc_err = true;
-                utc_err_cnt++;
+            // 衛星毎のC/N0
+            monitor->begin_epoch(fix.seq);
+            for (auto &g : gsv) {
+                monitor->add_gsv(g);
             }
-            else {
-                if (prev_gps_time_t > 0) {
-                    int diff = difftime(current_gps_time_t, prev_gps_time_t);
-                    if (diff > 1) {
-                        utc_err = true;
-                        utc_err_cnt++;
-                    }
-                    else {
-                        utc_err = false;
+            monitor->end_epoch();
+
+            // 方位角・仰角毎のC/N0
+            if (skymap) {
+                for (auto &g : gsv) {
+                    for (auto svid : g.get_svid_list()) {
+                        nmea_gsv::sv_info si = g.get_svinfo(svid);
+                        skymap->add(si.elv, si.az, si.cno);
                     }
                 }
-                prev_gps_time_t = current_gps_time_t;
             }
 
-            // GPS座標をチェック
-            position_check(latitude, longitude, altitude);
-
-            // 表示
-            std::cout << "Checksum  " << print_result(!sum_err);
-            std::cout << "(error count = " << sum_err_cnt << ")\033[0K" << std::endl;
-            
-            std::cout << "UTC check " << print_result(!utc_err);
-            std::cout << "(error count = " << utc_err_cnt << ")\033[0K" << std::endl;
+            // メトリクス（relaxedのatomicを更新するだけ）
+            metrics::set(metrics::num_sv, fix.num_sv);
+            metrics::set(metrics::sv_tracked, (double)monitor->get_tracked());
+            metrics::set(metrics::hdop, fix.hdop);
+            metrics::set(metrics::fix, core.has_fix() ? 1 : 0);
+            metrics::set(metrics::ttff_seconds, ttff);
+            metrics::set(metrics::conf_version, (double)conf_version);
+            if (logger) {
+                metrics::set(metrics::log_dropped, (double)logger->get_dropped());
+            }
 
-            std::cout << "Position  " << print_result(!PositionError);
-            std::cout << "(error count = " << PositionErrorCount << ")\033[0K" << std::endl;
+            // ログ出力（書き込みスレッドに渡すだけでブロックしない）
+            if (logger) {
+                logger->push(fix);
+            }
 
-            std::cout << "Timeout   " << print_result(!timeout);
-            std::cout << "(error count = " << timeout_cnt << ")\033[0K" << std::endl;
+            // 履歴に追加
+            if (history) {
+                history->append(fix);
+            }
 
+            // 共有メモリへ公開
+            if (publisher) {
+                publisher->publish(fix, gsa, gsv);
+            }
 
-            // 時刻を表示
-            print_utc(gps_utc);
+            // 表示内容を描画スレッドへ渡す（描画は待たない）
+            if (d != nullptr) {
+                d->sum_err = fix.sum_err;
+                d->sum_err_cnt = fix.sum_err_cnt;
+                d->utc_err = fix.utc_err;
+                d->utc_err_cnt = fix.utc_err_cnt;
+                d->position_err = fix.position_err;
+                d->position_err_cnt = fix.position_err_cnt;
+                d->latitude_err = pos.latitude_error;
+                d->longitude_err = pos.longitude_error;
+                d->altitude_err = pos.altitude_error;
+                d->timeout = fix.timeout;
+                d->timeout_cnt = fix.timeout_cnt;
+                d->sv_tracked = monitor->get_tracked();
+                for (int t = 0; t < sv_monitor::event_type_count; t++) {
+                    d->sv_events[t] = monitor->get_count((sv_monitor::event_type)t);
+                }
+                d->has_reference = accuracy->has_reference();
+                if (d->has_reference) {
+                    d->accuracy = accuracy->get_result();
+                }
+                d->estimated = accuracy->get_estimated();
+                d->ttff = ttff;
+                d->elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+                d->assist = assist != nullptr;
+                if (assist) {
+                    d->assist_sent = assist->get_sent();
+                    d->assist_total = assist->get_total();
+                    d->assist_acked = assist->get_acked();
+                    d->assist_nak = assist->get_nak();
+                    d->assist_timeout = assist->get_timeout();
+                }
+                d->sos = sos != nullptr;
+                if (sos) {
+                    d->restore = sos->get_restore();
+                }
+                std::strncpy(d->gps_utc, core.get_utc_string(), sizeof(d->gps_utc) - 1);
+                d->gps_utc[sizeof(d->gps_utc) - 1] = '\0';
+                d->latitude = fix.latitude;
+                d->longitude = fix.longitude;
+                d->altitude = fix.altitude;
+                d->num_sv = fix.num_sv;
+                d->pdop = fix.pdop;
+                d->hdop = fix.hdop;
+                d->vdop = fix.vdop;
+                d->sv_count = 0;
+                if (param.print_sv) {
+                    capture_satellite_info(*d, gsa, gsv);
+                }
+                view->publish();
+            }
+        }
+#ifdef GPS_TEST_ALLOC_CHECK
+        // ウォームアップ後はヒープを使わないこと
+        uint64_t allocs = alloc_counter::count() - alloc_before;
+        uint64_t epochs = core.get_fix().seq;
+        if (epochs > alloc_warmup && allocs != 0) {
+            std::cerr << "alloc check: " << allocs << " allocations at epoch " << epochs << std::endl;
+            std::abort();
+        }
+#endif
+        // 予定した起床時刻からの遅れ（スケジューリングのジッター）を記録
+        const uint64_t interval_ns = (uint64_t)poll_interval * 1000000u;
+        uint64_t planned;
+        if (txready) {
+            // 読めた直後はバーストの続きを短く待ち、読み終えたらTX-readyを待つ（来なくてもwatchdogで読む）
+            int wait_ms = (sts == ubx::ok) ? TxReadyConfig.gap_ms : TxReadyConfig.watchdog_ms;
+            if (assist && !assist->done()) {
+                // 支援データの送信中は一定間隔で回す
+                wait_ms = std::min(wait_ms, poll_interval);
+            }
+            planned = trace::now() + (uint64_t)wait_ms * 1000000u;
+            uint64_t event_ns = 0;
+            if (txready->wait_until(planned, event_ns)) {
+                // エッジから起床までの遅れ
+                trace::record(trace::wakeup, event_ns, std::max(trace::now(), event_ns));
+                continue;
+            }
+            if (sts != ubx::ok) {
+                watchdog_cnt++;
+            }
+        }
+        else {
+            planned = trace::now() + interval_ns;
+            realtime::sleep_until(planned);
+        }
+        uint64_t woke = std::max(trace::now(), planned);
+        trace::record(trace::wakeup, planned, woke);
+        if (woke - planned >= interval_ns) {
+            late_cnt++;
+            metrics::add(metrics::late_wakeups);
+        }
+    }
 
-            // 緯度を表示
-            print_gps_coordinates(latitude, longitude, altitude);
+    if (render_thread.joinable()) {
+        // 最後の表示内容を描画してから終了
+        render_stop = true;
+        render_thread.join();
+    }
+    if (metrics_srv) {
+        metrics_srv->stop();
+    }
+    if (sos) {
+        // 航法データを保存して次の起動をホットスタートにする（応答が無くてもSosTimeoutで諦める）
+        sos->save(ubx, buf);
+    }
 
-            // DOP（精度）を表示
-            double pdop = std::numeric_limits<double>::quiet_NaN();
-            double hdop = std::numeric_limits<double>::quiet_NaN();
-            double vdop = std::numeric_limits<double>::quiet_NaN();
-            if(gsa.size() > 0) {
-                pdop = gsa[0].get_pdop();
-                hdop = gsa[0].get_hdop();
-                vdop = gsa[0].get_vdop();
+    if (render_stats.frames > 0) {
+        std::cout << "render: frames = " << render_stats.frames
+                  << ", bytes/frame = " << render_stats.total_bytes / render_stats.frames
+                  << ", us/frame = " << render_stats.total_us / render_stats.frames
+                  << ", coalesced = " << view->get_coalesced()
+                  << ", skipped = " << render_skipped << std::endl;
+    }
+    if (!param.headless) {
+        std::cout << "wakeup: late = " << late_cnt << " (>= " << poll_interval << " ms)"
+                  << ", policy = " << (fifo ? "SCHED_FIFO " + std::to_string(RealtimeConfig.priority) : std::string("SCHED_OTHER"));
+        if (RealtimeConfig.enabled && RealtimeConfig.cpu >= 0) {
+            std::cout << ", cpu = " << RealtimeConfig.cpu;
+        }
+        std::cout << std::endl;
+        trace::dump_histogram(std::cout, trace::wakeup);
+        if (txready) {
+            std::cout << "txready: events = " << txready->get_events()
+                      << ", watchdog = " << watchdog_cnt << std::endl;
+        }
+    }
+    if (logger && !param.headless) {
+        std::cout << "log: written = " << logger->get_written()
+                  << ", dropped = " << logger->get_dropped()
+                  << ", errors = " << logger->get_errors() << std::endl;
+    }
+    if (sim && !param.headless) {
+        // 注入した異常と検出した異常
+        std::cout << "sim: epochs = " << sim->get_epochs();
+        for (int f = 0; f < gps_sim::fault_count; f++) {
+            std::cout << ", " << gps_sim::fault_name((gps_sim::fault)f) << " = " << sim->get_injected((gps_sim::fault)f);
+        }
+        std::cout << std::endl;
+        const gps_fix &fix = core.get_fix();
+        std::cout << "detected: checksum = " << fix.sum_err_cnt
+                  << ", utc = " << fix.utc_err_cnt
+                  << ", position = " << fix.position_err_cnt
+                  << ", timeout = " << fix.timeout_cnt
+                  << ", conflict = " << conflict_cnt << std::endl;
+    }
+    if (recorder) {
+        // 記録中のダンプを書き出す
+        recorder->close();
+        if (!param.headless) {
+            std::cout << "recorder: dumps = " << recorder->get_dumps()
+                      << ", suppressed = " << recorder->get_suppressed()
+                      << ", errors = " << recorder->get_errors() << std::endl;
+        }
+    }
+    if (!param.headless && accuracy->has_reference()) {
+        double lat, lon, alt;
+        enu_accuracy::result acc = accuracy->get_result();
+        accuracy->get_reference(lat, lon, alt);
+        char line[256];
+        std::snprintf(line, sizeof(line), "accuracy: reference = %.7f, %.7f, %.2f, n = %llu, cep50 = %.3f m, "
+                      "cep95 = %.3f m, 2drms = %.3f m, v95 = %.3f m, bias(enu) = %.3f, %.3f, %.3f m",
+                      lat, lon, alt, (unsigned long long)acc.count, acc.cep50, acc.cep95,
+                      acc.drms2, acc.vertical95, acc.mean_e, acc.mean_n, acc.mean_u);
+        std::cout << line << std::endl;
+    }
+    if (!param.headless) {
+        if (conf_version > 0) {
+            std::cout << "conf: reloads = " << conf_version << std::endl;
+        }
+        std::cout << "ttff: ";
+        if (ttff >= 0) {
+            std::cout << std::fixed << std::setprecision(1) << ttff << std::defaultfloat << " s";
+        }
+        else {
+            std::cout << "no fix";
+        }
+        std::cout << (assist ? " (assisted)" : " (unassisted)") << std::endl;
+        if (sos) {
+            std::cout << "sos: restore = " << upd_sos::restore_name(sos->get_restore())
+                      << ", backup = " << upd_sos::backup_name(sos->get_backup()) << std::endl;
+        }
+        if (assist) {
+            std::cout << "assist: total = " << assist->get_total()
+                      << ", sent = " << assist->get_sent()
+                      << ", acked = " << assist->get_acked()
+                      << ", nak = " << assist->get_nak()
+                      << ", timeout = " << assist->get_timeout() << std::endl;
+        }
+    }
+    if (has_last && AssistPositionFile != "") {
+        mga_assist::save_position(AssistPositionFile, last_latitude, last_longitude, last_altitude);
+    }
+    if (!param.headless) {
+        std::cout << "c/n0:";
+        for (int t = 0; t < sv_monitor::event_type_count; t++) {
+            std::cout << (t == 0 ? " " : ", ") << sv_monitor::event_name((sv_monitor::event_type)t)
+                      << " = " << monitor->get_count((sv_monitor::event_type)t);
+        }
+        std::cout << std::endl;
+    }
+    // 残っているレコードを書き出す
+    logger.reset();
+    if (history && HistoryFile != "" && history->size() > 0) {
+        history->save(HistoryFile);
+    }
+    if (skymap && skymap->get_observations() > 0) {
+        // 前回までのマップに足し合わせる（読めない・分解能が違うファイルは.badへ移して残す）
+        sky_map prev;
+        bool exists = access(SkyMapFile.c_str(), F_OK) == 0;
+        if (exists && prev.load(SkyMapFile) && prev.merge(*skymap)) {
+            prev.save(SkyMapFile);
+        }
+        else if (exists) {
+            std::string bad = SkyMapFile + ".bad";
+            if (std::rename(SkyMapFile.c_str(), bad.c_str()) == 0) {
+                std::cerr << "sky_map: " << SkyMapFile << " is unreadable or has a different resolution, moved to " << bad << std::endl;
+                skymap->save(SkyMapFile);
             }
-            std::cout << "num_sv=" << num_sv << ", ";
+            else {
+                std::cerr << "sky_map: failed to move " << SkyMapFile << " to " << bad << ", not saved" << std::endl;
+            }
+        }
+        else {
+            skymap->save(SkyMapFile);
+        }
+    }
+    if (archive) {
+        archive->close();
+        if (!param.headless && archive->get_stored_bytes() > 0) {
+            std::cout << "archive: raw = " << archive->get_raw_bytes()
+                      << ", stored = " << archive->get_stored_bytes() << std::endl;
+        }
+    }
 
-            print_dop(pdop, hdop, vdop);
+    if (!param.headless) {
+        std::cout << "terminate" << std::endl;
+    }
+}
 
-            if (param.print_sv) {
-                // 衛星の情報表示
-                print_satellite_info(gsa, gsv);
+/**
+ * @brief gps_test.confの変更を監視してSIGHUPを送るスレッド
+ *
+ * エディタは一時ファイルからの名前の変更で保存することがあるので、ディレクトリを監視する。
+ * 保存で続けて届くイベントはまとめて1回にする。
+ */
+static void conf_watch_proc()
+{
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "gps_test: inotify_init1: " << std::strerror(errno) << std::endl;
+        return;
+    }
+    if (inotify_add_watch(fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        std::cerr << "gps_test: inotify_add_watch: " << std::strerror(errno) << std::endl;
+        close(fd);
+        return;
+    }
+    alignas(struct inotify_event) char events[4096];
+    bool changed = false;
+    while (!terminate) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int ret = poll(&pfd, 1, changed ? 100 : 500);
+        if (ret == 0 && changed) {
+            // イベントが落ち着いたら再読み込み
+            changed = false;
+            kill(getpid(), SIGHUP);
+            continue;
+        }
+        if (ret <= 0) {
+            continue;
+        }
+        ssize_t n;
+        while ((n = read(fd, events, sizeof(events))) > 0) {
+            for (char *p = events; p < events + n; ) {
+                const struct inotify_event *ev = reinterpret_cast<const struct inotify_event *>(p);
+                if (ev->len > 0 && std::strcmp(ev->name, conf_file) == 0) {
+                    changed = true;
+                }
+                p += sizeof(struct inotify_event) + ev->len;
             }
-            std::cout << "\033[0J";
-
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
-
-    std::cout << "terminate" << std::endl;
+    close(fd);
 }
 
 /**
@@ -506,6 +1175,8 @@ int main(int argc, char *argv[])
     sigset_t ss = {0};
     int signo = 0;
     gps_test_param param;
+    // 端末で起動したか（端末を閉じた時のSIGHUPは再読み込みではなく終了）
+    bool stdout_tty = isatty(STDOUT_FILENO) != 0;
     
     for (int i = 1; i < argc; i++) {
         if(argv[i][0] == '-') {
@@ -515,16 +1186,46 @@ int main(int argc, char *argv[])
             if (argv[i][1] == 's') {
                 param.print_sv = true;
             }
+            if (argv[i][1] == 'l') {
+                param.logging = true;
+            }
+            if (argv[i][1] == 'b') {
+                // gps_broker経由で受信
+                param.broker = true;
+            }
+            if (argv[i][1] == 'S') {
+                // 受信機の代わりにシミュレーターを使う（設定はgps_test.confのSim*）
+                param.simulate = true;
+            }
+            if (argv[i][1] == 'r') {
+                param.archive = true;
+            }
+            if (argv[i][1] == 'q') {
+                // ヘッドレス（画面出力なし、ログのみ）
+                param.headless = true;
+                param.logging = true;
+            }
         }
     }
 
-    read_conf();
+    if (param.headless) {
+        param.print_nmea = false;
+        param.print_sv = false;
+    }
 
-    // 無限ループを回避するためにメインのループを別スレッドにする。
-    terminate.store(false);
-    std::thread loop_thread([param]{loop_thread_proc(param);}) ;
+    read_conf();
+    std::unique_ptr<live_conf> initial(new live_conf);
+    if (!read_live_conf(*initial)) {
+        exit(EXIT_FAILURE);
+    }
+    LiveConf.publish(std::move(initial));
+    uint64_t conf_version = 0;
+    if (RealtimeConfig.enabled && RealtimeConfig.lock_memory) {
+        // スレッドを作る前にロックする（以後に確保するメモリとスタックもロックされる）
+        realtime::lock_memory();
+    }
 
-    // Ctrl+Cとkillを待つようにセット
+    // Ctrl+Cとkillを待つようにセット（ループスレッドにも継承させるため先にブロックする）
     sigemptyset(&ss);
     if (sigaddset(&ss, SIGINT) != 0) {
         exit(EXIT_FAILURE);
@@ -538,91 +1239,344 @@ int main(int argc, char *argv[])
     if (sigaddset(&ss, SIGHUP) != 0) {
         exit(EXIT_FAILURE);
     }
+    if (sigaddset(&ss, SIGUSR1) != 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (sigaddset(&ss, SIGUSR2) != 0) {
+        exit(EXIT_FAILURE);
+    }
     if (sigprocmask(SIG_BLOCK, &ss, NULL) != 0) {
         exit(EXIT_FAILURE);
     }
 
+    // 無限ループを回避するためにメインのループを別スレッドにする。
+    terminate.store(false);
+    std::thread loop_thread([param]{loop_thread_proc(param);}) ;
+    std::thread watch_thread;
+    if (ConfWatch) {
+        watch_thread = std::thread(conf_watch_proc);
+    }
+
     // シグナル待ち
-    if (sigwait(&ss, &signo) == 0) {
+    while (sigwait(&ss, &signo) == 0) {
+        if (signo == SIGUSR1) {
+            // 処理時間の統計とトレースを出力して継続
+            trace::dump(std::cerr);
+            if (!trace::export_chrome(TraceFile)) {
+                std::cerr << "failed to write " << TraceFile << std::endl;
+            }
+            continue;
+        }
+        if (signo == SIGUSR2) {
+            // 直近の受信データを書き出して継続
+            recorder_request.store(true);
+            continue;
+        }
+        struct termios tio;
+        if (signo == SIGHUP && stdout_tty && tcgetattr(STDOUT_FILENO, &tio) != 0) {
+            // 端末がハングアップした（gnome-terminalのウィンドウを閉じた）ので終了してI2Cを離す
+            break;
+        }
+        if (signo == SIGHUP) {
+            // 設定を読み直してループスレッドへ渡す（読み込めなければ今の設定のまま）
+            std::unique_ptr<live_conf> next(new live_conf);
+            next->version = conf_version + 1;
+            if (read_live_conf(*next)) {
+                conf_version++;
+                LiveConf.publish(std::move(next));
+            }
+            continue;
+        }
         if (signo == SIGINT) {
         }
         else if (signo == SIGKILL) {
         }
         else if (signo == SIGTERM) {
         }
-        else if (signo == SIGHUP) {
-        }
+        break;
     }
 
     // シグナルを受信したらループを終了
     terminate.store(true);
     loop_thread.join();
+    if (watch_thread.joinable()) {
+        watch_thread.join();
+    }
 
     return 0;
 }
 
 /**
- * @brief 空白文字削除
+ * @brief 設定ファイル読み込み
  * 
- * @param str 文字列
- * @param trim_character_list 削除対象の空白文字
- * @return std::string 結果
  */
-inline std::string trim(const std::string& str, const char* trim_character_list=" \t\v\r\n")
+void read_conf()
 {
-    std::string result = "";
-    // 左から最初の空白文字以外の文字を検索
-    auto left = str.find_first_not_of(trim_character_list);
-    if (left != std::string::npos) {
-        // すべて空白文字でなければ右から最後の空白文字以外の文字を検索 
-        auto right = str.find_last_not_of(trim_character_list);
-        // 左右の空白文字を除いた文字列を切り出す
-        result = str.substr(left, right - left + 1);
-    }
-    return result;
+    read_conf_file(conf_file, [](const std::string &key, const std::string &value) {
+        if (key == "LogFile") {
+            LogConfig.path = value;
+        }
+        else if (key == "LogFormat") {
+            LogConfig.fmt = log_writer::parse_format(value);
+        }
+        else if (key == "LogFsyncInterval") {
+            LogConfig.fsync_interval_ms = std::stoi(value);
+        }
+        else if (key == "LogRotateSize") {
+            LogConfig.rotate_size = std::stoul(value);
+        }
+        else if (key == "LogRotateCount") {
+            LogConfig.rotate_count = std::stoi(value);
+        }
+        else if (key == "ArchiveFile") {
+            ArchiveFile = value;
+        }
+        else if (key == "ArchiveCompress") {
+            ArchiveCompress = std::stoi(value) != 0;
+        }
+        else if (key == "SharedMemoryName") {
+            SharedMemoryName = value;
+        }
+        else if (key == "BrokerSocket") {
+            BrokerSocket = value;
+        }
+        else if (key == "TraceFile") {
+            TraceFile = value;
+        }
+        else if (key == "ArenaSize") {
+            ArenaSize = std::stoul(value);
+        }
+        else if (key == "HistoryChunks") {
+            HistoryChunks = std::stoul(value);
+        }
+        else if (key == "HistoryFile") {
+            HistoryFile = value;
+        }
+        else if (key == "ConfWatch") {
+            ConfWatch = std::stoi(value) != 0;
+        }
+        else if (key == "MetricsSocket") {
+            MetricsSocket = value;
+        }
+        else if (key == "MetricsPort") {
+            MetricsPort = std::stoi(value);
+        }
+        else if (key == "RenderMaxFps") {
+            RenderMaxFps = std::stoi(value);
+        }
+        else if (key == "RealTime") {
+            RealtimeConfig.enabled = std::stoi(value) != 0;
+        }
+        else if (key == "RealTimePriority") {
+            RealtimeConfig.priority = std::stoi(value);
+        }
+        else if (key == "RealTimeCpu") {
+            RealtimeConfig.cpu = std::stoi(value);
+        }
+        else if (key == "RealTimeLockMemory") {
+            RealtimeConfig.lock_memory = std::stoi(value) != 0;
+        }
+        else if (key == "TxReadyChip") {
+            TxReadyConfig.chip = value;
+        }
+        else if (key == "TxReadyLine") {
+            TxReadyConfig.line = std::stoi(value);
+        }
+        else if (key == "TxReadyActiveLow") {
+            TxReadyConfig.active_low = std::stoi(value) != 0;
+        }
+        else if (key == "TxReadyPio") {
+            TxReadyConfig.pio = std::stoi(value);
+        }
+        else if (key == "TxReadyThreshold") {
+            TxReadyConfig.threshold = std::stoi(value);
+        }
+        else if (key == "TxReadyConfigure") {
+            TxReadyConfig.configure = std::stoi(value) != 0;
+        }
+        else if (key == "TxReadyWatchdog") {
+            TxReadyConfig.watchdog_ms = std::stoi(value);
+        }
+        else if (key == "TxReadyGap") {
+            TxReadyConfig.gap_ms = std::stoi(value);
+        }
+        else if (key == "SkyMapResolution") {
+            SkyMapResolution = std::stoi(value);
+        }
+        else if (key == "SkyMapFile") {
+            SkyMapFile = value;
+        }
+        else if (key == "ReferenceLatitude") {
+            AccuracyConfig.latitude = std::stod(value);
+        }
+        else if (key == "ReferenceLongitude") {
+            AccuracyConfig.longitude = std::stod(value);
+        }
+        else if (key == "ReferenceAltitude") {
+            AccuracyConfig.altitude = std::stod(value);
+        }
+        else if (key == "ReferenceEpochs") {
+            AccuracyConfig.estimate_epochs = std::stoi(value);
+        }
+        else if (key == "RecorderFile") {
+            RecorderConfig.path_prefix = value;
+        }
+        else if (key == "RecorderBursts") {
+            RecorderConfig.bursts = std::stoul(value);
+        }
+        else if (key == "RecorderBufferSize") {
+            RecorderConfig.buffer_size = std::stoul(value);
+        }
+        else if (key == "RecorderPostBursts") {
+            RecorderConfig.post_bursts = std::stoul(value);
+        }
+        else if (key == "RecorderInterval") {
+            RecorderConfig.min_interval_s = std::stoi(value);
+        }
+        else if (key == "RecorderMaxDumps") {
+            RecorderConfig.max_dumps = std::stoi(value);
+        }
+        else if (key == "AssistFile") {
+            AssistFile = value;
+        }
+        else if (key == "AssistPositionFile") {
+            AssistPositionFile = value;
+        }
+        else if (key == "AssistTime") {
+            AssistConfig.send_time = std::stoi(value) != 0;
+        }
+        else if (key == "AssistWindow") {
+            AssistConfig.window = std::stoi(value);
+        }
+        else if (key == "AssistTimeout") {
+            AssistConfig.timeout_ms = std::stoi(value);
+        }
+        else if (key == "AssistInterval") {
+            AssistConfig.interval_ms = std::stoi(value);
+        }
+        else if (key == "SosBackup") {
+            SosBackup = std::stoi(value) != 0;
+        }
+        else if (key == "SosStopGnss") {
+            SosConfig.stop_gnss = std::stoi(value) != 0;
+        }
+        else if (key == "SosTimeout") {
+            SosConfig.timeout_ms = std::stoi(value);
+        }
+        else if (key == "SimRate") {
+            SimConfig.rate_hz = std::stoi(value);
+        }
+        else if (key == "SimGps") {
+            SimConfig.sv_count[gps_sim::gps] = std::stoi(value);
+        }
+        else if (key == "SimGlonass") {
+            SimConfig.sv_count[gps_sim::glonass] = std::stoi(value);
+        }
+        else if (key == "SimGalileo") {
+            SimConfig.sv_count[gps_sim::galileo] = std::stoi(value);
+        }
+        else if (key == "SimBeiDou") {
+            SimConfig.sv_count[gps_sim::beidou] = std::stoi(value);
+        }
+        else if (key == "SimLatitude") {
+            SimConfig.latitude = std::stod(value);
+        }
+        else if (key == "SimLongitude") {
+            SimConfig.longitude = std::stod(value);
+        }
+        else if (key == "SimAltitude") {
+            SimConfig.altitude = std::stod(value);
+        }
+        else if (key == "SimSpeed") {
+            SimConfig.speed = std::stod(value);
+        }
+        else if (key == "SimHeading") {
+            SimConfig.heading = std::stod(value);
+        }
+        else if (key == "SimTurnRate") {
+            SimConfig.turn_rate = std::stod(value);
+        }
+        else if (key == "SimClimbRate") {
+            SimConfig.climb_rate = std::stod(value);
+        }
+        else if (key == "SimSeed") {
+            SimConfig.seed = std::stoul(value);
+        }
+        else if (key == "SimBadChecksum") {
+            SimConfig.fault_rate[gps_sim::bad_checksum] = std::stod(value);
+        }
+        else if (key == "SimDropSentence") {
+            SimConfig.fault_rate[gps_sim::drop_sentence] = std::stod(value);
+        }
+        else if (key == "SimTruncate") {
+            SimConfig.fault_rate[gps_sim::truncate] = std::stod(value);
+        }
+        else if (key == "SimTimeJump") {
+            SimConfig.fault_rate[gps_sim::time_jump] = std::stod(value);
+        }
+        else if (key == "SimOutOfRange") {
+            SimConfig.fault_rate[gps_sim::out_of_range] = std::stod(value);
+        }
+        else if (key == "SimConflict") {
+            SimConfig.fault_rate[gps_sim::conflict] = std::stod(value);
+        }
+        else if (key == "SimJamming") {
+            SimConfig.fault_rate[gps_sim::jamming] = std::stod(value);
+        }
+        else if (key == "SimColdStart") {
+            SimConfig.cold_start_s = std::stod(value);
+        }
+        else if (key == "SimAssistedStart") {
+            SimConfig.assisted_start_s = std::stod(value);
+        }
+        else if (key == "SimBackupFile") {
+            std::snprintf(SimConfig.backup_file, sizeof(SimConfig.backup_file), "%s", value.c_str());
+        }
+        else if (key == "SimHotStart") {
+            SimConfig.hot_start_s = std::stod(value);
+        }
+    });
 }
 
 /**
- * @brief 設定ファイル読み込み
- * 
+ * @brief 動作中に再読み込みできる設定を読み込む
+ *
+ * 起動時とSIGHUPでメインスレッドが呼ぶ（ループスレッドは使わない）。
+ *
+ * @param conf 出力先
+ * @return true OK
+ * @return false 値が不正
  */
-void read_conf()
+bool read_live_conf(live_conf &conf)
 {
-    std::ifstream ifs;
-    std::string filename = "gps_test.conf";
-    ifs.open(filename, std::ios::in);
-    std::string line;
-    while (std::getline(ifs, line)) {
-        // #以降はコメントなので削除
-        auto comment_pos = line.find("#");
-        if (comment_pos != std::string::npos) {
-            line = line.substr(0, comment_pos);
-        }
-
-        // '='があればKeyとValueへ分割
-        auto pos = line.find("=");
-        if (pos != std::string::npos) {
-            auto key = trim(line.substr(0, pos));
-            auto value = trim(line.substr(pos + 1));
-            if (key == "MinimumLatitude") {
-                MinimumLatitude = std::stod(value);
+    try {
+        read_conf_file(conf_file, [&conf](const std::string &key, const std::string &value) {
+            if (read_position_conf(key, value, conf.range)) {
+                // 位置の範囲（gps_checkと共通）
             }
-            else if (key == "MaximumLatitude") {
-                MaximumLatitude = std::stod(value);
+            else if (key == "TimeoutLimit") {
+                conf.timeout_ms = std::stoi(value);
             }
-            else if (key == "MinimumLongitude") {
-                MinimumLongitude = std::stod(value);
+            else if (key == "CnoDropThreshold") {
+                conf.monitor.drop_threshold = std::stoi(value);
             }
-            else if (key == "MaximumLongitude") {
-                MaximumLongitude = std::stod(value);
+            else if (key == "CnoFadeThreshold") {
+                conf.monitor.fade_threshold = std::stoi(value);
             }
-            else if (key == "MinimumAltitude") {
-                MinimumAltitude = std::stod(value);
+            else if (key == "CnoElevationMask") {
+                conf.monitor.elevation_mask = std::stoi(value);
             }
-            else if (key == "MaximumAltitude") {
-                MaximumAltitude = std::stod(value);
+            else if (key == "CnoCommonCount") {
+                conf.monitor.common_count = std::stoi(value);
             }
-        }
+            else if (key == "CnoRelockEpochs") {
+                conf.monitor.relock_epochs = std::stoi(value);
+            }
+        });
     }
-
+    catch (const std::exception &e) {
+        std::cerr << "gps_test: invalid value in " << conf_file << ": " << e.what() << std::endl;
+        return false;
+    }
+    return true;
 }
@@ -8,6 +8,12 @@ start() {
 }
 
 stop() {
+    # 先にSIGINTで終了させる（終了時の処理を待ってから端末を閉じる）
+    pkill -INT -x gps_test
+    for i in $(seq 50); do
+        pgrep -x gps_test > /dev/null || break
+        sleep 0.1
+    done
     pkill gnome-terminal
 }
 
@@ -10,6 +10,8 @@
  */
 
 #include "ubx.hpp"
+#include "gnss_core.hpp"
+#include "trace.hpp"
 #include <atomic>
 #include <chrono>
 #include <iostream>
@@ -20,6 +22,7 @@
 #include <signal.h>
 
 static std::atomic<bool> terminate(false);  //! スレッド終了フラグ
+static std::string broker_path;             //! ブローカーのソケット（空ならI2Cを直接読む）
 
 /**
  * @brief ランダムな時間ウェイト(500ms ～ 1s)
@@ -42,34 +45,26 @@ static void random_sleep()
  */
 static void loop_thread_proc()
 {
-    ubx ubx;
+    ubx ubx(broker_path);
+    gnss_core::config conf;
+    gnss_core core(conf);
 
-    std::string msg;
     while (!terminate.load()) {
         std::vector<uint8_t> buf;
-        std::vector<std::string> nmea;
         ubx::status sts = ubx.get_nmea(buf);
         if(sts == ubx::conflict) {
             random_sleep();
             continue;
         }
         if(sts == ubx::ok) {
-            msg.insert(msg.end(), buf.begin(), buf.end());
+            core.feed(buf.data(), buf.size());
         }
 
         // OKならNMEAを表示
-        if(sts == ubx::empty && msg.size() > 0) {
-            nmea.clear();
-            size_t pos;
-            std::string delimiter = "\r\n";
-            while ((pos = msg.find(delimiter)) != std::string::npos) {
-                std::string sentence = msg.substr(0, pos);
-                msg.erase(0, pos + delimiter.length());
-                nmea.push_back(sentence);
-            }
-            msg = "";
-            for (auto s : nmea) {
-                std::cout << s << std::endl;
+        if(sts == ubx::empty && core.end_burst(trace::now())) {
+            for (auto &s : core.get_sentences()) {
+                std::cout.write(s.str, s.len);
+                std::cout << std::endl;
             }
         }
 
@@ -83,11 +78,18 @@ static void loop_thread_proc()
  * 
  * @return int 
  */
-int main(void) 
+int main(int argc, char *argv[]) 
 {
     sigset_t ss = {0};
     int signo = 0;
 
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-' && argv[i][1] == 'b') {
+            // gps_broker経由で受信
+            broker_path = (i + 1 < argc) ? argv[++i] : ubx::default_broker_path;
+        }
+    }
+
     // 無限ループを回避するためにメインのループを別スレッドで動かす。
     terminate.store(false);
     std::thread loop_thread([]{loop_thread_proc();}) ;
@@ -0,0 +1,327 @@
+/**
+ * @file log_writer.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 測位結果の非同期ログ出力
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "log_writer.hpp"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+static const size_t out_buffer_size = 64 * 1024;    // まとめ書きするサイズ
+static const size_t record_max_size = 512;          // 1レコードの最大サイズ
+static const int batch_interval_ms = 1000;          // まとめ書きの最大間隔(ms)
+static const int poll_interval_ms = 100;            // リングバッファの確認間隔(ms)
+
+static const char csv_header[] =
+    "seq,mono_ms,utc,latitude,longitude,altitude,num_sv,pdop,hdop,vdop,"
+    "sum_err,sum_err_cnt,utc_err,utc_err_cnt,position_err,position_err_cnt,timeout,timeout_cnt\n";
+
+/**
+ * @brief Construct a new log writer::log writer object
+ *
+ * @param conf 設定
+ */
+log_writer::log_writer(const config &conf) :
+conf(conf),
+ring(conf.ring_size),
+head(0),
+tail(0),
+stop(false),
+written(0),
+dropped(0),
+errors(0),
+out(out_buffer_size + record_max_size),
+out_len(0),
+fd(-1),
+file_size(0)
+{
+    open_file();
+    thread = std::thread([this]{thread_proc();});
+}
+
+/**
+ * @brief Destroy the log writer::log writer object
+ *
+ * 残っているレコードを書き出してから終了する。
+ */
+log_writer::~log_writer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stop.store(true);
+    }
+    cv.notify_one();
+    thread.join();
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+/**
+ * @brief レコードを追加（ブロックしない）
+ *
+ * @param fix 測位結果
+ * @return true 追加した
+ * @return false リングバッファが一杯のため破棄した
+ */
+bool log_writer::push(const gps_fix &fix)
+{
+    uint64_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) >= ring.size()) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    ring[h % ring.size()] = fix;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+}
+
+/**
+ * @brief 書き込んだレコード数を取得
+ *
+ * @return uint64_t レコード数
+ */
+uint64_t log_writer::get_written()
+{
+    return written.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief 破棄したレコード数を取得
+ *
+ * @return uint64_t レコード数
+ */
+uint64_t log_writer::get_dropped()
+{
+    return dropped.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief 書き込みエラー数を取得
+ *
+ * @return uint64_t エラー数
+ */
+uint64_t log_writer::get_errors()
+{
+    return errors.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief 出力形式の文字列を変換
+ *
+ * @param str "csv" or "jsonl"
+ * @return log_writer::format 出力形式
+ */
+log_writer::format log_writer::parse_format(const std::string &str)
+{
+    if (str == "jsonl" || str == "json") {
+        return jsonl;
+    }
+    return csv;
+}
+
+/**
+ * @brief 書き込みスレッド
+ *
+ */
+void log_writer::thread_proc()
+{
+    auto last_batch = std::chrono::steady_clock::now();
+    auto last_sync = last_batch;
+    bool dirty = false;
+
+    while (true) {
+        bool stopping = stop.load();
+
+        // リングバッファからまとめて取り出してフォーマット
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        uint64_t h = head.load(std::memory_order_acquire);
+        while (t != h) {
+            out_len += format_record(ring[t % ring.size()], &out[out_len], record_max_size);
+            t++;
+            tail.store(t, std::memory_order_release);
+            written.fetch_add(1, std::memory_order_relaxed);
+            if (out_len >= out_buffer_size) {
+                flush();
+                last_batch = std::chrono::steady_clock::now();
+                dirty = true;
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (out_len > 0 && (stopping ||
+            std::chrono::duration_cast<std::chrono::milliseconds>(now - last_batch).count() >= batch_interval_ms)) {
+            flush();
+            last_batch = now;
+            dirty = true;
+        }
+        if (dirty && fd >= 0 &&
+            std::chrono::duration_cast<std::chrono::milliseconds>(now - last_sync).count() >= conf.fsync_interval_ms) {
+            fsync(fd);
+            last_sync = now;
+            dirty = false;
+        }
+
+        if (stopping) {
+            break;
+        }
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait_for(lock, std::chrono::milliseconds(poll_interval_ms), [this]{return stop.load();});
+    }
+}
+
+/**
+ * @brief ログファイルを開く
+ *
+ */
+void log_writer::open_file()
+{
+    fd = open(conf.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "log_writer: failed to open " << conf.path << ": " << std::strerror(errno) << std::endl;
+        errors.fetch_add(1, std::memory_order_relaxed);
+        file_size = 0;
+        return;
+    }
+    struct stat st;
+    file_size = (fstat(fd, &st) == 0) ? st.st_size : 0;
+
+    // 新しいファイルならCSVヘッダを出力
+    if (file_size == 0 && conf.fmt == csv) {
+        if (write(fd, csv_header, sizeof(csv_header) - 1) > 0) {
+            file_size += sizeof(csv_header) - 1;
+        }
+    }
+}
+
+/**
+ * @brief ログファイルをローテーション
+ *
+ * path -> path.1 -> path.2 ... path.<rotate_count>（最も古いものは削除）
+ */
+void log_writer::rotate()
+{
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+        fd = -1;
+    }
+    for (int i = conf.rotate_count - 1; i >= 1; i--) {
+        std::string from = conf.path + "." + std::to_string(i);
+        std::string to = conf.path + "." + std::to_string(i + 1);
+        rename(from.c_str(), to.c_str());
+    }
+    if (conf.rotate_count > 0) {
+        rename(conf.path.c_str(), (conf.path + ".1").c_str());
+    }
+    else {
+        unlink(conf.path.c_str());
+    }
+    open_file();
+}
+
+/**
+ * @brief まとめ書き用バッファをファイルに出力
+ *
+ */
+void log_writer::flush()
+{
+    if (conf.rotate_size > 0 && file_size > 0 && file_size + out_len > conf.rotate_size) {
+        rotate();
+    }
+    if (fd < 0) {
+        // 開けていなければ再度開いてみる
+        open_file();
+    }
+    if (fd >= 0) {
+        size_t pos = 0;
+        while (pos < out_len) {
+            ssize_t ret = write(fd, &out[pos], out_len - pos);
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                errors.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+            pos += ret;
+        }
+        file_size += pos;
+    }
+    out_len = 0;
+}
+
+/**
+ * @brief 1レコードをフォーマット
+ *
+ * @param fix 測位結果
+ * @param buf 出力先
+ * @param size 出力先のサイズ
+ * @return size_t 出力したバイト数
+ */
+size_t log_writer::format_record(const gps_fix &fix, char *buf, size_t size)
+{
+    char utc[32] = "";
+    if (fix.utc > 0) {
+        struct tm tm;
+        gmtime_r(&fix.utc, &tm);
+        std::strftime(utc, sizeof(utc), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    }
+
+    int n;
+    if (conf.fmt == jsonl) {
+        // JSONではNaNを表現できないのでnullを出力
+        char num[6][32];
+        const double values[6] = { fix.latitude, fix.longitude, fix.altitude, fix.pdop, fix.hdop, fix.vdop };
+        const char *formats[6] = { "%.7f", "%.7f", "%.1f", "%.2f", "%.2f", "%.2f" };
+        for (int i = 0; i < 6; i++) {
+            if (std::isnan(values[i])) {
+                std::strcpy(num[i], "null");
+            }
+            else {
+                std::snprintf(num[i], sizeof(num[i]), formats[i], values[i]);
+            }
+        }
+        n = std::snprintf(buf, size,
+            "{\"seq\":%llu,\"mono_ms\":%llu,\"utc\":\"%s\","
+            "\"lat\":%s,\"lon\":%s,\"alt\":%s,\"num_sv\":%d,"
+            "\"pdop\":%s,\"hdop\":%s,\"vdop\":%s,"
+            "\"sum_err\":%s,\"sum_err_cnt\":%d,\"utc_err\":%s,\"utc_err_cnt\":%d,"
+            "\"position_err\":%s,\"position_err_cnt\":%d,\"timeout\":%s,\"timeout_cnt\":%d}\n",
+            (unsigned long long)fix.seq, (unsigned long long)(fix.mono_ns / 1000000), utc,
+            num[0], num[1], num[2], fix.num_sv, num[3], num[4], num[5],
+            fix.sum_err ? "true" : "false", fix.sum_err_cnt,
+            fix.utc_err ? "true" : "false", fix.utc_err_cnt,
+            fix.position_err ? "true" : "false", fix.position_err_cnt,
+            fix.timeout ? "true" : "false", fix.timeout_cnt);
+    }
+    else {
+        n = std::snprintf(buf, size,
+            "%llu,%llu,%s,%.7f,%.7f,%.1f,%d,%.2f,%.2f,%.2f,%d,%d,%d,%d,%d,%d,%d,%d\n",
+            (unsigned long long)fix.seq, (unsigned long long)(fix.mono_ns / 1000000), utc,
+            fix.latitude, fix.longitude, fix.altitude, fix.num_sv, fix.pdop, fix.hdop, fix.vdop,
+            fix.sum_err, fix.sum_err_cnt, fix.utc_err, fix.utc_err_cnt,
+            fix.position_err, fix.position_err_cnt, fix.timeout, fix.timeout_cnt);
+    }
+    if (n < 0) {
+        return 0;
+    }
+    if ((size_t)n >= size) {
+        return size - 1;
+    }
+    return n;
+}
@@ -0,0 +1,92 @@
+/**
+ * @file log_writer.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 測位結果の非同期ログ出力
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef LOG_WRITER_HPP
+#define LOG_WRITER_HPP
+
+#include "gps_fix.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief 測位結果の非同期ログ出力
+ *
+ * ループスレッドは事前確保したリングバッファにレコードをコピーするだけで、
+ * ファイルへの書き込み・fsync・ローテーションは書き込みスレッドで行う。
+ */
+class log_writer
+{
+public:
+    enum format {
+        csv,
+        jsonl
+    };
+
+    /**
+     * @brief 設定
+     *
+     */
+    class config {
+    public:
+        std::string path;           // 出力ファイル
+        format fmt;                 // 出力形式
+        int fsync_interval_ms;      // fsync間隔(ms)
+        size_t rotate_size;         // ローテーションするサイズ(byte)
+        int rotate_count;           // 残す世代数
+        size_t ring_size;           // リングバッファのレコード数
+        config() {
+            path = "gps_test.log";
+            fmt = csv;
+            fsync_interval_ms = 10000;
+            rotate_size = 16 * 1024 * 1024;
+            rotate_count = 4;
+            ring_size = 1024;
+        }
+    };
+
+    log_writer(const config &conf);
+    ~log_writer();
+    bool push(const gps_fix &fix);
+    uint64_t get_written();
+    uint64_t get_dropped();
+    uint64_t get_errors();
+
+    static format parse_format(const std::string &str);
+
+private:
+    config conf;
+    std::vector<gps_fix> ring;              // 事前確保したリングバッファ
+    std::atomic<uint64_t> head;             // 書き込み位置（ループスレッド）
+    std::atomic<uint64_t> tail;             // 読み出し位置（書き込みスレッド）
+    std::atomic<bool> stop;
+    std::atomic<uint64_t> written;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> errors;
+    std::vector<char> out;                  // まとめ書き用バッファ
+    size_t out_len;
+    int fd;
+    size_t file_size;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::thread thread;
+
+    void thread_proc();
+    void open_file();
+    void rotate();
+    void flush();
+    size_t format_record(const gps_fix &fix, char *buf, size_t size);
+};
+
+#endif
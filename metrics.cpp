@@ -0,0 +1,314 @@
+/**
+ * @file metrics.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 動作状況のメトリクス（Prometheusのテキスト形式で公開）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "metrics.hpp"
+#include "trace.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+std::atomic<uint64_t> metrics::counters[metrics::counter_count];
+std::atomic<double> metrics::gauges[metrics::gauge_count];
+
+static const char *counter_help[metrics::counter_count] = {
+    "Epochs processed",
+    "Bytes read from the receiver",
+    "I2C read conflicts",
+    "Receiver read errors",
+    "Sentences with a valid checksum",
+    "Sentences with a checksum error",
+    "Sentences truncated at the end of a burst",
+    "RMC sentences whose time could not be parsed",
+    "UTC continuity errors",
+    "Positions outside the configured range",
+    "Receive timeouts",
+    "Wakeups later than one poll interval",
+};
+
+static const char *gauge_help[metrics::gauge_count] = {
+    "Satellites used in the fix",
+    "Satellites tracked with a C/N0",
+    "Horizontal dilution of precision",
+    "1 if the receiver has a valid fix",
+    "Time to first fix in seconds (-1 before the first fix)",
+    "Log records dropped because the writer fell behind",
+    "Number of configuration reloads",
+};
+
+static const int first_bucket = 10;     // 公開するヒストグラムのバケット（2^10 ns ～ 2^30 ns）
+static const int last_bucket = 30;
+static const int listen_backlog = 4;
+static const int accept_poll_ms = 500;  // 終了を確認する間隔
+static const int io_timeout_ms = 1000;  // 遅いクライアントを待つ時間
+
+/**
+ * @brief カウンターの名前
+ *
+ * @param c カウンター
+ * @return const char* 名前
+ */
+const char *metrics::counter_name(counter c)
+{
+    static const char *names[counter_count] = {
+        "epochs", "bytes_read", "conflicts", "dev_errors", "sentences", "checksum_errors",
+        "truncated", "parse_failures", "utc_errors", "position_errors", "timeouts",
+        "late_wakeups"
+    };
+    return (c < counter_count) ? names[c] : "unknown";
+}
+
+/**
+ * @brief ゲージの名前
+ *
+ * @param g ゲージ
+ * @return const char* 名前
+ */
+const char *metrics::gauge_name(gauge g)
+{
+    static const char *names[gauge_count] = {
+        "num_sv", "sv_tracked", "hdop", "fix", "ttff_seconds", "log_dropped", "conf_version"
+    };
+    return (g < gauge_count) ? names[g] : "unknown";
+}
+
+/**
+ * @brief Prometheusのテキスト形式で出力
+ *
+ * @param out 出力先
+ */
+void metrics::write_prometheus(std::string &out)
+{
+    char line[256];
+    for (int c = 0; c < counter_count; c++) {
+        const char *name = counter_name((counter)c);
+        std::snprintf(line, sizeof(line), "# HELP gps_test_%s_total %s\n# TYPE gps_test_%s_total counter\ngps_test_%s_total %llu\n",
+                      name, counter_help[c], name, name,
+                      (unsigned long long)counters[c].load(std::memory_order_relaxed));
+        out += line;
+    }
+    for (int g = 0; g < gauge_count; g++) {
+        const char *name = gauge_name((gauge)g);
+        std::snprintf(line, sizeof(line), "# HELP gps_test_%s %s\n# TYPE gps_test_%s gauge\ngps_test_%s %.9g\n",
+                      name, gauge_help[g], name, name, gauges[g].load(std::memory_order_relaxed));
+        out += line;
+    }
+
+    out += "# HELP gps_test_stage_duration_seconds Processing time per stage\n"
+           "# TYPE gps_test_stage_duration_seconds histogram\n";
+    for (int s = 0; s < trace::stage_count; s++) {
+        uint64_t buckets[trace::histogram_buckets];
+        uint64_t sum_ns = 0;
+        trace::get_histogram((trace::stage)s, buckets, sum_ns);
+        const char *name = trace::stage_name((trace::stage)s);
+        // 記録中に読むことがあるので回数はバケットの合計にする（累積が単調になる）
+        uint64_t acc = 0;
+        for (int i = 0; i < trace::histogram_buckets; i++) {
+            acc += buckets[i];
+            if (i >= first_bucket && i <= last_bucket) {
+                std::snprintf(line, sizeof(line), "gps_test_stage_duration_seconds_bucket{stage=\"%s\",le=\"%.9g\"} %llu\n",
+                              name, (double)(1ull << i) * 1e-9, (unsigned long long)acc);
+                out += line;
+            }
+        }
+        std::snprintf(line, sizeof(line),
+                      "gps_test_stage_duration_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n"
+                      "gps_test_stage_duration_seconds_sum{stage=\"%s\"} %.9f\n"
+                      "gps_test_stage_duration_seconds_count{stage=\"%s\"} %llu\n",
+                      name, (unsigned long long)acc, name, sum_ns * 1e-9, name, (unsigned long long)acc);
+        out += line;
+    }
+}
+
+/**
+ * @brief Construct a new metrics server::metrics server object
+ *
+ * @param socket_path Unixドメインソケット（空なら使わない）
+ * @param tcp_port localhostのTCPポート（0なら使わない）
+ */
+metrics_server::metrics_server(const std::string &socket_path, int tcp_port) :
+socket_path(socket_path),
+tcp_port(tcp_port),
+listen_fd{-1, -1},
+stopping(false),
+scrapes(0)
+{
+}
+
+/**
+ * @brief Destroy the metrics server::metrics server object
+ *
+ */
+metrics_server::~metrics_server()
+{
+    stop();
+}
+
+/**
+ * @brief 待ち受けを開始
+ *
+ * @return true OK
+ * @return false ERROR
+ */
+bool metrics_server::start()
+{
+    if (socket_path != "") {
+        listen_fd[0] = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+        unlink(socket_path.c_str());
+        if (listen_fd[0] < 0 || bind(listen_fd[0], reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 ||
+            listen(listen_fd[0], listen_backlog) != 0) {
+            std::cerr << "metrics: failed to listen " << socket_path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+    }
+    if (tcp_port > 0) {
+        // 外部からは読めないようにlocalhostだけ
+        listen_fd[1] = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int on = 1;
+        setsockopt(listen_fd[1], SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        struct sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(tcp_port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (listen_fd[1] < 0 || bind(listen_fd[1], reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 ||
+            listen(listen_fd[1], listen_backlog) != 0) {
+            std::cerr << "metrics: failed to listen 127.0.0.1:" << tcp_port << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+    }
+    thread = std::thread([this]{thread_proc();});
+    return true;
+}
+
+/**
+ * @brief 待ち受けを終了
+ *
+ */
+void metrics_server::stop()
+{
+    stopping = true;
+    if (thread.joinable()) {
+        thread.join();
+    }
+    for (int &fd : listen_fd) {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (socket_path != "") {
+        unlink(socket_path.c_str());
+        socket_path = "";
+    }
+}
+
+/**
+ * @brief 読み出された回数を取得
+ *
+ * @return uint64_t 回数
+ */
+uint64_t metrics_server::get_scrapes() const
+{
+    return scrapes;
+}
+
+/**
+ * @brief 待ち受けスレッド
+ *
+ */
+void metrics_server::thread_proc()
+{
+    // ループスレッドの邪魔をしないように優先度を下げる
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 10);
+
+    struct pollfd pfd[2];
+    for (int i = 0; i < 2; i++) {
+        pfd[i].fd = listen_fd[i];
+        pfd[i].events = POLLIN;
+    }
+    while (!stopping) {
+        if (poll(pfd, 2, accept_poll_ms) <= 0) {
+            continue;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (pfd[i].fd >= 0 && (pfd[i].revents & POLLIN)) {
+                int fd = accept4(pfd[i].fd, nullptr, nullptr, SOCK_CLOEXEC);
+                if (fd >= 0) {
+                    serve(fd);
+                    close(fd);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief 1回の読み出しに応答
+ *
+ * HTTPのリクエストは中身を見ずに読み捨てる（何も送らないクライアントにも応答する）。
+ *
+ * @param fd 接続
+ */
+void metrics_server::serve(int fd)
+{
+    struct timeval tv;
+    tv.tv_sec = io_timeout_ms / 1000;
+    tv.tv_usec = (io_timeout_ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    // リクエストヘッダーの終わり（空行）まで読む
+    char req[2048];
+    size_t len = 0;
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    while (len < sizeof(req) - 1 && poll(&pfd, 1, 200) > 0) {
+        ssize_t n = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+        req[len] = '\0';
+        if (std::strstr(req, "\r\n\r\n") != nullptr || std::strstr(req, "\n\n") != nullptr) {
+            break;
+        }
+    }
+
+    std::string body;
+    body.reserve(32 * 1024);
+    metrics::write_prometheus(body);
+    char header[128];
+    int hlen = std::snprintf(header, sizeof(header),
+                             "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n",
+                             body.size());
+    std::string resp(header, hlen);
+    resp += body;
+    size_t pos = 0;
+    while (pos < resp.size()) {
+        ssize_t n = send(fd, resp.data() + pos, resp.size() - pos, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return;
+        }
+        pos += n;
+    }
+    scrapes++;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file metrics.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 動作状況のメトリクス（Prometheusのテキスト形式で公開）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+/**
+ * @brief メトリクス（カウンターとゲージ）
+ *
+ * 更新はrelaxedのatomic 1回だけなので、ループスレッドからそのまま呼べる（ロック・ヒープなし）。
+ * 処理段階毎の処理時間はtraceのヒストグラムをそのまま公開する。
+ */
+class metrics
+{
+public:
+    enum counter {
+        epochs,             // 処理したエポック数
+        bytes_read,         // 受信したバイト数
+        conflicts,          // I2Cのコンフリクト
+        dev_errors,         // 読み込みエラー
+        sentences,          // チェックサムが正しいセンテンス数
+        checksum_errors,
+        truncated,          // バーストの途中で切れたセンテンス
+        parse_failures,     // 時刻を解析できなかったRMC
+        utc_errors,
+        position_errors,
+        timeouts,
+        late_wakeups,       // poll間隔以上遅れて起床した回数
+        counter_count
+    };
+
+    enum gauge {
+        num_sv,             // 測位に使った衛星数
+        sv_tracked,         // C/N0を追尾中の衛星数
+        hdop,
+        fix,                // 測位していれば1
+        ttff_seconds,       // 初回測位までの時間（測位前は-1）
+        log_dropped,        // ログの書き込みが間に合わず捨てた数
+        conf_version,       // 設定を再読み込みした回数
+        gauge_count
+    };
+
+    static inline void add(counter c, uint64_t n = 1)
+    {
+        counters[c].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    static inline void set(gauge g, double value)
+    {
+        gauges[g].store(value, std::memory_order_relaxed);
+    }
+
+    static void write_prometheus(std::string &out);
+    static const char *counter_name(counter c);
+    static const char *gauge_name(gauge g);
+
+private:
+    static std::atomic<uint64_t> counters[counter_count];
+    static std::atomic<double> gauges[gauge_count];
+};
+
+/**
+ * @brief メトリクスを公開するスレッド
+ *
+ * Unixドメインソケット（またはlocalhostのTCPポート）で待ち受け、接続毎にHTTPの応答として
+ * Prometheusのテキスト形式を返す（curl --unix-socket path http://localhost/metrics）。
+ * 優先度を下げたスレッドで動き、ループスレッドとはatomicの読み出しだけで共有するので、
+ * 読み出しが遅くてもループは待たない。
+ */
+class metrics_server
+{
+public:
+    metrics_server(const std::string &socket_path, int tcp_port);
+    ~metrics_server();
+    bool start();
+    void stop();
+    uint64_t get_scrapes() const;
+
+private:
+    std::string socket_path;    // 空ならUnixドメインソケットを使わない
+    int tcp_port;               // 0ならTCPを使わない
+    int listen_fd[2];
+    std::atomic<bool> stopping;
+    std::atomic<uint64_t> scrapes;
+    std::thread thread;
+
+    void thread_proc();
+    void serve(int fd);
+};
+
+#endif
@@ -0,0 +1,399 @@
+/**
+ * @file mga_assist.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 支援データ(UBX-MGA)の送信（TTFFの短縮）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "mga_assist.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <thread>
+
+static const uint8_t class_cfg = 0x06;
+static const uint8_t class_mga = 0x13;
+static const uint8_t id_cfg_valset = 0x8a;
+static const uint8_t id_mga_ini = 0x40;
+static const uint8_t id_mga_ack = 0x60;
+static const uint32_t key_navspg_ackaiding = 0x10110025;   // CFG-NAVSPG-ACKAIDING
+
+/**
+ * @brief リトルエンディアンで書き込む
+ *
+ * @param p 出力先
+ * @param v 値
+ * @param n バイト数
+ */
+static void put_le(uint8_t *p, uint32_t v, int n)
+{
+    for (int i = 0; i < n; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+/**
+ * @brief Construct a new mga assist::mga assist object
+ *
+ * @param conf 設定
+ */
+mga_assist::mga_assist(const config &conf) :
+conf(conf),
+configured(false),
+has_position(false),
+latitude(0),
+longitude(0),
+altitude(0),
+next(0),
+outstanding(0),
+ack_seen(false),
+no_ack(false),
+sent_count(0),
+acked_count(0),
+nak_count(0),
+timeout_count(0)
+{
+    if (this->conf.window < 1) {
+        this->conf.window = 1;
+    }
+    // RAMの設定でMGA-ACKを有効にする（version, layers, reserved(2), key, value）
+    uint8_t payload[9] = { 0, 0x01, 0, 0 };
+    put_le(&payload[4], key_navspg_ackaiding, 4);
+    payload[8] = 1;
+    ubx::make_frame(class_cfg, id_cfg_valset, payload, sizeof(payload), ack_config);
+}
+
+/**
+ * @brief 支援データファイルを読み込む
+ *
+ * UBX-MGA以外とチェックサムが合わないメッセージは読み飛ばす。
+ *
+ * @param path ファイル
+ * @return true OK
+ * @return false ファイルが無い
+ */
+bool mga_assist::load(const std::string &path)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) {
+        std::cerr << "mga_assist: failed to open " << path << std::endl;
+        return false;
+    }
+    std::vector<uint8_t> buf((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    data.clear();
+    size_t skipped = 0;
+    size_t pos = 0;
+    while (pos + 8 <= buf.size()) {
+        if (buf[pos] != 0xb5 || buf[pos + 1] != 0x62) {
+            pos++;
+            continue;
+        }
+        size_t total = 8 + (buf[pos + 4] | (buf[pos + 5] << 8));
+        if (pos + total > buf.size() || !ubx::valid_frame(&buf[pos], total)) {
+            skipped++;
+            pos++;
+            continue;
+        }
+        if (buf[pos + 2] == class_mga) {
+            message m;
+            m.frame.assign(buf.begin() + pos, buf.begin() + pos + total);
+            m.st = queued;
+            data.push_back(m);
+        }
+        else {
+            skipped++;
+        }
+        pos += total;
+    }
+    if (skipped > 0) {
+        std::cerr << "mga_assist: skipped " << skipped << " invalid messages in " << path << std::endl;
+    }
+    return true;
+}
+
+/**
+ * @brief 前回の位置を設定
+ *
+ * @param latitude 緯度(deg)
+ * @param longitude 経度(deg)
+ * @param altitude 高度(m)
+ */
+void mga_assist::set_position(double latitude, double longitude, double altitude)
+{
+    this->latitude = latitude;
+    this->longitude = longitude;
+    this->altitude = altitude;
+    has_position = true;
+}
+
+/**
+ * @brief 送信するメッセージを追加
+ *
+ * @param frame UBXメッセージ
+ */
+void mga_assist::push(const std::vector<uint8_t> &frame)
+{
+    message m;
+    m.frame = frame;
+    m.st = queued;
+    queue.push_back(m);
+}
+
+/**
+ * @brief 送信を開始（時刻、位置、支援データの順に並べる）
+ *
+ */
+void mga_assist::start()
+{
+    queue.clear();
+    std::vector<uint8_t> frame;
+
+    if (conf.send_time) {
+        // MGA-INI-TIME_UTC（システム時刻、うるう秒は不明）
+        auto now = std::chrono::system_clock::now();
+        time_t t = std::chrono::system_clock::to_time_t(now);
+        long ns = (long)(std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count() % 1000000000);
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        double acc_s = std::floor(conf.time_acc_s);
+        uint8_t payload[24] = {0};
+        payload[0] = 0x10;
+        payload[3] = (uint8_t)-128;
+        put_le(&payload[4], tm.tm_year + 1900, 2);
+        payload[6] = tm.tm_mon + 1;
+        payload[7] = tm.tm_mday;
+        payload[8] = tm.tm_hour;
+        payload[9] = tm.tm_min;
+        payload[10] = tm.tm_sec;
+        put_le(&payload[12], (uint32_t)ns, 4);
+        put_le(&payload[16], (uint32_t)acc_s, 2);
+        put_le(&payload[20], (uint32_t)((conf.time_acc_s - acc_s) * 1e9), 4);
+        ubx::make_frame(class_mga, id_mga_ini, payload, sizeof(payload), frame);
+        push(frame);
+    }
+    if (has_position) {
+        // MGA-INI-POS_LLH
+        uint8_t payload[20] = {0};
+        payload[0] = 0x01;
+        put_le(&payload[4], (uint32_t)(int32_t)std::lround(latitude * 1e7), 4);
+        put_le(&payload[8], (uint32_t)(int32_t)std::lround(longitude * 1e7), 4);
+        put_le(&payload[12], (uint32_t)(int32_t)std::lround(altitude * 100.0), 4);
+        put_le(&payload[16], (uint32_t)std::lround(conf.pos_acc_m * 100.0), 4);
+        ubx::make_frame(class_mga, id_mga_ini, payload, sizeof(payload), frame);
+        push(frame);
+    }
+    for (auto &m : data) {
+        queue.push_back(m);
+    }
+    next = 0;
+    outstanding = 0;
+    configured = false;
+}
+
+/**
+ * @brief ACKのタイムアウトを判定して送信できる分を送る
+ *
+ * ループの毎回呼ぶ。1回にwindow個まで送り、送信の間はinterval_ms空ける。
+ *
+ * @param dev 受信機
+ */
+void mga_assist::poll(ubx &dev)
+{
+    if (done()) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (!configured) {
+        dev.send(ack_config.data(), ack_config.size());
+        configured = true;
+        last_send = now;
+    }
+
+    // タイムアウト
+    for (size_t i = 0; i < next; i++) {
+        message &m = queue[i];
+        if (m.st == sent && !no_ack && now - m.sent_time >= std::chrono::milliseconds(conf.timeout_ms)) {
+            m.st = timed_out;
+            outstanding--;
+            timeout_count++;
+        }
+    }
+    if (!ack_seen && !no_ack && (int)timeout_count >= conf.window) {
+        // ACKが返らない受信機は間隔だけで送る
+        no_ack = true;
+        outstanding = 0;
+    }
+
+    int budget = no_ack ? conf.window : conf.window - outstanding;
+    while (budget > 0 && next < queue.size()) {
+        auto elapsed = std::chrono::steady_clock::now() - last_send;
+        if (elapsed < std::chrono::milliseconds(conf.interval_ms)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(conf.interval_ms) - elapsed);
+        }
+        message &m = queue[next];
+        if (dev.send(m.frame.data(), m.frame.size()) != ubx::ok) {
+            // 次のループで再送
+            break;
+        }
+        last_send = std::chrono::steady_clock::now();
+        m.st = sent;
+        m.sent_time = last_send;
+        next++;
+        sent_count++;
+        budget--;
+        if (!no_ack) {
+            outstanding++;
+        }
+    }
+}
+
+/**
+ * @brief 受信したUBXメッセージを処理（MGA-ACKだけ）
+ *
+ * MGA-ACKのペイロード: type(1=受理), version, infoCode, msgId, msgPayloadStart(4)
+ *
+ * @param frame UBXメッセージ（ubx::take_frames()で取り出したもの）
+ * @param len 長さ
+ * @return true MGA-ACK
+ * @return false それ以外
+ */
+bool mga_assist::on_frame(const uint8_t *frame, size_t len)
+{
+    if (frame[2] != class_mga || frame[3] != id_mga_ack || len < 8 + 8) {
+        return false;
+    }
+    const uint8_t *p = frame + 6;
+    ack_seen = true;
+    for (size_t i = 0; i < next; i++) {
+        message &m = queue[i];
+        if (m.st != sent || m.frame[3] != p[3]) {
+            continue;
+        }
+        size_t cmp = m.frame.size() - 8 < 4 ? m.frame.size() - 8 : 4;
+        if (std::memcmp(&m.frame[6], &p[4], cmp) != 0) {
+            continue;
+        }
+        if (p[0] == 1) {
+            m.st = acked;
+            acked_count++;
+        }
+        else {
+            m.st = nak;
+            nak_count++;
+        }
+        if (!no_ack) {
+            outstanding--;
+        }
+        break;
+    }
+    return true;
+}
+
+/**
+ * @brief すべて送信してACKを受け取った（またはタイムアウトした）か
+ *
+ * @return true 終了
+ * @return false 送信中
+ */
+bool mga_assist::done() const
+{
+    return next >= queue.size() && (no_ack || outstanding == 0);
+}
+
+/**
+ * @brief 送信するメッセージ数を取得
+ *
+ * @return size_t メッセージ数
+ */
+size_t mga_assist::get_total() const
+{
+    return queue.size();
+}
+
+/**
+ * @brief 送信したメッセージ数を取得
+ *
+ * @return size_t メッセージ数
+ */
+size_t mga_assist::get_sent() const
+{
+    return sent_count;
+}
+
+/**
+ * @brief 受理されたメッセージ数を取得
+ *
+ * @return size_t メッセージ数
+ */
+size_t mga_assist::get_acked() const
+{
+    return acked_count;
+}
+
+/**
+ * @brief 受理されなかったメッセージ数を取得
+ *
+ * @return size_t メッセージ数
+ */
+size_t mga_assist::get_nak() const
+{
+    return nak_count;
+}
+
+/**
+ * @brief ACKがタイムアウトしたメッセージ数を取得
+ *
+ * @return size_t メッセージ数
+ */
+size_t mga_assist::get_timeout() const
+{
+    return timeout_count;
+}
+
+/**
+ * @brief 前回の位置を読み込む
+ *
+ * @param path ファイル（"緯度 経度 高度"）
+ * @param latitude 緯度(deg)
+ * @param longitude 経度(deg)
+ * @param altitude 高度(m)
+ * @return true OK
+ * @return false ファイルが無い、または壊れている
+ */
+bool mga_assist::load_position(const std::string &path, double &latitude, double &longitude, double &altitude)
+{
+    std::ifstream ifs(path);
+    if (!(ifs >> latitude >> longitude >> altitude)) {
+        return false;
+    }
+    return latitude >= -90 && latitude <= 90 && longitude >= -180 && longitude <= 180;
+}
+
+/**
+ * @brief 最後の位置を保存
+ *
+ * @param path ファイル
+ * @param latitude 緯度(deg)
+ * @param longitude 経度(deg)
+ * @param altitude 高度(m)
+ * @return true OK
+ * @return false ERROR
+ */
+bool mga_assist::save_position(const std::string &path, double latitude, double longitude, double altitude)
+{
+    FILE *fp = std::fopen(path.c_str(), "w");
+    if (fp == nullptr) {
+        std::cerr << "mga_assist: failed to open " << path << std::endl;
+        return false;
+    }
+    std::fprintf(fp, "%.7f %.7f %.1f\n", latitude, longitude, altitude);
+    return std::fclose(fp) == 0;
+}
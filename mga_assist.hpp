@@ -0,0 +1,114 @@
+/**
+ * @file mga_assist.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 支援データ(UBX-MGA)の送信（TTFFの短縮）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef MGA_ASSIST_HPP
+#define MGA_ASSIST_HPP
+
+#include "ubx.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief 支援データ(UBX-MGA)の送信
+ *
+ * 起動直後に現在時刻(MGA-INI-TIME_UTC)、前回の位置(MGA-INI-POS_LLH)、
+ * ローカルの支援データファイル（AssistNow Offline/Onlineのファイル、UBX-MGAを連結したもの）の順に送信する。
+ * 受信機のI2Cの受信バッファを溢れさせないよう、MGA-ACKが返っていない送信をwindow個までに制限し、
+ * 送信の間隔もinterval_ms以上空ける。ACKが返らない受信機（ACKの設定が無効）は間隔だけで送る。
+ */
+class mga_assist
+{
+public:
+    /**
+     * @brief 設定
+     *
+     */
+    class config {
+    public:
+        bool send_time;         // 現在時刻を送る（システム時刻が正しいこと）
+        double time_acc_s;      // 時刻の精度(秒)
+        double pos_acc_m;       // 前回の位置の精度(m)
+        int window;             // ACK待ちの最大数
+        int timeout_ms;         // ACKのタイムアウト
+        int interval_ms;        // 送信の最小間隔
+        config() {
+            send_time = true;
+            time_acc_s = 2.0;
+            pos_acc_m = 1000.0;
+            window = 4;
+            timeout_ms = 1000;
+            interval_ms = 10;
+        }
+    };
+
+    mga_assist(const config &conf);
+    bool load(const std::string &path);
+    void set_position(double latitude, double longitude, double altitude);
+    void start();
+    void poll(ubx &dev);
+    bool on_frame(const uint8_t *frame, size_t len);
+    bool done() const;
+
+    size_t get_total() const;
+    size_t get_sent() const;
+    size_t get_acked() const;
+    size_t get_nak() const;
+    size_t get_timeout() const;
+
+    static bool load_position(const std::string &path, double &latitude, double &longitude, double &altitude);
+    static bool save_position(const std::string &path, double latitude, double longitude, double altitude);
+
+private:
+    enum state {
+        queued,
+        sent,
+        acked,
+        nak,
+        timed_out
+    };
+
+    /**
+     * @brief 送信するメッセージ
+     *
+     */
+    class message {
+    public:
+        std::vector<uint8_t> frame;
+        state st;
+        std::chrono::steady_clock::time_point sent_time;
+    };
+
+    config conf;
+    std::vector<message> data;              // 支援データファイル
+    std::vector<message> queue;             // 送信順（start()で作る）
+    std::vector<uint8_t> ack_config;        // MGA-ACKを有効にする設定(CFG-VALSET)
+    bool configured;
+    bool has_position;
+    double latitude;
+    double longitude;
+    double altitude;
+    size_t next;                            // 次に送るメッセージ
+    int outstanding;                        // ACK待ちの数
+    bool ack_seen;                          // MGA-ACKを受信した
+    bool no_ack;                            // ACKを待たずに送る
+    std::chrono::steady_clock::time_point last_send;
+    size_t sent_count;
+    size_t acked_count;
+    size_t nak_count;
+    size_t timeout_count;
+
+    void push(const std::vector<uint8_t> &frame);
+};
+
+#endif
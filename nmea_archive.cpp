@@ -0,0 +1,1165 @@
+/**
+ * @file nmea_archive.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief NMEAの圧縮アーカイブ
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "nmea_archive.hpp"
+#include "nmea_rmc.hpp"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+static const char block_magic[4] = { 'N', 'M', 'A', 'B' };
+static const size_t block_header_size = 13;
+static const uint8_t flag_compressed = 0x01;
+static const size_t max_slots = 64;         // 差分を取るセンテンスの種類の上限
+
+static const char index_magic[4] = { 'N', 'M', 'I', 'X' };
+static const uint32_t index_version = 1;
+
+static const uint8_t rec_literal = 'L';
+static const uint8_t rec_delta = 'D';
+
+/**
+ * @brief 可変長整数を追加
+ *
+ * @param buf 出力先
+ * @param value 値
+ */
+static void put_varint(std::vector<uint8_t> &buf, uint64_t value)
+{
+    while (value >= 0x80) {
+        buf.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    buf.push_back((uint8_t)value);
+}
+
+/**
+ * @brief 可変長整数を取得
+ *
+ * @param p 読み込み位置（更新される）
+ * @param end 終端
+ * @param value 値
+ * @return true OK
+ * @return false ERROR（データ不足）
+ */
+static bool get_varint(const uint8_t *&p, const uint8_t *end, uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t c = *p++;
+        value |= (uint64_t)(c & 0x7f) << shift;
+        if ((c & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline void put_le32(uint8_t *p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static inline uint32_t get_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void put_le64(uint8_t *p, uint64_t value)
+{
+    put_le32(p, (uint32_t)value);
+    put_le32(p + 4, (uint32_t)(value >> 32));
+}
+
+static inline uint64_t get_le64(const uint8_t *p)
+{
+    return (uint64_t)get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+/**
+ * @brief 索引のエントリをバイト列にする
+ *
+ * @param e エントリ
+ * @param p 出力先（index_entry_size）
+ */
+static void encode_entry(const nmea_archive::index_entry &e, uint8_t *p)
+{
+    put_le64(&p[0], e.offset);
+    put_le32(&p[8], e.stored_len);
+    put_le32(&p[12], e.raw_len);
+    put_le64(&p[16], (uint64_t)e.first_utc);
+    put_le64(&p[24], (uint64_t)e.last_utc);
+    put_le64(&p[32], (uint64_t)e.max_utc);
+    put_le64(&p[40], e.first_mono_ns);
+    put_le64(&p[48], e.last_mono_ns);
+}
+
+/**
+ * @brief バイト列から索引のエントリを取得
+ *
+ * @param p 入力（index_entry_size）
+ * @param e エントリ
+ */
+static void decode_entry(const uint8_t *p, nmea_archive::index_entry &e)
+{
+    e.offset = get_le64(&p[0]);
+    e.stored_len = get_le32(&p[8]);
+    e.raw_len = get_le32(&p[12]);
+    e.first_utc = (int64_t)get_le64(&p[16]);
+    e.last_utc = (int64_t)get_le64(&p[24]);
+    e.max_utc = (int64_t)get_le64(&p[32]);
+    e.first_mono_ns = get_le64(&p[40]);
+    e.last_mono_ns = get_le64(&p[48]);
+}
+
+/**
+ * @brief すべて書き込む
+ *
+ * @param fd ファイル
+ * @param buf データ
+ * @param len 長さ
+ * @return true OK
+ * @return false ERROR
+ */
+static bool write_all(int fd, const uint8_t *buf, size_t len)
+{
+    size_t pos = 0;
+    while (pos < len) {
+        ssize_t ret = write(fd, &buf[pos], len - pos);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        pos += ret;
+    }
+    return true;
+}
+
+/**
+ * @brief RMCなら時刻を取得
+ *
+ * @param line センテンス（"\r\n"を含まない）
+ * @param len 長さ
+ * @return int64_t 時刻（RMCでない、または時刻が無ければ-1）
+ */
+static int64_t rmc_time(const char *line, size_t len)
+{
+    if (len < 6 || line[0] != '$' || std::memcmp(&line[3], "RMC", 3) != 0) {
+        return -1;
+    }
+    nmea_rmc rmc(nmea_view(line, len));
+    time_t t = rmc.get_time_t();
+    return t > 0 ? (int64_t)t : -1;
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief 圧縮後の最大サイズ
+ *
+ * @param len 圧縮前のサイズ
+ * @return size_t 圧縮後の最大サイズ
+ */
+size_t nmea_archive::compress_bound(size_t len)
+{
+    return len + len / 255 + 16;
+}
+
+/**
+ * @brief LZ77圧縮（LZ4と同様のトークン形式）
+ *
+ * token(1): 上位4bit リテラル長, 下位4bit 一致長-4（15は255の続きで延長）
+ * literal, offset(2, LE), 一致長の延長
+ * 最後のシーケンスはリテラルのみ
+ *
+ * @param src 入力
+ * @param len 入力サイズ
+ * @param dst 出力（compress_bound(len)以上）
+ * @return size_t 出力サイズ
+ */
+size_t nmea_archive::compress(const uint8_t *src, size_t len, uint8_t *dst)
+{
+    const int hash_bits = 12;
+    const size_t min_match = 4;
+    const size_t last_literals = 5;
+    uint32_t table[1 << hash_bits];
+    std::memset(table, 0, sizeof(table));
+
+    size_t ip = 0;
+    size_t anchor = 0;
+    size_t op = 0;
+
+    auto put_len = [&](size_t n) {
+        while (n >= 255) {
+            dst[op++] = 255;
+            n -= 255;
+        }
+        dst[op++] = (uint8_t)n;
+    };
+    auto put_sequence = [&](size_t lit_len, size_t offset, size_t match_len) {
+        size_t ml = match_len >= min_match ? match_len - min_match : 0;
+        dst[op++] = (uint8_t)(((lit_len < 15 ? lit_len : 15) << 4) | (ml < 15 ? ml : 15));
+        if (lit_len >= 15) {
+            put_len(lit_len - 15);
+        }
+        std::memcpy(&dst[op], &src[anchor], lit_len);
+        op += lit_len;
+        if (match_len == 0) {
+            return;
+        }
+        dst[op++] = (uint8_t)offset;
+        dst[op++] = (uint8_t)(offset >> 8);
+        if (ml >= 15) {
+            put_len(ml - 15);
+        }
+    };
+
+    if (len > min_match + last_literals) {
+        size_t limit = len - last_literals;
+        while (ip + min_match <= limit) {
+            uint32_t seq = read32(&src[ip]);
+            uint32_t h = (seq * 2654435761u) >> (32 - hash_bits);
+            size_t ref = table[h];
+            table[h] = (uint32_t)(ip + 1);
+            if (ref > 0 && ip - (ref - 1) < 65536 && read32(&src[ref - 1]) == seq) {
+                ref--;
+                size_t match_len = min_match;
+                while (ip + match_len < limit && src[ref + match_len] == src[ip + match_len]) {
+                    match_len++;
+                }
+                put_sequence(ip - anchor, ip - ref, match_len);
+                ip += match_len;
+                anchor = ip;
+            }
+            else {
+                ip++;
+            }
+        }
+    }
+    put_sequence(len - anchor, 0, 0);
+
+    return op;
+}
+
+/**
+ * @brief LZ77伸張
+ *
+ * @param src 入力
+ * @param len 入力サイズ
+ * @param dst 出力
+ * @param dst_len 出力サイズ（伸張後のサイズと一致すること）
+ * @return true OK
+ * @return false ERROR（データ破損）
+ */
+bool nmea_archive::decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len)
+{
+    size_t ip = 0;
+    size_t op = 0;
+    auto get_len = [&](size_t &n) {
+        uint8_t c;
+        do {
+            if (ip >= len) {
+                return false;
+            }
+            c = src[ip++];
+            n += c;
+        } while (c == 255);
+        return true;
+    };
+
+    while (ip < len) {
+        uint8_t token = src[ip++];
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && !get_len(lit_len)) {
+            return false;
+        }
+        if (ip + lit_len > len || op + lit_len > dst_len) {
+            return false;
+        }
+        std::memcpy(&dst[op], &src[ip], lit_len);
+        ip += lit_len;
+        op += lit_len;
+        if (ip == len) {
+            // 最後のシーケンス
+            break;
+        }
+        if (ip + 2 > len) {
+            return false;
+        }
+        size_t offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        size_t match_len = token & 0x0f;
+        if (match_len == 15 && !get_len(match_len)) {
+            return false;
+        }
+        match_len += 4;
+        if (offset == 0 || offset > op || op + match_len > dst_len) {
+            return false;
+        }
+        // 重なりがあるので1バイトずつコピー
+        for (size_t i = 0; i < match_len; i++, op++) {
+            dst[op] = dst[op - offset];
+        }
+    }
+
+    return op == dst_len;
+}
+
+/**
+ * @brief ','でフィールドに分割（','で結合すると元に戻る）
+ *
+ * @param line センテンス（max_lineまで）
+ * @param len 長さ
+ * @param fields フィールド（max_fields個）
+ * @param nfield フィールド数
+ * @return true OK
+ * @return false フィールドが多すぎる
+ */
+bool nmea_archive::split_fields(const char *line, size_t len, field *fields, size_t &nfield)
+{
+    size_t n = 0;
+    size_t start = 0;
+    for (size_t i = 0; i <= len; i++) {
+        if (i == len || line[i] == ',') {
+            if (n == max_fields) {
+                return false;
+            }
+            fields[n].pos = (uint16_t)start;
+            fields[n].len = (uint16_t)(i - start);
+            n++;
+            start = i + 1;
+        }
+    }
+    nfield = n;
+    return true;
+}
+
+/**
+ * @brief センテンスの種類を取得
+ *
+ * GSVはメッセージ番号毎、GSAはsystemId毎に別の種類として扱う。
+ *
+ * @param line センテンス
+ * @param fields フィールド
+ * @param nfield フィールド数
+ * @param key 種類の出力先（max_key）
+ * @return size_t 種類の長さ（max_keyに収まらなければ0）
+ */
+size_t nmea_archive::make_key(const char *line, const field *fields, size_t nfield, char *key)
+{
+    const char *id = &line[fields[0].pos];
+    size_t id_len = fields[0].len;
+    const char *sub = nullptr;
+    size_t sub_len = 0;
+    if (id_len >= 6 && std::memcmp(&id[3], "GSV", 3) == 0 && nfield > 2) {
+        sub = &line[fields[2].pos];
+        sub_len = fields[2].len;
+    }
+    else if (id_len >= 6 && std::memcmp(&id[3], "GSA", 3) == 0 && nfield > 1) {
+        sub = &line[fields[nfield - 1].pos];
+        const char *star = static_cast<const char *>(std::memchr(sub, '*', fields[nfield - 1].len));
+        sub_len = star != nullptr ? (size_t)(star - sub) : fields[nfield - 1].len;
+    }
+    size_t key_len = id_len + (sub != nullptr ? 1 + sub_len : 0);
+    if (key_len > max_key) {
+        return 0;
+    }
+    std::memcpy(key, id, id_len);
+    if (sub != nullptr) {
+        key[id_len] = ',';
+        std::memcpy(&key[id_len + 1], sub, sub_len);
+    }
+    return key_len;
+}
+
+/**
+ * @brief Construct a new nmea archive::writer::writer object
+ *
+ * @param path 出力ファイル
+ * @param compress true: ブロックをLZ圧縮する
+ * @param block_size ブロックの非圧縮サイズ
+ */
+nmea_archive::writer::writer(const std::string &path, bool compress, size_t block_size) :
+fd(-1),
+index_fd(-1),
+compress(compress),
+block_size(block_size),
+file_offset(0),
+mono_ns(0),
+max_utc(-1),
+slot_count(0),
+nfield(0),
+raw_bytes(0),
+stored_bytes(0)
+{
+    // 追加するレコードはmax_record以下なので、ブロックはblock_size + max_recordを超えない
+    block.reserve(block_size + max_record);
+    packed.resize(block_header_size + compress_bound(block_size + max_record));
+    out.reserve(block_size * 2 + write_align);
+    pending.reserve(max_record);
+    slots.resize(max_slots);
+
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "nmea_archive: failed to open " << path << ": " << std::strerror(errno) << std::endl;
+        return;
+    }
+    off_t size = lseek(fd, 0, SEEK_END);
+    file_offset = size > 0 ? size : 0;
+    open_index(path);
+}
+
+/**
+ * @brief 索引を開く（追記する）
+ *
+ * 既存のアーカイブに追記する場合、索引が無いかアーカイブと合わなければ作り直す。
+ *
+ * @param path アーカイブファイル
+ */
+void nmea_archive::writer::open_index(const std::string &path)
+{
+    int flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+    if (file_offset == 0) {
+        // 新しいアーカイブなので古い索引は捨てる
+        flags |= O_TRUNC;
+    }
+    else {
+        index idx(path);
+        index_entry last;
+        bool valid = idx.is_open() &&
+                     (idx.size() == 0 ? false : idx.get(idx.size() - 1, last) && last.end() == file_offset);
+        if (!valid && !index::rebuild(path)) {
+            return;
+        }
+        index rebuilt(path);
+        if (rebuilt.size() > 0 && rebuilt.get(rebuilt.size() - 1, last)) {
+            max_utc = last.max_utc;
+        }
+    }
+
+    std::string index_path = index::path_of(path);
+    index_fd = open(index_path.c_str(), flags, 0644);
+    if (index_fd < 0) {
+        std::cerr << "nmea_archive: failed to open " << index_path << ": " << std::strerror(errno) << std::endl;
+        return;
+    }
+    if (lseek(index_fd, 0, SEEK_END) == 0) {
+        uint8_t header[index_header_size];
+        std::memcpy(header, index_magic, sizeof(index_magic));
+        put_le32(&header[4], index_version);
+        write_all(index_fd, header, sizeof(header));
+    }
+}
+
+/**
+ * @brief Destroy the nmea archive::writer::writer object
+ *
+ */
+nmea_archive::writer::~writer()
+{
+    close();
+}
+
+/**
+ * @brief ファイルを開けたかどうか
+ *
+ * @return true 開けた
+ * @return false 開けなかった
+ */
+bool nmea_archive::writer::is_open()
+{
+    return fd >= 0;
+}
+
+/**
+ * @brief 受信したバイト列を追加
+ *
+ * @param data 受信データ
+ * @param len 長さ
+ */
+void nmea_archive::writer::append(const uint8_t *data, size_t len)
+{
+    raw_bytes += len;
+    mono_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    const char *p = reinterpret_cast<const char *>(data);
+    const char *end = p + len;
+    while (p < end) {
+        const char *nl = static_cast<const char *>(std::memchr(p, '\n', end - p));
+        if (nl == nullptr) {
+            add_pending(p, end - p);
+            break;
+        }
+        if (pending.empty()) {
+            add_line(p, nl + 1 - p);
+        }
+        else {
+            add_pending(p, nl + 1 - p);
+            add_line(pending.data(), pending.size());
+            pending.clear();
+        }
+        p = nl + 1;
+    }
+}
+
+/**
+ * @brief 残りを書き出して閉じる
+ *
+ */
+void nmea_archive::writer::close()
+{
+    if (fd < 0) {
+        return;
+    }
+    if (!pending.empty()) {
+        add_literal(pending.data(), pending.size());
+        pending.clear();
+    }
+    flush_block();
+    write_out(true);
+    fsync(fd);
+    ::close(fd);
+    fd = -1;
+    if (index_fd >= 0) {
+        ::close(index_fd);
+        index_fd = -1;
+    }
+}
+
+/**
+ * @brief 元のバイト数を取得
+ *
+ * @return uint64_t バイト数
+ */
+uint64_t nmea_archive::writer::get_raw_bytes()
+{
+    return raw_bytes;
+}
+
+/**
+ * @brief 書き込んだバイト数を取得
+ *
+ * @return uint64_t バイト数
+ */
+uint64_t nmea_archive::writer::get_stored_bytes()
+{
+    return stored_bytes;
+}
+
+/**
+ * @brief 1行を追加
+ *
+ * @param line 行（改行を含む）
+ * @param len 長さ
+ */
+void nmea_archive::writer::add_line(const char *line, size_t len)
+{
+    // 索引のためにRMCの時刻を記録
+    size_t body_len = len;
+    while (body_len > 0 && (line[body_len - 1] == '\n' || line[body_len - 1] == '\r')) {
+        body_len--;
+    }
+    int64_t utc = rmc_time(line, body_len);
+    if (utc > 0) {
+        if (entry.first_utc < 0) {
+            entry.first_utc = utc;
+        }
+        entry.last_utc = utc;
+    }
+
+    // 長い行、フィールドや種類が長すぎる行はそのまま
+    char key[max_key];
+    size_t key_len;
+    if (len < 8 || len - 2 > max_line || line[0] != '$' || line[len - 2] != '\r' ||
+        !split_fields(line, len - 2, fields, nfield) || (key_len = make_key(line, fields, nfield, key)) == 0) {
+        add_literal(line, len);
+        return;
+    }
+
+    size_t index = 0;
+    while (index < slot_count &&
+           (slots[index].key_len != key_len || std::memcmp(slots[index].key, key, key_len) != 0)) {
+        index++;
+    }
+    if (index == slot_count) {
+        if (slot_count >= max_slots) {
+            add_literal(line, len);
+            return;
+        }
+        std::memcpy(slots[index].key, key, key_len);
+        slots[index].key_len = key_len;
+        slots[index].valid = false;
+        slot_count++;
+    }
+    slot &cur = slots[index];
+
+    // 変化したフィールドのビットマップ
+    begin_record(len);
+    block.push_back(rec_delta);
+    put_varint(block, index);
+    put_varint(block, nfield);
+    size_t bitmap_pos = block.size();
+    block.resize(bitmap_pos + (nfield + 7) / 8, 0);
+    for (size_t i = 0; i < nfield; i++) {
+        const char *f = &line[fields[i].pos];
+        if (!cur.valid || i >= cur.nfield || cur.fields[i].len != fields[i].len ||
+            std::memcmp(&cur.line[cur.fields[i].pos], f, fields[i].len) != 0) {
+            block[bitmap_pos + i / 8] |= (uint8_t)(1 << (i % 8));
+            put_varint(block, fields[i].len);
+            block.insert(block.end(), f, f + fields[i].len);
+        }
+    }
+    // 次の行と比べるために行とフィールドの位置を保存
+    std::memcpy(cur.line, line, len - 2);
+    std::memcpy(cur.fields, fields, nfield * sizeof(field));
+    cur.nfield = nfield;
+    cur.valid = true;
+
+    if (block.size() >= block_size) {
+        flush_block();
+    }
+}
+
+/**
+ * @brief そのままのバイト列を追加
+ *
+ * @param data バイト列
+ * @param len 長さ
+ */
+void nmea_archive::writer::add_literal(const char *data, size_t len)
+{
+    // ブロックの容量を超えないようにmax_record毎に分ける（読み込むと連結される）
+    const size_t chunk_max = max_record - 16;
+    do {
+        size_t chunk = len < chunk_max ? len : chunk_max;
+        begin_record(chunk);
+        block.push_back(rec_literal);
+        put_varint(block, chunk);
+        block.insert(block.end(), data, data + chunk);
+        if (block.size() >= block_size) {
+            flush_block();
+        }
+        data += chunk;
+        len -= chunk;
+    } while (len > 0);
+}
+
+/**
+ * @brief 改行で終わっていない残りに追加
+ *
+ * max_recordを超える分はそのままのバイト列として書く（受信データが壊れて改行が来なくても伸ばさない）。
+ *
+ * @param data バイト列
+ * @param len 長さ
+ */
+void nmea_archive::writer::add_pending(const char *data, size_t len)
+{
+    while (len > 0) {
+        if (pending.size() == max_record) {
+            add_literal(pending.data(), pending.size());
+            pending.clear();
+        }
+        size_t n = std::min(len, max_record - pending.size());
+        pending.append(data, n);
+        data += n;
+        len -= n;
+    }
+}
+
+/**
+ * @brief レコードの追加を索引に記録
+ *
+ * @param len 元の行の長さ
+ */
+void nmea_archive::writer::begin_record(size_t len)
+{
+    if (block.empty()) {
+        entry.first_mono_ns = mono_ns;
+    }
+    entry.last_mono_ns = mono_ns;
+    entry.raw_len += len;
+}
+
+/**
+ * @brief ブロックを確定
+ *
+ */
+void nmea_archive::writer::flush_block()
+{
+    if (block.empty()) {
+        return;
+    }
+    if (packed.size() < block_header_size + compress_bound(block.size())) {
+        packed.resize(block_header_size + compress_bound(block.size()));
+    }
+    uint8_t flags = 0;
+    size_t stored_len = block.size();
+    const uint8_t *body = block.data();
+    if (compress) {
+        size_t n = nmea_archive::compress(block.data(), block.size(), &packed[block_header_size]);
+        if (n < block.size()) {
+            flags |= flag_compressed;
+            stored_len = n;
+            body = &packed[block_header_size];
+        }
+    }
+
+    uint8_t header[block_header_size];
+    std::memcpy(header, block_magic, sizeof(block_magic));
+    header[4] = flags;
+    put_le32(&header[5], block.size());
+    put_le32(&header[9], stored_len);
+    entry.offset = file_offset + stored_bytes + out.size();
+    entry.stored_len = stored_len;
+    out.insert(out.end(), header, header + block_header_size);
+    out.insert(out.end(), body, body + stored_len);
+
+    // 索引に追加
+    if (entry.last_utc > max_utc) {
+        max_utc = entry.last_utc;
+    }
+    entry.max_utc = max_utc;
+    if (index_fd >= 0) {
+        uint8_t e[index_entry_size];
+        encode_entry(entry, e);
+        if (!write_all(index_fd, e, sizeof(e))) {
+            std::cerr << "nmea_archive: failed to write index: " << std::strerror(errno) << std::endl;
+        }
+    }
+    entry = index_entry();
+
+    // ブロック毎に差分の状態をリセット（ブロック単位で復元できるようにする）
+    // （slotsは解放せず未使用にするだけ、ヒープを使わない）
+    block.clear();
+    slot_count = 0;
+
+    write_out(false);
+}
+
+/**
+ * @brief 書き込み待ちのデータをwrite_align単位で書き込む
+ *
+ * @param all true: 端数も書き込む
+ */
+void nmea_archive::writer::write_out(bool all)
+{
+    size_t len = all ? out.size() : out.size() / write_align * write_align;
+    if (fd < 0 || len == 0) {
+        return;
+    }
+    size_t pos = 0;
+    while (pos < len) {
+        ssize_t ret = write(fd, &out[pos], len - pos);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "nmea_archive: failed to write: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        pos += ret;
+    }
+    stored_bytes += pos;
+    out.erase(out.begin(), out.begin() + len);
+}
+
+/**
+ * @brief Construct a new nmea archive::reader::reader object
+ *
+ * @param path アーカイブファイル
+ */
+nmea_archive::reader::reader(const std::string &path) :
+fd(-1)
+{
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "nmea_archive: failed to open " << path << ": " << std::strerror(errno) << std::endl;
+    }
+}
+
+/**
+ * @brief Destroy the nmea archive::reader::reader object
+ *
+ */
+nmea_archive::reader::~reader()
+{
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+/**
+ * @brief ファイルを開けたかどうか
+ *
+ * @return true 開けた
+ * @return false 開けなかった
+ */
+bool nmea_archive::reader::is_open()
+{
+    return fd >= 0;
+}
+
+/**
+ * @brief 読み込み位置を移動
+ *
+ * @param offset ブロックの位置（索引のoffset）
+ * @return true OK
+ * @return false ERROR
+ */
+bool nmea_archive::reader::seek(uint64_t offset)
+{
+    return fd >= 0 && lseek(fd, offset, SEEK_SET) == (off_t)offset;
+}
+
+/**
+ * @brief 読み込み位置を取得
+ *
+ * @return uint64_t 次に読むブロックの位置
+ */
+uint64_t nmea_archive::reader::tell()
+{
+    off_t pos = (fd >= 0) ? lseek(fd, 0, SEEK_CUR) : -1;
+    return pos > 0 ? pos : 0;
+}
+
+/**
+ * @brief 1ブロック分を復元
+ *
+ * @param data 復元したバイト列
+ * @return true OK
+ * @return false 終端またはデータ破損
+ */
+bool nmea_archive::reader::read_block(std::string &data)
+{
+    auto read_all = [this](uint8_t *buf, size_t len) {
+        size_t pos = 0;
+        while (pos < len) {
+            ssize_t ret = read(fd, &buf[pos], len - pos);
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ret <= 0) {
+                return false;
+            }
+            pos += ret;
+        }
+        return true;
+    };
+
+    data.clear();
+    uint8_t header[block_header_size];
+    if (fd < 0 || !read_all(header, block_header_size)) {
+        return false;
+    }
+    if (std::memcmp(header, block_magic, sizeof(block_magic)) != 0) {
+        std::cerr << "nmea_archive: bad block header" << std::endl;
+        return false;
+    }
+    uint8_t flags = header[4];
+    size_t raw_len = get_le32(&header[5]);
+    size_t stored_len = get_le32(&header[9]);
+    stored.resize(stored_len);
+    if (!read_all(stored.data(), stored_len)) {
+        std::cerr << "nmea_archive: truncated block" << std::endl;
+        return false;
+    }
+    if (flags & flag_compressed) {
+        block.resize(raw_len);
+        if (!decompress(stored.data(), stored_len, block.data(), raw_len)) {
+            std::cerr << "nmea_archive: corrupted block" << std::endl;
+            return false;
+        }
+    }
+    else {
+        block.swap(stored);
+    }
+
+    // レコードを復元
+    slots.clear();
+    const uint8_t *p = block.data();
+    const uint8_t *end = p + block.size();
+    while (p < end) {
+        uint8_t type = *p++;
+        uint64_t len;
+        if (type == rec_literal) {
+            if (!get_varint(p, end, len) || len > (uint64_t)(end - p)) {
+                return false;
+            }
+            data.append(reinterpret_cast<const char *>(p), len);
+            p += len;
+        }
+        else if (type == rec_delta) {
+            uint64_t index;
+            uint64_t nfield;
+            if (!get_varint(p, end, index) || index > slots.size() || !get_varint(p, end, nfield)) {
+                return false;
+            }
+            if (index == slots.size()) {
+                slots.emplace_back();
+            }
+            std::vector<std::string> &fields = slots[index].fields;
+            const uint8_t *bitmap = p;
+            p += (nfield + 7) / 8;
+            if (p > end) {
+                return false;
+            }
+            fields.resize(nfield);
+            for (size_t i = 0; i < nfield; i++) {
+                if (bitmap[i / 8] & (1 << (i % 8))) {
+                    if (!get_varint(p, end, len) || len > (uint64_t)(end - p)) {
+                        return false;
+                    }
+                    fields[i].assign(reinterpret_cast<const char *>(p), len);
+                    p += len;
+                }
+                if (i > 0) {
+                    data.push_back(',');
+                }
+                data.append(fields[i]);
+            }
+            data.append("\r\n");
+        }
+        else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Construct a new nmea archive::index entry::index entry object
+ *
+ */
+nmea_archive::index_entry::index_entry() :
+offset(0),
+stored_len(0),
+raw_len(0),
+first_utc(-1),
+last_utc(-1),
+max_utc(-1),
+first_mono_ns(0),
+last_mono_ns(0)
+{
+}
+
+/**
+ * @brief ブロックの終わりの位置
+ *
+ * @return uint64_t 次のブロックの位置
+ */
+uint64_t nmea_archive::index_entry::end() const
+{
+    return offset + block_header_size + stored_len;
+}
+
+/**
+ * @brief Construct a new nmea archive::index::index object
+ *
+ * @param archive_path アーカイブファイル（索引はpath_of()）
+ */
+nmea_archive::index::index(const std::string &archive_path) :
+fd(-1),
+count(0)
+{
+    fd = open(path_of(archive_path).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    uint8_t header[index_header_size];
+    struct stat st;
+    if (pread(fd, header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        std::memcmp(header, index_magic, sizeof(index_magic)) != 0 ||
+        get_le32(&header[4]) != index_version || fstat(fd, &st) != 0) {
+        ::close(fd);
+        fd = -1;
+        return;
+    }
+    // 途中まで書かれたエントリは無視
+    count = (st.st_size - index_header_size) / index_entry_size;
+}
+
+/**
+ * @brief Destroy the nmea archive::index::index object
+ *
+ */
+nmea_archive::index::~index()
+{
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+/**
+ * @brief 索引を開けたかどうか
+ *
+ * @return true 開けた
+ * @return false 無い、または形式が違う
+ */
+bool nmea_archive::index::is_open()
+{
+    return fd >= 0;
+}
+
+/**
+ * @brief エントリ数（ブロック数）を取得
+ *
+ * @return size_t エントリ数
+ */
+size_t nmea_archive::index::size()
+{
+    return count;
+}
+
+/**
+ * @brief エントリを取得
+ *
+ * @param i 番号
+ * @param e エントリ
+ * @return true OK
+ * @return false ERROR
+ */
+bool nmea_archive::index::get(size_t i, index_entry &e)
+{
+    uint8_t buf[index_entry_size];
+    if (fd < 0 || i >= count ||
+        pread(fd, buf, sizeof(buf), index_header_size + i * index_entry_size) != (ssize_t)sizeof(buf)) {
+        return false;
+    }
+    decode_entry(buf, e);
+    return true;
+}
+
+/**
+ * @brief 時刻を含むブロックを検索（二分探索）
+ *
+ * 時刻の最大値がutc以上になる最初のブロックを返す。
+ * 時刻が戻った場合も最大値は単調に増えるので二分探索できる。
+ *
+ * @param utc 時刻
+ * @return size_t ブロックの番号（無ければsize()）
+ */
+size_t nmea_archive::index::find(time_t utc)
+{
+    size_t lo = 0;
+    size_t hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        index_entry e;
+        if (!get(mid, e)) {
+            return count;
+        }
+        if (e.max_utc < (int64_t)utc) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * @brief 索引ファイル名を取得
+ *
+ * @param archive_path アーカイブファイル
+ * @return std::string 索引ファイル
+ */
+std::string nmea_archive::index::path_of(const std::string &archive_path)
+{
+    return archive_path + ".idx";
+}
+
+/**
+ * @brief アーカイブを読んで索引を作り直す
+ *
+ * 単調増加時刻はアーカイブに残っていないので0とする。
+ * 壊れたブロックがあればその手前までの索引を作る。
+ *
+ * @param archive_path アーカイブファイル
+ * @return true OK
+ * @return false ERROR
+ */
+bool nmea_archive::index::rebuild(const std::string &archive_path)
+{
+    reader r(archive_path);
+    if (!r.is_open()) {
+        return false;
+    }
+    std::string tmp_path = path_of(archive_path) + ".tmp";
+    int out = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) {
+        std::cerr << "nmea_archive: failed to open " << tmp_path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    std::vector<uint8_t> buf(index_header_size);
+    std::memcpy(buf.data(), index_magic, sizeof(index_magic));
+    put_le32(&buf[4], index_version);
+
+    std::string data;
+    int64_t max_utc = -1;
+    uint64_t offset = r.tell();
+    while (r.read_block(data)) {
+        index_entry e;
+        e.offset = offset;
+        offset = r.tell();
+        e.stored_len = offset - e.offset - block_header_size;
+        e.raw_len = data.size();
+        size_t pos = 0;
+        while (pos < data.size()) {
+            size_t nl = data.find('\n', pos);
+            size_t end = (nl == std::string::npos) ? data.size() : nl;
+            size_t len = end - pos;
+            while (len > 0 && data[pos + len - 1] == '\r') {
+                len--;
+            }
+            int64_t utc = rmc_time(&data[pos], len);
+            if (utc > 0) {
+                if (e.first_utc < 0) {
+                    e.first_utc = utc;
+                }
+                e.last_utc = utc;
+            }
+            pos = end + 1;
+        }
+        if (e.last_utc > max_utc) {
+            max_utc = e.last_utc;
+        }
+        e.max_utc = max_utc;
+        size_t n = buf.size();
+        buf.resize(n + index_entry_size);
+        encode_entry(e, &buf[n]);
+    }
+
+    bool ok = write_all(out, buf.data(), buf.size()) && fsync(out) == 0;
+    ::close(out);
+    if (!ok || rename(tmp_path.c_str(), path_of(archive_path).c_str()) != 0) {
+        std::cerr << "nmea_archive: failed to write " << path_of(archive_path) << std::endl;
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
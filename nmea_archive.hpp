@@ -0,0 +1,197 @@
+/**
+ * @file nmea_archive.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief NMEAの圧縮アーカイブ
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef NMEA_ARCHIVE_HPP
+#define NMEA_ARCHIVE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+
+/**
+ * @brief NMEAの圧縮アーカイブ
+ *
+ * ファイル形式
+ *      ブロックの並び。各ブロックは独立して復元できる。
+ *      header: magic "NMAB"(4), flags(1), raw_len(4, LE), stored_len(4, LE)
+ *      body:   stored_len バイト（flags & compressed なら LZ 圧縮）
+ *
+ * ブロック内のレコード
+ *      'L' varint(len) bytes           : そのままのバイト列
+ *      'D' varint(slot) varint(nfield) bitmap {varint(len) bytes}
+ *                                      : 同じ種類の前回のセンテンスとの差分（フィールド単位）
+ *                                        末尾の"\r\n"は省略
+ *
+ * 索引ファイル（アーカイブ名 + ".idx"）
+ *      header: magic "NMIX"(4), version(4, LE)
+ *      entry:  index_entry_size バイト（LE）をブロック毎に追加
+ *      ブロック毎に時刻の最大値を持つので、時刻から二分探索でブロックの位置を求められる。
+ *      索引が無い、またはアーカイブと合わない場合はアーカイブから作り直す。
+ */
+class nmea_archive
+{
+public:
+    static const size_t default_block_size = 64 * 1024;    // ブロックの非圧縮サイズ
+    static const size_t write_align = 4096;                 // ファイルへの書き込み単位
+    static const size_t index_header_size = 8;
+    static const size_t index_entry_size = 56;
+
+    /**
+     * @brief 索引のエントリ（ブロック毎）
+     *
+     */
+    class index_entry {
+    public:
+        uint64_t offset;            // ブロックの位置（ヘッダの先頭）
+        uint32_t stored_len;        // ヘッダを除いたブロックのサイズ
+        uint32_t raw_len;           // 復元したNMEAのサイズ
+        int64_t first_utc;          // ブロック内の最初のRMCの時刻（無ければ-1）
+        int64_t last_utc;           // ブロック内の最後のRMCの時刻（無ければ-1）
+        int64_t max_utc;            // 先頭からこのブロックまでの時刻の最大値（検索のキー）
+        uint64_t first_mono_ns;     // 受信した単調増加時刻（作り直した索引では0）
+        uint64_t last_mono_ns;
+
+        index_entry();
+        uint64_t end() const;
+    };
+
+    /**
+     * @brief 索引（時刻からブロックを検索）
+     *
+     */
+    class index {
+    public:
+        index(const std::string &archive_path);
+        ~index();
+        bool is_open();
+        size_t size();
+        bool get(size_t i, index_entry &e);
+        size_t find(time_t utc);
+
+        static std::string path_of(const std::string &archive_path);
+        static bool rebuild(const std::string &archive_path);
+
+    private:
+        int fd;
+        size_t count;
+    };
+
+    static const size_t max_line = 256;         // 差分を取る行の最大長（改行を除く、長い行はそのまま）
+    static const size_t max_fields = 64;        // 差分を取る行のフィールド数の上限
+    static const size_t max_key = 32;           // 種類の最大長
+    static const size_t max_record = 1024;      // 1レコードで追加する最大（長いバイト列は分割する）
+
+    /**
+     * @brief フィールド（行の中の位置）
+     *
+     */
+    class field {
+    public:
+        uint16_t pos;
+        uint16_t len;
+    };
+
+    /**
+     * @brief センテンスの差分状態（書き込み、固定長でヒープを使わない）
+     *
+     */
+    class slot {
+    public:
+        char key[max_key];                  // 種類（"$GPGSV,2" など）
+        size_t key_len;
+        char line[max_line];                // 前回の行
+        field fields[max_fields];           // 前回のフィールド（lineの中の位置）
+        size_t nfield;
+        bool valid;                         // fieldsがこのブロックの前回の値か（falseなら全フィールドを書く）
+    };
+
+    /**
+     * @brief センテンスの差分状態（読み込み）
+     *
+     */
+    class read_slot {
+    public:
+        std::vector<std::string> fields;    // 前回のフィールド
+    };
+
+    /**
+     * @brief 書き込み
+     *
+     */
+    class writer {
+    public:
+        writer(const std::string &path, bool compress, size_t block_size = default_block_size);
+        ~writer();
+        bool is_open();
+        void append(const uint8_t *data, size_t len);
+        void close();
+        uint64_t get_raw_bytes();
+        uint64_t get_stored_bytes();
+
+    private:
+        int fd;
+        int index_fd;
+        bool compress;
+        size_t block_size;
+        uint64_t file_offset;               // 開いた時のファイルサイズ
+        uint64_t mono_ns;                   // 追加中のデータを受信した時刻
+        index_entry entry;                  // 作成中のブロックの索引
+        int64_t max_utc;
+        std::string pending;                // 改行で終わっていない残り（max_recordまで、超えた分はそのまま書く）
+        std::vector<uint8_t> block;         // 非圧縮ブロック
+        std::vector<uint8_t> packed;        // 圧縮ブロック
+        std::vector<uint8_t> out;           // 書き込み待ち（write_align単位で書き込む）
+        std::vector<slot> slots;            // 起動時にmax_slots個を確保してブロックを跨いで使い回す
+        size_t slot_count;                  // このブロックで使っているslots
+        field fields[max_fields];           // 今回の行のフィールド
+        size_t nfield;
+        uint64_t raw_bytes;
+        uint64_t stored_bytes;
+
+        void open_index(const std::string &path);
+        void add_line(const char *line, size_t len);
+        void add_literal(const char *data, size_t len);
+        void add_pending(const char *data, size_t len);
+        void begin_record(size_t len);
+        void flush_block();
+        void write_out(bool all);
+    };
+
+    /**
+     * @brief 読み込み
+     *
+     */
+    class reader {
+    public:
+        reader(const std::string &path);
+        ~reader();
+        bool is_open();
+        bool read_block(std::string &data);
+        bool seek(uint64_t offset);
+        uint64_t tell();
+
+    private:
+        int fd;
+        std::vector<uint8_t> stored;
+        std::vector<uint8_t> block;
+        std::vector<read_slot> slots;
+    };
+
+    static size_t compress_bound(size_t len);
+    static size_t compress(const uint8_t *src, size_t len, uint8_t *dst);
+    static bool decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len);
+    static bool split_fields(const char *line, size_t len, field *fields, size_t &nfield);
+    static size_t make_key(const char *line, const field *fields, size_t nfield, char *key);
+};
+
+#endif
@@ -11,7 +11,6 @@
 
 #include "nmea_gga.hpp"
 #include <iostream>
-#include <vector>
 #include <cmath>
 
 /**
@@ -19,7 +18,7 @@
  * 
  * @param nmea GAA
  */
-nmea_gga::nmea_gga(std::string nmea) : 
+nmea_gga::nmea_gga(const nmea_view &nmea) : 
 latitude(std::nan("")),
 longitude(std::nan("")),
 altitude(std::nan("")),
@@ -27,19 +26,13 @@ num_sv(0),
 time("")
 {
     try {
-        std::vector<std::string> items;
-        size_t pos;
-        while ((pos = nmea.find_first_of(",*")) != std::string::npos) {
-            items.push_back(nmea.substr(0, pos));
-            nmea.erase(0, pos + 1);
-        }
-        items.push_back(nmea);
+        nmea_fields<32> items(nmea);
 
         // 緯度
-        std::string latitude_str = items[2];
+        nmea_view latitude_str = items[2];
         if (latitude_str != "") {
-            double latitude_deg = std::stod(latitude_str.substr(0,2));
-            double latitude_minute = std::stod(latitude_str.substr(2,8));
+            double latitude_deg = nmea_to_double(latitude_str.substr(0,2));
+            double latitude_minute = nmea_to_double(latitude_str.substr(2));
             if (items[3] == "N") {
                 // 北緯は正
                 latitude = latitude_deg + (latitude_minute / 60.0);
@@ -54,10 +47,10 @@ time("")
         }
 
         // 経度
-        std::string longitude_str = items[4];
+        nmea_view longitude_str = items[4];
         if (longitude_str != "") {
-            double longitude_deg = std::stod(longitude_str.substr(0,3));
-            double longitude_minute = std::stod(longitude_str.substr(3,8));
+            double longitude_deg = nmea_to_double(longitude_str.substr(0,3));
+            double longitude_minute = nmea_to_double(longitude_str.substr(3));
             if (items[5] == "E") {
                 // 東経は正
                 longitude = longitude_deg + (longitude_minute/60.0);
@@ -72,26 +65,26 @@ time("")
         }
 
         // 海抜（標高）
-        std::string altitude_str = items[9];
+        nmea_view altitude_str = items[9];
         if (altitude_str != "") {
-            altitude = std::stod(altitude_str);
+            altitude = nmea_to_double(altitude_str);
         }
         else {
             altitude = std::nan("");
         }
 
         // 使用した衛星の数
-        std::string nmu_sv_str = items[7];
+        nmea_view nmu_sv_str = items[7];
         if (nmu_sv_str != "") {
-            num_sv = std::stod(nmu_sv_str);
+            num_sv = nmea_to_double(nmu_sv_str);
         }
         else {
             num_sv = 0;
         }
 
-        time = items[1];
+        items[1].copy_to(time, sizeof(time));
     }
-    catch (std::exception ex) {
+    catch (std::exception &ex) {
         std::cerr << "GAA exception: " << ex.what() << std::endl;
         latitude = std::nan("");
         longitude = std::nan("");
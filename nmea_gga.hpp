@@ -12,6 +12,7 @@
 #ifndef NMEA_GGA_HPP
 #define NMEA_GGA_HPP
 
+#include "nmea_view.hpp"
 #include <string>
 
 /**
@@ -21,7 +22,7 @@
 class nmea_gga
 {
 public:
-    nmea_gga (std::string nmea);
+    nmea_gga (const nmea_view &nmea);
     double get_latitude();
     double get_longitude();
     double get_altitude();
@@ -33,7 +34,7 @@ private:
     double longitude;
     double altitude;
     int num_sv;
-    std::string time;
+    char time[16];
 };
 
 #endif
\ No newline at end of file
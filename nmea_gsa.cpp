@@ -16,7 +16,7 @@
  * 
  * @param nmea 
  */
-nmea_gsa::nmea_gsa(std::string nmea) :
+nmea_gsa::nmea_gsa(const nmea_view &nmea) :
 pdop(99.99),
 hdop(99.99),
 vdop(99.99),
@@ -27,30 +27,24 @@ system_id(-1)
     // Example
     //      $GPGSA,A,3,23,29,07,08,09,18,26,28,,,,,1.94,1.18,1.54,1*0D\r\n
     try {
-        std::vector<std::string> items;
-        size_t pos;
-        while ((pos = nmea.find_first_of(",*")) != std::string::npos) {
-            items.push_back(nmea.substr(0, pos));
-            nmea.erase(0, pos + 1);
-        }
-        items.push_back(nmea);
+        nmea_fields<32> items(nmea);
         if (items.size() == 20) {
             for (int i = 0; i < 12; i++) {
-                std::string svid_str = items[3 + i];
+                nmea_view svid_str = items[3 + i];
                 if (svid_str != "") {
-                    svid.push_back(std::stoi(items[3 + i]));
+                    svid.push_back(nmea_to_int(items[3 + i]));
                 }
             }
 
-            std::string pdop_str = items[15];
-            pdop = std::stod(pdop_str);
-            hdop = std::stod(items[16]);
-            vdop = std::stod(items[17]);
-            system_id = std::stoi(items[18]);
+            nmea_view pdop_str = items[15];
+            pdop = nmea_to_double(pdop_str);
+            hdop = nmea_to_double(items[16]);
+            vdop = nmea_to_double(items[17]);
+            system_id = nmea_to_int(items[18]);
         }
 
     }
-    catch (std::exception ex) {
+    catch (std::exception &ex) {
         std::cerr << "GSA exception: " << ex.what() << std::endl;
     }
     
@@ -69,9 +63,9 @@ int nmea_gsa::get_system_id()
 /**
  * @brief 
  * 
- * @return std::vector<int> 
+ * @return const nmea_gsa::svid_list& 
  */
-std::vector<int> nmea_gsa::get_svid_list()
+const nmea_gsa::svid_list &nmea_gsa::get_svid_list()
 {
     return svid;
 }
@@ -12,8 +12,9 @@
 #define NMEA_GSA_HPP
 
 
+#include "nmea_view.hpp"
+#include "fixed_vector.hpp"
 #include <string>
-#include <vector>
 
 /**
  * @brief GSA
@@ -22,15 +23,16 @@
 class nmea_gsa
 {
 public:
-    nmea_gsa(std::string nmea);
+    typedef fixed_vector<int, 12> svid_list;
+    nmea_gsa(const nmea_view &nmea);
     int get_system_id();
-    std::vector<int> get_svid_list();
+    const svid_list &get_svid_list();
     double get_pdop();
     double get_hdop();
     double get_vdop();
 private:
     int nav_mode;
-    std::vector<int> svid;
+    svid_list svid;
     double pdop;
     double hdop;
     double vdop;
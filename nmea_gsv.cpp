@@ -17,7 +17,11 @@
  * 
  * @param nmea 
  */
-nmea_gsv::nmea_gsv(std::string nmea)
+nmea_gsv::nmea_gsv(const nmea_view &nmea) :
+system_id(0),
+signal_id(-1),
+num_msg(0),
+msg_num(0)
 {
     // Structure
     //      $xxGSV,numMsg,msgNum,numSV{,svid,elv,az,cno},signalId*cs\r\n
@@ -28,13 +32,7 @@ nmea_gsv::nmea_gsv(std::string nmea)
     //      $GPGSV,1,1,03,12,,,42,24,,,47,32,,,37,5*66\r\n
     //      $GAGSV,1,1,00,2*76\r\n
     try {
-        std::vector<std::string> items;
-        size_t pos;
-        while ((pos = nmea.find_first_of(",*")) != std::string::npos) {
-            items.push_back(nmea.substr(0, pos));
-            nmea.erase(0, pos + 1);
-        }
-        items.push_back(nmea);
+        nmea_fields<32> items(nmea);
         if (items[0] == "$GPGSV") {
             // GPS,SBAS
             system_id = 1;
@@ -55,56 +53,63 @@ nmea_gsv::nmea_gsv(std::string nmea)
             // Other
             system_id = 0;
         }
-        int num_msg = std::stoi(items[1]);
-        int msg_num = std::stoi(items[2]);
-        int num_sv = std::stoi(items[3]);
+        num_msg = nmea_to_int(items[1]);
+        msg_num = nmea_to_int(items[2]);
+        int num_sv = nmea_to_int(items[3]);
         int cnt = 0;
         if (num_msg > msg_num) {
             cnt = 4;
         }
         else {
-            cnt = num_sv % 4;
+            // 最後のメッセージは残りの衛星（衛星数が4の倍数なら4機）
+            cnt = num_sv - (msg_num - 1) * 4;
+            if (cnt < 0) {
+                cnt = 0;
+            }
+            if (cnt > 4) {
+                cnt = 4;
+            }
         }
 
         sv_list.resize(cnt);
         for (int i = 0; i < cnt; i++) {
-            std::string svid_str = items[4 + i * 4];
-            std::string elv_str = items[5 + i * 4];
-            std::string az_str = items[6 + i * 4];
-            std::string cno_str = items[7 + i * 4];
+            nmea_view svid_str = items[4 + i * 4];
+            nmea_view elv_str = items[5 + i * 4];
+            nmea_view az_str = items[6 + i * 4];
+            nmea_view cno_str = items[7 + i * 4];
 
             if (svid_str != "") {
-                sv_list[i].svid = std::stoi(svid_str);
+                sv_list[i].svid = nmea_to_int(svid_str);
             }
             else {
                 sv_list[i].svid = -1;
             }
 
             if (elv_str != "") {
-                sv_list[i].elv = std::stoi(elv_str);
+                sv_list[i].elv = nmea_to_int(elv_str);
             }
             else {
                 sv_list[i].elv = -1;
             }
 
             if (az_str != "") {
-                sv_list[i].az = std::stoi(az_str);
+                sv_list[i].az = nmea_to_int(az_str);
             }
             else {
                 sv_list[i].az = -1;
             }
 
             if (cno_str != "") {
-                sv_list[i].cno = std::stoi(cno_str);
+                sv_list[i].cno = nmea_to_int(cno_str);
             }
             else {
                 sv_list[i].cno = -1;
             }
             sv_list[i].sys = system_id;
         }
-        signal_id = std::stoi(items[4 + cnt * 4]);
+        signal_id = nmea_to_int(items[4 + cnt * 4]);
     }
-    catch (std::exception ex) {
+    catch (std::exception &ex) {
         std::cerr << "GSV exception: " << ex.what() << std::endl;
     }
 }
@@ -119,6 +124,36 @@ int nmea_gsv::get_system_id()
     return system_id;
 }
 
+/**
+ * @brief signalId取得
+ *
+ * @return int signalId（無ければ-1）
+ */
+int nmea_gsv::get_signal_id()
+{
+    return signal_id;
+}
+
+/**
+ * @brief メッセージ数取得
+ *
+ * @return int numMsg
+ */
+int nmea_gsv::get_num_msg()
+{
+    return num_msg;
+}
+
+/**
+ * @brief メッセージ番号取得
+ *
+ * @return int msgNum（1から）
+ */
+int nmea_gsv::get_msg_num()
+{
+    return msg_num;
+}
+
 /**
  * @brief 衛星情報検索
  * 
@@ -128,7 +163,7 @@ int nmea_gsv::get_system_id()
  */
 bool nmea_gsv::find_svid(int svid)
 {
-    for (auto sv : sv_list) {
+    for (auto &sv : sv_list) {
         if (sv.svid == svid) {
             return true;
         }
@@ -146,7 +181,7 @@ bool nmea_gsv::find_svid(int svid)
 nmea_gsv::sv_info nmea_gsv::get_svinfo(int svid)
 {
     sv_info info;
-    for (auto sv : sv_list) {
+    for (auto &sv : sv_list) {
         if (sv.svid == svid) {
             info = sv;
             break;
@@ -156,13 +191,13 @@ nmea_gsv::sv_info nmea_gsv::get_svinfo(int svid)
     return info;
 }
 
-std::vector<int> nmea_gsv::get_svid_list()
+nmea_gsv::svid_list nmea_gsv::get_svid_list()
 {
-    std::vector<int> svid_list;
-    for (auto sv : sv_list) {
-        svid_list.push_back(sv.svid);
+    svid_list list;
+    for (auto &sv : sv_list) {
+        list.push_back(sv.svid);
     }
 
-    return svid_list;
+    return list;
 }
 
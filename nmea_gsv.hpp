@@ -11,8 +11,9 @@
 #ifndef NMEA_GSV_HPP
 #define NMEA_GSV_HPP
 
+#include "nmea_view.hpp"
+#include "fixed_vector.hpp"
 #include <string>
-#include <vector>
 
 /**
  * @brief GSV
@@ -29,15 +30,21 @@ public:
         int cno;
         int sys;
     };
-    nmea_gsv(std::string nmea);
+    typedef fixed_vector<int, 4> svid_list;
+    nmea_gsv(const nmea_view &nmea);
     int get_system_id();
+    int get_signal_id();
+    int get_num_msg();
+    int get_msg_num();
     bool find_svid(int svid);
     sv_info get_svinfo(int svid);
-    std::vector<int> get_svid_list();
+    svid_list get_svid_list();
 private:
     int system_id;
-    std::vector<sv_info> sv_list;
+    fixed_vector<sv_info, 4> sv_list;
     int signal_id;
+    int num_msg;
+    int msg_num;
 };
 
 #endif
@@ -34,28 +34,30 @@ static inline int cnt_leap(int y)
  * 
  * @param nmea RMC
  */
-nmea_rmc::nmea_rmc(std::string nmea) :
- gps_time((time_t)-1)
+nmea_rmc::nmea_rmc(const nmea_view &nmea) :
+ gps_time((time_t)-1),
+ date(""),
+ time("")
 {
     try {
-        std::vector<std::string> items;
-        size_t pos;
-        while ((pos = nmea.find_first_of(",*")) != std::string::npos) {
-            items.push_back(nmea.substr(0, pos));
-            nmea.erase(0, pos + 1);
-        }
-        items.push_back(nmea);
-        date = items[9];
-        time = items[1];
+        nmea_fields<32> items(nmea);
+        nmea_view date_str = items[9];
+        nmea_view time_str = items[1];
+        date_str.copy_to(date, sizeof(date));
+        time_str.copy_to(time, sizeof(time));
+
+        if (date_str.size() >= 6 && time_str.size() >= 6) {
+            int day = nmea_to_int(date_str.substr(0,2));
+            int mon = nmea_to_int(date_str.substr(2,2));
+            int year = 2000 + nmea_to_int(date_str.substr(4,2));
 
-        if (date.size() >= 6 && time.size() >= 6) {
-            int day = std::stoi(date.substr(0,2));
-            int mon = std::stoi(date.substr(2,2));
-            int year = std::stoi("20" + date.substr(4,2));
+            int hour = nmea_to_int(time_str.substr(0,2));
+            int min = nmea_to_int(time_str.substr(2,2));
+            int sec = nmea_to_int(time_str.substr(4,2));
 
-            int hour = std::stoi(time.substr(0,2));
-            int min = std::stoi(time.substr(2,2));
-            int sec = std::stoi(time.substr(4,2));
+            if (mon < 1 || mon > 12) {
+                throw std::out_of_range("month");
+            }
 
             // time_t（エポック秒）を計算
             static const int dom[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
@@ -71,7 +73,7 @@ nmea_rmc::nmea_rmc(std::string nmea) :
             gps_time = (time_t)-1;
         } 
     }
-    catch (std::exception ex) {
+    catch (std::exception &ex) {
         std::cerr << "RMC exception: " << ex.what() << std::endl;
         gps_time = (time_t)-1;
     }
@@ -115,6 +117,27 @@ std::string nmea_rmc::get_utc_datetime()
     return str;
 }
 
+/**
+ * @brief 日時取得（ヒープを使わない）
+ * 
+ * @param buf 出力先（"YYYY-mm-dd HH:MM:SS"、無効なら空文字列）
+ * @param size 出力先のサイズ
+ * @return size_t 出力した長さ
+ */
+size_t nmea_rmc::get_utc_datetime(char *buf, size_t size)
+{
+    if (size == 0) {
+        return 0;
+    }
+    buf[0] = '\0';
+    if(gps_time > 0) {
+        struct tm tm;
+        gmtime_r(&gps_time, &tm);
+        return std::strftime(buf, size, "%Y-%m-%d %H:%M:%S", &tm);
+    }
+    return 0;
+}
+
 time_t nmea_rmc::get_time_t()
 {
     return gps_time;
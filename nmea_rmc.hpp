@@ -12,6 +12,7 @@
 #ifndef NMEA_RMC_HPP
 #define NMEA_RMC_HPP
 
+#include "nmea_view.hpp"
 #include <ctime>
 #include <string>
 
@@ -22,16 +23,17 @@
 class nmea_rmc
 {
 public:
-    nmea_rmc(std::string nmea);
+    nmea_rmc(const nmea_view &nmea);
     std::string get_local_datetime();
     std::string get_utc_datetime();
+    size_t get_utc_datetime(char *buf, size_t size);
     time_t get_time_t();
     std::string get_time();
 
 private:
     std::time_t gps_time;
-    std::string date;
-    std::string time;
+    char date[8];
+    char time[16];
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,202 @@
+/**
+ * @file nmea_view.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief NMEAのセンテンス・フィールドの参照（コピーしない）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef NMEA_VIEW_HPP
+#define NMEA_VIEW_HPP
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+/**
+ * @brief 文字列の一部への参照（所有しない）
+ *
+ */
+class nmea_view
+{
+public:
+    const char *str;
+    size_t len;
+
+    nmea_view() : str(""), len(0) {}
+    nmea_view(const char *str, size_t len) : str(str), len(len) {}
+    nmea_view(const char *str) : str(str), len(std::strlen(str)) {}
+    nmea_view(const std::string &str) : str(str.data()), len(str.size()) {}
+
+    bool empty() const { return len == 0; }
+    size_t size() const { return len; }
+    const char *begin() const { return str; }
+    const char *end() const { return str + len; }
+    char operator[](size_t pos) const { return str[pos]; }
+
+    /**
+     * @brief 部分文字列（範囲外は切り詰める）
+     *
+     * @param pos 開始位置
+     * @param n 長さ
+     * @return nmea_view 部分文字列
+     */
+    nmea_view substr(size_t pos, size_t n = std::string::npos) const
+    {
+        if (pos > len) {
+            pos = len;
+        }
+        if (n > len - pos) {
+            n = len - pos;
+        }
+        return nmea_view(str + pos, n);
+    }
+
+    /**
+     * @brief 文字の検索
+     *
+     * @param c 文字
+     * @param pos 開始位置
+     * @return size_t 位置（見つからなければnpos）
+     */
+    size_t find(char c, size_t pos = 0) const
+    {
+        if (pos >= len) {
+            return std::string::npos;
+        }
+        const void *p = std::memchr(str + pos, c, len - pos);
+        return p ? static_cast<const char *>(p) - str : std::string::npos;
+    }
+
+    /**
+     * @brief 文字列を含むか
+     *
+     * @param s 文字列
+     * @return true 含む
+     * @return false 含まない
+     */
+    bool contains(const char *s) const
+    {
+        size_t n = std::strlen(s);
+        for (size_t i = 0; i + n <= len; i++) {
+            if (std::memcmp(str + i, s, n) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool operator==(const char *s) const
+    {
+        return std::strlen(s) == len && std::memcmp(str, s, len) == 0;
+    }
+
+    bool operator!=(const char *s) const
+    {
+        return !(*this == s);
+    }
+
+    std::string to_string() const
+    {
+        return std::string(str, len);
+    }
+
+    /**
+     * @brief 終端文字付きでコピー（収まらない分は切り捨て）
+     *
+     * @param buf コピー先
+     * @param size コピー先のサイズ
+     */
+    void copy_to(char *buf, size_t size) const
+    {
+        if (size == 0) {
+            return;
+        }
+        size_t n = len < size - 1 ? len : size - 1;
+        std::memcpy(buf, str, n);
+        buf[n] = '\0';
+    }
+};
+
+/**
+ * @brief ','と'*'で区切ったフィールド
+ *
+ * @tparam N 最大フィールド数（超えた分は最後のフィールドに含まれる）
+ */
+template <size_t N>
+class nmea_fields
+{
+public:
+    nmea_fields(const nmea_view &nmea) : count(0)
+    {
+        size_t start = 0;
+        for (size_t i = 0; i < nmea.len && count < N - 1; i++) {
+            if (nmea.str[i] == ',' || nmea.str[i] == '*') {
+                items[count++] = nmea_view(nmea.str + start, i - start);
+                start = i + 1;
+            }
+        }
+        items[count++] = nmea.substr(start);
+    }
+
+    size_t size() const { return count; }
+
+    /**
+     * @brief フィールド取得（範囲外は空）
+     *
+     * @param i 番号
+     * @return nmea_view フィールド
+     */
+    nmea_view operator[](size_t i) const
+    {
+        return (i < count) ? items[i] : nmea_view();
+    }
+
+private:
+    nmea_view items[N];
+    size_t count;
+};
+
+/**
+ * @brief 数値変換（std::stodと同じく変換できなければ例外）
+ *
+ * @param v 文字列
+ * @return double 値
+ */
+inline double nmea_to_double(const nmea_view &v)
+{
+    char buf[32];
+    v.copy_to(buf, sizeof(buf));
+    char *end;
+    double value = std::strtod(buf, &end);
+    if (end == buf) {
+        throw std::invalid_argument("nmea_to_double");
+    }
+    return value;
+}
+
+/**
+ * @brief 数値変換（std::stoiと同じく変換できなければ例外）
+ *
+ * @param v 文字列
+ * @param base 基数
+ * @return int 値
+ */
+inline int nmea_to_int(const nmea_view &v, int base = 10)
+{
+    char buf[32];
+    v.copy_to(buf, sizeof(buf));
+    char *end;
+    long value = std::strtol(buf, &end, base);
+    if (end == buf) {
+        throw std::invalid_argument("nmea_to_int");
+    }
+    return static_cast<int>(value);
+}
+
+#endif
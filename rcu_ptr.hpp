@@ -0,0 +1,98 @@
+/**
+ * @file rcu_ptr.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 読み込み側がロックしない設定の差し替え（RCU）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef RCU_PTR_HPP
+#define RCU_PTR_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief 読み込み側がロックしない設定の差し替え（RCU）
+ *
+ * 書き込み側は新しいスナップショットを作ってpublish()でポインタを差し替えるだけで、
+ * 古いスナップショットは読み込み側が次にread()するまで残す（読み込み側が1スレッドの場合）。
+ * read()で取得したポインタは次にread()するまで有効。読み込み側はヒープもロックも使わない。
+ * 古いスナップショットはpublish()の時に回収する（差し替えは稀なので十分）。
+ *
+ * @tparam T スナップショット（作成後は変更しない）
+ */
+template <class T>
+class rcu_ptr
+{
+public:
+    rcu_ptr() : current(nullptr), reads(0) {}
+    ~rcu_ptr() { delete current.load(); }
+    rcu_ptr(const rcu_ptr &) = delete;
+    rcu_ptr &operator=(const rcu_ptr &) = delete;
+
+    /**
+     * @brief 最新のスナップショットを取得（読み込み側、前回取得したものはこの後使わないこと）
+     *
+     * @return const T* スナップショット（publish()前はnullptr）
+     */
+    const T *read()
+    {
+        reads.fetch_add(1);
+        return current.load();
+    }
+
+    /**
+     * @brief スナップショットを差し替え（書き込み側）
+     *
+     * @param next 新しいスナップショット（所有権を移す）
+     */
+    void publish(std::unique_ptr<T> next)
+    {
+        const T *prev = current.exchange(next.release());
+        uint64_t now = reads.load();
+        // 差し替えた後にread()されていれば読み込み側はもう使っていない
+        for (size_t i = 0; i < retired.size(); ) {
+            if (retired[i].reads < now) {
+                retired.erase(retired.begin() + i);
+            }
+            else {
+                i++;
+            }
+        }
+        if (prev != nullptr) {
+            retired.push_back(retired_entry{std::unique_ptr<const T>(prev), now});
+        }
+    }
+
+    /**
+     * @brief 回収待ちのスナップショット数
+     *
+     * @return size_t 数
+     */
+    size_t get_retired() const
+    {
+        return retired.size();
+    }
+
+private:
+    /**
+     * @brief 回収待ちのスナップショット
+     *
+     */
+    struct retired_entry {
+        std::unique_ptr<const T> snapshot;
+        uint64_t reads;         // 差し替えた時点のread()の回数
+    };
+
+    std::atomic<T *> current;
+    std::atomic<uint64_t> reads;
+    std::vector<retired_entry> retired;     // 書き込み側だけが使う
+};
+
+#endif
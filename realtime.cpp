@@ -0,0 +1,108 @@
+/**
+ * @file realtime.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief リアルタイムスケジューリング（SCHED_FIFO、CPUの固定、メモリのロック）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "realtime.hpp"
+#include <alloca.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief プロセスのメモリをロック（現在と今後確保するページ）
+ *
+ * 起動時、スレッドを作る前に呼ぶ（以後に確保したメモリとスタックもロックされる）。
+ *
+ * @return true OK
+ * @return false ERROR
+ */
+bool realtime::lock_memory()
+{
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        std::cerr << "realtime: mlockall failed: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief 呼び出したスレッドのスタックを事前に触る
+ *
+ * @param size サイズ(byte)
+ */
+__attribute__((noinline)) void realtime::prefault_stack(size_t size)
+{
+    const size_t page = sysconf(_SC_PAGESIZE);
+    volatile char *stack = static_cast<volatile char *>(alloca(size));
+    for (size_t i = 0; i < size; i += page) {
+        stack[i] = 0;
+    }
+}
+
+/**
+ * @brief 呼び出したスレッドをSCHED_FIFOにする
+ *
+ * この後に作ったスレッドも継承するので、他のスレッドを作り終えてから呼ぶ。
+ *
+ * @param priority 優先度(1～99)
+ * @return true OK
+ * @return false ERROR
+ */
+bool realtime::set_fifo(int priority)
+{
+    struct sched_param sp;
+    std::memset(&sp, 0, sizeof(sp));
+    sp.sched_priority = priority;
+    int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+    if (ret != 0) {
+        std::cerr << "realtime: SCHED_FIFO " << priority << " failed: " << std::strerror(ret) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief 呼び出したスレッドを1つのコアに固定する
+ *
+ * @param cpu コア
+ * @return true OK
+ * @return false ERROR
+ */
+bool realtime::set_cpu(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (ret != 0) {
+        std::cerr << "realtime: cpu " << cpu << " failed: " << std::strerror(ret) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief 指定した時刻まで待つ
+ *
+ * @param mono_ns CLOCK_MONOTONICの時刻(ns)
+ */
+void realtime::sleep_until(uint64_t mono_ns)
+{
+    struct timespec ts;
+    ts.tv_sec = mono_ns / 1000000000u;
+    ts.tv_nsec = mono_ns % 1000000000u;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+    }
+}
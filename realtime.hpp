@@ -0,0 +1,57 @@
+/**
+ * @file realtime.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief リアルタイムスケジューリング（SCHED_FIFO、CPUの固定、メモリのロック）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef REALTIME_HPP
+#define REALTIME_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief リアルタイムスケジューリング（SCHED_FIFO、CPUの固定、メモリのロック）
+ *
+ * 他のアプリケーションとCPUを共有していても受信の周期が遅れないように、ループスレッドを
+ * SCHED_FIFOで動かし、指定したコアに固定する。メモリはmlockallでロックし、スタックは
+ * 事前に触ってページフォルトを起こさないようにする。
+ * SCHED_FIFOとmlockallには権限（CAP_SYS_NICE、CAP_IPC_LOCKまたはulimit -r/-l）が必要で、
+ * 設定できなければエラーを表示して通常のスケジューリングのまま動く。
+ */
+class realtime
+{
+public:
+    /**
+     * @brief 設定
+     *
+     */
+    class config {
+    public:
+        bool enabled;           // リアルタイムモード
+        int priority;           // SCHED_FIFOの優先度(1～99)
+        int cpu;                // 固定するコア（-1なら固定しない）
+        bool lock_memory;       // mlockall
+        size_t stack_prefault;  // 事前に触るスタックのサイズ(byte)
+        config() {
+            enabled = false;
+            priority = 50;
+            cpu = -1;
+            lock_memory = true;
+            stack_prefault = 256 * 1024;
+        }
+    };
+
+    static bool lock_memory();
+    static void prefault_stack(size_t size);
+    static bool set_fifo(int priority);
+    static bool set_cpu(int cpu);
+    static void sleep_until(uint64_t mono_ns);
+};
+
+#endif
@@ -0,0 +1,148 @@
+/**
+ * @file shm_publisher.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 最新の測位結果を共有メモリへ公開
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "shm_publisher.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+/**
+ * @brief Construct a new shm publisher::shm publisher object
+ *
+ * @param name 共有メモリ名（"/gps_test"）
+ */
+shm_publisher::shm_publisher(const std::string &name) :
+name(name),
+shm(nullptr),
+generation(0)
+{
+    std::memset(&work, 0, sizeof(work));
+
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "shm_publisher: failed to shm_open " << name << ": " << std::strerror(errno) << std::endl;
+        return;
+    }
+    if (ftruncate(fd, sizeof(gps_shm)) != 0) {
+        std::cerr << "shm_publisher: failed to ftruncate: " << std::strerror(errno) << std::endl;
+        close(fd);
+        return;
+    }
+    void *p = mmap(nullptr, sizeof(gps_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        std::cerr << "shm_publisher: failed to mmap: " << std::strerror(errno) << std::endl;
+        return;
+    }
+    shm = static_cast<gps_shm *>(p);
+
+    // 前回の内容は破棄して初期化（読み出し側はmagicで確認する）
+    __atomic_store_n(&shm->magic, 0u, __ATOMIC_RELAXED);
+    std::memset(&shm->fix, 0, sizeof(shm->fix));
+    shm->version = GPS_SHM_VERSION;
+    shm->size = sizeof(gps_shm);
+    shm->seq = 0;
+    __atomic_store_n(&shm->magic, GPS_SHM_MAGIC, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Destroy the shm publisher::shm publisher object
+ *
+ */
+shm_publisher::~shm_publisher()
+{
+    if (shm != nullptr) {
+        munmap(shm, sizeof(gps_shm));
+        shm_unlink(name.c_str());
+    }
+}
+
+/**
+ * @brief 共有メモリを開けたかどうか
+ *
+ * @return true 開けた
+ * @return false 開けなかった
+ */
+bool shm_publisher::is_open()
+{
+    return shm != nullptr;
+}
+
+/**
+ * @brief 測位結果を公開
+ *
+ * @param fix 測位結果
+ * @param gsa_list GSA
+ * @param gsv_list GSV
+ */
+void shm_publisher::publish(const gps_fix &fix, arena_vector<nmea_gsa> &gsa_list, arena_vector<nmea_gsv> &gsv_list)
+{
+    if (shm == nullptr) {
+        return;
+    }
+
+    // 書き込む内容を組み立て（ロックの外で行う）
+    generation++;
+    work.generation = generation;
+    work.mono_ns = fix.mono_ns;
+    work.utc = fix.utc;
+    work.latitude = fix.latitude;
+    work.longitude = fix.longitude;
+    work.altitude = fix.altitude;
+    work.pdop = fix.pdop;
+    work.hdop = fix.hdop;
+    work.vdop = fix.vdop;
+    work.num_sv = fix.num_sv;
+    work.flags = (fix.sum_err ? GPS_SHM_SUM_ERR : 0u) |
+                 (fix.utc_err ? GPS_SHM_UTC_ERR : 0u) |
+                 (fix.position_err ? GPS_SHM_POSITION_ERR : 0u) |
+                 (fix.timeout ? GPS_SHM_TIMEOUT : 0u);
+    work.sum_err_cnt = fix.sum_err_cnt;
+    work.utc_err_cnt = fix.utc_err_cnt;
+    work.position_err_cnt = fix.position_err_cnt;
+    work.timeout_cnt = fix.timeout_cnt;
+
+    uint32_t n = 0;
+    for (auto &gsv : gsv_list) {
+        for (auto svid : gsv.get_svid_list()) {
+            if (n >= GPS_SHM_MAX_SV) {
+                break;
+            }
+            nmea_gsv::sv_info si = gsv.get_svinfo(svid);
+            gps_shm_sv &sv = work.sv[n++];
+            sv.svid = si.svid;
+            sv.elv = si.elv;
+            sv.az = si.az;
+            sv.cno = si.cno;
+            sv.sys = si.sys;
+            sv.active = 0;
+            for (auto &gsa : gsa_list) {
+                for (auto said : gsa.get_svid_list()) {
+                    if (said == svid) {
+                        sv.active = 1;
+                    }
+                }
+            }
+        }
+    }
+    work.sv_count = n;
+
+    // seqlock: 奇数にしてから書き込み、偶数に戻す
+    uint32_t seq = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&shm->fix, &work, sizeof(work));
+    __atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,41 @@
+/**
+ * @file shm_publisher.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 最新の測位結果を共有メモリへ公開
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef SHM_PUBLISHER_HPP
+#define SHM_PUBLISHER_HPP
+
+#include "gps_shm.h"
+#include "gps_fix.hpp"
+#include "nmea_gsa.hpp"
+#include "nmea_gsv.hpp"
+#include "epoch_arena.hpp"
+#include <string>
+
+/**
+ * @brief 最新の測位結果を共有メモリへ公開
+ *
+ */
+class shm_publisher
+{
+public:
+    shm_publisher(const std::string &name = GPS_SHM_NAME);
+    ~shm_publisher();
+    bool is_open();
+    void publish(const gps_fix &fix, arena_vector<nmea_gsa> &gsa_list, arena_vector<nmea_gsv> &gsv_list);
+
+private:
+    std::string name;
+    gps_shm *shm;
+    uint64_t generation;
+    gps_shm_fix work;       // 書き込み前に組み立てる領域
+};
+
+#endif
@@ -0,0 +1,366 @@
+/**
+ * @file sky_map.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 方位角・仰角毎のC/N0の統計（スカイマップ）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "sky_map.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+
+static const char sky_map_magic[4] = { 'S', 'K', 'Y', 'M' };
+static const uint32_t sky_map_version = 1;
+static const uint8_t no_cno = 0xff;
+
+/**
+ * @brief 平均
+ *
+ * @return double C/N0の平均（観測が無ければNaN）
+ */
+double sky_map::cell::mean() const
+{
+    return count > 0 ? (double)sum / count : std::nan("");
+}
+
+/**
+ * @brief 標準偏差
+ *
+ * @return double C/N0の標準偏差（観測が無ければNaN）
+ */
+double sky_map::cell::stddev() const
+{
+    if (count == 0) {
+        return std::nan("");
+    }
+    double m = (double)sum / count;
+    double v = (double)sum_sq / count - m * m;
+    return v > 0 ? std::sqrt(v) : 0.0;
+}
+
+/**
+ * @brief Construct a new sky map::sky map object
+ *
+ * @param resolution セルの大きさ(deg、90の約数でなければ5)
+ */
+sky_map::sky_map(int resolution) :
+resolution(valid_resolution(resolution) ? resolution : 5),
+observations(0)
+{
+    az_cells = 360 / this->resolution;
+    el_cells = 90 / this->resolution;
+    cells.resize((size_t)az_cells * el_cells);
+    clear();
+}
+
+/**
+ * @brief 分解能が使えるか
+ *
+ * @param resolution セルの大きさ(deg)
+ * @return true 使える
+ * @return false 使えない
+ */
+bool sky_map::valid_resolution(int resolution)
+{
+    return resolution >= 1 && resolution <= 90 && 90 % resolution == 0;
+}
+
+/**
+ * @brief すべてのセルを空にする
+ *
+ */
+void sky_map::clear()
+{
+    for (auto &c : cells) {
+        c.count = 0;
+        c.sum = 0;
+        c.sum_sq = 0;
+        c.min = no_cno;
+        c.max = 0;
+    }
+    observations = 0;
+}
+
+/**
+ * @brief 観測を追加
+ *
+ * @param elv 仰角(deg、90は最上段のセル)
+ * @param az 方位角(deg)
+ * @param cno C/N0(dB-Hz)
+ * @return true 追加した
+ * @return false 値が無い、または範囲外
+ */
+bool sky_map::add(int elv, int az, int cno)
+{
+    if (elv < 0 || elv > 90 || az < 0 || az >= 360 || cno < 0 || cno >= no_cno) {
+        return false;
+    }
+    int e = std::min(elv / resolution, el_cells - 1);
+    int a = az / resolution;
+    cell &c = cells[(size_t)e * az_cells + a];
+    c.count++;
+    c.sum += cno;
+    c.sum_sq += (uint64_t)cno * cno;
+    c.min = std::min(c.min, (uint8_t)cno);
+    c.max = std::max(c.max, (uint8_t)cno);
+    observations++;
+    return true;
+}
+
+/**
+ * @brief 別のマップを足し合わせる
+ *
+ * @param other マップ（同じ分解能）
+ * @return true OK
+ * @return false 分解能が違う
+ */
+bool sky_map::merge(const sky_map &other)
+{
+    if (other.resolution != resolution) {
+        return false;
+    }
+    for (size_t i = 0; i < cells.size(); i++) {
+        cell &c = cells[i];
+        const cell &o = other.cells[i];
+        if (o.count == 0) {
+            continue;
+        }
+        c.count += o.count;
+        c.sum += o.sum;
+        c.sum_sq += o.sum_sq;
+        c.min = std::min(c.min, o.min);
+        c.max = std::max(c.max, o.max);
+    }
+    observations += other.observations;
+    return true;
+}
+
+/**
+ * @brief 分解能を取得
+ *
+ * @return int セルの大きさ(deg)
+ */
+int sky_map::get_resolution() const
+{
+    return resolution;
+}
+
+/**
+ * @brief 方位角のセル数を取得
+ *
+ * @return int セル数
+ */
+int sky_map::get_az_cells() const
+{
+    return az_cells;
+}
+
+/**
+ * @brief 仰角のセル数を取得
+ *
+ * @return int セル数
+ */
+int sky_map::get_el_cells() const
+{
+    return el_cells;
+}
+
+/**
+ * @brief セルを取得
+ *
+ * @param el_index 仰角のセル番号
+ * @param az_index 方位角のセル番号
+ * @return const cell& セル
+ */
+const sky_map::cell &sky_map::at(int el_index, int az_index) const
+{
+    return cells[(size_t)el_index * az_cells + az_index];
+}
+
+/**
+ * @brief 観測回数を取得
+ *
+ * @return uint64_t 観測回数
+ */
+uint64_t sky_map::get_observations() const
+{
+    return observations;
+}
+
+/**
+ * @brief 観測があるセル数を取得
+ *
+ * @return size_t セル数
+ */
+size_t sky_map::get_covered() const
+{
+    size_t n = 0;
+    for (auto &c : cells) {
+        if (c.count > 0) {
+            n++;
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief ファイルへ保存
+ *
+ * 一時ファイルに書いてから名前を変更する（途中で止まっても前のファイルは壊れない）。
+ *
+ * @param path ファイル
+ * @return true OK
+ * @return false ERROR
+ */
+bool sky_map::save(const std::string &path) const
+{
+    std::string tmp_path = path + ".tmp";
+    FILE *fp = std::fopen(tmp_path.c_str(), "wb");
+    if (fp == nullptr) {
+        std::cerr << "sky_map: failed to open " << tmp_path << std::endl;
+        return false;
+    }
+    uint32_t header[2] = { sky_map_version, (uint32_t)resolution };
+    bool ok = std::fwrite(sky_map_magic, sizeof(sky_map_magic), 1, fp) == 1 &&
+              std::fwrite(header, sizeof(header), 1, fp) == 1;
+    for (size_t i = 0; ok && i < cells.size(); i++) {
+        const cell &c = cells[i];
+        ok = std::fwrite(&c.count, sizeof(c.count), 1, fp) == 1 &&
+             std::fwrite(&c.sum, sizeof(c.sum), 1, fp) == 1 &&
+             std::fwrite(&c.sum_sq, sizeof(c.sum_sq), 1, fp) == 1 &&
+             std::fwrite(&c.min, sizeof(c.min), 1, fp) == 1 &&
+             std::fwrite(&c.max, sizeof(c.max), 1, fp) == 1;
+    }
+    ok = ok && std::fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    if (std::fclose(fp) != 0) {
+        ok = false;
+    }
+    if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "sky_map: failed to write " << path << std::endl;
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief ファイルから読み込む（分解能はファイルに合わせる）
+ *
+ * @param path ファイル
+ * @return true OK
+ * @return false スカイマップのファイルではない、または壊れている
+ */
+bool sky_map::load(const std::string &path)
+{
+    FILE *fp = std::fopen(path.c_str(), "rb");
+    if (fp == nullptr) {
+        return false;
+    }
+    char magic[4];
+    uint32_t header[2];
+    if (std::fread(magic, sizeof(magic), 1, fp) != 1 || std::memcmp(magic, sky_map_magic, sizeof(magic)) != 0 ||
+        std::fread(header, sizeof(header), 1, fp) != 1 || header[0] != sky_map_version ||
+        !valid_resolution((int)header[1])) {
+        std::fclose(fp);
+        return false;
+    }
+
+    sky_map map((int)header[1]);
+    bool ok = true;
+    for (size_t i = 0; ok && i < map.cells.size(); i++) {
+        cell &c = map.cells[i];
+        ok = std::fread(&c.count, sizeof(c.count), 1, fp) == 1 &&
+             std::fread(&c.sum, sizeof(c.sum), 1, fp) == 1 &&
+             std::fread(&c.sum_sq, sizeof(c.sum_sq), 1, fp) == 1 &&
+             std::fread(&c.min, sizeof(c.min), 1, fp) == 1 &&
+             std::fread(&c.max, sizeof(c.max), 1, fp) == 1;
+        map.observations += c.count;
+    }
+    std::fclose(fp);
+    if (!ok) {
+        std::cerr << "sky_map: truncated file " << path << std::endl;
+        return false;
+    }
+    *this = map;
+    return true;
+}
+
+/**
+ * @brief CSVで出力（観測があるセルのみ）
+ *
+ * @param os 出力先
+ */
+void sky_map::write_csv(std::ostream &os) const
+{
+    char line[128];
+    os << "az,el,count,mean,stddev,min,max\n";
+    for (int e = 0; e < el_cells; e++) {
+        for (int a = 0; a < az_cells; a++) {
+            const cell &c = at(e, a);
+            if (c.count == 0) {
+                continue;
+            }
+            std::snprintf(line, sizeof(line), "%d,%d,%u,%.2f,%.2f,%u,%u\n",
+                          a * resolution, e * resolution, c.count, c.mean(), c.stddev(), c.min, c.max);
+            os << line;
+        }
+    }
+}
+
+/**
+ * @brief 平均C/N0をPGM画像で出力
+ *
+ * 横が方位角(左が0deg)、縦が仰角(上が90deg)。lo～hi(dB-Hz)を1～255にし、観測が無いセルは0(黒)。
+ *
+ * @param path ファイル
+ * @param scale 1セルの画素数
+ * @param lo 最小値(dB-Hz)
+ * @param hi 最大値(dB-Hz)
+ * @return true OK
+ * @return false ERROR
+ */
+bool sky_map::write_pgm(const std::string &path, int scale, int lo, int hi) const
+{
+    if (scale < 1 || hi <= lo) {
+        return false;
+    }
+    FILE *fp = std::fopen(path.c_str(), "wb");
+    if (fp == nullptr) {
+        std::cerr << "sky_map: failed to open " << path << std::endl;
+        return false;
+    }
+    int width = az_cells * scale;
+    int height = el_cells * scale;
+    std::fprintf(fp, "P5\n%d %d\n255\n", width, height);
+    std::vector<uint8_t> row(width);
+    bool ok = true;
+    for (int e = el_cells - 1; ok && e >= 0; e--) {
+        for (int a = 0; a < az_cells; a++) {
+            const cell &c = at(e, a);
+            uint8_t v = 0;
+            if (c.count > 0) {
+                double t = (c.mean() - lo) / (hi - lo);
+                v = (uint8_t)(1 + std::lround(std::min(1.0, std::max(0.0, t)) * 254));
+            }
+            std::fill(row.begin() + a * scale, row.begin() + (a + 1) * scale, v);
+        }
+        for (int y = 0; ok && y < scale; y++) {
+            ok = std::fwrite(row.data(), 1, row.size(), fp) == row.size();
+        }
+    }
+    if (std::fclose(fp) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        std::cerr << "sky_map: failed to write " << path << std::endl;
+    }
+    return ok;
+}
@@ -0,0 +1,79 @@
+/**
+ * @file sky_map.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 方位角・仰角毎のC/N0の統計（スカイマップ）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef SKY_MAP_HPP
+#define SKY_MAP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+/**
+ * @brief 方位角・仰角毎のC/N0の統計（スカイマップ）
+ *
+ * 方位角(0～360deg)と仰角(0～90deg)を固定の分解能のセルに分け、GSVの衛星毎の観測を
+ * セルの回数・合計・二乗和・最小値・最大値に積算する（1観測O(1)、セルは起動時に確保）。
+ * 合計は整数なので、別の試験や別の端末のマップを足し合わせても誤差が出ない。
+ *
+ * ファイル形式（ホストのバイト順）
+ *      header: magic "SKYM"(4), version(4), resolution(4)
+ *      cell:   count(4), sum(8), sum_sq(8), min(1), max(1)（仰角、方位角の順）
+ */
+class sky_map
+{
+public:
+    /**
+     * @brief セル
+     *
+     */
+    class cell {
+    public:
+        uint32_t count;     // 観測回数
+        uint64_t sum;       // C/N0の合計
+        uint64_t sum_sq;    // C/N0の二乗和
+        uint8_t min;        // 観測が無ければ0xff
+        uint8_t max;
+
+        double mean() const;
+        double stddev() const;
+    };
+
+    sky_map(int resolution = 5);
+
+    bool add(int elv, int az, int cno);
+    bool merge(const sky_map &other);
+    void clear();
+
+    int get_resolution() const;
+    int get_az_cells() const;
+    int get_el_cells() const;
+    const cell &at(int el_index, int az_index) const;
+    uint64_t get_observations() const;
+    size_t get_covered() const;
+
+    bool save(const std::string &path) const;
+    bool load(const std::string &path);
+    void write_csv(std::ostream &os) const;
+    bool write_pgm(const std::string &path, int scale, int lo, int hi) const;
+
+    static bool valid_resolution(int resolution);
+
+private:
+    int resolution;         // deg（90の約数）
+    int az_cells;
+    int el_cells;
+    std::vector<cell> cells;
+    uint64_t observations;
+};
+
+#endif
@@ -0,0 +1,464 @@
+/**
+ * @file sv_monitor.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 衛星毎のC/N0の履歴と異常検出
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "sv_monitor.hpp"
+#include <cstring>
+
+static const float fast_alpha = 1.0f / 4;      // 短期平均（約4エポック）
+static const float slow_alpha = 1.0f / 32;     // 長期平均（約32エポック）
+static const uint32_t warmup_samples = 8;      // 追尾直後は検出しない
+
+/**
+ * @brief Construct a new sv monitor::sv monitor object
+ *
+ * @param conf 設定
+ */
+sv_monitor::sv_monitor(const config &conf) :
+conf(conf),
+sat_count(0),
+epoch(0),
+epoch_drops(0),
+event_head(0),
+group_count(0)
+{
+    std::memset(counts, 0, sizeof(counts));
+    for (size_t i = 0; i < table_size; i++) {
+        table[i] = empty_slot;
+    }
+}
+
+/**
+ * @brief 閾値を変更（衛星毎の履歴と回数はそのまま）
+ *
+ * @param conf 設定
+ */
+void sv_monitor::set_config(const config &conf)
+{
+    this->conf = conf;
+}
+
+/**
+ * @brief 衛星のハッシュ値
+ *
+ * @param sys 衛星システム
+ * @param svid 衛星番号
+ * @param sig 信号
+ * @return size_t ハッシュ値
+ */
+size_t sv_monitor::hash(int sys, int svid, int sig)
+{
+    uint32_t key = ((uint32_t)sys << 24) ^ ((uint32_t)sig << 16) ^ (uint32_t)svid;
+    return (key * 2654435761u) >> 24;
+}
+
+/**
+ * @brief 衛星を検索
+ *
+ * @param sys 衛星システム
+ * @param svid 衛星番号
+ * @param sig 信号
+ * @return satellite* 衛星（無ければnullptr）
+ */
+sv_monitor::satellite *sv_monitor::lookup(int sys, int svid, int sig)
+{
+    for (size_t i = hash(sys, svid, sig) % table_size, n = 0; n < table_size; i = (i + 1) % table_size, n++) {
+        if (table[i] == empty_slot) {
+            return nullptr;
+        }
+        satellite &s = sats[table[i]];
+        if (s.sys == sys && s.svid == svid && s.sig == sig) {
+            return &s;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * @brief 衛星を検索（const）
+ *
+ * @param sys 衛星システム
+ * @param svid 衛星番号
+ * @param sig 信号
+ * @return const satellite* 衛星（無ければnullptr）
+ */
+const sv_monitor::satellite *sv_monitor::find(int sys, int svid, int sig) const
+{
+    return const_cast<sv_monitor *>(this)->lookup(sys, svid, sig);
+}
+
+/**
+ * @brief ハッシュ表を作り直す
+ *
+ */
+void sv_monitor::rebuild_table()
+{
+    for (size_t i = 0; i < table_size; i++) {
+        table[i] = empty_slot;
+    }
+    for (size_t k = 0; k < sat_count; k++) {
+        size_t i = hash(sats[k].sys, sats[k].svid, sats[k].sig) % table_size;
+        while (table[i] != empty_slot) {
+            i = (i + 1) % table_size;
+        }
+        table[i] = (int16_t)k;
+    }
+}
+
+/**
+ * @brief 衛星を追加
+ *
+ * 一杯なら最も長く見えていない衛星を再利用する（削除があるのでハッシュ表を作り直す）。
+ *
+ * @param sys 衛星システム
+ * @param svid 衛星番号
+ * @param sig 信号
+ * @return satellite* 衛星
+ */
+sv_monitor::satellite *sv_monitor::allocate(int sys, int svid, int sig)
+{
+    size_t k;
+    bool rebuild = false;
+    if (sat_count < max_satellites) {
+        k = sat_count++;
+    }
+    else {
+        k = 0;
+        for (size_t i = 1; i < sat_count; i++) {
+            if (sats[i].last_epoch < sats[k].last_epoch) {
+                k = i;
+            }
+        }
+        rebuild = true;
+    }
+    satellite &s = sats[k];
+    s.sys = sys;
+    s.svid = svid;
+    s.sig = sig;
+    s.elv = -1;
+    s.az = -1;
+    s.cno = -1;
+    s.fast = 0;
+    s.slow = 0;
+    s.samples = 0;
+    s.last_epoch = epoch;
+    s.tracking = false;
+    s.degraded = false;
+    s.lost = false;
+    s.lost_cno = 0;
+    std::memset(s.history, no_cno, sizeof(s.history));
+
+    if (rebuild) {
+        rebuild_table();
+    }
+    else {
+        size_t i = hash(sys, svid, sig) % table_size;
+        while (table[i] != empty_slot) {
+            i = (i + 1) % table_size;
+        }
+        table[i] = (int16_t)k;
+    }
+    return &s;
+}
+
+/**
+ * @brief エポックの開始
+ *
+ * @param epoch エポック番号（増加していくこと）
+ */
+void sv_monitor::begin_epoch(uint64_t epoch)
+{
+    this->epoch = epoch;
+    epoch_drops = 0;
+    group_count = 0;
+}
+
+/**
+ * @brief GSVを追加
+ *
+ * @param gsv GSV
+ */
+void sv_monitor::add_gsv(nmea_gsv &gsv)
+{
+    int sys = gsv.get_system_id();
+    int sig = gsv.get_signal_id();
+    size_t g = 0;
+    while (g < group_count && !(groups[g].sys == sys && groups[g].sig == sig)) {
+        g++;
+    }
+    if (g == group_count && group_count < max_groups) {
+        groups[g].sys = sys;
+        groups[g].sig = sig;
+        groups[g].received = 0;
+        group_count++;
+    }
+    if (g < group_count) {
+        int msg = gsv.get_msg_num();
+        groups[g].num_msg = gsv.get_num_msg();
+        if (msg >= 1 && msg <= 32) {
+            groups[g].received |= 1u << (msg - 1);
+        }
+    }
+
+    for (auto svid : gsv.get_svid_list()) {
+        nmea_gsv::sv_info si = gsv.get_svinfo(svid);
+        update(sys, si.svid, sig, si.elv, si.az, si.cno);
+    }
+}
+
+/**
+ * @brief 衛星システム・信号のGSVがすべて揃ったか
+ *
+ * @param sys 衛星システム
+ * @param sig 信号
+ * @return true 揃った
+ * @return false 欠けている、または受信していない
+ */
+bool sv_monitor::is_complete(int sys, int sig) const
+{
+    for (size_t g = 0; g < group_count; g++) {
+        if (groups[g].sys == sys && groups[g].sig == sig) {
+            int n = groups[g].num_msg;
+            if (n < 1 || n > 32) {
+                return false;
+            }
+            uint32_t all = (n == 32) ? 0xffffffffu : ((1u << n) - 1);
+            return (groups[g].received & all) == all;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief GSVの衛星情報を追加
+ *
+ * @param sys 衛星システム
+ * @param svid 衛星番号
+ * @param sig 信号
+ * @param elv 仰角（無ければ-1）
+ * @param az 方位角（無ければ-1）
+ * @param cno C/N0（追尾していなければ-1）
+ */
+void sv_monitor::update(int sys, int svid, int sig, int elv, int az, int cno)
+{
+    if (svid < 0) {
+        return;
+    }
+    satellite *s = lookup(sys, svid, sig);
+    if (s == nullptr) {
+        s = allocate(sys, svid, sig);
+    }
+
+    // 見えていなかったエポックの履歴を無効にする
+    uint64_t gap = epoch - s->last_epoch;
+    for (uint64_t e = 1; e < gap && e <= history_size; e++) {
+        s->history[(s->last_epoch + e) % history_size] = no_cno;
+    }
+    s->history[epoch % history_size] = (cno >= 0 && cno < no_cno) ? (uint8_t)cno : no_cno;
+    s->last_epoch = epoch;
+    if (elv >= 0) {
+        s->elv = elv;
+    }
+    if (az >= 0) {
+        s->az = az;
+    }
+    s->cno = cno;
+
+    if (cno < 0) {
+        // GSVに含まれているがC/N0が無い（追尾していない）
+        if (s->tracking) {
+            lose_lock(*s);
+        }
+        return;
+    }
+
+    if (!s->tracking) {
+        // 追尾開始
+        s->tracking = true;
+        s->degraded = false;
+        s->samples = 0;
+        s->fast = cno;
+        s->slow = cno;
+    }
+    s->samples++;
+
+    if (s->lost && s->samples >= (uint32_t)conf.relock_epochs &&
+        (s->fast >= s->lost_cno - conf.drop_threshold || s->samples >= history_size)) {
+        // 追尾外れから回復した（C/N0が戻らなくてもhistory_size続けて追尾すれば回復とする）
+        s->lost = false;
+    }
+
+    if (s->samples > warmup_samples) {
+        if (!s->degraded && s->fast - cno >= conf.drop_threshold) {
+            record(sudden_drop, s, (int)(s->fast + 0.5f), cno);
+            s->degraded = true;
+            epoch_drops++;
+        }
+    }
+    s->fast += (cno - s->fast) * fast_alpha;
+    s->slow += (cno - s->slow) * slow_alpha;
+    if (s->samples > warmup_samples) {
+        float diff = s->slow - s->fast;
+        if (!s->degraded && diff >= conf.fade_threshold) {
+            record(slow_fade, s, (int)(s->slow + 0.5f), cno);
+            s->degraded = true;
+            epoch_drops++;
+        }
+        else if (s->degraded && diff < conf.fade_threshold / 2.0f) {
+            // 回復した
+            s->degraded = false;
+        }
+    }
+}
+
+/**
+ * @brief 追尾が外れた
+ *
+ * 前の追尾外れから回復していなければ数えない。
+ *
+ * @param sat 衛星
+ */
+void sv_monitor::lose_lock(satellite &sat)
+{
+    if (!sat.lost && sat.elv >= conf.elevation_mask) {
+        record(loss_of_lock, &sat, (int)(sat.fast + 0.5f), -1);
+        epoch_drops++;
+        sat.lost = true;
+        sat.lost_cno = (int)(sat.slow + 0.5f);
+    }
+    sat.tracking = false;
+}
+
+/**
+ * @brief エポックの終了
+ *
+ * GSVに含まれなくなった衛星と、複数の衛星が同時に下がったかをチェックする。
+ * GSVが揃っていない衛星システムの衛星は判定しない。
+ *
+ */
+void sv_monitor::end_epoch()
+{
+    for (size_t k = 0; k < sat_count; k++) {
+        satellite &s = sats[k];
+        if (s.tracking && s.last_epoch != epoch && is_complete(s.sys, s.sig)) {
+            lose_lock(s);
+            s.cno = -1;
+        }
+    }
+    if (conf.common_count > 0 && epoch_drops >= conf.common_count) {
+        record(interference, nullptr, epoch_drops, -1);
+    }
+}
+
+/**
+ * @brief イベントを記録
+ *
+ * @param type 種類
+ * @param sat 衛星（interferenceはnullptr）
+ * @param cno_before 前の値
+ * @param cno_after 今回の値
+ */
+void sv_monitor::record(event_type type, const satellite *sat, int cno_before, int cno_after)
+{
+    event &e = events[event_head % max_events];
+    e.epoch = epoch;
+    e.type = type;
+    e.sys = sat ? sat->sys : 0;
+    e.svid = sat ? sat->svid : 0;
+    e.sig = sat ? sat->sig : 0;
+    e.cno_before = cno_before;
+    e.cno_after = cno_after;
+    event_head++;
+    counts[type]++;
+}
+
+/**
+ * @brief イベントの回数を取得
+ *
+ * @param type 種類
+ * @return uint64_t 回数
+ */
+uint64_t sv_monitor::get_count(event_type type) const
+{
+    return counts[type];
+}
+
+/**
+ * @brief 追尾中の衛星数を取得
+ *
+ * @return size_t 衛星数
+ */
+size_t sv_monitor::get_tracked() const
+{
+    size_t n = 0;
+    for (size_t k = 0; k < sat_count; k++) {
+        if (sats[k].tracking) {
+            n++;
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief 直近のイベントを取得（新しい順）
+ *
+ * @param out 出力先
+ * @param n 最大数
+ * @return size_t 取得した数
+ */
+size_t sv_monitor::get_events(event *out, size_t n) const
+{
+    size_t count = 0;
+    for (uint64_t i = event_head; i > 0 && count < n && event_head - i < max_events; i--) {
+        out[count++] = events[(i - 1) % max_events];
+    }
+    return count;
+}
+
+/**
+ * @brief 衛星のC/N0の履歴を取得（古い順、無効は-1）
+ *
+ * @param sat 衛星
+ * @param out 出力先
+ * @param n 最大数（history_sizeまで）
+ * @return size_t 取得した数
+ */
+size_t sv_monitor::get_history(const satellite &sat, int *out, size_t n) const
+{
+    if (n > history_size) {
+        n = history_size;
+    }
+    // 現在のエポックから遡る（記録していないエポックは無効）
+    for (size_t i = 0; i < n; i++) {
+        uint64_t e = epoch - (n - 1 - i);
+        if (e > epoch || e > sat.last_epoch) {
+            // 記録する前、またはGSVに含まれなくなった後
+            out[i] = -1;
+            continue;
+        }
+        uint8_t v = sat.history[e % history_size];
+        out[i] = (v == no_cno) ? -1 : v;
+    }
+    return n;
+}
+
+/**
+ * @brief イベントの名前
+ *
+ * @param type 種類
+ * @return const char* 名前
+ */
+const char *sv_monitor::event_name(event_type type)
+{
+    static const char *names[event_type_count] = {
+        "loss_of_lock", "sudden_drop", "slow_fade", "interference"
+    };
+    return names[type];
+}
@@ -0,0 +1,159 @@
+/**
+ * @file sv_monitor.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 衛星毎のC/N0の履歴と異常検出
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef SV_MONITOR_HPP
+#define SV_MONITOR_HPP
+
+#include "nmea_gsv.hpp"
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief 衛星毎のC/N0の履歴と異常検出
+ *
+ * 衛星（衛星システム、衛星番号、信号）毎に固定長のリングバッファへC/N0を記録し、
+ * 追尾が外れた（loss of lock）、C/N0が急に下がった（drop）、ゆっくり下がった（fade）を検出する。
+ * 同じエポックで複数の衛星が同時に下がった場合は受信機側の妨害（interference）とする。
+ * GSVが欠けたエポック（チェックサムエラー、センテンスの欠落）はGSVに無い衛星を外れたとしない。
+ * 追尾が外れた衛星は、再び追尾してC/N0の短期平均が外れる前の長期平均からdrop_threshold以内に戻り、relock_epochs続けて追尾するまで
+ * 次の追尾外れを数えない（妨害中に閾値付近の衛星が外れたり戻ったりしても1回とする）。
+ *
+ * 衛星数とエポック毎の処理は上限があり、ヒープは使わない。
+ */
+class sv_monitor
+{
+public:
+    static const size_t max_satellites = 128;   // 記録する衛星数（超えたら最も古い衛星を再利用）
+    static const size_t history_size = 64;      // 衛星毎のC/N0の履歴（エポック数）
+    static const size_t max_events = 32;        // 記録する直近のイベント数
+
+    enum event_type {
+        loss_of_lock,   // 仰角マスク以上で追尾が外れた
+        sudden_drop,    // 短期平均からdrop_threshold以上下がった
+        slow_fade,      // 長期平均と短期平均の差がfade_threshold以上
+        interference,   // 同じエポックでcommon_count機以上が下がった
+        event_type_count
+    };
+
+    /**
+     * @brief 設定
+     *
+     */
+    class config {
+    public:
+        int drop_threshold;     // dB
+        int fade_threshold;     // dB
+        int elevation_mask;     // deg（これより低い衛星が外れても異常としない）
+        int common_count;       // 同時に下がった衛星数
+        int relock_epochs;      // 追尾外れの後、回復したとするまでのエポック数
+        config() {
+            drop_threshold = 6;
+            fade_threshold = 4;
+            elevation_mask = 10;
+            common_count = 3;
+            relock_epochs = 10;
+        }
+    };
+
+    /**
+     * @brief 検出したイベント
+     *
+     */
+    class event {
+    public:
+        uint64_t epoch;
+        event_type type;
+        int sys;                // interferenceは0
+        int svid;
+        int sig;
+        int cno_before;         // 短期平均(dB-Hz)
+        int cno_after;          // 今回の値（外れた場合は-1）
+    };
+
+    /**
+     * @brief 衛星毎の状態
+     *
+     */
+    class satellite {
+    public:
+        int sys;
+        int svid;
+        int sig;
+        int elv;
+        int az;
+        int cno;                        // 最新のC/N0（追尾していなければ-1）
+        float fast;                     // C/N0の短期平均（指数移動平均）
+        float slow;                     // C/N0の長期平均
+        uint32_t samples;               // 追尾してからのサンプル数
+        uint64_t last_epoch;            // 最後にGSVに含まれていたエポック
+        bool tracking;
+        bool degraded;                  // drop/fadeを検出して回復待ち
+        bool lost;                      // 追尾外れを検出して回復待ち（回復するまで次の追尾外れを数えない）
+        int lost_cno;                   // 追尾が外れる前の長期平均(dB-Hz)
+        uint8_t history[history_size];  // C/N0（エポック % history_size、no_cnoは無効）
+    };
+
+    static const uint8_t no_cno = 0xff;
+
+    sv_monitor(const config &conf = config());
+    void set_config(const config &conf);
+    void begin_epoch(uint64_t epoch);
+    void add_gsv(nmea_gsv &gsv);
+    void update(int sys, int svid, int sig, int elv, int az, int cno);
+    void end_epoch();
+
+    uint64_t get_count(event_type type) const;
+    size_t get_tracked() const;
+    size_t get_events(event *out, size_t n) const;
+    const satellite *find(int sys, int svid, int sig) const;
+    size_t get_history(const satellite &sat, int *out, size_t n) const;
+
+    static const char *event_name(event_type type);
+
+private:
+    static const size_t table_size = 256;       // ハッシュ表（max_satellitesの2倍）
+    static const int16_t empty_slot = -1;
+    static const size_t max_groups = 16;
+
+    /**
+     * @brief エポック内のGSVの受信状況（衛星システム・信号毎）
+     *
+     */
+    class group {
+    public:
+        int sys;
+        int sig;
+        int num_msg;
+        uint32_t received;      // 受信したmsgNumのビット
+    };
+
+    config conf;
+    satellite sats[max_satellites];
+    size_t sat_count;
+    int16_t table[table_size];
+    uint64_t epoch;
+    int epoch_drops;                            // 今回のエポックで下がった衛星数
+    uint64_t counts[event_type_count];
+    event events[max_events];
+    uint64_t event_head;
+    group groups[max_groups];
+    size_t group_count;
+
+    satellite *lookup(int sys, int svid, int sig);
+    satellite *allocate(int sys, int svid, int sig);
+    void rebuild_table();
+    bool is_complete(int sys, int sig) const;
+    void lose_lock(satellite &sat);
+    void record(event_type type, const satellite *sat, int cno_before, int cno_after);
+    static size_t hash(int sys, int svid, int sig);
+};
+
+#endif
@@ -0,0 +1,100 @@
+/**
+ * @file frame_renderer_test.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief frame_rendererのテスト（行数が減ったフレームも描画する）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "frame_renderer.hpp"
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok) {
+        std::cerr << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+/**
+ * @brief 行を組み立てる
+ *
+ * @param fr フレーム
+ * @param n 行数
+ */
+static void build(frame_renderer &fr, int n)
+{
+    fr.begin();
+    for (int i = 0; i < n; i++) {
+        fr.printf("sv %02d", i);
+        fr.newline();
+    }
+}
+
+/**
+ * @brief 出力を読む
+ *
+ * @param fd パイプ
+ * @return std::string 出力
+ */
+static std::string drain(int fd)
+{
+    char buf[4096];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    return n > 0 ? std::string(buf, n) : std::string();
+}
+
+int main()
+{
+    int pfd[2];
+    if (pipe(pfd) != 0) {
+        return EXIT_FAILURE;
+    }
+    frame_renderer fr(pfd[1]);
+
+    // 3行を描画
+    build(fr, 3);
+    check(fr.changed(), "first frame is changed");
+    fr.present();
+    drain(pfd[0]);
+
+    // 同じフレームは描画しない
+    build(fr, 3);
+    check(!fr.changed(), "same frame is not changed");
+
+    // 行数が減った（衛星の一覧が短くなった）フレームは描画し、残った行を消す
+    build(fr, 2);
+    check(fr.changed(), "shrunk frame is changed");
+    fr.present();
+    std::string out = drain(pfd[0]);
+    check(out.find("\033[3;1H\033[2K") != std::string::npos, "shrunk frame clears the old row");
+
+    // 後から組み立てる行（描画統計）を除いて比較する
+    build(fr, 2);
+    fr.puts("stats 1");
+    fr.newline();
+    fr.present();
+    drain(pfd[0]);
+    build(fr, 2);
+    check(!fr.changed(1), "same frame before the trailing row is not changed");
+    build(fr, 1);
+    check(fr.changed(1), "shrunk frame before the trailing row is changed");
+
+    close(pfd[0]);
+    close(pfd[1]);
+    if (failures > 0) {
+        return EXIT_FAILURE;
+    }
+    std::cout << "frame_renderer_test: OK" << std::endl;
+    return EXIT_SUCCESS;
+}
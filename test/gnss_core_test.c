@@ -0,0 +1,114 @@
+/**
+ * @file gnss_core_test.c
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief gnss_coreのC APIのテスト（処理時間はハンドル毎に受け取る）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "gnss_core.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief ハンドル毎の処理時間の集計
+ *
+ */
+struct timing_count {
+    uint64_t calls[GNSS_CORE_STAGE_COUNT];
+    int bad;                /* 範囲外の段階、または終了が開始より前 */
+};
+
+static void count_timing(void *user, int stage, uint64_t start_ns, uint64_t end_ns)
+{
+    struct timing_count *tc = (struct timing_count *)user;
+    if (stage < 0 || stage >= GNSS_CORE_STAGE_COUNT || end_ns < start_ns) {
+        tc->bad++;
+        return;
+    }
+    tc->calls[stage]++;
+}
+
+static gnss_core *create(struct timing_count *tc)
+{
+    struct gnss_core_config conf;
+    gnss_core_default_config(&conf);
+    conf.timing = count_timing;
+    conf.timing_user = tc;
+    return gnss_core_create(&conf);
+}
+
+static void feed_epochs(gnss_core *core, const char *data, size_t len, int epochs)
+{
+    for (int i = 0; i < epochs; i++) {
+        gnss_core_feed(core, data, len);
+        gnss_core_end_burst(core, (uint64_t)(i + 1) * 1000000000u);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: gnss_core_test <nmea>\n");
+        return EXIT_FAILURE;
+    }
+    static char data[64 * 1024];
+    FILE *fp = fopen(argv[1], "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "gnss_core_test: failed to open %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    size_t len = fread(data, 1, sizeof(data), fp);
+    fclose(fp);
+
+    struct timing_count a, b;
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    gnss_core *core_a = create(&a);
+    gnss_core *core_b = create(&b);
+    if (core_a == NULL || core_b == NULL) {
+        fprintf(stderr, "FAILED: gnss_core_create\n");
+        return EXIT_FAILURE;
+    }
+
+    /* 別々のハンドルの処理時間は混ざらない */
+    feed_epochs(core_a, data, len, 3);
+    feed_epochs(core_b, data, len, 1);
+    int failures = 0;
+    if (a.bad != 0 || b.bad != 0) {
+        fprintf(stderr, "FAILED: invalid stage or time\n");
+        failures++;
+    }
+    if (a.calls[GNSS_CORE_STAGE_SPLIT] != 3 || b.calls[GNSS_CORE_STAGE_SPLIT] != 1 ||
+        a.calls[GNSS_CORE_STAGE_CHECK] != 3 || b.calls[GNSS_CORE_STAGE_CHECK] != 1) {
+        fprintf(stderr, "FAILED: split/check calls a = %llu/%llu, b = %llu/%llu (expected 3/3, 1/1)\n",
+                (unsigned long long)a.calls[GNSS_CORE_STAGE_SPLIT], (unsigned long long)a.calls[GNSS_CORE_STAGE_CHECK],
+                (unsigned long long)b.calls[GNSS_CORE_STAGE_SPLIT], (unsigned long long)b.calls[GNSS_CORE_STAGE_CHECK]);
+        failures++;
+    }
+    if (b.calls[GNSS_CORE_STAGE_CHECKSUM] == 0 || a.calls[GNSS_CORE_STAGE_CHECKSUM] != 3 * b.calls[GNSS_CORE_STAGE_CHECKSUM]) {
+        fprintf(stderr, "FAILED: checksum calls a = %llu, b = %llu\n",
+                (unsigned long long)a.calls[GNSS_CORE_STAGE_CHECKSUM], (unsigned long long)b.calls[GNSS_CORE_STAGE_CHECKSUM]);
+        failures++;
+    }
+
+    /* timingが無ければ呼ばない */
+    struct gnss_core_config conf;
+    gnss_core_default_config(&conf);
+    if (conf.timing != NULL) {
+        fprintf(stderr, "FAILED: default timing is not NULL\n");
+        failures++;
+    }
+
+    gnss_core_destroy(core_a);
+    gnss_core_destroy(core_b);
+    if (failures > 0) {
+        return EXIT_FAILURE;
+    }
+    printf("gnss_core_test: OK\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,123 @@
+/**
+ * @file sv_monitor_test.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief sv_monitorのテスト（1回の妨害で追尾外れは衛星毎に1回まで）
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "gps_sim.hpp"
+#include "nmea_gsv.hpp"
+#include "sv_monitor.hpp"
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok) {
+        std::cerr << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+typedef std::tuple<int, int, int> sv_key;   // 衛星システム、衛星番号、信号
+
+/**
+ * @brief シミュレーターの1エポックをsv_monitorへ入れ、追尾外れを衛星毎に数える
+ *
+ * @param sim シミュレーター
+ * @param monitor 監視
+ * @param epoch エポック番号
+ * @param lost 衛星毎の追尾外れの回数
+ */
+static void run_epoch(gps_sim &sim, sv_monitor &monitor, uint64_t epoch, std::map<sv_key, int> &lost)
+{
+    std::string burst;
+    sim.next_burst(burst);
+    uint64_t before = monitor.get_count(sv_monitor::loss_of_lock);
+
+    monitor.begin_epoch(epoch);
+    size_t pos = 0;
+    while (pos < burst.size()) {
+        size_t end = burst.find("\r\n", pos);
+        if (end == std::string::npos) {
+            end = burst.size();
+        }
+        std::string line = burst.substr(pos, end - pos);
+        if (line.compare(3, 4, "GSV,") == 0) {
+            nmea_gsv gsv(line);
+            monitor.add_gsv(gsv);
+        }
+        pos = end + 2;
+    }
+    monitor.end_epoch();
+
+    // 今回のエポックのイベント（新しい順）
+    uint64_t n = monitor.get_count(sv_monitor::loss_of_lock) - before;
+    sv_monitor::event events[sv_monitor::max_events];
+    size_t count = monitor.get_events(events, sv_monitor::max_events);
+    for (size_t i = 0; i < count && n > 0; i++) {
+        if (events[i].epoch == epoch && events[i].type == sv_monitor::loss_of_lock) {
+            lost[sv_key(events[i].sys, events[i].svid, events[i].sig)]++;
+            n--;
+        }
+    }
+}
+
+int main()
+{
+    gps_sim::config sim_conf;
+    sim_conf.rate_hz = 10;
+    sv_monitor::config conf;
+    conf.elevation_mask = 0;
+
+    for (uint32_t seed = 1; seed <= 20; seed++) {
+        sim_conf.seed = seed;
+        gps_sim sim(sim_conf);
+        sv_monitor monitor(conf);
+        std::map<sv_key, int> lost;
+        uint64_t epoch = 0;
+
+        // 追尾が安定してから妨害する
+        for (int i = 0; i < 100; i++) {
+            run_epoch(sim, monitor, ++epoch, lost);
+        }
+        check(lost.empty(), "no loss of lock before jamming");
+
+        // 妨害を2回（妨害が終わって回復した後の追尾外れは再び数える）
+        for (int burst = 0; burst < 2; burst++) {
+            lost.clear();
+            uint64_t interference = monitor.get_count(sv_monitor::interference);
+            sim.inject(gps_sim::jamming);
+            for (int i = 0; i < 200; i++) {
+                run_epoch(sim, monitor, ++epoch, lost);
+            }
+
+            check(!lost.empty(), "jamming causes loss of lock");
+            for (auto &l : lost) {
+                if (l.second > 1) {
+                    std::cerr << "FAILED: seed " << seed << " burst " << burst + 1
+                              << " sv " << std::get<0>(l.first) << "/" << std::get<1>(l.first)
+                              << " loss_of_lock = " << l.second << " (expected at most 1)" << std::endl;
+                    failures++;
+                }
+            }
+            check(monitor.get_count(sv_monitor::interference) - interference <= 2,
+                  "one jamming burst is not reported as repeated interference");
+        }
+    }
+
+    if (failures > 0) {
+        return EXIT_FAILURE;
+    }
+    std::cout << "sv_monitor_test: OK" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,253 @@
+/**
+ * @file trace.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 処理段階毎の時間計測
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "trace.hpp"
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iomanip>
+#include <vector>
+
+static const size_t ring_size = 4096;       // スレッド毎のイベント数（2のべき乗）
+static const int max_threads = 16;          // リングバッファを持てるスレッド数
+static const int bucket_count = trace::histogram_buckets;
+
+/**
+ * @brief トレースイベント
+ *
+ */
+class trace_event {
+public:
+    uint64_t start;     // 開始時刻(ns)
+    uint32_t dur;       // 処理時間(ns)
+    uint32_t stage;
+};
+
+/**
+ * @brief スレッド毎のリングバッファ
+ *
+ */
+class trace_ring {
+public:
+    trace_event events[ring_size];
+    std::atomic<uint64_t> count;    // 書き込んだイベント数（所有スレッドのみ更新）
+    int tid;
+};
+
+/**
+ * @brief 段階毎のヒストグラム
+ *
+ */
+class trace_histogram {
+public:
+    std::atomic<uint64_t> buckets[bucket_count];    // [i]: 2^(i-1) <= ns < 2^i
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+};
+
+static trace_ring rings[max_threads];
+static std::atomic<int> ring_count(0);
+static trace_histogram histograms[trace::stage_count];
+static thread_local trace_ring *this_ring = nullptr;
+static thread_local bool registered = false;
+
+/**
+ * @brief 呼び出したスレッドのリングバッファを取得（初回に割り当てる）
+ *
+ * @return trace_ring* リングバッファ（割り当てられなければnullptr）
+ */
+static trace_ring *get_ring()
+{
+    if (!registered) {
+        registered = true;
+        int index = ring_count.fetch_add(1);
+        if (index < max_threads) {
+            this_ring = &rings[index];
+            this_ring->tid = (int)syscall(SYS_gettid);
+        }
+    }
+    return this_ring;
+}
+
+/**
+ * @brief 処理時間を記録
+ *
+ * @param s 段階
+ * @param start 開始時刻(ns)
+ * @param end 終了時刻(ns)
+ */
+void trace::record(stage s, uint64_t start, uint64_t end)
+{
+    uint64_t dur = end - start;
+
+    trace_histogram &h = histograms[s];
+    int bucket = 0;
+    if (dur > 0) {
+        bucket = 64 - __builtin_clzll(dur);
+        if (bucket >= bucket_count) {
+            bucket = bucket_count - 1;
+        }
+    }
+    h.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    h.count.fetch_add(1, std::memory_order_relaxed);
+    h.sum.fetch_add(dur, std::memory_order_relaxed);
+    uint64_t max = h.max.load(std::memory_order_relaxed);
+    while (dur > max && !h.max.compare_exchange_weak(max, dur, std::memory_order_relaxed)) {
+    }
+
+    trace_ring *ring = get_ring();
+    if (ring != nullptr) {
+        uint64_t n = ring->count.load(std::memory_order_relaxed);
+        trace_event &ev = ring->events[n & (ring_size - 1)];
+        ev.start = start;
+        ev.dur = dur > UINT32_MAX ? UINT32_MAX : (uint32_t)dur;
+        ev.stage = s;
+        ring->count.store(n + 1, std::memory_order_release);
+    }
+}
+
+/**
+ * @brief 段階のヒストグラムを取得（ロックしないので各値は記録中に少しずれることがある）
+ *
+ * @param s 段階
+ * @param buckets 出力先（histogram_buckets個）
+ * @param sum_ns 処理時間の合計(ns)
+ * @return uint64_t 回数
+ */
+uint64_t trace::get_histogram(stage s, uint64_t *buckets, uint64_t &sum_ns)
+{
+    trace_histogram &h = histograms[s];
+    for (int i = 0; i < bucket_count; i++) {
+        buckets[i] = h.buckets[i].load(std::memory_order_relaxed);
+    }
+    sum_ns = h.sum.load(std::memory_order_relaxed);
+    return h.count.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief 段階名を取得
+ *
+ * @param s 段階
+ * @return const char* 段階名
+ */
+const char *trace::stage_name(stage s)
+{
+    static const char *names[stage_count] = {
+        "bus_open", "bus_length", "bus_read", "bus_close", "split", "checksum",
+        "parse_rmc", "parse_gga", "parse_gsa", "parse_gsv", "check", "render", "wakeup"
+    };
+    return (s < stage_count) ? names[s] : "unknown";
+}
+
+/**
+ * @brief 段階毎の処理時間の統計を出力
+ *
+ * @param os 出力先
+ */
+void trace::dump(std::ostream &os)
+{
+    os << "stage          count      mean(us)   p50(us)    p99(us)    max(us)" << std::endl;
+    for (int s = 0; s < stage_count; s++) {
+        trace_histogram &h = histograms[s];
+        uint64_t count = h.count.load(std::memory_order_relaxed);
+        if (count == 0) {
+            continue;
+        }
+        // パーセンタイルはバケットの上限値で近似
+        uint64_t p50 = 0;
+        uint64_t p99 = 0;
+        uint64_t acc = 0;
+        for (int i = 0; i < bucket_count; i++) {
+            acc += h.buckets[i].load(std::memory_order_relaxed);
+            uint64_t upper = (i == 0) ? 1 : (1ull << i);
+            if (p50 == 0 && acc * 100 >= count * 50) {
+                p50 = upper;
+            }
+            if (p99 == 0 && acc * 100 >= count * 99) {
+                p99 = upper;
+                break;
+            }
+        }
+        os << std::left << std::setw(15) << stage_name((stage)s) << std::right
+           << std::setw(10) << count << " "
+           << std::fixed << std::setprecision(3)
+           << std::setw(10) << h.sum.load(std::memory_order_relaxed) / 1000.0 / count << " "
+           << std::setw(10) << p50 / 1000.0 << " "
+           << std::setw(10) << p99 / 1000.0 << " "
+           << std::setw(10) << h.max.load(std::memory_order_relaxed) / 1000.0 << std::endl;
+    }
+}
+
+/**
+ * @brief 段階のヒストグラムを出力（空のバケットは除く）
+ *
+ * 各行はバケットの上限値(us)、回数、割合の棒。
+ *
+ * @param os 出力先
+ * @param s 段階
+ */
+void trace::dump_histogram(std::ostream &os, stage s)
+{
+    static const int bar_width = 40;
+    trace_histogram &h = histograms[s];
+    uint64_t count = h.count.load(std::memory_order_relaxed);
+    if (count == 0) {
+        return;
+    }
+    for (int i = 0; i < bucket_count; i++) {
+        uint64_t n = h.buckets[i].load(std::memory_order_relaxed);
+        if (n == 0) {
+            continue;
+        }
+        uint64_t upper = (i == 0) ? 1 : (1ull << i);
+        int bar = (int)((n * bar_width + count - 1) / count);
+        os << "  < " << std::fixed << std::setprecision(3) << std::setw(12) << upper / 1000.0 << " us "
+           << std::setw(10) << n << " " << std::string(bar, '#') << std::endl;
+    }
+}
+
+/**
+ * @brief リングバッファのイベントをChrome trace形式(JSON)で出力
+ *
+ * chrome://tracing や Perfetto で開ける。
+ *
+ * @param path 出力ファイル
+ * @return true OK
+ * @return false ERROR
+ */
+bool trace::export_chrome(const std::string &path)
+{
+    FILE *fp = std::fopen(path.c_str(), "w");
+    if (fp == nullptr) {
+        return false;
+    }
+    int pid = getpid();
+    bool first = true;
+    std::fprintf(fp, "{\"traceEvents\":[\n");
+    int n = std::min(ring_count.load(), max_threads);
+    for (int r = 0; r < n; r++) {
+        trace_ring &ring = rings[r];
+        uint64_t count = ring.count.load(std::memory_order_acquire);
+        uint64_t begin = count > ring_size ? count - ring_size : 0;
+        for (uint64_t i = begin; i < count; i++) {
+            const trace_event &ev = ring.events[i & (ring_size - 1)];
+            std::fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+                         first ? "" : ",\n", stage_name((stage)ev.stage),
+                         ev.start / 1000.0, ev.dur / 1000.0, pid, ring.tid);
+            first = false;
+        }
+    }
+    std::fprintf(fp, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    return std::fclose(fp) == 0;
+}
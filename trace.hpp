@@ -0,0 +1,82 @@
+/**
+ * @file trace.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 処理段階毎の時間計測
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <time.h>
+
+/**
+ * @brief 処理段階毎の時間計測
+ *
+ * 各段階の処理時間をスレッド毎のリングバッファ（固定長イベント）と
+ * 段階毎のヒストグラム（log2バケット）に記録する。
+ * 記録はロックなしで行い、dump()/export_chrome()はいつ呼んでもよい。
+ */
+class trace
+{
+public:
+    enum stage {
+        bus_open,       // /dev/i2c-* のopen
+        bus_length,     // 0xFD 長さ読み出し ioctl
+        bus_read,       // 0xFF ストリーム読み出し ioctl
+        bus_close,
+        split,          // バーストをセンテンスへ分割
+        checksum,
+        parse_rmc,
+        parse_gga,
+        parse_gsa,
+        parse_gsv,
+        check,          // 時刻・位置チェック
+        render,         // 画面表示
+        wakeup,         // poll間隔の待ちから起床するまでの遅れ（スケジューリングのジッター）
+        stage_count
+    };
+
+    /**
+     * @brief スコープの処理時間を記録
+     *
+     */
+    class scope {
+    public:
+        scope(stage s) : s(s), start(now()) {}
+        ~scope() { record(s, start, now()); }
+    private:
+        stage s;
+        uint64_t start;
+    };
+
+    /**
+     * @brief 単調増加時刻(ns)を取得
+     *
+     * @return uint64_t 時刻(ns)
+     */
+    static inline uint64_t now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+    }
+
+    static const int histogram_buckets = 40;    // [i]: 2^(i-1) <= ns < 2^i（2^39 ns まで）
+
+    static void record(stage s, uint64_t start, uint64_t end);
+    static uint64_t get_histogram(stage s, uint64_t *buckets, uint64_t &sum_ns);
+    static void dump(std::ostream &os);
+    static void dump_histogram(std::ostream &os, stage s);
+    static bool export_chrome(const std::string &path);
+    static const char *stage_name(stage s);
+};
+
+#endif
@@ -0,0 +1,107 @@
+/**
+ * @file triple_buffer.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 最新の値だけを受け渡すトリプルバッファ
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef TRIPLE_BUFFER_HPP
+#define TRIPLE_BUFFER_HPP
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * @brief 最新の値だけを受け渡すトリプルバッファ（書き込み側・読み込み側とも1スレッド）
+ *
+ * 書き込み側はback()へ直接書いてpublish()し、読み込み側はtake()で最新の値をfront()へ取る。
+ * どちらも待たず、ロックもヒープも使わない。読み込み側が取る前に次の値をpublish()すると
+ * 前の値は読まれずに上書きされる（まとめた数はget_coalesced()）。
+ * back()は2回前にpublish()した領域を再利用するので、書き込み側はすべてのメンバーを書き直すこと。
+ *
+ * @tparam T 値
+ */
+template <class T>
+class triple_buffer
+{
+public:
+    triple_buffer() : slots(), middle(1), back_index(0), front_index(2), coalesced(0) {}
+    triple_buffer(const triple_buffer &) = delete;
+    triple_buffer &operator=(const triple_buffer &) = delete;
+
+    /**
+     * @brief 書き込み先（書き込み側）
+     *
+     * @return T& 書き込み先
+     */
+    T &back()
+    {
+        return slots[back_index];
+    }
+
+    /**
+     * @brief back()へ書いた値を公開（書き込み側）
+     *
+     */
+    void publish()
+    {
+        unsigned prev = middle.exchange(back_index | fresh_bit, std::memory_order_acq_rel);
+        back_index = prev & index_mask;
+        if (prev & fresh_bit) {
+            // 前の値は読まれなかった
+            coalesced.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief 新しい値があればfront()へ取る（読み込み側）
+     *
+     * @return true 新しい値を取った
+     * @return false 前回から公開されていない
+     */
+    bool take()
+    {
+        if ((middle.load(std::memory_order_relaxed) & fresh_bit) == 0) {
+            return false;
+        }
+        unsigned prev = middle.exchange(front_index, std::memory_order_acq_rel);
+        front_index = prev & index_mask;
+        return true;
+    }
+
+    /**
+     * @brief 最後にtake()した値（読み込み側）
+     *
+     * @return const T& 値
+     */
+    const T &front() const
+    {
+        return slots[front_index];
+    }
+
+    /**
+     * @brief 読まれずに上書きされた数
+     *
+     * @return uint64_t 数
+     */
+    uint64_t get_coalesced() const
+    {
+        return coalesced.load(std::memory_order_relaxed);
+    }
+
+private:
+    static const unsigned index_mask = 3;
+    static const unsigned fresh_bit = 4;    // 公開後まだ読まれていない
+
+    T slots[3];
+    std::atomic<unsigned> middle;           // 受け渡し中の領域
+    unsigned back_index;                    // 書き込み側だけが使う
+    unsigned front_index;                   // 読み込み側だけが使う
+    std::atomic<uint64_t> coalesced;
+};
+
+#endif
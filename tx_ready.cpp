@@ -0,0 +1,187 @@
+/**
+ * @file tx_ready.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 受信機のTX-ready（GPIO）で受信データを待つ
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "tx_ready.hpp"
+#include "trace.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/gpio.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <vector>
+
+static const uint8_t class_cfg = 0x06;
+static const uint8_t id_cfg_prt = 0x00;
+static const uint8_t port_ddc = 0;
+static const uint8_t ddc_address = 0x42;
+static const uint16_t proto_ubx_nmea = 0x0003;
+static const int max_threshold = 511 * 8;      // txReadyのthres（9bit、8byte単位）
+static const int event_buffer = 16;
+
+/**
+ * @brief Construct a new tx ready::tx ready object
+ *
+ * @param conf 設定
+ */
+tx_ready::tx_ready(const config &conf) :
+conf(conf),
+line_fd(-1),
+events(0)
+{
+}
+
+/**
+ * @brief Destroy the tx ready::tx ready object
+ *
+ */
+tx_ready::~tx_ready()
+{
+    if (line_fd >= 0) {
+        close(line_fd);
+    }
+}
+
+/**
+ * @brief GPIOのラインを入力・エッジ検出で取得
+ *
+ * @return true OK
+ * @return false ERROR（呼び出し側は一定間隔の読み込みに戻す）
+ */
+bool tx_ready::open()
+{
+    int chip_fd = ::open(conf.chip.c_str(), O_RDONLY | O_CLOEXEC);
+    if (chip_fd < 0) {
+        std::cerr << "tx_ready: failed to open " << conf.chip << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    struct gpio_v2_line_request req;
+    std::memset(&req, 0, sizeof(req));
+    req.offsets[0] = conf.line;
+    req.num_lines = 1;
+    std::strncpy(req.consumer, "gps_test", sizeof(req.consumer) - 1);
+    // アクティブローの場合も論理値でアクティブになるエッジを検出する
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING;
+    if (conf.active_low) {
+        req.config.flags |= GPIO_V2_LINE_FLAG_ACTIVE_LOW;
+    }
+    req.event_buffer_size = event_buffer;
+    int ret = ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req);
+    int err = errno;
+    close(chip_fd);
+    if (ret < 0) {
+        std::cerr << "tx_ready: failed to request line " << conf.line << " of " << conf.chip << ": "
+                  << std::strerror(err) << std::endl;
+        return false;
+    }
+    line_fd = req.fd;
+    return true;
+}
+
+/**
+ * @brief 受信機のTX-readyを設定(CFG-PRT)
+ *
+ * ペイロード: portID, reserved, txReady(2), mode(4), reserved(4), inProtoMask(2), outProtoMask(2), flags(2), reserved(2)
+ * txReady: en(bit0), pol(bit1、1ならアクティブロー), pin(bit2-6), thres(bit7-15、8byte単位)
+ *
+ * @param dev 受信機
+ */
+void tx_ready::configure(ubx &dev)
+{
+    int thres = conf.threshold < 8 ? 8 : (conf.threshold > max_threshold ? max_threshold : conf.threshold);
+    uint16_t tx = 0x0001 | (conf.active_low ? 0x0002 : 0) | ((conf.pio & 0x1f) << 2) | ((thres / 8) << 7);
+    uint32_t mode = ddc_address << 1;
+    uint8_t payload[20];
+    std::memset(payload, 0, sizeof(payload));
+    payload[0] = port_ddc;
+    payload[2] = tx & 0xff;
+    payload[3] = tx >> 8;
+    payload[4] = mode & 0xff;
+    payload[12] = proto_ubx_nmea & 0xff;
+    payload[13] = proto_ubx_nmea >> 8;
+    payload[14] = proto_ubx_nmea & 0xff;
+    payload[15] = proto_ubx_nmea >> 8;
+    std::vector<uint8_t> frame;
+    ubx::make_frame(class_cfg, id_cfg_prt, payload, sizeof(payload), frame);
+    dev.send(frame.data(), frame.size());
+}
+
+/**
+ * @brief ラインが今アクティブか（エッジの後にまだデータが残っている）
+ *
+ * @return true アクティブ
+ * @return false 非アクティブ、または読めない
+ */
+bool tx_ready::is_active()
+{
+    struct gpio_v2_line_values values;
+    values.bits = 0;
+    values.mask = 1;
+    if (ioctl(line_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) {
+        return false;
+    }
+    return (values.bits & 1) != 0;
+}
+
+/**
+ * @brief TX-readyがアクティブになるかdeadlineまで待つ
+ *
+ * 既にアクティブならすぐに戻る（読み残しがある）。ヒープは使わない。
+ *
+ * @param deadline_ns 待つ期限（CLOCK_MONOTONIC、ns）
+ * @param event_ns エッジの時刻（CLOCK_MONOTONIC、ns）
+ * @return true アクティブになった
+ * @return false deadlineまで来なかった
+ */
+bool tx_ready::wait_until(uint64_t deadline_ns, uint64_t &event_ns)
+{
+    if (is_active()) {
+        event_ns = trace::now();
+        events++;
+        return true;
+    }
+    for (;;) {
+        uint64_t now = trace::now();
+        if (now >= deadline_ns) {
+            return false;
+        }
+        struct pollfd pfd = { line_fd, POLLIN, 0 };
+        struct timespec ts;
+        ts.tv_sec = (deadline_ns - now) / 1000000000u;
+        ts.tv_nsec = (deadline_ns - now) % 1000000000u;
+        int ret = ppoll(&pfd, 1, &ts, nullptr);
+        if (ret < 0 && errno != EINTR) {
+            return false;
+        }
+        if (ret > 0 && (pfd.revents & POLLIN)) {
+            // たまったエッジはまとめて読み捨てる（最初のエッジの時刻を返す）
+            struct gpio_v2_line_event ev[event_buffer];
+            ssize_t n = read(line_fd, ev, sizeof(ev));
+            if (n >= (ssize_t)sizeof(ev[0])) {
+                event_ns = ev[0].timestamp_ns;
+                events++;
+                return true;
+            }
+        }
+    }
+}
+
+/**
+ * @brief エッジで起床した回数
+ *
+ * @return uint64_t 回数
+ */
+uint64_t tx_ready::get_events() const
+{
+    return events;
+}
@@ -0,0 +1,71 @@
+/**
+ * @file tx_ready.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 受信機のTX-ready（GPIO）で受信データを待つ
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef TX_READY_HPP
+#define TX_READY_HPP
+
+#include "ubx.hpp"
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief 受信機のTX-ready（GPIO）で受信データを待つ
+ *
+ * 受信機はDDC(I2C)の出力バッファがthresholdを超えるとTX-readyのピンをアクティブにする。
+ * GPIOのキャラクターデバイス(/dev/gpiochipN、uAPI v2)でラインのエッジを待つので、
+ * 一定間隔でI2Cを読まなくてよい。エッジが来なくてもwatchdogの時間で読む（ピンの配線・設定の誤りに備える）。
+ * 受信機側のTX-readyはCFG-PRT(DDC)で設定する。
+ */
+class tx_ready
+{
+public:
+    /**
+     * @brief 設定
+     *
+     */
+    class config {
+    public:
+        std::string chip;       // GPIOチップ（空ならTX-readyを使わない）
+        int line;               // ライン番号
+        bool active_low;        // アクティブロー（受信機のpolと合わせる）
+        int pio;                // 受信機のTX-readyに使うPIO
+        int threshold;          // 受信機の出力バッファのしきい値(byte、8の倍数)
+        bool configure;         // 起動時にCFG-PRTで受信機を設定する
+        int watchdog_ms;        // エッジが来なくても読む間隔
+        int gap_ms;             // 読めた後にバーストの続きを待つ時間
+        config() {
+            chip = "";
+            line = 0;
+            active_low = false;
+            pio = 6;
+            threshold = 8;
+            configure = true;
+            watchdog_ms = 500;
+            gap_ms = 10;
+        }
+    };
+
+    tx_ready(const config &conf);
+    ~tx_ready();
+    bool open();
+    void configure(ubx &dev);
+    bool wait_until(uint64_t deadline_ns, uint64_t &event_ns);
+    uint64_t get_events() const;
+
+private:
+    config conf;
+    int line_fd;
+    uint64_t events;            // エッジで起床した回数
+
+    bool is_active();
+};
+
+#endif
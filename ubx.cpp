@@ -10,10 +10,14 @@
  */
 
 #include "ubx.hpp"
+#include "trace.hpp"
+#include "gps_sim.hpp"
 #include <fcntl.h>
 #include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <cstring>
 #include <iostream>
@@ -21,13 +25,157 @@
 #include <sstream>
 #include <iomanip>
 
+const char *ubx::default_broker_path = "/tmp/gps_broker.sock";
+
+static const char *dev_name = "/dev/i2c-1";
+static const uint8_t dev_addr = 0x42u;
+
+/**
+ * @brief Construct a new ubx::ubx object
+ * 
+ */
+ubx::ubx() :
+sock(-1),
+sim(nullptr),
+sim_gap(false)
+{
+
+}
+
 /**
  * @brief Construct a new ubx::ubx object
  * 
+ * I2Cを直接読まずにブローカー(gps_broker)から受信する。
+ * 
+ * @param broker_path ブローカーのソケット（空ならI2Cを直接読む）
+ * @param sim シミュレーター（指定した場合はI2C・ブローカーの代わりに使う）
+ */
+ubx::ubx(const std::string &broker_path, gps_sim *sim) :
+broker_path(broker_path),
+sock(-1),
+sim(sim),
+sim_gap(false),
+sim_next(std::chrono::steady_clock::now())
+{
+    if (sim != nullptr) {
+        // 最大64KiBのバースト（I2Cの1回の読み込みと同じ）
+        sim_burst.reserve(64 * 1024);
+    }
+    else if (broker_path != "") {
+        broker_connect();
+    }
+}
+
+/**
+ * @brief Destroy the ubx::ubx object
+ * 
+ */
+ubx::~ubx()
+{
+    if (sock >= 0) {
+        close(sock);
+    }
+}
+
+/**
+ * @brief ブローカーへ接続
+ * 
+ * @return true 接続した
+ * @return false 接続できなかった
+ */
+bool ubx::broker_connect()
+{
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        std::cerr << "ubx: failed to socket: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, broker_path.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) {
+        std::cerr << "ubx: failed to connect " << broker_path << ": " << std::strerror(errno) << std::endl;
+        close(sock);
+        sock = -1;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief ブローカーから受信済みのデータを取得（ブロックしない）
+ * 
+ * @param buf 受信データ
+ * @return ubx::status 
  */
-ubx::ubx()
+ubx::status ubx::broker_read(std::vector<uint8_t> &buf)
 {
+    if (sock < 0 && !broker_connect()) {
+        return ubx::dev_error;
+    }
+
+    std::array<uint8_t, 4096> tmp;
+    while (true) {
+        ssize_t ret = recv(sock, tmp.data(), tmp.size(), MSG_DONTWAIT);
+        if (ret > 0) {
+            buf.insert(buf.end(), tmp.begin(), tmp.begin() + ret);
+            continue;
+        }
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        // 切断された（次回再接続する）
+        std::cerr << "ubx: broker disconnected" << std::endl;
+        close(sock);
+        sock = -1;
+        if (buf.size() == 0) {
+            return ubx::dev_error;
+        }
+        break;
+    }
 
+    if (buf.size() == 0) {
+        return ubx::empty;
+    }
+    return ubx::ok;
+}
+
+/**
+ * @brief シミュレーターからデータを取得（ブロックしない）
+ * 
+ * 受信機と同じく、出力レートの周期で1エポック分のバーストを返し、
+ * バーストの後には必ず空読み(empty)を挟む。0xFFを含むバーストはI2Cと同じ判定でコンフリクトとして捨てる。
+ * 
+ * @param buf 受信データ
+ * @return ubx::status 
+ */
+ubx::status ubx::sim_read(std::vector<uint8_t> &buf)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (sim_gap || now < sim_next) {
+        sim_gap = false;
+        return ubx::empty;
+    }
+    sim_next += std::chrono::microseconds(1000000 / sim->get_rate());
+    if (sim_next + std::chrono::seconds(1) < now) {
+        // 読み出しが遅れた分は追いかけない
+        sim_next = now;
+    }
+    sim_gap = true;
+
+    sim->next_burst(sim_burst);
+    if (has_conflict(reinterpret_cast<const uint8_t *>(sim_burst.data()), sim_burst.size())) {
+        return ubx::conflict;
+    }
+    buf.insert(buf.end(), sim_burst.begin(), sim_burst.end());
+    if (buf.size() == 0) {
+        return ubx::empty;
+    }
+    return ubx::ok;
 }
 
 /**
@@ -95,6 +243,13 @@ int8_t ubx::i2c_write(int32_t fd, uint8_t dev_addr, uint8_t reg_addr, const uint
  */
 ubx::status ubx::get_nmea(std::vector<uint8_t> &buf)
 {
+    if (sim != nullptr) {
+        return sim_read(buf);
+    }
+    if (broker_path != "") {
+        return broker_read(buf);
+    }
+
 #if 0
     std::string msg;
     static time_t pt = time(nullptr);
@@ -141,14 +296,14 @@ ubx::status ubx::get_nmea(std::vector<uint8_t> &buf)
     return ubx::ok;
 
 #else
-    const char *dev_name = "/dev/i2c-1";
-    const uint8_t dev_addr = 0x42u;
     const uint8_t size_reg = 0xfdu;
     const uint8_t stream_reg = 0xffu;
     bool conflict = false;
 
     // OPEN
+    uint64_t t0 = trace::now();
     int32_t fd = open(dev_name, O_RDWR);
+    trace::record(trace::bus_open, t0, trace::now());
     if (fd < 0) {
         std::cerr << "get_nmea: failed to open: " << std::strerror(errno) << std::endl;
         return ubx::dev_error;
@@ -156,8 +311,10 @@ ubx::status ubx::get_nmea(std::vector<uint8_t> &buf)
 
     try {
         // データサイズ取得
-        std::vector<uint8_t> lenbuf(2, 0);
+        std::array<uint8_t, 2> lenbuf = {0, 0};
+        t0 = trace::now();
         int8_t ret = i2c_read(fd, dev_addr, size_reg, lenbuf.data(), lenbuf.size());
+        trace::record(trace::bus_length, t0, trace::now());
         if (ret != 0) {
             return ubx::dev_error;
         }
@@ -166,15 +323,11 @@ ubx::status ubx::get_nmea(std::vector<uint8_t> &buf)
         if (len > 0) {
             // データ取得
             buf.resize(len);
+            t0 = trace::now();
             ret = i2c_read(fd, dev_addr, stream_reg, buf.data(), buf.size());
+            trace::record(trace::bus_read, t0, trace::now());
 
-            for (auto c : buf) {
-                if (c == 0xff) {
-                    // コンフリクト
-                    conflict = true;
-                    break;
-                }
-            }
+            conflict = has_conflict(buf.data(), buf.size());
         }
     }
     catch (std::exception ex) {
@@ -183,9 +336,11 @@ ubx::status ubx::get_nmea(std::vector<uint8_t> &buf)
     }
 
     // CLOSE
+    t0 = trace::now();
     if (close(fd) < 0) {
         std::cerr << "get_nmea: failed to close: " << std::strerror(errno) << std::endl;
     }
+    trace::record(trace::bus_close, t0, trace::now());
 
     if (conflict == true) {
 
@@ -198,3 +353,141 @@ ubx::status ubx::get_nmea(std::vector<uint8_t> &buf)
     return ubx::ok;
 #endif
 }
+
+/**
+ * @brief UBXメッセージを送信
+ * 
+ * ブローカー経由の場合はブローカーが他のクライアントの送信と直列化してから書き込む。
+ * 
+ * @param frame UBXメッセージ（0xB5 0x62 から チェックサムまで）
+ * @param length 長さ
+ * @return ubx::status 
+ */
+ubx::status ubx::send(const uint8_t *frame, size_t length)
+{
+    if (length < 2) {
+        return ubx::dev_error;
+    }
+
+    if (sim != nullptr) {
+        sim->receive(frame, length);
+        return ubx::ok;
+    }
+
+    if (broker_path != "") {
+        if (sock < 0 && !broker_connect()) {
+            return ubx::dev_error;
+        }
+        size_t pos = 0;
+        while (pos < length) {
+            ssize_t ret = ::send(sock, &frame[pos], length - pos, MSG_NOSIGNAL);
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::cerr << "ubx: failed to send: " << std::strerror(errno) << std::endl;
+                return ubx::dev_error;
+            }
+            pos += ret;
+        }
+        return ubx::ok;
+    }
+
+    int32_t fd = open(dev_name, O_RDWR);
+    if (fd < 0) {
+        std::cerr << "send: failed to open: " << std::strerror(errno) << std::endl;
+        return ubx::dev_error;
+    }
+    // DDCの書き込みはレジスタアドレスを指定せずにメッセージを先頭から書き込む
+    int8_t ret = i2c_write(fd, dev_addr, frame[0], &frame[1], length - 1);
+    if (close(fd) < 0) {
+        std::cerr << "send: failed to close: " << std::strerror(errno) << std::endl;
+    }
+    if (ret != 0) {
+        return ubx::dev_error;
+    }
+    return ubx::ok;
+}
+
+/**
+ * @brief UBXメッセージを作る
+ * 
+ * @param cls クラス
+ * @param id ID
+ * @param payload ペイロード
+ * @param len ペイロードの長さ
+ * @param out 出力先
+ */
+void ubx::make_frame(uint8_t cls, uint8_t id, const uint8_t *payload, size_t len, std::vector<uint8_t> &out)
+{
+    out.resize(len + 8);
+    out[0] = 0xb5;
+    out[1] = 0x62;
+    out[2] = cls;
+    out[3] = id;
+    out[4] = (uint8_t)(len & 0xff);
+    out[5] = (uint8_t)(len >> 8);
+    if (len > 0) {
+        std::memcpy(&out[6], payload, len);
+    }
+    uint8_t ck_a = 0;
+    uint8_t ck_b = 0;
+    for (size_t i = 2; i < len + 6; i++) {
+        ck_a += out[i];
+        ck_b += ck_a;
+    }
+    out[len + 6] = ck_a;
+    out[len + 7] = ck_b;
+}
+
+/**
+ * @brief 受信データにコンフリクト（他のマスターとの競合で読めた0xFF）があるか
+ *
+ * 受信機はデータが無いと0xFFを返すが、UBXメッセージ（MGA-ACK、UPD-SOS、ACK-ACK）の
+ * ペイロードやチェックサムにも0xFFは含まれるので、チェックサムが正しいUBXメッセージは読み飛ばす。
+ *
+ * @param data 受信データ
+ * @param len 長さ
+ * @return true コンフリクト
+ * @return false OK
+ */
+bool ubx::has_conflict(const uint8_t *data, size_t len)
+{
+    size_t i = 0;
+    while (i < len) {
+        if (data[i] == 0xb5 && i + 6 <= len && data[i + 1] == 0x62) {
+            size_t total = 8 + (data[i + 4] | (data[i + 5] << 8));
+            if (i + total <= len && valid_frame(&data[i], total)) {
+                i += total;
+                continue;
+            }
+        }
+        if (data[i] == 0xff) {
+            return true;
+        }
+        i++;
+    }
+    return false;
+}
+
+/**
+ * @brief UBXメッセージのチェックサムが正しいか
+ * 
+ * @param frame 0xB5 0x62から
+ * @param total メッセージの長さ
+ * @return true 正しい
+ * @return false 正しくない
+ */
+bool ubx::valid_frame(const uint8_t *frame, size_t total)
+{
+    if (total < 8) {
+        return false;
+    }
+    uint8_t ck_a = 0;
+    uint8_t ck_b = 0;
+    for (size_t i = 2; i < total - 2; i++) {
+        ck_a += frame[i];
+        ck_b += ck_a;
+    }
+    return frame[total - 2] == ck_a && frame[total - 1] == ck_b;
+}
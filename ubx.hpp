@@ -12,9 +12,12 @@
 #ifndef UBX_HPP
 #define UBX_HPP
 
+#include <chrono>
 #include <vector>
 #include <string>
 
+class gps_sim;
+
 /**
  * @brief UBX
  * 
@@ -22,7 +25,11 @@
 class ubx
 {
 public:
+    static const char *default_broker_path;
+
     ubx();
+    ubx(const std::string &broker_path, gps_sim *sim = nullptr);
+    ~ubx();
     enum status {
         empty,
         conflict,
@@ -30,11 +37,60 @@ public:
         ok
     };
     status get_nmea(std::vector<uint8_t> &buf);
+    status send(const uint8_t *frame, size_t length);
+
+    static void make_frame(uint8_t cls, uint8_t id, const uint8_t *payload, size_t len, std::vector<uint8_t> &out);
+    static bool valid_frame(const uint8_t *frame, size_t total);
+    static bool has_conflict(const uint8_t *data, size_t len);
+    template <class F>
+    static size_t take_frames(std::vector<uint8_t> &buf, F handler);
 
 private:
+    std::string broker_path;    // ブローカーのソケット（空ならI2Cを直接読む）
+    int sock;
+    gps_sim *sim;               // シミュレーター（nullptrでなければI2C・ブローカーの代わりに使う）
+    bool sim_gap;               // バーストの間の空読み
+    std::chrono::steady_clock::time_point sim_next;
+    std::string sim_burst;
+
+    bool broker_connect();
+    status broker_read(std::vector<uint8_t> &buf);
+    status sim_read(std::vector<uint8_t> &buf);
     int8_t i2c_read(int32_t fd, uint8_t dev_addr, uint8_t reg_addr, uint8_t* data, uint16_t length);
     int8_t i2c_write(int32_t fd, uint8_t dev_addr, uint8_t reg_addr, const uint8_t* data, uint16_t length);
 };
 
+/**
+ * @brief 受信データからUBXメッセージを取り除いてhandlerへ渡す（ヒープは使わない）
+ *
+ * 取り除かないとNMEAのセンテンスに混ざってチェックサムエラーになる。
+ * 途中で切れたメッセージとチェックサムが合わないものはそのまま残す。
+ *
+ * @param buf 受信データ
+ * @param handler void(const uint8_t *frame, size_t total)
+ * @return size_t 取り除いたメッセージ数
+ */
+template <class F>
+size_t ubx::take_frames(std::vector<uint8_t> &buf, F handler)
+{
+    size_t n = buf.size();
+    size_t out = 0;
+    size_t i = 0;
+    size_t removed = 0;
+    while (i < n) {
+        if (buf[i] == 0xb5 && i + 6 <= n && buf[i + 1] == 0x62) {
+            size_t total = 8 + (buf[i + 4] | (buf[i + 5] << 8));
+            if (i + total <= n && valid_frame(&buf[i], total)) {
+                handler(&buf[i], total);
+                i += total;
+                removed++;
+                continue;
+            }
+        }
+        buf[out++] = buf[i++];
+    }
+    buf.resize(out);
+    return removed;
+}
 
 #endif
\ No newline at end of file
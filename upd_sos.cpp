@@ -0,0 +1,220 @@
+/**
+ * @file upd_sos.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 受信機の航法データの保存と復元(UBX-UPD-SOS)
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "upd_sos.hpp"
+#include <thread>
+
+static const uint8_t class_cfg = 0x06;
+static const uint8_t id_cfg_rst = 0x04;
+static const uint8_t class_upd = 0x09;
+static const uint8_t id_upd_sos = 0x14;
+
+// UPD-SOSのcmd
+static const uint8_t cmd_create = 0;
+static const uint8_t cmd_clear = 1;
+static const uint8_t cmd_backup_ack = 2;
+static const uint8_t cmd_restored = 3;
+
+// CFG-RSTのresetMode
+static const uint8_t reset_gnss_stop = 0x08;
+static const uint8_t reset_gnss_start = 0x09;
+
+static const int save_poll_ms = 50;     // 保存の応答を待つ間の読み込み間隔
+
+/**
+ * @brief Construct a new upd sos::upd sos object
+ *
+ * @param conf 設定
+ */
+upd_sos::upd_sos(const config &conf) :
+conf(conf),
+restore(waiting),
+backup(none),
+cleared(false),
+polls(0)
+{
+    frame.reserve(64);
+}
+
+/**
+ * @brief UBXメッセージを送信
+ *
+ * @param dev 受信機
+ * @param cls クラス
+ * @param id ID
+ * @param payload ペイロード
+ * @param len ペイロードの長さ
+ */
+void upd_sos::send(ubx &dev, uint8_t cls, uint8_t id, const uint8_t *payload, size_t len)
+{
+    ubx::make_frame(cls, id, payload, len, frame);
+    dev.send(frame.data(), frame.size());
+}
+
+/**
+ * @brief CFG-RSTを送信（航法データは消さない）
+ *
+ * @param dev 受信機
+ * @param mode resetMode
+ */
+void upd_sos::send_reset(ubx &dev, uint8_t mode)
+{
+    // navBbrMask(2) = 0（ホットスタート）, resetMode, reserved
+    const uint8_t payload[4] = { 0, 0, mode, 0 };
+    send(dev, class_cfg, id_cfg_rst, payload, sizeof(payload));
+}
+
+/**
+ * @brief 起動時の処理（GNSSの再開と復元の結果の問い合わせ）
+ *
+ * @param dev 受信機
+ */
+void upd_sos::start(ubx &dev)
+{
+    if (conf.stop_gnss) {
+        // 前回の終了時に止めたまま電源が切られていない場合に備える（動作中なら何もしない）
+        send_reset(dev, reset_gnss_start);
+    }
+    // ペイロード無しで復元の結果を問い合わせる
+    send(dev, class_upd, id_upd_sos, nullptr, 0);
+    polls = 1;
+    last_poll = std::chrono::steady_clock::now();
+}
+
+/**
+ * @brief 応答が無ければ問い合わせ直し、復元していればバックアップを消す
+ *
+ * ループの毎回呼ぶ。
+ *
+ * @param dev 受信機
+ */
+void upd_sos::poll(ubx &dev)
+{
+    if (restore == waiting) {
+        auto now = std::chrono::steady_clock::now();
+        if (polls < conf.poll_count && now - last_poll >= std::chrono::milliseconds(conf.poll_interval_ms)) {
+            send(dev, class_upd, id_upd_sos, nullptr, 0);
+            polls++;
+            last_poll = now;
+        }
+        return;
+    }
+    if (restore == restored && conf.clear && !cleared) {
+        const uint8_t payload[4] = { cmd_clear, 0, 0, 0 };
+        send(dev, class_upd, id_upd_sos, payload, sizeof(payload));
+        cleared = true;
+    }
+}
+
+/**
+ * @brief 受信したUBXメッセージを処理（UPD-SOSだけ）
+ *
+ * ペイロード: cmd, reserved(3), response, reserved(3)
+ *
+ * @param frame UBXメッセージ（ubx::take_frames()で取り出したもの）
+ * @param len 長さ
+ * @return true UPD-SOS
+ * @return false それ以外
+ */
+bool upd_sos::on_frame(const uint8_t *frame, size_t len)
+{
+    if (frame[2] != class_upd || frame[3] != id_upd_sos || len < 8 + 8) {
+        return false;
+    }
+    const uint8_t *p = frame + 6;
+    if (p[0] == cmd_backup_ack) {
+        backup = (p[4] == 1) ? saved : rejected;
+    }
+    else if (p[0] == cmd_restored) {
+        static const restore_result results[] = { unknown, failed, restored, not_restored };
+        restore = (p[4] < 4) ? results[p[4]] : unknown;
+    }
+    return true;
+}
+
+/**
+ * @brief 航法データをフラッシュへ保存（終了時）
+ *
+ * 応答はtimeout_msまでしか待たない。保存できなかった場合はGNSSを再開する。
+ *
+ * @param dev 受信機
+ * @param buf 受信バッファ
+ * @return backup_result 結果
+ */
+upd_sos::backup_result upd_sos::save(ubx &dev, std::vector<uint8_t> &buf)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(conf.timeout_ms);
+    if (conf.stop_gnss) {
+        send_reset(dev, reset_gnss_stop);
+    }
+    const uint8_t payload[4] = { cmd_create, 0, 0, 0 };
+    send(dev, class_upd, id_upd_sos, payload, sizeof(payload));
+
+    backup = none;
+    while (backup == none && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(save_poll_ms));
+        buf.clear();
+        if (dev.get_nmea(buf) == ubx::ok) {
+            ubx::take_frames(buf, [this](const uint8_t *f, size_t len) { on_frame(f, len); });
+        }
+    }
+    if (backup == none) {
+        backup = timed_out;
+    }
+    if (backup != saved && conf.stop_gnss) {
+        send_reset(dev, reset_gnss_start);
+    }
+    return backup;
+}
+
+/**
+ * @brief 起動時の復元の結果を取得
+ *
+ * @return restore_result 結果
+ */
+upd_sos::restore_result upd_sos::get_restore() const
+{
+    return restore;
+}
+
+/**
+ * @brief 終了時の保存の結果を取得
+ *
+ * @return backup_result 結果
+ */
+upd_sos::backup_result upd_sos::get_backup() const
+{
+    return backup;
+}
+
+/**
+ * @brief 復元の結果の名前
+ *
+ * @param r 結果
+ * @return const char* 名前
+ */
+const char *upd_sos::restore_name(restore_result r)
+{
+    static const char *names[restore_result_count] = { "waiting", "unknown", "failed", "restored", "not_restored" };
+    return (r < restore_result_count) ? names[r] : "unknown";
+}
+
+/**
+ * @brief 保存の結果の名前
+ *
+ * @param r 結果
+ * @return const char* 名前
+ */
+const char *upd_sos::backup_name(backup_result r)
+{
+    static const char *names[backup_result_count] = { "none", "saved", "rejected", "timeout" };
+    return (r < backup_result_count) ? names[r] : "unknown";
+}
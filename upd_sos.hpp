@@ -0,0 +1,94 @@
+/**
+ * @file upd_sos.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief 受信機の航法データの保存と復元(UBX-UPD-SOS)
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef UPD_SOS_HPP
+#define UPD_SOS_HPP
+
+#include "ubx.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief 受信機の航法データの保存と復元(UBX-UPD-SOS)
+ *
+ * 終了時にGNSSを止めて(CFG-RST)航法データ（軌道・時刻・位置）をフラッシュへ保存させ、
+ * 次の電源投入時に受信機が復元するとホットスタートになる。
+ * 起動時は復元の結果を問い合わせ、復元できていればバックアップを消す（古いデータで復元しないため）。
+ * 終了時の保存はtimeout_msまでしか待たない（受信機が応答しなくても終了する）。
+ * stop_gnssで止めたGNSSは、次にstop_gnssを指定してstart()するか受信機の電源を入れ直すまで止まったままになる。
+ */
+class upd_sos
+{
+public:
+    enum restore_result {
+        waiting,            // 応答待ち
+        unknown,
+        failed,             // 復元に失敗
+        restored,           // 復元した（ホットスタート）
+        not_restored,       // バックアップが無い
+        restore_result_count
+    };
+
+    enum backup_result {
+        none,               // 保存していない
+        saved,
+        rejected,           // 受信機が受け付けなかった
+        timed_out,          // 応答が無い
+        backup_result_count
+    };
+
+    /**
+     * @brief 設定
+     *
+     */
+    class config {
+    public:
+        bool stop_gnss;         // 保存の前にGNSSを止める（起動時に再開する）
+        bool clear;             // 復元したらバックアップを消す
+        int timeout_ms;         // 保存の応答を待つ時間
+        int poll_interval_ms;   // 復元の結果の問い合わせ間隔
+        int poll_count;         // 問い合わせの回数
+        config() {
+            stop_gnss = false;
+            clear = true;
+            timeout_ms = 2000;
+            poll_interval_ms = 1000;
+            poll_count = 3;
+        }
+    };
+
+    upd_sos(const config &conf);
+    void start(ubx &dev);
+    void poll(ubx &dev);
+    bool on_frame(const uint8_t *frame, size_t len);
+    backup_result save(ubx &dev, std::vector<uint8_t> &buf);
+    restore_result get_restore() const;
+    backup_result get_backup() const;
+
+    static const char *restore_name(restore_result r);
+    static const char *backup_name(backup_result r);
+
+private:
+    config conf;
+    restore_result restore;
+    backup_result backup;
+    bool cleared;
+    int polls;                              // 問い合わせた回数
+    std::chrono::steady_clock::time_point last_poll;
+    std::vector<uint8_t> frame;             // 送信用（容量は確保済み）
+
+    void send(ubx &dev, uint8_t cls, uint8_t id, const uint8_t *payload, size_t len);
+    void send_reset(ubx &dev, uint8_t mode);
+};
+
+#endif
@@ -0,0 +1,129 @@
+/**
+ * @file work_pool.cpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief ワークスティーリングのスレッドプール
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include "work_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Construct a new work pool::work pool object
+ *
+ * @param threads スレッド数（0以下ならコア数）
+ */
+work_pool::work_pool(int threads) :
+threads(threads),
+steals(0)
+{
+    if (this->threads <= 0) {
+        this->threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    queues.reset(new queue[this->threads]);
+}
+
+/**
+ * @brief すべての仕事を処理して戻る
+ *
+ * @param count 仕事の数
+ * @param f 仕事（別のスレッドから同時に呼ばれる）
+ */
+void work_pool::run(size_t count, const std::function<void(size_t index)> &f)
+{
+    // 連続した範囲で配る（隣り合う仕事は同じスレッドで処理されやすい）
+    for (int t = 0; t < threads; t++) {
+        size_t begin = count * t / threads;
+        size_t end = count * (t + 1) / threads;
+        std::lock_guard<std::mutex> lock(queues[t].mtx);
+        for (size_t i = begin; i < end; i++) {
+            queues[t].items.push_back(i);
+        }
+    }
+
+    std::atomic<uint64_t> stolen_count(0);
+    auto worker = [&](int self) {
+        size_t index;
+        bool stolen;
+        while (pop(self, index, stolen)) {
+            if (stolen) {
+                stolen_count++;
+            }
+            f(index);
+        }
+    };
+
+    // 呼び出したスレッドも仕事をする
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; t++) {
+        workers.emplace_back(worker, t);
+    }
+    worker(0);
+    for (auto &th : workers) {
+        th.join();
+    }
+    steals += stolen_count;
+}
+
+/**
+ * @brief 次の仕事を取り出す
+ *
+ * 自分のキューに無ければ他のキューの末尾から盗む。
+ * 仕事は後から増えないので、すべてのキューが空なら終了。
+ *
+ * @param self 自分のスレッド番号
+ * @param index 仕事の番号
+ * @param stolen 盗んだ仕事ならtrue
+ * @return true 仕事がある
+ * @return false すべて終わった
+ */
+bool work_pool::pop(int self, size_t &index, bool &stolen)
+{
+    {
+        std::lock_guard<std::mutex> lock(queues[self].mtx);
+        if (!queues[self].items.empty()) {
+            index = queues[self].items.front();
+            queues[self].items.pop_front();
+            stolen = false;
+            return true;
+        }
+    }
+    for (int i = 1; i < threads; i++) {
+        int victim = (self + i) % threads;
+        std::lock_guard<std::mutex> lock(queues[victim].mtx);
+        if (!queues[victim].items.empty()) {
+            index = queues[victim].items.back();
+            queues[victim].items.pop_back();
+            stolen = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief スレッド数を取得
+ *
+ * @return int スレッド数
+ */
+int work_pool::get_threads() const
+{
+    return threads;
+}
+
+/**
+ * @brief 盗んだ仕事の数を取得
+ *
+ * @return uint64_t 数
+ */
+uint64_t work_pool::get_steals() const
+{
+    return steals;
+}
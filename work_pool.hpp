@@ -0,0 +1,51 @@
+/**
+ * @file work_pool.hpp
+ * @author Keiji Hayashi (keiji.hayashi@konicaminolta.com)
+ * @brief ワークスティーリングのスレッドプール
+ * @version 0.1
+ * @date 2022-04-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef WORK_POOL_HPP
+#define WORK_POOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+/**
+ * @brief ワークスティーリングのスレッドプール
+ *
+ * 仕事（0～count-1の番号）をスレッド毎のキューへ連続した範囲で分けて配る。
+ * 各スレッドは自分のキューの先頭から順に処理し、空になったら
+ * 他のスレッドのキューの末尾から盗む。
+ */
+class work_pool
+{
+public:
+    work_pool(int threads);
+    void run(size_t count, const std::function<void(size_t index)> &f);
+    int get_threads() const;
+    uint64_t get_steals() const;
+
+private:
+    class queue {
+    public:
+        std::mutex mtx;
+        std::deque<size_t> items;
+    };
+
+    int threads;
+    std::unique_ptr<queue[]> queues;
+    uint64_t steals;
+
+    bool pop(int self, size_t &index, bool &stolen);
+};
+
+#endif